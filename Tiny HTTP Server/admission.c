@@ -0,0 +1,196 @@
+/*
+ * admission.c
+ *
+ * Functions that shed load when the server is overloaded:
+ * a bounded dispatch queue answered with a preformatted
+ * 503 Service Unavailable, and optional CoDel dropping of
+ * requests that waited too long in the queue. Clients over
+ * their rate limit get a preformatted 429 Too Many Requests.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "admission.h"
+#include "http_server.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "error_page.h"
+#include "tls.h"
+
+/** nanoseconds per millisecond */
+#define NS_PER_MS 1000000ULL
+
+/** bytes of unread request drained before closing a shed connection */
+#define SHED_DRAIN_BYTES 4096
+
+/** headers added to the 503 response */
+static char shedHeaders[MAXBUF];
+
+/** headers added to the 429 response */
+static char rateLimitHeaders[MAXBUF];
+
+/** Definition of the CoDel state */
+static struct {
+	pthread_mutex_t lock;      /** guards the state */
+	uint64_t firstAboveTime;   /** when delay has been above target for an interval */
+	uint64_t dropNext;         /** time of the next drop while dropping */
+	uint32_t count;            /** drops since entering dropping state */
+	uint32_t lastCount;        /** count when dropping state was last left */
+	bool dropping;             /** in dropping state */
+} codel = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, false };
+
+/**
+ * Integer square root.
+ * @param n the value
+ * @return the largest r such that r*r <= n
+ */
+static uint32_t isqrt(uint32_t n) {
+	uint32_t r = 0;
+	for (uint32_t bit = 1u << 30; bit != 0; bit >>= 2) {
+		if (n >= r + bit) {
+			n -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+	}
+	return r;
+}
+
+/**
+ * CoDel control law: time of the next drop.
+ * @param t the time of the current drop
+ * @param count the drop count
+ * @param interval the CoDel interval in ns
+ * @return the time of the next drop
+ */
+static uint64_t controlLaw(uint64_t t, uint32_t count, uint64_t interval) {
+	uint32_t root = isqrt(count);
+	return t + interval / (root ? root : 1);
+}
+
+/**
+ * Initialize admission control and format the headers the 503 and
+ * 429 responses add to their preformatted error responses.
+ */
+void initAdmission(void) {
+	snprintf(shedHeaders, sizeof(shedHeaders), "Retry-After: %d%sConnection: close%s",
+			 serverConfig()->shedRetryAfterSec, CRLF, CRLF);
+	// a token is back within a second at any configured rate
+	snprintf(rateLimitHeaders, sizeof(rateLimitHeaders), "Retry-After: %d%sConnection: close%s",
+			 1, CRLF, CRLF);
+}
+
+/**
+ * Answer a connection with the preformatted 503 response, or the 429
+ * response for a client over its rate limit, and close it.
+ *
+ * @param conn the connection
+ * @param reason the reason for shedding
+ */
+void shedConnection(Connection *conn, ShedReason reason) {
+	const char *why;
+	switch (reason) {
+	case SHED_QUEUE_FULL:      statsIncrement(shedQueueFull); why = "queue full"; break;
+	case SHED_QUEUE_DELAY:     statsIncrement(shedQueueDelay); why = "queue delay"; break;
+	case SHED_RATE_LIMITED:    statsIncrement(shedRateLimited); why = "rate limited"; break;
+	default:                   statsIncrement(shedDiskQueueFull); why = "disk queue full"; break;
+	}
+	char response[ERROR_RESPONSE_MAX];
+	size_t responseLen = (reason == SHED_RATE_LIMITED)
+		? formatErrorResponse(response, sizeof(response), 429, "Too Many Requests", NULL, rateLimitHeaders)
+		: formatErrorResponse(response, sizeof(response), 503, "Service Unavailable", NULL, shedHeaders);
+	if (debug) {
+		fprintf(stderr, "connection %d shed: %s\n", conn->sock_fd, why);
+	}
+
+	// plaintext would break a TLS session: the response goes through
+	// the stream once the handshake is done, and before it the
+	// connection is just closed
+	if (isTlsStream(conn->stream)) {
+		if (tlsEstablished(conn->stream)) {
+			fwrite(response, 1, responseLen, conn->stream);
+			fflush(conn->stream);
+		}
+		closeConnection(conn);
+		return;
+	}
+
+	// one write of the preformatted response; nothing has been
+	// written to the stream yet
+	if (send(conn->sock_fd, response, responseLen, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		perror("shedConnection");
+	}
+
+	// drain the unread request, so closing does not reset the
+	// connection before the client reads the response
+	char buf[MAXBUF];
+	for (int drained = 0; drained < SHED_DRAIN_BYTES; ) {
+		ssize_t n = recv(conn->sock_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n <= 0) {
+			break;
+		}
+		drained += n;
+	}
+	shutdown(conn->sock_fd, SHUT_WR);
+	closeConnection(conn);
+}
+
+/**
+ * Decide with CoDel whether a request dequeued now should be
+ * dropped, given when it was queued. Requests are dropped only
+ * while the queue delay has stayed above the target for a full
+ * interval, at a rate that rises with the square root of the
+ * number of drops.
+ *
+ * @param queuedAt monotonic ns when the request was queued
+ * @param now monotonic ns now
+ * @return true if the request should be dropped
+ */
+bool codelShouldDrop(uint64_t queuedAt, uint64_t now) {
+	uint64_t sojourn = (now > queuedAt) ? now - queuedAt : 0;
+	const ServerConfig *config = serverConfig();
+	uint64_t target = config->codelTargetMs*NS_PER_MS;
+	uint64_t interval = config->codelIntervalMs*NS_PER_MS;
+	bool drop = false;
+
+	pthread_mutex_lock(&codel.lock);
+
+	// delay must stay above target for an interval before dropping
+	bool okToDrop = false;
+	if (sojourn < target) {
+		codel.firstAboveTime = 0;
+	} else if (codel.firstAboveTime == 0) {
+		codel.firstAboveTime = now + interval;
+	} else if (now >= codel.firstAboveTime) {
+		okToDrop = true;
+	}
+
+	if (codel.dropping) {
+		if (!okToDrop) {
+			codel.dropping = false;
+		} else if (now >= codel.dropNext) {
+			codel.count++;
+			codel.dropNext = controlLaw(codel.dropNext, codel.count, interval);
+			drop = true;
+		}
+	} else if (okToDrop) {
+		// resume near the previous drop rate if we only just left
+		uint32_t delta = codel.count - codel.lastCount;
+		codel.count = (delta > 1 && now - codel.dropNext < 16*interval)
+					? delta : 1;
+		codel.dropNext = controlLaw(now, codel.count, interval);
+		codel.lastCount = codel.count;
+		codel.dropping = true;
+		drop = true;
+	}
+
+	pthread_mutex_unlock(&codel.lock);
+	return drop;
+}
@@ -0,0 +1,57 @@
+/*
+ * admission.h
+ *
+ * Functions that shed load when the server is overloaded:
+ * a bounded dispatch queue answered with a preformatted
+ * 503 Service Unavailable, and optional CoDel dropping of
+ * requests that waited too long in the queue. Clients over
+ * their rate limit get a preformatted 429 Too Many Requests.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef ADMISSION_H_
+#define ADMISSION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "connection.h"
+
+/** Reasons for shedding a request */
+typedef enum ShedReason {
+	SHED_QUEUE_FULL,    /** dispatch queue above its high-water mark */
+	SHED_QUEUE_DELAY,   /** CoDel dropped the request for queue delay */
+	SHED_DISK_QUEUE_FULL, /** disk-I/O queue above its high-water mark */
+	SHED_RATE_LIMITED   /** client over its rate limit */
+} ShedReason;
+
+/**
+ * Initialize admission control and format the headers the 503 and
+ * 429 responses add to their preformatted error responses.
+ */
+void initAdmission(void);
+
+/**
+ * Answer a connection with the preformatted 503 response, or the 429
+ * response for a client over its rate limit, and close it.
+ *
+ * @param conn the connection
+ * @param reason the reason for shedding
+ */
+void shedConnection(Connection *conn, ShedReason reason);
+
+/**
+ * Decide with CoDel whether a request dequeued now should be
+ * dropped, given when it was queued. Requests are dropped only
+ * while the queue delay has stayed above the target for a full
+ * interval, at a rate that rises with the square root of the
+ * number of drops.
+ *
+ * @param queuedAt monotonic ns when the request was queued
+ * @param now monotonic ns now
+ * @return true if the request should be dropped
+ */
+bool codelShouldDrop(uint64_t queuedAt, uint64_t now);
+
+#endif /* ADMISSION_H_ */
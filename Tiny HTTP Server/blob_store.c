@@ -0,0 +1,229 @@
+/*
+ * blob_store.c
+ *
+ * Functions that store uploaded files by content, so each distinct
+ * body is kept once however many request paths it is uploaded to.
+ *
+ * Blobs are spread over 256 subdirectories by the top byte of the
+ * hash and named hash-length in hex. A blob is created by linking
+ * a fully received upload into the store, so the store never holds
+ * a partial blob. XXH64 is fast but not collision resistant, so a
+ * matching name is trusted only after the bytes are compared; an
+ * upload that collides with a different blob is stored unshared.
+ *
+ * Blobs are only ever added while the server runs. A blob whose
+ * request paths were all replaced or deleted has one link left,
+ * the store's own, and is removed when the store is next opened.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "blob_store.h"
+#include "content_root.h"
+#include "file_util.h"
+#include "xxh64.h"
+
+/** the store directory, or -1 if the store is not open */
+static int storefd = -1;
+
+/**
+ * Remove the blobs of one subdirectory that no request path links to.
+ * @param dirfd the subdirectory
+ * @return the number of blobs removed
+ */
+static int sweepBlobs(int dirfd) {
+	DIR *dir = fdopendir(dirfd);
+	if (dir == NULL) {
+		close(dirfd);
+		return 0;
+	}
+	int nremoved = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		struct stat sb;
+		if (fstatat(dirfd, entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0
+				&& S_ISREG(sb.st_mode) && sb.st_nlink == 1
+				&& unlinkat(dirfd, entry->d_name, 0) == 0) {
+			nremoved++;
+		}
+	}
+	closedir(dir);
+	return nremoved;
+}
+
+/**
+ * Open the blob store, creating its directory if necessary, and
+ * remove blobs no request path links to any more. The store must
+ * be on the same file system as the content base.
+ *
+ * @param path the store directory
+ * @return 0 if successful, -1 with errno set if error
+ */
+int openBlobStore(const char *path) {
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+		return -1;
+	}
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+	int nremoved = 0;
+	for (int i = 0; i < 256; i++) {
+		char fanout[4];
+		snprintf(fanout, sizeof(fanout), "%02x", i);
+		int dirfd = openat(fd, fanout, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirfd >= 0) {
+			nremoved += sweepBlobs(dirfd);
+		}
+	}
+	if (nremoved > 0) {
+		fprintf(stderr, "Removed %d unreferenced blobs from %s\n", nremoved, path);
+	}
+	storefd = fd;
+	return 0;
+}
+
+/**
+ * Return whether the blob store is open.
+ * @return true if uploads are deduplicated
+ */
+bool blobStoreOpen(void) {
+	return storefd >= 0;
+}
+
+/**
+ * Receive bytes from an input stream into an open file, hashing
+ * them on the way.
+ *
+ * @param istream the input stream
+ * @param fd the file descriptor
+ * @param nbytes the number of bytes to receive
+ * @param id set to the identity of the received bytes
+ * @return 0 if successful, -1 with errno set if error
+ */
+int receiveBlob(FILE *istream, int fd, off_t nbytes, BlobId *id) {
+	char buf[BUFSIZ];
+	Xxh64State state;
+	xxh64Reset(&state, 0);
+	id->size = nbytes;
+
+	off_t offset = 0;
+	while (offset < nbytes) {
+		off_t nleft = nbytes - offset;
+		ssize_t nread = readAvailable(istream, buf, (nleft < (off_t)sizeof(buf)) ? (size_t)nleft : sizeof(buf));
+		if (nread <= 0) {
+			if (nread == 0) {
+				errno = ECONNRESET;
+			}
+			return -1;
+		}
+		xxh64Update(&state, buf, nread);
+		if (writeFileBytes(fd, buf, nread, offset) != 0) {
+			return -1;
+		}
+		offset += nread;
+	}
+	id->hash = xxh64Digest(&state);
+	return 0;
+}
+
+/**
+ * Compare the bytes of two files of the same length.
+ *
+ * @param fd1 the first file
+ * @param fd2 the second file
+ * @param size the length of the files
+ * @return true if the bytes are equal
+ */
+static bool sameBytes(int fd1, int fd2, off_t size) {
+	char buf1[BUFSIZ], buf2[BUFSIZ];
+	for (off_t offset = 0; offset < size; ) {
+		size_t n = (size - offset < (off_t)sizeof(buf1)) ? (size_t)(size - offset) : sizeof(buf1);
+		if (pread(fd1, buf1, n, offset) != (ssize_t)n
+				|| pread(fd2, buf2, n, offset) != (ssize_t)n
+				|| memcmp(buf1, buf2, n) != 0) {
+			return false;
+		}
+		offset += n;
+	}
+	return true;
+}
+
+/**
+ * Return whether a blob holds the same bytes as a received file.
+ *
+ * @param dirfd the subdirectory of the blob
+ * @param name the name of the blob
+ * @param tmpUri the request path of the received file
+ * @param id the identity of the received bytes
+ * @return true if the bytes are equal
+ */
+static bool blobMatches(int dirfd, const char *name, const char *tmpUri, const BlobId *id) {
+	int blobfd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (blobfd < 0) {
+		return false;
+	}
+	struct stat sb;
+	bool same = false;
+	if (fstat(blobfd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size == id->size) {
+		int fd = contentOpen(tmpUri, O_RDONLY, 0);
+		if (fd >= 0) {
+			same = sameBytes(blobfd, fd, id->size);
+			close(fd);
+		}
+	}
+	close(blobfd);
+	return same;
+}
+
+/**
+ * Move a received file to its request path through the store. If
+ * the store has a blob with the same bytes, the path is linked to
+ * it and the received file is removed; otherwise the received file
+ * becomes the blob. The path is replaced atomically either way.
+ *
+ * @param tmpUri the request path of the received file
+ * @param uri the target request path
+ * @param id the identity of the received bytes
+ * @return 1 if an existing blob was reused, 0 if not, -1 with
+ *  errno set if error
+ */
+int commitBlob(const char *tmpUri, const char *uri, const BlobId *id) {
+	char fanout[4], name[40];
+	snprintf(fanout, sizeof(fanout), "%02x", (unsigned)(id->hash >> 56));
+	snprintf(name, sizeof(name), "%016llx-%llx", (unsigned long long)id->hash, (unsigned long long)id->size);
+	if (mkdirat(storefd, fanout, 0755) != 0 && errno != EEXIST) {
+		return -1;
+	}
+	int dirfd = openat(storefd, fanout, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		return -1;
+	}
+
+	// a new blob is the received file itself; a racing upload of
+	// the same bytes may create it first
+	if (contentLinkTo(tmpUri, dirfd, name) != 0 && errno == EEXIST
+			&& blobMatches(dirfd, name, tmpUri, id)
+			&& contentLinkFrom(dirfd, name, uri) == 0) {
+		close(dirfd);
+		contentRemove(tmpUri, false);
+		return 1;
+	}
+	close(dirfd);
+
+	// the received file is renamed into place, also when the store
+	// cannot link it or the hash collided; it is then kept unshared
+	return (contentRename(tmpUri, uri) == 0) ? 0 : -1;
+}
@@ -0,0 +1,72 @@
+/*
+ * blob_store.h
+ *
+ * Functions that store uploaded files by content, so each distinct
+ * body is kept once however many request paths it is uploaded to.
+ *
+ * An upload is hashed with XXH64 while it is received. Its blob is
+ * a file in the store named for the hash and length, and every
+ * request path with that content is a hard link to the blob, so
+ * serving a path is unchanged. A re-upload of known content is
+ * linked to the existing blob and its received copy is discarded.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef BLOB_STORE_H_
+#define BLOB_STORE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** Definition of the identity of a blob */
+typedef struct BlobId {
+	uint64_t hash;              /** XXH64 of the content */
+	off_t size;                 /** length of the content */
+} BlobId;
+
+/**
+ * Open the blob store, creating its directory if necessary, and
+ * remove blobs no request path links to any more. The store must
+ * be on the same file system as the content base.
+ *
+ * @param path the store directory
+ * @return 0 if successful, -1 with errno set if error
+ */
+int openBlobStore(const char *path);
+
+/**
+ * Return whether the blob store is open.
+ * @return true if uploads are deduplicated
+ */
+bool blobStoreOpen(void);
+
+/**
+ * Receive bytes from an input stream into an open file, hashing
+ * them on the way.
+ *
+ * @param istream the input stream
+ * @param fd the file descriptor
+ * @param nbytes the number of bytes to receive
+ * @param id set to the identity of the received bytes
+ * @return 0 if successful, -1 with errno set if error
+ */
+int receiveBlob(FILE *istream, int fd, off_t nbytes, BlobId *id);
+
+/**
+ * Move a received file to its request path through the store. If
+ * the store has a blob with the same bytes, the path is linked to
+ * it and the received file is removed; otherwise the received file
+ * becomes the blob. The path is replaced atomically either way.
+ *
+ * @param tmpUri the request path of the received file
+ * @param uri the target request path
+ * @param id the identity of the received bytes
+ * @return 1 if an existing blob was reused, 0 if not, -1 with
+ *  errno set if error
+ */
+int commitBlob(const char *tmpUri, const char *uri, const BlobId *id);
+
+#endif /* BLOB_STORE_H_ */
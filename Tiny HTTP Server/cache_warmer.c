@@ -0,0 +1,341 @@
+/*
+ * cache_warmer.c
+ *
+ * Functions that warm the file cache before the listener accepts.
+ *
+ * The saved list is plain text, one request path per line, like the
+ * list handed to a new server on upgrade. Paths are opened through
+ * the content root as requests are, so a list edited by hand cannot
+ * reach outside the content base.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "cache_warmer.h"
+#include "content_bundle.h"
+#include "content_root.h"
+#include "file_cache.h"
+#include "http_server.h"
+#include "server_config.h"
+#include "server_stats.h"
+
+/** Definition of a growable buffer of cached paths */
+typedef struct PathList {
+	char *buf;          /** the paths, one per line */
+	size_t len;         /** bytes used */
+	size_t size;        /** bytes allocated */
+	bool failed;        /** out of memory */
+} PathList;
+
+/** Definition of a growable array of paths to warm */
+typedef struct PathArray {
+	char **paths;       /** the request paths */
+	size_t n;           /** paths used */
+	size_t size;        /** paths allocated */
+	size_t max;         /** most paths collected */
+} PathArray;
+
+/** Definition of the files shared by the warming threads */
+typedef struct WarmJob {
+	char **paths;                   /** the request paths, most recently used first */
+	size_t npaths;                  /** the number of paths */
+	atomic_size_t next;             /** index of the next path to open */
+	atomic_size_t warmed;           /** files cached */
+	const ServerConfig *config;     /** configuration of the warming threads */
+} WarmJob;
+
+/**
+ * Append a cached path to a path list.
+ *
+ * @param path the request path
+ * @param arg the path list
+ */
+static void appendPath(const char *path, void *arg) {
+	PathList *list = arg;
+	size_t len = strlen(path);
+	if (list->failed || strchr(path, '\n') != NULL) {
+		return;
+	}
+	if (list->len + len + 2 > list->size) {
+		size_t size = 2 * (list->size + len + 2);
+		char *buf = realloc(list->buf, size);
+		if (buf == NULL) {
+			list->failed = true;
+			return;
+		}
+		list->buf = buf;
+		list->size = size;
+	}
+	memcpy(list->buf + list->len, path, len);
+	list->len += len;
+	list->buf[list->len++] = '\n';
+}
+
+/**
+ * Return the paths in the file cache, one per line, most recently
+ * used first.
+ *
+ * @param len set to the length of the list
+ * @return the list, to be freed by the caller; NULL if the cache is
+ *  empty or there is no memory
+ */
+char *hotPathList(size_t *len) {
+	PathList list = { NULL, 0, 0, false };
+	fileCacheForEach(appendPath, &list);
+	if (list.failed) {
+		free(list.buf);
+		list.buf = NULL;
+		list.len = 0;
+	}
+	*len = list.len;
+	return list.buf;
+}
+
+/**
+ * Add a copy of a path to a path array.
+ *
+ * @param array the path array
+ * @param path the request path
+ * @return 0 if successful, -1 if the array is full or no memory
+ */
+static int addPath(PathArray *array, const char *path) {
+	if (array->n == array->max) {
+		return -1;
+	}
+	if (array->n == array->size) {
+		size_t size = (array->size > 0) ? 2 * array->size : 64;
+		char **paths = realloc(array->paths, size * sizeof(char *));
+		if (paths == NULL) {
+			return -1;
+		}
+		array->paths = paths;
+		array->size = size;
+	}
+	array->paths[array->n] = strdup(path);
+	if (array->paths[array->n] == NULL) {
+		return -1;
+	}
+	array->n++;
+	return 0;
+}
+
+/**
+ * Free the paths of a path array.
+ *
+ * @param array the path array
+ */
+static void freePaths(PathArray *array) {
+	for (size_t i = 0; i < array->n; i++) {
+		free(array->paths[i]);
+	}
+	free(array->paths);
+	array->paths = NULL;
+	array->n = array->size = 0;
+}
+
+/**
+ * Read the hot paths saved by the last server.
+ *
+ * @param file the saved list
+ * @param array the path array
+ * @return 0 if successful, -1 with errno set if the list cannot be read
+ */
+static int readHotPaths(const char *file, PathArray *array) {
+	FILE *in = fopen(file, "r");
+	if (in == NULL) {
+		return -1;
+	}
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &size, in)) > 0) {
+		if (line[len-1] == '\n') {
+			line[--len] = '\0';
+		}
+		if (line[0] == '/' && addPath(array, line) != 0) {
+			break;
+		}
+	}
+	free(line);
+	fclose(in);
+	return 0;
+}
+
+/**
+ * Collect the regular files of a directory and its subdirectories
+ * until the path array is full.
+ *
+ * @param array the path array
+ * @param dirfd the directory; it is closed
+ * @param path the request path of the directory, of size MAXBUF
+ * @param pathLen the length of the path
+ * @param depth the level of the directory
+ * @return 0 if the array has room, -1 once it is full
+ */
+static int collectFiles(PathArray *array, int dirfd, char *path, size_t pathLen, int depth) {
+	DIR *dir = fdopendir(dirfd);
+	if (dir == NULL) {
+		close(dirfd);
+		return 0;
+	}
+	int status = 0;
+	struct dirent *entry;
+	while (status == 0 && (entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		// relative to the directory; links are not followed
+		struct stat sb;
+		if (fstatat(dirfd, entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+			continue;
+		}
+		int n = snprintf(path + pathLen, MAXBUF - pathLen, "/%s", entry->d_name);
+		if (n < 0 || (size_t)n >= MAXBUF - pathLen) {
+			continue;  // too long to request
+		}
+		if (S_ISREG(sb.st_mode)) {
+			status = addPath(array, path);
+		} else if (S_ISDIR(sb.st_mode) && depth < CACHE_WARM_MAX_DEPTH) {
+			int subfd = openat(dirfd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+			if (subfd >= 0) {
+				status = collectFiles(array, subfd, path, pathLen + n, depth + 1);
+			}
+		}
+	}
+	path[pathLen] = '\0';
+	closedir(dir);
+	return status;
+}
+
+/**
+ * A warming thread opens paths into the file cache until none are left.
+ *
+ * @param arg the warm job
+ * @return NULL
+ */
+static void *warmFiles(void *arg) {
+	WarmJob *job = arg;
+	setThreadConfig(job->config);
+	off_t maxRead = (off_t)job->config->pageCacheProbeMaxKb * 1024;
+	size_t i;
+	while ((i = atomic_fetch_add(&job->next, 1)) < job->npaths) {
+		FileCacheEntry *entry = fileCacheOpen(job->paths[job->npaths - 1 - i]);
+		if (entry == NULL) {
+			continue;
+		}
+#if defined(POSIX_FADV_WILLNEED)
+		// read in what the page cache probe would find cold
+		if (entry->sb.st_size > 0 && entry->sb.st_size <= maxRead) {
+			posix_fadvise(entry->fd, 0, entry->sb.st_size, POSIX_FADV_WILLNEED);
+		}
+#else
+		(void)maxRead;
+#endif
+		fileCacheRelease(entry);
+		atomic_fetch_add(&job->warmed, 1);
+		statsIncrement(cacheWarmedFiles);
+	}
+	setThreadConfig(NULL);
+	return NULL;
+}
+
+/**
+ * Open files into the file cache in parallel, least recently used
+ * first, and read the small ones into the page cache.
+ *
+ * @param paths the request paths, most recently used first
+ * @param npaths the number of paths
+ * @return the number of files cached
+ */
+size_t warmFileCache(char *paths[], size_t npaths) {
+	const ServerConfig *config = serverConfig();
+	WarmJob job = { .paths = paths, .npaths = npaths, .config = config };
+	atomic_init(&job.next, 0);
+	atomic_init(&job.warmed, 0);
+
+	// the calling thread warms too
+	int nthreads = config->cacheWarmThreads - 1;
+	if ((size_t)nthreads >= npaths) {
+		nthreads = (npaths > 0) ? npaths - 1 : 0;
+	}
+	pthread_t threads[nthreads > 0 ? nthreads : 1];
+	int started = 0;
+	while (started < nthreads && pthread_create(&threads[started], NULL, warmFiles, &job) == 0) {
+		started++;
+	}
+	warmFiles(&job);
+	setThreadConfig(config);
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	return atomic_load(&job.warmed);
+}
+
+/**
+ * Warm the file cache from the saved hot paths, or from a walk of
+ * the content base if none were saved. Does nothing if warming is
+ * off or a content bundle is served.
+ */
+void warmCaches(void) {
+	const ServerConfig *config = serverConfig();
+	if (!config->cacheWarm || config->fileCacheMaxEntries == 0 || contentBundleOpen()) {
+		return;
+	}
+	PathArray array = { NULL, 0, 0, config->fileCacheMaxEntries };
+	const char *source = config->cacheWarmList;
+	if (*source == '\0' || readHotPaths(source, &array) != 0 || array.n == 0) {
+		source = config->contentBase;
+		int fd = contentOpen("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+		if (fd >= 0) {
+			char path[MAXBUF] = "";
+			collectFiles(&array, fd, path, 0, 0);
+		}
+	}
+	if (array.n == 0) {
+		return;
+	}
+	size_t warmed = warmFileCache(array.paths, array.n);
+	fprintf(stderr, "Warmed file cache with %zu of %zu files from %s\n", warmed, array.n, source);
+	freePaths(&array);
+}
+
+/**
+ * Save the paths in the file cache to cache_warm_list, so the next
+ * server warms its cache with them. Does nothing if no list is
+ * configured.
+ *
+ * @return 0 if successful, -1 if the list cannot be written
+ */
+int saveHotPaths(void) {
+	const char *file = serverConfig()->cacheWarmList;
+	if (*file == '\0' || contentBundleOpen()) {
+		return 0;
+	}
+	// written aside and renamed, so a reader never sees part of a list
+	char tmp[MAXBUF + 32];
+	snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid());
+	FILE *out = fopen(tmp, "w");
+	if (out == NULL) {
+		return -1;
+	}
+	size_t len;
+	char *list = hotPathList(&len);
+	int status = (len > 0 && fwrite(list, 1, len, out) != len) ? -1 : 0;
+	free(list);
+	if (fclose(out) != 0 || status != 0 || rename(tmp, file) != 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
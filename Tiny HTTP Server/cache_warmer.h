@@ -0,0 +1,67 @@
+/*
+ * cache_warmer.h
+ *
+ * Functions that warm the file cache before the listener accepts,
+ * so the first requests after a restart find the stat, descriptor
+ * and page caches warm instead of all waiting on the disk.
+ *
+ * On shutdown the paths in the file cache are saved to
+ * cache_warm_list, most recently used first. On startup they are
+ * opened again by cache_warm_threads threads, least recently used
+ * first, so the cache ends up in the same order; without a saved
+ * list the content base is walked until the cache is full. Files
+ * small enough for the page cache probe are read ahead as well, so
+ * they are served without the disk-I/O pool. A server started by
+ * an upgrade warms from the paths the old server hands it instead.
+ *
+ * Each prefork worker warms its own cache and saves its own paths;
+ * the list saved last is the one warmed from on the next start.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CACHE_WARMER_H_
+#define CACHE_WARMER_H_
+
+#include <stddef.h>
+
+/** deepest directory level walked for files to warm */
+#define CACHE_WARM_MAX_DEPTH 32
+
+/**
+ * Return the paths in the file cache, one per line, most recently
+ * used first.
+ *
+ * @param len set to the length of the list
+ * @return the list, to be freed by the caller; NULL if the cache is
+ *  empty or there is no memory
+ */
+char *hotPathList(size_t *len);
+
+/**
+ * Open files into the file cache in parallel, least recently used
+ * first, and read the small ones into the page cache.
+ *
+ * @param paths the request paths, most recently used first
+ * @param npaths the number of paths
+ * @return the number of files cached
+ */
+size_t warmFileCache(char *paths[], size_t npaths);
+
+/**
+ * Warm the file cache from the saved hot paths, or from a walk of
+ * the content base if none were saved. Does nothing if warming is
+ * off or a content bundle is served.
+ */
+void warmCaches(void);
+
+/**
+ * Save the paths in the file cache to cache_warm_list, so the next
+ * server warms its cache with them. Does nothing if no list is
+ * configured.
+ *
+ * @return 0 if successful, -1 if the list cannot be written
+ */
+int saveHotPaths(void);
+
+#endif /* CACHE_WARMER_H_ */
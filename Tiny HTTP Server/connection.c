@@ -0,0 +1,446 @@
+/*
+ * connection.c
+ *
+ * Functions that manage client connections, including the
+ * deadlines that bound each phase of a request and the
+ * parking of idle keep-alive connections.
+ *
+ * A single monitor thread owns the timer wheel and an epoll set
+ * of parked connections. A deadline that expires on a parked
+ * connection closes it directly; one that expires while a worker
+ * is serving the connection shuts down the socket, so the worker's
+ * blocked read or write returns and the worker closes it.
+ *
+ * When the server drains, the monitor closes the parked keep-alive
+ * connections, and connections are no longer parked after a request.
+ * Connections waiting for their first request are still served.
+ *
+ * An HTTP/2 connection is parked between frames, but its streams may
+ * still be writing to it, so the monitor shuts it down instead of
+ * closing it, and dispatches it for its session to end.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "connection.h"
+#include "http_server.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "time_util.h"
+#include "coroutine.h"
+#include "tls.h"
+#include "file_util.h"
+
+/** milliseconds per timer wheel tick */
+#define TICK_MS 100
+
+/** maximum events per epoll wait */
+#define MAX_EVENTS 64
+
+/** the timer wheel; guarded by monitor_lock */
+static TimerWheel *wheel = NULL;
+
+/** guards the timer wheel and connection deadline state */
+static pthread_mutex_t monitor_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** epoll set of parked connections */
+static int epoll_fd = -1;
+
+/** function that dispatches readable parked connections */
+static void (*dispatch_connection)(Connection *conn) = NULL;
+
+/** parked connections; guarded by monitor_lock */
+static Connection *parkedHead = NULL;
+
+/** number of open connections */
+static atomic_long nopen = 0;
+
+/** connections are closed after their current request */
+static atomic_bool draining = false;
+
+/**
+ * Add a connection to the parked list.
+ * Called with monitor_lock held.
+ *
+ * @param conn the connection
+ */
+static void parkedLink(Connection *conn) {
+	conn->parkedPrev = NULL;
+	conn->parkedNext = parkedHead;
+	if (parkedHead != NULL) {
+		parkedHead->parkedPrev = conn;
+	}
+	parkedHead = conn;
+	conn->parked = true;
+}
+
+/**
+ * Remove a connection from the parked list.
+ * Called with monitor_lock held.
+ *
+ * @param conn the connection
+ */
+static void parkedUnlink(Connection *conn) {
+	if (conn->parkedPrev != NULL) {
+		conn->parkedPrev->parkedNext = conn->parkedNext;
+	} else {
+		parkedHead = conn->parkedNext;
+	}
+	if (conn->parkedNext != NULL) {
+		conn->parkedNext->parkedPrev = conn->parkedPrev;
+	}
+	conn->parkedPrev = conn->parkedNext = NULL;
+	conn->parked = false;
+}
+
+/**
+ * Close a parked connection. Called by the monitor thread
+ * with monitor_lock held.
+ *
+ * @param conn the connection
+ */
+static void closeParked(Connection *conn) {
+	parkedUnlink(conn);
+	timerWheelCancel(&conn->timer);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sock_fd, NULL);
+	fclose(conn->stream);
+	free(conn);
+	atomic_fetch_sub(&nopen, 1);
+}
+
+/**
+ * Close the parked connections that are idle between requests.
+ * Called by the monitor thread with monitor_lock held.
+ */
+static void closeIdleConnections(void) {
+	Connection *next;
+	for (Connection *conn = parkedHead; conn != NULL; conn = next) {
+		next = conn->parkedNext;
+		if (conn->deadline == DEADLINE_KEEPALIVE && conn->http2 != NULL) {
+			// its session ends when it sees the socket shut down
+			shutdown(conn->sock_fd, SHUT_RDWR);
+		} else if (conn->deadline == DEADLINE_KEEPALIVE) {
+			closeParked(conn);
+		}
+	}
+}
+
+/**
+ * Return the current tick of the monotonic clock.
+ * @return the current tick
+ */
+static uint64_t currentTick(void) {
+	return monotonicTimeNanos() / (TICK_MS*1000000ULL);
+}
+
+/**
+ * Return the timeout in ticks for a deadline.
+ * @param deadline the deadline
+ * @return the timeout in ticks
+ */
+static uint64_t deadlineTicks(Deadline deadline) {
+	const ServerConfig *config = serverConfig();
+	int ms;
+	switch (deadline) {
+	case DEADLINE_READ_HEADER: ms = config->readHeaderTimeoutMs; break;
+	case DEADLINE_READ_BODY:   ms = config->readBodyTimeoutMs; break;
+	case DEADLINE_WRITE:       ms = config->writeTimeoutMs; break;
+	case DEADLINE_KEEPALIVE:   ms = config->keepAliveTimeoutMs; break;
+	default:                   ms = 0;
+	}
+	return (ms + TICK_MS - 1) / TICK_MS;
+}
+
+/**
+ * Count an expired deadline.
+ * @param deadline the deadline
+ */
+static void countExpired(Deadline deadline) {
+	switch (deadline) {
+	case DEADLINE_READ_HEADER: statsIncrement(timeoutsReadHeader); break;
+	case DEADLINE_READ_BODY:   statsIncrement(timeoutsReadBody); break;
+	case DEADLINE_WRITE:       statsIncrement(timeoutsWrite); break;
+	case DEADLINE_KEEPALIVE:   statsIncrement(timeoutsKeepAlive); break;
+	default:                   break;
+	}
+}
+
+/**
+ * Timer callback for an expired connection deadline.
+ * Called by the monitor thread with monitor_lock held.
+ *
+ * @param timer the connection timer
+ */
+static void deadlineExpired(TimerEntry *timer) {
+	Connection *conn = (Connection *)((char *)timer - offsetof(Connection, timer));
+	countExpired(conn->deadline);
+	if (debug) {
+		fprintf(stderr, "connection %d deadline %d expired\n", conn->sock_fd, conn->deadline);
+	}
+	conn->deadline = DEADLINE_NONE;
+
+	if (conn->parked && conn->http2 == NULL) {
+		// monitor owns parked connections, so close it here
+		closeParked(conn);
+	} else {
+		// unblock the worker, or wake a parked session; it closes the connection
+		atomic_store(&conn->expired, true);
+		shutdown(conn->sock_fd, SHUT_RDWR);
+	}
+}
+
+/**
+ * The monitor thread dispatches parked connections that
+ * become readable and advances the timer wheel.
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void *monitor(void *arg) {
+	(void)arg;
+	struct epoll_event events[MAX_EVENTS];
+	bool swept = false;
+	while (true) {
+		int nevents = epoll_wait(epoll_fd, events, MAX_EVENTS, TICK_MS);
+		for (int i = 0; i < nevents; i++) {
+			Connection *conn = events[i].data.ptr;
+			pthread_mutex_lock(&monitor_lock);
+			timerWheelCancel(&conn->timer);
+			conn->deadline = DEADLINE_NONE;
+			parkedUnlink(conn);
+			pthread_mutex_unlock(&monitor_lock);
+
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sock_fd, NULL);
+			dispatch_connection(conn);
+		}
+
+		pthread_mutex_lock(&monitor_lock);
+		timerWheelAdvance(wheel, currentTick());
+		if (!swept && atomic_load(&draining)) {
+			// connections parked later are closed by parkConnection
+			closeIdleConnections();
+			swept = true;
+		}
+		pthread_mutex_unlock(&monitor_lock);
+	}
+	return NULL;
+}
+
+/**
+ * Create a new connection for a peer socket.
+ * @param sock_fd the socket descriptor
+ * @param peerAddr the peer IPv4 address in network byte order
+ * @return a new connection or NULL if the socket cannot be opened as a stream
+ */
+Connection *newConnection(int sock_fd, uint32_t peerAddr) {
+	Connection *conn = malloc(sizeof(Connection));
+	if (conn == NULL) {
+		return NULL;
+	}
+	// a coroutine waits for its socket instead of blocking on it
+	conn->stream = tlsEnabled() ? openTlsStream(sock_fd)
+				 : coroutinesRunning() ? openCoroutineStream(sock_fd) : fdopen(sock_fd, "r+");
+	if (conn->stream == NULL) {
+		perror("fdopen");
+		free(conn);
+		return NULL;
+	}
+	conn->sock_fd = sock_fd;
+	conn->peerAddr = peerAddr;
+	initTimerEntry(&conn->timer, deadlineExpired);
+	conn->deadline = DEADLINE_NONE;
+	conn->parked = false;
+	atomic_init(&conn->expired, false);
+	conn->nrequests = 0;
+	conn->queuedAt = 0;
+	conn->pipelined = NULL;
+	conn->npipelined = 0;
+	conn->http2 = NULL;
+	conn->parkedPrev = conn->parkedNext = NULL;
+	atomic_fetch_add(&nopen, 1);
+	return conn;
+}
+
+/**
+ * Close the connection and its socket, and free the connection.
+ * @param conn the connection
+ */
+void closeConnection(Connection *conn) {
+	cancelDeadline(conn);
+	fflush(conn->stream);
+	fclose(conn->stream);  // also closes sock_fd
+	free(conn->pipelined);
+	free(conn);
+	atomic_fetch_sub(&nopen, 1);
+}
+
+/**
+ * Arm a deadline for the current phase of a connection,
+ * replacing any deadline already armed.
+ *
+ * @param conn the connection
+ * @param deadline the deadline
+ */
+void armDeadline(Connection *conn, Deadline deadline) {
+	pthread_mutex_lock(&monitor_lock);
+	conn->deadline = deadline;
+	timerWheelArm(wheel, &conn->timer, currentTick() + deadlineTicks(deadline));
+	pthread_mutex_unlock(&monitor_lock);
+}
+
+/**
+ * Arm a deadline that runs from an earlier time instead of now,
+ * replacing any deadline already armed.
+ *
+ * @param conn the connection
+ * @param deadline the deadline
+ * @param since monotonic ns the deadline's timeout runs from
+ */
+void armDeadlineSince(Connection *conn, Deadline deadline, uint64_t since) {
+	pthread_mutex_lock(&monitor_lock);
+	conn->deadline = deadline;
+	timerWheelArm(wheel, &conn->timer, since / (TICK_MS*1000000ULL) + deadlineTicks(deadline));
+	pthread_mutex_unlock(&monitor_lock);
+}
+
+/**
+ * Cancel the deadline armed for a connection.
+ * @param conn the connection
+ */
+void cancelDeadline(Connection *conn) {
+	pthread_mutex_lock(&monitor_lock);
+	timerWheelCancel(&conn->timer);
+	conn->deadline = DEADLINE_NONE;
+	pthread_mutex_unlock(&monitor_lock);
+}
+
+/**
+ * Return whether a deadline expired while the connection was served.
+ * The socket has been shut down and the connection should be closed.
+ *
+ * @param conn the connection
+ * @return true if a deadline expired
+ */
+bool connectionExpired(Connection *conn) {
+	return atomic_load(&conn->expired);
+}
+
+/**
+ * Park a connection until its next request arrives. The connection
+ * is dispatched when readable, or closed if its read-header or
+ * keep-alive deadline expires first. A connection whose next request
+ * is already buffered is dispatched at once, since the socket may
+ * never become readable again.
+ *
+ * @param conn the connection
+ */
+void parkConnection(Connection *conn) {
+	// a session arms its own deadline, and ends itself when draining
+	bool session = (conn->http2 != NULL);
+	Deadline deadline = (conn->nrequests == 0) ? DEADLINE_READ_HEADER : DEADLINE_KEEPALIVE;
+	if (streamBufferedInput(conn->stream) > 0) {
+		if (!session && deadline == DEADLINE_KEEPALIVE && atomic_load(&draining)) {
+			closeConnection(conn);
+		} else {
+			dispatch_connection(conn);
+		}
+		return;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLRDHUP;
+	event.data.ptr = conn;
+
+	// register under the lock so the deadline cannot fire before the
+	// connection is in the epoll set, and a drain cannot miss it
+	pthread_mutex_lock(&monitor_lock);
+	if (!session && deadline == DEADLINE_KEEPALIVE && atomic_load(&draining)) {
+		pthread_mutex_unlock(&monitor_lock);
+		closeConnection(conn);
+		return;
+	}
+	if (!session) {
+		conn->deadline = deadline;
+		timerWheelArm(wheel, &conn->timer, currentTick() + deadlineTicks(deadline));
+	}
+	parkedLink(conn);
+	int status = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->sock_fd, &event);
+	if (status != 0) {
+		timerWheelCancel(&conn->timer);
+		conn->deadline = DEADLINE_NONE;
+		parkedUnlink(conn);
+	}
+	pthread_mutex_unlock(&monitor_lock);
+
+	if (status != 0) {
+		perror("parkConnection");
+		if (session) {
+			// its session ends when it sees the socket shut down
+			shutdown(conn->sock_fd, SHUT_RDWR);
+			dispatch_connection(conn);
+		} else {
+			closeConnection(conn);
+		}
+	}
+}
+
+/**
+ * Stop keeping connections alive so the server can exit. Idle
+ * keep-alive connections are closed, and connections being served
+ * are closed after their current request.
+ */
+void drainConnections(void) {
+	// the monitor closes the idle connections on its next tick
+	atomic_store(&draining, true);
+}
+
+/**
+ * Determine whether connections are being drained.
+ * @return true if connections are closed after their current request
+ */
+bool connectionsDraining(void) {
+	return atomic_load(&draining);
+}
+
+/**
+ * Return the number of open connections.
+ * @return the number of open connections
+ */
+long openConnections(void) {
+	return atomic_load(&nopen);
+}
+
+/**
+ * Start the monitor thread that watches parked connections
+ * and expires deadlines.
+ *
+ * @param dispatch function called with a parked connection that is readable
+ * @return 0 if successful, -1 if error
+ */
+int startConnectionMonitor(void (*dispatch)(Connection *conn)) {
+	dispatch_connection = dispatch;
+	wheel = newTimerWheel(currentTick());
+	if (wheel == NULL) {
+		return -1;
+	}
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		return -1;
+	}
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, monitor, NULL) != 0) {
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
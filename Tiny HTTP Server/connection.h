@@ -0,0 +1,143 @@
+/*
+ * connection.h
+ *
+ * Functions that manage client connections, including the
+ * deadlines that bound each phase of a request and the
+ * parking of idle keep-alive connections.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CONNECTION_H_
+#define CONNECTION_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "timer_wheel.h"
+
+/** Deadlines that can be armed on a connection */
+typedef enum Deadline {
+	DEADLINE_NONE,          /** no deadline armed */
+	DEADLINE_READ_HEADER,   /** waiting for the request line and headers */
+	DEADLINE_READ_BODY,     /** waiting for the request body */
+	DEADLINE_WRITE,         /** sending the response */
+	DEADLINE_KEEPALIVE      /** idle between requests */
+} Deadline;
+
+struct Http2Session;
+
+/** Definition of a client connection */
+typedef struct Connection {
+	int sock_fd;            /** the socket descriptor */
+	uint32_t peerAddr;      /** peer IPv4 address in network byte order */
+	FILE *stream;           /** the socket stream */
+	TimerEntry timer;       /** deadline timer */
+	Deadline deadline;      /** the armed deadline */
+	bool parked;            /** waiting in the monitor for the next request */
+	atomic_bool expired;    /** a deadline expired while being served */
+	unsigned nrequests;     /** requests served on this connection */
+	uint64_t queuedAt;      /** monotonic ns when queued for a worker */
+	char *pipelined;        /** pipelined input set aside while responding */
+	size_t npipelined;      /** bytes of pipelined input */
+	struct Http2Session *http2;     /** the HTTP/2 session read from the connection, or NULL */
+	struct Connection *parkedPrev;  /** previous parked connection */
+	struct Connection *parkedNext;  /** next parked connection */
+} Connection;
+
+/**
+ * Create a new connection for a peer socket.
+ * @param sock_fd the socket descriptor
+ * @param peerAddr the peer IPv4 address in network byte order
+ * @return a new connection or NULL if the socket cannot be opened as a stream
+ */
+Connection *newConnection(int sock_fd, uint32_t peerAddr);
+
+/**
+ * Close the connection and its socket, and free the connection.
+ * @param conn the connection
+ */
+void closeConnection(Connection *conn);
+
+/**
+ * Arm a deadline for the current phase of a connection,
+ * replacing any deadline already armed.
+ *
+ * @param conn the connection
+ * @param deadline the deadline
+ */
+void armDeadline(Connection *conn, Deadline deadline);
+
+/**
+ * Arm a deadline that runs from an earlier time instead of now,
+ * replacing any deadline already armed.
+ *
+ * @param conn the connection
+ * @param deadline the deadline
+ * @param since monotonic ns the deadline's timeout runs from
+ */
+void armDeadlineSince(Connection *conn, Deadline deadline, uint64_t since);
+
+/**
+ * Cancel the deadline armed for a connection.
+ * @param conn the connection
+ */
+void cancelDeadline(Connection *conn);
+
+/**
+ * Return whether a deadline expired while the connection was served.
+ * The socket has been shut down and the connection should be closed.
+ *
+ * @param conn the connection
+ * @return true if a deadline expired
+ */
+bool connectionExpired(Connection *conn);
+
+/**
+ * Park a connection until its next request arrives. The connection
+ * is dispatched when readable, or closed if its read-header or
+ * keep-alive deadline expires first. A connection whose next request
+ * is already buffered is dispatched at once, since the socket may
+ * never become readable again.
+ *
+ * A connection with an HTTP/2 session is parked until its next frame
+ * with the deadline its session armed. It is never closed while
+ * parked, since streams may still be writing to it: an expired
+ * deadline or a drain shuts its socket down, and its session ends
+ * once it is dispatched.
+ *
+ * @param conn the connection
+ */
+void parkConnection(Connection *conn);
+
+/**
+ * Stop keeping connections alive so the server can exit. Idle
+ * keep-alive connections are closed, and connections being served
+ * are closed after their current request.
+ */
+void drainConnections(void);
+
+/**
+ * Determine whether connections are being drained.
+ * @return true if connections are closed after their current request
+ */
+bool connectionsDraining(void);
+
+/**
+ * Return the number of open connections.
+ * @return the number of open connections
+ */
+long openConnections(void);
+
+/**
+ * Start the monitor thread that watches parked connections
+ * and expires deadlines.
+ *
+ * @param dispatch function called with a parked connection that is readable
+ * @return 0 if successful, -1 if error
+ */
+int startConnectionMonitor(void (*dispatch)(Connection *conn));
+
+#endif /* CONNECTION_H_ */
@@ -0,0 +1,212 @@
+/*
+ * content_bundle.c
+ *
+ * Functions that serve content from a memory-mapped content bundle.
+ *
+ * The bundle is mapped once and checked when it is opened, so
+ * lookups are a binary search of the mapped index that makes no
+ * system calls and takes no locks.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  // MAP_POPULATE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "content_bundle.h"
+#include "http_server.h"
+
+/** the mapped bundle */
+static const char *bundle = NULL;
+
+/** the index of the mapped bundle */
+static const BundleEntry *bundleIndex = NULL;
+
+/** number of entries in the index */
+static uint32_t bundleEntries = 0;
+
+/**
+ * Determine whether a string lies within the bundle.
+ *
+ * @param base the bundle
+ * @param size the size of the bundle
+ * @param offset the offset of the string
+ * @return true if the string and its terminator are in the bundle
+ */
+static bool validString(const char *base, size_t size, uint64_t offset) {
+	return offset < size && memchr(base + offset, '\0', size - offset) != NULL;
+}
+
+/**
+ * Determine whether bytes lie within the bundle.
+ *
+ * @param size the size of the bundle
+ * @param offset the offset of the bytes
+ * @param len the number of bytes
+ * @return true if the bytes are in the bundle
+ */
+static bool validBytes(size_t size, uint64_t offset, uint64_t len) {
+	return offset <= size && len <= size - offset;
+}
+
+/**
+ * Check that a mapped bundle is well formed, so it can be
+ * served without further checks.
+ *
+ * @param base the bundle
+ * @param size the size of the bundle
+ * @return true if the bundle is well formed
+ */
+static bool validBundle(const char *base, size_t size) {
+	if (size < sizeof(BundleHeader)) {
+		return false;
+	}
+	const BundleHeader *header = (const BundleHeader *)base;
+	if (memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != BUNDLE_VERSION
+			|| header->size != size
+			|| header->index % sizeof(uint64_t) != 0
+			|| !validBytes(size, header->index, (uint64_t)header->nentries * sizeof(BundleEntry))) {
+		return false;
+	}
+	const BundleEntry *index = (const BundleEntry *)(base + header->index);
+	for (uint32_t i = 0; i < header->nentries; i++) {
+		const BundleEntry *e = &index[i];
+		if (!validString(base, size, e->path)
+				|| !validString(base, size, e->etag)
+				|| !validString(base, size, e->headers)
+				|| !validBytes(size, e->content, e->contentLen)) {
+			return false;
+		}
+		if (e->gzipContent != 0
+				&& (!validString(base, size, e->gzipHeaders)
+					|| !validBytes(size, e->gzipContent, e->gzipLen))) {
+			return false;
+		}
+		// binary search needs strictly ascending paths
+		if (i > 0 && strcmp(base + index[i-1].path, base + e->path) >= 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Map a content bundle to serve requests from.
+ *
+ * @param path the bundle file
+ * @return 0 if successful, -1 with errno set if error
+ */
+int openContentBundle(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		close(fd);
+		return -1;
+	}
+	int flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+	// fault the whole bundle in now rather than on first requests
+	flags |= MAP_POPULATE;
+#endif
+	void *base = (sb.st_size > 0) ? mmap(NULL, sb.st_size, PROT_READ, flags, fd, 0) : MAP_FAILED;
+	int saved = errno;
+	close(fd);
+	if (base == MAP_FAILED) {
+		errno = (sb.st_size > 0) ? saved : EINVAL;
+		return -1;
+	}
+	if (!validBundle(base, sb.st_size)) {
+		munmap(base, sb.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	const BundleHeader *header = base;
+	bundle = base;
+	bundleIndex = (const BundleEntry *)(bundle + header->index);
+	bundleEntries = header->nentries;
+	return 0;
+}
+
+/**
+ * Determine whether requests are served from a content bundle.
+ * @return true if a bundle is mapped
+ */
+bool contentBundleOpen(void) {
+	return bundle != NULL;
+}
+
+/**
+ * Find the entry for a request path. A path that ends with '/'
+ * finds the "index.html" file of the directory.
+ *
+ * @param uri the request path
+ * @return the entry, or NULL if not in the bundle
+ */
+const BundleEntry *bundleLookup(const char *uri) {
+	char indexUri[MAXBUF];
+	size_t len = strlen(uri);
+	if (len > 0 && uri[len-1] == '/') {
+		if (len + sizeof("index.html") > sizeof(indexUri)) {
+			return NULL;
+		}
+		memcpy(indexUri, uri, len);
+		memcpy(indexUri + len, "index.html", sizeof("index.html"));
+		uri = indexUri;
+	}
+
+	size_t lo = 0, hi = bundleEntries;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(uri, bundle + bundleIndex[mid].path);
+		if (cmp == 0) {
+			return &bundleIndex[mid];
+		}
+		if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Return a string of the bundle.
+ *
+ * @param offset the offset of the string
+ * @return the string
+ */
+const char *bundleString(uint64_t offset) {
+	return bundle + offset;
+}
+
+/**
+ * Return bytes of the bundle.
+ *
+ * @param offset the offset of the bytes
+ * @return the bytes
+ */
+const void *bundleBytes(uint64_t offset) {
+	return bundle + offset;
+}
+
+/**
+ * Return the number of files in the bundle.
+ * @return the number of files
+ */
+long bundleSize(void) {
+	return bundleEntries;
+}
@@ -0,0 +1,99 @@
+/*
+ * content_bundle.h
+ *
+ * Format of a content bundle, a single file that holds a read-only
+ * copy of the content base, and functions that serve from it.
+ *
+ * The bundle is written by the offline packer (tools/pack_bundle.c)
+ * and mapped into memory by the server, so a lookup is a binary
+ * search of the mapped index and a response is written straight
+ * from the mapping.
+ *
+ * A bundle is a BundleHeader, followed by the file contents and
+ * strings, followed by an index of BundleEntry records sorted by
+ * request path. Offsets are from the start of the bundle and values
+ * are in the byte order of the machine that packed it.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CONTENT_BUNDLE_H_
+#define CONTENT_BUNDLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** bundle file magic number */
+#define BUNDLE_MAGIC "TCHSBNDL"
+
+/** bundle format version */
+#define BUNDLE_VERSION 1
+
+/** Definition of the bundle header */
+typedef struct BundleHeader {
+	char magic[8];              /** BUNDLE_MAGIC */
+	uint32_t version;           /** BUNDLE_VERSION */
+	uint32_t nentries;          /** number of index entries */
+	uint64_t index;             /** offset of the index */
+	uint64_t size;              /** size of the bundle */
+} BundleHeader;
+
+/** Definition of an index entry for one file */
+typedef struct BundleEntry {
+	uint64_t path;              /** offset of the request path */
+	uint64_t etag;              /** offset of the quoted ETag */
+	uint64_t headers;           /** offset of the entity headers for the content */
+	uint64_t gzipHeaders;       /** offset of the entity headers for the gzip content */
+	uint64_t content;           /** offset of the content */
+	uint64_t contentLen;        /** length of the content */
+	uint64_t gzipContent;       /** offset of the gzip content, 0 if none */
+	uint64_t gzipLen;           /** length of the gzip content */
+} BundleEntry;
+
+/**
+ * Map a content bundle to serve requests from.
+ *
+ * @param path the bundle file
+ * @return 0 if successful, -1 with errno set if error
+ */
+int openContentBundle(const char *path);
+
+/**
+ * Determine whether requests are served from a content bundle.
+ * @return true if a bundle is mapped
+ */
+bool contentBundleOpen(void);
+
+/**
+ * Find the entry for a request path. A path that ends with '/'
+ * finds the "index.html" file of the directory.
+ *
+ * @param uri the request path
+ * @return the entry, or NULL if not in the bundle
+ */
+const BundleEntry *bundleLookup(const char *uri);
+
+/**
+ * Return a string of the bundle.
+ *
+ * @param offset the offset of the string
+ * @return the string
+ */
+const char *bundleString(uint64_t offset);
+
+/**
+ * Return bytes of the bundle.
+ *
+ * @param offset the offset of the bytes
+ * @return the bytes
+ */
+const void *bundleBytes(uint64_t offset);
+
+/**
+ * Return the number of files in the bundle.
+ * @return the number of files
+ */
+long bundleSize(void);
+
+#endif /* CONTENT_BUNDLE_H_ */
@@ -0,0 +1,700 @@
+/*
+ * content_root.c
+ *
+ * Functions that access files under the content base through
+ * a directory descriptor opened at startup.
+ *
+ * Paths are resolved with openat2(RESOLVE_BENEATH), so neither
+ * ".." nor a symbolic link can lead outside the content base.
+ * Where openat2 is unavailable, paths are walked one component
+ * at a time with O_NOFOLLOW, which refuses symbolic links.
+ *
+ * Descriptors for the directories that contain requested files
+ * are cached, so a lookup opens only the last path component. While
+ * the content base is watched, a directory moved or removed flushes
+ * them; otherwise a cached descriptor is checked against its path
+ * once it is older than file_cache_ttl_ms, so a directory renamed or
+ * replaced is opened again under its path within that time.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#if defined(__linux__) && defined(SYS_openat2)
+#include <linux/openat2.h>
+#endif
+
+#include "content_root.h"
+#include "http_server.h"
+#include "server_config.h"
+#include "map.h"
+#include "time_util.h"
+#include "file_cache.h"
+
+/** nanoseconds per millisecond */
+#define NS_PER_MS 1000000ULL
+
+/** the content base directory */
+static int rootfd = -1;
+
+/** guards the directory cache; held for reading while a cached descriptor is used */
+static pthread_rwlock_t dir_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/** Definition of a cached directory descriptor */
+typedef struct CachedDir {
+	int fd;         /** the directory descriptor */
+	dev_t dev;      /** device of the directory */
+	ino_t ino;      /** inode of the directory */
+	_Atomic uint64_t validatedAt;  /** monotonic ns its path last named it */
+} CachedDir;
+
+/** cached directory descriptors by path relative to the content base */
+static map_base_t dirCache;
+
+/** number of cached directory descriptors */
+static long ndirs = 0;
+
+/** openat2 is supported by the kernel */
+static atomic_bool haveOpenat2 = true;
+
+/**
+ * Open a path beneath a directory by walking it one component at
+ * a time without following symbolic links.
+ *
+ * @param dirfd the directory
+ * @param path the relative path
+ * @param flags the open flags
+ * @param mode the mode if a file is created
+ * @return the file descriptor, or -1 with errno set if error
+ */
+static int walkBeneath(int dirfd, const char *path, int flags, mode_t mode) {
+	char component[MAXBUF];
+	int curfd = dirfd;
+	while (true) {
+		const char *slash = strchr(path, '/');
+		size_t len = (slash != NULL) ? (size_t)(slash - path) : strlen(path);
+		if (len >= sizeof(component)) {
+			errno = ENAMETOOLONG;
+			break;
+		}
+		memcpy(component, path, len);
+		component[len] = '\0';
+		if (strcmp(component, "..") == 0) {
+			errno = EXDEV;
+			break;
+		}
+		int fd = (slash != NULL)
+			? openat(curfd, component, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+			: openat(curfd, component, flags | O_NOFOLLOW | O_CLOEXEC, mode);
+		if (curfd != dirfd) {
+			int saved = errno;
+			close(curfd);
+			errno = saved;
+		}
+		if (fd < 0 || slash == NULL) {
+			return fd;
+		}
+		curfd = fd;
+		path = slash + 1;
+	}
+	if (curfd != dirfd) {
+		int saved = errno;
+		close(curfd);
+		errno = saved;
+	}
+	return -1;
+}
+
+/**
+ * Open a path beneath a directory.
+ *
+ * @param dirfd the directory
+ * @param path the relative path
+ * @param flags the open flags
+ * @param mode the mode if a file is created
+ * @return the file descriptor, or -1 with errno set if error;
+ *  EXDEV if the path leads outside the directory
+ */
+static int openBeneath(int dirfd, const char *path, int flags, mode_t mode) {
+#if defined(__linux__) && defined(SYS_openat2)
+	if (atomic_load_explicit(&haveOpenat2, memory_order_relaxed)) {
+		struct open_how how;
+		memset(&how, 0, sizeof(how));
+		how.flags = flags | O_CLOEXEC;
+		how.mode = (flags & O_CREAT) ? mode : 0;
+		how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+		int fd = syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+		if (fd >= 0 || errno != ENOSYS) {
+			return fd;
+		}
+		atomic_store_explicit(&haveOpenat2, false, memory_order_relaxed);
+	}
+#endif
+	return walkBeneath(dirfd, path, flags, mode);
+}
+
+/**
+ * Split a request path into the path of its directory relative
+ * to the content base and its last component.
+ *
+ * @param uri the request path
+ * @param dir storage for the directory path, of size MAXBUF
+ * @param leaf returns the last component, in dir
+ * @return 0 if successful, -1 with errno set if too long
+ */
+static int splitUri(const char *uri, char *dir, const char **leaf) {
+	while (*uri == '/') {
+		uri++;
+	}
+	size_t len = strlen(uri);
+	if (len >= MAXBUF-2) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	while (len > 0 && uri[len-1] == '/') {
+		len--;
+	}
+	if (len == 0) {  // the content base itself
+		dir[0] = '\0';
+		*leaf = ".";
+		return 0;
+	}
+	// leave room to terminate the directory path separately
+	char *path = dir + 1;
+	memcpy(path, uri, len);
+	path[len] = '\0';
+	char *slash = strrchr(path, '/');
+	if (slash == NULL) {
+		dir[0] = '\0';
+		*leaf = path;
+	} else {
+		*slash = '\0';
+		*leaf = slash + 1;
+		memmove(dir, path, slash - path + 1);
+	}
+	return 0;
+}
+
+/**
+ * Close all cached directory descriptors. Caller holds
+ * dir_lock for writing.
+ */
+static void closeCachedDirs(void) {
+	map_iter_t iter = map_iter_();
+	const char *key;
+	while ((key = map_next_(&dirCache, &iter)) != NULL) {
+		close(((CachedDir *)map_get_(&dirCache, key))->fd);
+	}
+	map_deinit_(&dirCache);
+	memset(&dirCache, 0, sizeof(dirCache));
+	ndirs = 0;
+}
+
+/**
+ * Close all cached directory descriptors.
+ */
+static void flushDirCache(void) {
+	pthread_rwlock_wrlock(&dir_lock);
+	closeCachedDirs();
+	pthread_rwlock_unlock(&dir_lock);
+}
+
+/**
+ * Determine whether a cached directory can be used under its path.
+ * While the content base is watched it is current until the cache is
+ * flushed; otherwise its path is checked to still name it once the
+ * entry is older than file_cache_ttl_ms.
+ *
+ * @param dir the directory path relative to the content base
+ * @param cached the cached directory
+ * @return true if the directory can be used
+ */
+static bool dirCurrent(const char *dir, CachedDir *cached) {
+	if (fileCacheCoherent()) {
+		return true;
+	}
+	uint64_t now = monotonicTimeNanos();
+	uint64_t validatedAt = atomic_load_explicit(&cached->validatedAt, memory_order_relaxed);
+	if (now - validatedAt < serverConfig()->fileCacheTtlMs * NS_PER_MS) {
+		return true;
+	}
+	struct stat sb;
+	if (fstatat(rootfd, dir, &sb, 0) != 0 || sb.st_dev != cached->dev || sb.st_ino != cached->ino) {
+		return false;
+	}
+	atomic_store_explicit(&cached->validatedAt, now, memory_order_relaxed);
+	return true;
+}
+
+/**
+ * Drop a cached directory descriptor that is no longer current,
+ * unless another thread has replaced it. Caller holds dir_lock for
+ * writing.
+ *
+ * @param dir the directory path relative to the content base
+ * @param fd the stale descriptor
+ */
+static void dropCachedDir(const char *dir, int fd) {
+	CachedDir *cached = (CachedDir *)map_get_(&dirCache, dir);
+	if (cached != NULL && cached->fd == fd) {
+		close(fd);
+		map_remove_(&dirCache, dir);
+		ndirs--;
+	}
+}
+
+/**
+ * Get the descriptor of a directory under the content base,
+ * opening and caching it if needed. Returns with dir_lock held
+ * for reading, unless there is an error; release it with unlockDir.
+ *
+ * @param dir the directory path relative to the content base
+ * @return the directory descriptor, or -1 with errno set if error
+ */
+static int lockDir(const char *dir) {
+	// a descriptor cached by this call is not checked again
+	bool opened = false;
+	while (true) {
+		pthread_rwlock_rdlock(&dir_lock);
+		if (*dir == '\0') {
+			return rootfd;
+		}
+		CachedDir *cached = (CachedDir *)map_get_(&dirCache, dir);
+		if (cached != NULL && (opened || dirCurrent(dir, cached))) {
+			return cached->fd;
+		}
+		int staleFd = (cached != NULL) ? cached->fd : -1;
+		pthread_rwlock_unlock(&dir_lock);
+
+		CachedDir entry;
+		struct stat sb;
+		entry.fd = openBeneath(rootfd, dir, O_PATH | O_DIRECTORY, 0);
+		if (entry.fd >= 0 && fstat(entry.fd, &sb) != 0) {
+			close(entry.fd);
+			entry.fd = -1;
+		}
+		if (entry.fd < 0) {
+			int saved = errno;
+			if (staleFd >= 0) {
+				pthread_rwlock_wrlock(&dir_lock);
+				dropCachedDir(dir, staleFd);
+				pthread_rwlock_unlock(&dir_lock);
+			}
+			errno = saved;
+			return -1;
+		}
+		entry.dev = sb.st_dev;
+		entry.ino = sb.st_ino;
+		atomic_init(&entry.validatedAt, monotonicTimeNanos());
+		pthread_rwlock_wrlock(&dir_lock);
+		if (staleFd >= 0) {
+			dropCachedDir(dir, staleFd);
+		}
+		if (map_get_(&dirCache, dir) != NULL) {
+			close(entry.fd);  // cached by another thread
+		} else {
+			if (ndirs >= serverConfig()->dirCacheMaxEntries) {
+				closeCachedDirs();
+			}
+			if (map_set_(&dirCache, dir, (char *)&entry, sizeof(entry)) != 0) {
+				pthread_rwlock_unlock(&dir_lock);
+				close(entry.fd);
+				errno = ENOMEM;
+				return -1;
+			}
+			ndirs++;
+		}
+		pthread_rwlock_unlock(&dir_lock);
+		// look it up again under the read lock
+		opened = true;
+	}
+}
+
+/**
+ * Release the directory cache lock taken by lockDir.
+ */
+static void unlockDir(void) {
+	pthread_rwlock_unlock(&dir_lock);
+}
+
+/**
+ * Determine whether a cached directory has been removed, so a
+ * directory created since with the same name is not seen.
+ *
+ * @param dirfd the directory descriptor
+ * @return true if removed
+ */
+static bool dirRemoved(int dirfd) {
+	struct stat sb;
+	return dirfd != rootfd && fstat(dirfd, &sb) == 0 && sb.st_nlink == 0;
+}
+
+/**
+ * Open the content base directory that request paths resolve under.
+ *
+ * @param base the content base directory
+ * @return 0 if successful, -1 with errno set if error
+ */
+int openContentRoot(const char *base) {
+	rootfd = open(base, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	return (rootfd < 0) ? -1 : 0;
+}
+
+/**
+ * Open a file under the content base.
+ *
+ * @param uri the request path
+ * @param flags the open flags
+ * @param mode the mode if a file is created
+ * @return the file descriptor, or -1 with errno set if error
+ */
+int contentOpen(const char *uri, int flags, mode_t mode) {
+	char dir[MAXBUF];
+	const char *leaf;
+	if (splitUri(uri, dir, &leaf) != 0) {
+		return -1;
+	}
+	for (int attempt = 0; ; attempt++) {
+		int dirfd = lockDir(dir);
+		if (dirfd < 0) {
+			return -1;
+		}
+		int fd = openBeneath(dirfd, leaf, flags, mode);
+		int saved = errno;
+		bool stale = fd < 0 && saved == ENOENT && attempt == 0 && dirRemoved(dirfd);
+		unlockDir();
+		if (stale) {
+			flushDirCache();
+			continue;
+		}
+		if (fd < 0 && saved == EXDEV && *dir != '\0') {
+			// a link out of its directory may still be beneath the base
+			char path[MAXBUF];
+			if (snprintf(path, sizeof(path), "%s/%s", dir, leaf) >= (int)sizeof(path)) {
+				errno = ENAMETOOLONG;
+				return -1;
+			}
+			return openBeneath(rootfd, path, flags, mode);
+		}
+		errno = saved;
+		return fd;
+	}
+}
+
+/**
+ * Get the status of a file under the content base.
+ *
+ * @param uri the request path
+ * @param sb the stat struct
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentStat(const char *uri, struct stat *sb) {
+	char dir[MAXBUF];
+	const char *leaf;
+	if (splitUri(uri, dir, &leaf) != 0) {
+		return -1;
+	}
+	int dirfd = lockDir(dir);
+	if (dirfd < 0) {
+		return -1;
+	}
+	int status = fstatat(dirfd, leaf, sb, AT_SYMLINK_NOFOLLOW);
+	int saved = errno;
+	bool stale = status != 0 && saved == ENOENT && dirRemoved(dirfd);
+	unlockDir();
+	if (status == 0 && !S_ISLNK(sb->st_mode)) {
+		return 0;
+	}
+	if (status != 0 && !stale) {
+		errno = saved;
+		return -1;
+	}
+
+	// a symbolic link, or a cached directory that was removed:
+	// resolve the path beneath the base
+	int fd = contentOpen(uri, O_PATH, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	status = fstat(fd, sb);
+	close(fd);
+	return status;
+}
+
+/**
+ * Open a directory under the content base for reading.
+ *
+ * @param uri the request path
+ * @return the directory stream, or NULL with errno set if error
+ */
+DIR *contentOpenDir(const char *uri) {
+	int fd = contentOpen(uri, O_RDONLY | O_DIRECTORY, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	DIR *dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+	}
+	return dir;
+}
+
+/**
+ * Remove a file or an empty directory under the content base.
+ *
+ * @param uri the request path
+ * @param isDir true to remove a directory
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentRemove(const char *uri, bool isDir) {
+	char dir[MAXBUF];
+	const char *leaf;
+	if (splitUri(uri, dir, &leaf) != 0) {
+		return -1;
+	}
+	if (strcmp(leaf, ".") == 0) {
+		errno = EBUSY;  // never the content base
+		return -1;
+	}
+	int dirfd = lockDir(dir);
+	if (dirfd < 0) {
+		return -1;
+	}
+	int status = unlinkat(dirfd, leaf, isDir ? AT_REMOVEDIR : 0);
+	int saved = errno;
+	unlockDir();
+	if (status == 0 && isDir) {
+		flushDirCache();  // the directory may be cached
+	}
+	errno = saved;
+	return status;
+}
+
+/**
+ * Make the directories that contain a path under the content base.
+ *
+ * @param uri the request path
+ * @param mode mode if a directory is created
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentMkdirs(const char *uri, mode_t mode) {
+	char dir[MAXBUF];
+	const char *leaf;
+	if (splitUri(uri, dir, &leaf) != 0) {
+		return -1;
+	}
+	if (*dir == '\0') {
+		return 0;
+	}
+	if (lockDir(dir) >= 0) {  // already exists
+		unlockDir();
+		return 0;
+	}
+
+	// create each missing component without following links
+	int curfd = rootfd;
+	for (char *component = dir; component != NULL; ) {
+		char *slash = strchr(component, '/');
+		if (slash != NULL) {
+			*slash = '\0';
+		}
+		int fd = -1;
+		if (mkdirat(curfd, component, mode) == 0 || errno == EEXIST) {
+			fd = openat(curfd, component, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		}
+		int saved = errno;
+		if (curfd != rootfd) {
+			close(curfd);
+		}
+		errno = saved;
+		if (fd < 0) {
+			return -1;
+		}
+		curfd = fd;
+		component = (slash != NULL) ? slash + 1 : NULL;
+	}
+	close(curfd);
+	return 0;
+}
+
+/**
+ * Create a new file with a unique name beside a path under the
+ * content base, for content that is renamed over the path once
+ * it is complete.
+ *
+ * @param uri the request path
+ * @param tmpUri storage for the request path of the new file
+ * @param size the size of the storage
+ * @return the file descriptor opened for writing, or -1 with errno set if error
+ */
+int contentCreateTemp(const char *uri, char *tmpUri, size_t size) {
+	static atomic_uint counter = 0;
+	for (int attempt = 0; attempt < 100; attempt++) {
+		unsigned suffix = (atomic_fetch_add(&counter, 1) * 2654435761u) ^ (unsigned)monotonicTimeNanos();
+		int len = snprintf(tmpUri, size, "%s.%06x", uri, suffix & 0xffffff);
+		if (len < 0 || (size_t)len >= size) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		int fd = contentOpen(tmpUri, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd >= 0 || errno != EEXIST) {
+			return fd;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Rename a file under the content base.
+ *
+ * @param fromUri the request path of the file
+ * @param toUri the new request path
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentRename(const char *fromUri, const char *toUri) {
+	char fromDir[MAXBUF], toDir[MAXBUF];
+	const char *fromLeaf, *toLeaf;
+	if (splitUri(fromUri, fromDir, &fromLeaf) != 0 || splitUri(toUri, toDir, &toLeaf) != 0) {
+		return -1;
+	}
+	if (strcmp(fromDir, toDir) == 0) {
+		int dirfd = lockDir(fromDir);
+		if (dirfd < 0) {
+			return -1;
+		}
+		int status = renameat(dirfd, fromLeaf, dirfd, toLeaf);
+		int saved = errno;
+		unlockDir();
+		errno = saved;
+		return status;
+	}
+
+	// different directories: open both without the cache
+	int fromfd = (*fromDir == '\0') ? rootfd : openBeneath(rootfd, fromDir, O_PATH | O_DIRECTORY, 0);
+	int tofd = (*toDir == '\0') ? rootfd : openBeneath(rootfd, toDir, O_PATH | O_DIRECTORY, 0);
+	int status = (fromfd < 0 || tofd < 0) ? -1 : renameat(fromfd, fromLeaf, tofd, toLeaf);
+	int saved = errno;
+	if (fromfd >= 0 && fromfd != rootfd) {
+		close(fromfd);
+	}
+	if (tofd >= 0 && tofd != rootfd) {
+		close(tofd);
+	}
+	errno = saved;
+	return status;
+}
+
+/**
+ * Link a file outside the content base to a path under it,
+ * atomically replacing any file at the path.
+ *
+ * @param fromDirFd descriptor of the directory of the file
+ * @param fromName name of the file in the directory
+ * @param uri the request path
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentLinkFrom(int fromDirFd, const char *fromName, const char *uri) {
+	char dir[MAXBUF];
+	const char *leaf;
+	if (splitUri(uri, dir, &leaf) != 0) {
+		return -1;
+	}
+	int dirfd = lockDir(dir);
+	if (dirfd < 0) {
+		return -1;
+	}
+	// the path may already link the file, and rename does nothing
+	// between two links to one file
+	struct stat fromSb, sb;
+	if (fstatat(fromDirFd, fromName, &fromSb, AT_SYMLINK_NOFOLLOW) != 0) {
+		int saved = errno;
+		unlockDir();
+		errno = saved;
+		return -1;
+	}
+	if (fstatat(dirfd, leaf, &sb, AT_SYMLINK_NOFOLLOW) == 0
+			&& sb.st_dev == fromSb.st_dev && sb.st_ino == fromSb.st_ino) {
+		unlockDir();
+		return 0;
+	}
+	// link under a unique name, then rename it over the path
+	static atomic_uint counter = 0;
+	char tmpLeaf[MAXBUF+8];
+	int status = -1;
+	for (int attempt = 0; attempt < 100 && status != 0; attempt++) {
+		unsigned suffix = (atomic_fetch_add(&counter, 1) * 2654435761u) ^ (unsigned)monotonicTimeNanos();
+		snprintf(tmpLeaf, sizeof(tmpLeaf), "%s.%06x", leaf, suffix & 0xffffff);
+		status = linkat(fromDirFd, fromName, dirfd, tmpLeaf, 0);
+		if (status != 0 && errno != EEXIST) {
+			break;
+		}
+	}
+	if (status == 0 && (status = renameat(dirfd, tmpLeaf, dirfd, leaf)) != 0) {
+		int saved = errno;
+		unlinkat(dirfd, tmpLeaf, 0);
+		errno = saved;
+	} else if (status == 0 && fstatat(dirfd, tmpLeaf, &sb, AT_SYMLINK_NOFOLLOW) == 0
+			&& sb.st_dev == fromSb.st_dev && sb.st_ino == fromSb.st_ino) {
+		// the path was linked to the file meanwhile, so the rename did nothing
+		unlinkat(dirfd, tmpLeaf, 0);
+	}
+	int saved = errno;
+	unlockDir();
+	errno = saved;
+	return status;
+}
+
+/**
+ * Link a file under the content base to a name outside it.
+ *
+ * @param uri the request path of the file
+ * @param toDirFd descriptor of the directory of the new link
+ * @param toName name of the new link in the directory
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentLinkTo(const char *uri, int toDirFd, const char *toName) {
+	char dir[MAXBUF];
+	const char *leaf;
+	if (splitUri(uri, dir, &leaf) != 0) {
+		return -1;
+	}
+	int dirfd = lockDir(dir);
+	if (dirfd < 0) {
+		return -1;
+	}
+	int status = linkat(dirfd, leaf, toDirFd, toName, 0);
+	int saved = errno;
+	unlockDir();
+	errno = saved;
+	return status;
+}
+
+/**
+ * Return the number of cached directory descriptors.
+ * @return the number of descriptors
+ */
+long contentDirCacheSize(void) {
+	pthread_rwlock_rdlock(&dir_lock);
+	long size = ndirs;
+	pthread_rwlock_unlock(&dir_lock);
+	return size;
+}
+
+/**
+ * Close the cached directory descriptors, so directories that
+ * have been moved or replaced are opened again by path.
+ */
+void contentFlushDirCache(void) {
+	flushDirCache();
+}
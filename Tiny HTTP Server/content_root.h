@@ -0,0 +1,130 @@
+/*
+ * content_root.h
+ *
+ * Functions that access files under the content base through
+ * a directory descriptor opened at startup. Request paths are
+ * resolved relative to it and can never reach outside it,
+ * whether by ".." or by symbolic links.
+ *
+ * Request paths are normalized URI paths that begin with '/'.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CONTENT_ROOT_H_
+#define CONTENT_ROOT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * Open the content base directory that request paths resolve under.
+ *
+ * @param base the content base directory
+ * @return 0 if successful, -1 with errno set if error
+ */
+int openContentRoot(const char *base);
+
+/**
+ * Open a file under the content base.
+ *
+ * @param uri the request path
+ * @param flags the open flags
+ * @param mode the mode if a file is created
+ * @return the file descriptor, or -1 with errno set if error
+ */
+int contentOpen(const char *uri, int flags, mode_t mode);
+
+/**
+ * Get the status of a file under the content base.
+ *
+ * @param uri the request path
+ * @param sb the stat struct
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentStat(const char *uri, struct stat *sb);
+
+/**
+ * Open a directory under the content base for reading.
+ *
+ * @param uri the request path
+ * @return the directory stream, or NULL with errno set if error
+ */
+DIR *contentOpenDir(const char *uri);
+
+/**
+ * Remove a file or an empty directory under the content base.
+ *
+ * @param uri the request path
+ * @param isDir true to remove a directory
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentRemove(const char *uri, bool isDir);
+
+/**
+ * Make the directories that contain a path under the content base.
+ *
+ * @param uri the request path
+ * @param mode mode if a directory is created
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentMkdirs(const char *uri, mode_t mode);
+
+/**
+ * Create a new file with a unique name beside a path under the
+ * content base, for content that is renamed over the path once
+ * it is complete.
+ *
+ * @param uri the request path
+ * @param tmpUri storage for the request path of the new file
+ * @param size the size of the storage
+ * @return the file descriptor opened for writing, or -1 with errno set if error
+ */
+int contentCreateTemp(const char *uri, char *tmpUri, size_t size);
+
+/**
+ * Rename a file under the content base.
+ *
+ * @param fromUri the request path of the file
+ * @param toUri the new request path
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentRename(const char *fromUri, const char *toUri);
+
+/**
+ * Link a file outside the content base to a path under it,
+ * atomically replacing any file at the path.
+ *
+ * @param fromDirFd descriptor of the directory of the file
+ * @param fromName name of the file in the directory
+ * @param uri the request path
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentLinkFrom(int fromDirFd, const char *fromName, const char *uri);
+
+/**
+ * Link a file under the content base to a name outside it.
+ *
+ * @param uri the request path of the file
+ * @param toDirFd descriptor of the directory of the new link
+ * @param toName name of the new link in the directory
+ * @return 0 if successful, -1 with errno set if error
+ */
+int contentLinkTo(const char *uri, int toDirFd, const char *toName);
+
+/**
+ * Return the number of cached directory descriptors.
+ * @return the number of descriptors
+ */
+long contentDirCacheSize(void);
+
+/**
+ * Close the cached directory descriptors, so directories that
+ * have been moved or replaced are opened again by path.
+ */
+void contentFlushDirCache(void);
+
+#endif /* CONTENT_ROOT_H_ */
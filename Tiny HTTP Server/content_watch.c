@@ -0,0 +1,327 @@
+/*
+ * content_watch.c
+ *
+ * Functions that watch the content base for changes made outside
+ * the server.
+ *
+ * Watches are added through /proc/self/fd of a directory opened
+ * beneath the content root, so a watch never follows a link out of
+ * the content base. Each watch descriptor maps to the request path
+ * of its directory; a directory moved within the content base is
+ * unwatched under its old path and watched again under the new one.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include "content_watch.h"
+#include "content_root.h"
+#include "file_cache.h"
+#include "http_server.h"
+#include "server_config.h"
+#include "server_stats.h"
+
+#if defined(__linux__)
+
+/** changes that make a cached file or directory stale */
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO \
+		| IN_CREATE | IN_DELETE | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/** bytes of events read at a time */
+#define WATCH_BUFFER_BYTES 65536
+
+/** the inotify instance */
+static int inotifyFd = -1;
+
+/** request paths of the watched directories by watch descriptor */
+static char **watchDirs = NULL;
+
+/** number of slots in watchDirs */
+static int nwatchSlots = 0;
+
+/** number of watched directories */
+static atomic_long nwatches = 0;
+
+/** a directory could not be watched, so changes beneath it are missed */
+static bool overLimit = false;
+
+/**
+ * Note that a directory could not be watched, so cached files
+ * must be revalidated after the TTL again.
+ *
+ * @param path the request path of the directory
+ */
+static void watchIncomplete(const char *path) {
+	if (!overLimit) {
+		fprintf(stderr, "Cannot watch %s; cached files revalidated after file_cache_ttl_ms\n",
+				(*path == '\0') ? "/" : path);
+	}
+	overLimit = true;
+	fileCacheSetCoherent(false);
+}
+
+/**
+ * Watch a directory.
+ *
+ * @param dirfd the directory
+ * @param path the request path of the directory
+ * @return 0 if successful, -1 if it cannot be watched
+ */
+static int addWatch(int dirfd, const char *path) {
+	if (atomic_load(&nwatches) >= serverConfig()->contentWatchMaxDirs) {
+		watchIncomplete(path);
+		return -1;
+	}
+	char procPath[64];
+	snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", dirfd);
+	int wd = inotify_add_watch(inotifyFd, procPath, WATCH_MASK);
+	if (wd < 0) {
+		watchIncomplete(path);
+		return -1;
+	}
+	if (wd >= nwatchSlots) {
+		int slots = (wd + 1 > 2 * nwatchSlots) ? wd + 1 : 2 * nwatchSlots;
+		char **dirs = realloc(watchDirs, slots * sizeof(char *));
+		if (dirs == NULL) {
+			inotify_rm_watch(inotifyFd, wd);
+			watchIncomplete(path);
+			return -1;
+		}
+		memset(dirs + nwatchSlots, 0, (slots - nwatchSlots) * sizeof(char *));
+		watchDirs = dirs;
+		nwatchSlots = slots;
+	}
+	// the same directory may already be watched under another path
+	if (watchDirs[wd] == NULL) {
+		atomic_fetch_add(&nwatches, 1);
+	}
+	free(watchDirs[wd]);
+	watchDirs[wd] = strdup(path);
+	return 0;
+}
+
+/**
+ * Watch a directory and its subdirectories. The directory is
+ * watched before it is listed, so no subdirectory created in
+ * between is missed.
+ *
+ * @param dirfd the directory; it is closed
+ * @param path the request path of the directory, of size MAXBUF
+ * @param pathLen the length of the path
+ * @param depth the level of the directory
+ */
+static void watchTree(int dirfd, char *path, size_t pathLen, int depth) {
+	DIR *dir = (addWatch(dirfd, path) == 0) ? fdopendir(dirfd) : NULL;
+	if (dir == NULL) {
+		close(dirfd);
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		// relative to the directory; links are not followed
+		struct stat sb;
+		if (fstatat(dirfd, entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(sb.st_mode)) {
+			continue;
+		}
+		int n = snprintf(path + pathLen, MAXBUF - pathLen, "/%s", entry->d_name);
+		if (n < 0 || (size_t)n >= MAXBUF - pathLen) {
+			continue;  // too long to request
+		}
+		if (depth < CONTENT_WATCH_MAX_DEPTH) {
+			int subfd = openat(dirfd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+			if (subfd >= 0) {
+				watchTree(subfd, path, pathLen + n, depth + 1);
+			}
+		}
+	}
+	path[pathLen] = '\0';
+	closedir(dir);
+}
+
+/**
+ * Stop watching a directory and its subdirectories. Their watch
+ * descriptors are forgotten when the IN_IGNORED events arrive.
+ *
+ * @param dir the request path of the directory
+ */
+static void unwatchTree(const char *dir) {
+	size_t len = strlen(dir);
+	for (int wd = 0; wd < nwatchSlots; wd++) {
+		const char *path = watchDirs[wd];
+		if (path != NULL && strncmp(path, dir, len) == 0 && (path[len] == '\0' || path[len] == '/')) {
+			inotify_rm_watch(inotifyFd, wd);
+		}
+	}
+}
+
+/**
+ * Drop the cache entries made stale by a change.
+ *
+ * @param event the inotify event
+ */
+static void handleEvent(const struct inotify_event *event) {
+	if (event->mask & IN_Q_OVERFLOW) {
+		// changes were missed, so nothing cached can be trusted
+		statsIncrement(contentWatchOverflows);
+		fileCacheInvalidateTree("");
+		contentFlushDirCache();
+		return;
+	}
+	if (event->wd < 0 || event->wd >= nwatchSlots || watchDirs[event->wd] == NULL) {
+		return;
+	}
+	if (event->mask & IN_IGNORED) {
+		free(watchDirs[event->wd]);
+		watchDirs[event->wd] = NULL;
+		atomic_fetch_sub(&nwatches, 1);
+		return;
+	}
+	if (event->len == 0) {
+		return;  // the directory itself; its parent reports the change
+	}
+	char path[MAXBUF];
+	int len = snprintf(path, sizeof(path), "%s/%s", watchDirs[event->wd], event->name);
+	if (len < 0 || (size_t)len >= sizeof(path)) {
+		return;  // too long to request
+	}
+
+	if (event->mask & IN_ISDIR) {
+		if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+			unwatchTree(path);
+			contentFlushDirCache();
+		} else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+			int depth = 0;
+			for (const char *p = path; *p != '\0'; p++) {
+				depth += (*p == '/');
+			}
+			int fd = contentOpen(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+			if (fd >= 0) {
+				watchTree(fd, path, len, depth);
+			}
+		}
+		// files beneath may have been cached before it was watched
+		statsAdd(contentWatchInvalidations, fileCacheInvalidateTree(path));
+		return;
+	}
+	if (fileCacheInvalidate(path)) {
+		statsIncrement(contentWatchInvalidations);
+		// a file written or renamed into place is cached again for the next request
+		if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+			FileCacheEntry *entry = fileCacheOpen(path);
+			if (entry != NULL) {
+				fileCacheRelease(entry);
+			}
+		}
+	}
+}
+
+/**
+ * The watch thread drops changed files from the caches.
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void *watchContent(void *arg) {
+	(void)arg;
+	char buf[WATCH_BUFFER_BYTES] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (true) {
+		ssize_t len = read(inotifyFd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+		if (len <= 0) {
+			perror("watchContent");
+			fileCacheSetCoherent(false);
+			return NULL;
+		}
+		const ServerConfig *config = acquireConfig();
+		setThreadConfig(config);
+		const struct inotify_event *event;
+		for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *)p;
+			handleEvent(event);
+		}
+		setThreadConfig(NULL);
+		releaseConfig(config);
+	}
+	return NULL;
+}
+
+/**
+ * Gauge for the number of watched directories.
+ * @return the number of directories
+ */
+static long content_watch_dirs(void) {
+	return atomic_load(&nwatches);
+}
+
+/**
+ * Watch the directories beneath the content base and start the
+ * thread that drops changed files from the caches. Call after the
+ * content root is open and before the file cache is warmed.
+ *
+ * @return 0 if successful, -1 with errno set if the content base
+ *  cannot be watched
+ */
+int startContentWatch(void) {
+	inotifyFd = inotify_init1(IN_CLOEXEC);
+	if (inotifyFd < 0) {
+		return -1;
+	}
+	int fd = contentOpen("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	char path[MAXBUF] = "";
+	watchTree(fd, path, 0, 0);
+	if (atomic_load(&nwatches) == 0) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, watchContent, NULL) != 0) {
+		return -1;
+	}
+	pthread_detach(thread);
+	registerStatsGauge("content_watch_dirs", content_watch_dirs);
+	fileCacheSetCoherent(!overLimit);
+	fprintf(stderr, "Watching %ld content directories\n", atomic_load(&nwatches));
+	return 0;
+}
+
+#else  // inotify is Linux only
+
+/**
+ * Watch the directories beneath the content base and start the
+ * thread that drops changed files from the caches. Call after the
+ * content root is open and before the file cache is warmed.
+ *
+ * @return 0 if successful, -1 with errno set if the content base
+ *  cannot be watched
+ */
+int startContentWatch(void) {
+	errno = ENOTSUP;
+	return -1;
+}
+
+#endif
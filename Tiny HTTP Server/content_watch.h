@@ -0,0 +1,40 @@
+/*
+ * content_watch.h
+ *
+ * Functions that watch the content base for changes made outside
+ * the server, so cached files are trusted until they change instead
+ * of being revalidated every file_cache_ttl_ms.
+ *
+ * Every directory beneath the content base is watched with inotify
+ * by a thread that drops the cache entry of a file as it changes,
+ * and opens it again once it has been written or renamed into place.
+ * A directory that is moved or removed drops the entries beneath it
+ * and the cached directory descriptors. If the event queue overflows
+ * both caches are flushed, since changes may have been missed.
+ *
+ * If a directory cannot be watched, because there are more than
+ * content_watch_max_dirs or the kernel limit on watches is reached,
+ * the watcher keeps dropping changed files but cached files are
+ * revalidated after the TTL again. A file changed only through a
+ * hard link outside the content base is not reported.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CONTENT_WATCH_H_
+#define CONTENT_WATCH_H_
+
+/** deepest directory level watched */
+#define CONTENT_WATCH_MAX_DEPTH 32
+
+/**
+ * Watch the directories beneath the content base and start the
+ * thread that drops changed files from the caches. Call after the
+ * content root is open and before the file cache is warmed.
+ *
+ * @return 0 if successful, -1 with errno set if the content base
+ *  cannot be watched
+ */
+int startContentWatch(void);
+
+#endif /* CONTENT_WATCH_H_ */
@@ -0,0 +1,605 @@
+/*
+ * coroutine.c
+ *
+ * Functions that serve connections on stackful coroutines.
+ *
+ * Each scheduler thread owns an epoll set and an eventfd. A coroutine
+ * that waits for its socket adds it to the set for one event and
+ * switches back to the scheduler with swapcontext; the scheduler
+ * resumes it when the event arrives. Coroutines started by the
+ * monitor, or woken by a disk-I/O thread, are posted to a ready
+ * queue and the eventfd is written to wake the scheduler.
+ *
+ * A coroutine always resumes on the thread that started it, and the
+ * configuration snapshot set for it follows it across switches.
+ *
+ * Stacks are mapped with a PROT_NONE guard page below them, so an
+ * overflow faults instead of corrupting a neighbour, and are kept in
+ * a pool for the next coroutine instead of being unmapped.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "coroutine.h"
+#include "disk_io.h"
+
+#if defined(__linux__) && defined(__GLIBC__)
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "http_server.h"
+#include "server_config.h"
+#include "server_stats.h"
+
+/** maximum events per epoll wait */
+#define MAX_EVENTS 64
+
+/** most unused stacks kept for reuse */
+#define STACK_POOL_MAX 1024
+
+/** Definition of a coroutine */
+typedef struct Coroutine {
+	ucontext_t context;                 /** saved registers and stack */
+	void *stack;                        /** the stack, above its guard page */
+	void (*function)(void *arg);        /** the function run */
+	void *arg;                          /** the function argument */
+	struct Scheduler *sched;            /** the scheduler that runs it */
+	const ServerConfig *config;         /** thread configuration while suspended */
+	bool done;                          /** the function returned */
+	struct Coroutine *next;             /** next in the ready queue */
+} Coroutine;
+
+/** Definition of a scheduler thread */
+typedef struct Scheduler {
+	pthread_t thread;                   /** the thread */
+	int epoll_fd;                       /** sockets that coroutines wait for */
+	int event_fd;                       /** written when the ready queue is posted */
+	ucontext_t context;                 /** where a coroutine switches back to */
+	pthread_mutex_t lock;               /** guards the ready queue */
+	Coroutine *readyHead;               /** first coroutine to resume */
+	Coroutine *readyTail;               /** last coroutine to resume */
+} Scheduler;
+
+/** Definition of work awaited by a coroutine */
+typedef struct AwaitedWork {
+	void (*function)(void *arg);        /** the function run */
+	void *arg;                          /** the function argument */
+	Coroutine *co;                      /** the waiting coroutine */
+	const ServerConfig *config;         /** configuration of the coroutine */
+} AwaitedWork;
+
+/** the scheduler threads */
+static Scheduler *schedulers = NULL;
+
+/** number of scheduler threads */
+static int nschedulers = 0;
+
+/** scheduler for the next coroutine */
+static atomic_uint nextScheduler = 0;
+
+/** coroutines alive */
+static atomic_long nalive = 0;
+
+/** usable bytes of each stack */
+static size_t stackBytes = 0;
+
+/** bytes of the guard page */
+static size_t guardBytes = 0;
+
+/** unused stacks, linked through their lowest word */
+static void *stackPool = NULL;
+
+/** number of unused stacks */
+static long npooled = 0;
+
+/** guards the stack pool */
+static pthread_mutex_t stackLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** the coroutine running on this thread */
+static __thread Coroutine *current = NULL;
+
+/**
+ * Take a stack from the pool, or map a new one with a guard page.
+ * @return the stack, or NULL if it cannot be mapped
+ */
+static void *takeStack(void) {
+	pthread_mutex_lock(&stackLock);
+	void *stack = stackPool;
+	if (stack != NULL) {
+		stackPool = *(void **)stack;
+		npooled--;
+	}
+	pthread_mutex_unlock(&stackLock);
+	if (stack != NULL) {
+		return stack;
+	}
+
+	char *base = mmap(NULL, guardBytes + stackBytes, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	// stacks grow down, so the guard is the lowest page
+	if (mprotect(base, guardBytes, PROT_NONE) != 0) {
+		munmap(base, guardBytes + stackBytes);
+		return NULL;
+	}
+	return base + guardBytes;
+}
+
+/**
+ * Return a stack to the pool, or unmap it if the pool is full.
+ * @param stack the stack
+ */
+static void releaseStack(void *stack) {
+	pthread_mutex_lock(&stackLock);
+	bool pooled = npooled < STACK_POOL_MAX;
+	if (pooled) {
+		*(void **)stack = stackPool;
+		stackPool = stack;
+		npooled++;
+	}
+	pthread_mutex_unlock(&stackLock);
+	if (!pooled) {
+		munmap((char *)stack - guardBytes, guardBytes + stackBytes);
+	}
+}
+
+/**
+ * Post a coroutine to the ready queue of its scheduler.
+ * @param co the coroutine
+ */
+static void postCoroutine(Coroutine *co) {
+	Scheduler *sched = co->sched;
+	co->next = NULL;
+	pthread_mutex_lock(&sched->lock);
+	if (sched->readyTail == NULL) {
+		sched->readyHead = co;
+	} else {
+		sched->readyTail->next = co;
+	}
+	sched->readyTail = co;
+	pthread_mutex_unlock(&sched->lock);
+
+	uint64_t one = 1;
+	while (write(sched->event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+	}
+}
+
+/**
+ * Switch from the running coroutine back to its scheduler.
+ * Returns when the coroutine is resumed.
+ */
+static void suspend(void) {
+	Coroutine *co = current;
+	co->config = getThreadConfig();
+	statsIncrement(coroutineWaits);
+	swapcontext(&co->context, &co->sched->context);
+}
+
+/**
+ * Entry point of a coroutine. When it returns, the context
+ * switches to the scheduler through uc_link.
+ */
+static void coroutineMain(void) {
+	Coroutine *co = current;
+	co->function(co->arg);
+	co->done = true;
+}
+
+/**
+ * Resume a coroutine until it waits or returns.
+ *
+ * @param sched the scheduler
+ * @param co the coroutine
+ */
+static void resume(Scheduler *sched, Coroutine *co) {
+	current = co;
+	setThreadConfig(co->config);
+	swapcontext(&sched->context, &co->context);
+	setThreadConfig(NULL);
+	current = NULL;
+	if (co->done) {
+		releaseStack(co->stack);
+		free(co);
+		atomic_fetch_sub(&nalive, 1);
+	}
+}
+
+/**
+ * Run the coroutines of a scheduler: those whose sockets are ready,
+ * then those posted to its ready queue.
+ *
+ * @param arg the scheduler
+ * @return NULL
+ */
+static void *runScheduler(void *arg) {
+	Scheduler *sched = arg;
+	struct epoll_event events[MAX_EVENTS];
+	for (;;) {
+		int nevents = epoll_wait(sched->epoll_fd, events, MAX_EVENTS, -1);
+		if (nevents < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+		for (int i = 0; i < nevents; i++) {
+			Coroutine *co = events[i].data.ptr;
+			if (co == NULL) {
+				uint64_t count;
+				while (read(sched->event_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+				}
+			} else {
+				resume(sched, co);
+			}
+		}
+
+		pthread_mutex_lock(&sched->lock);
+		Coroutine *co = sched->readyHead;
+		sched->readyHead = sched->readyTail = NULL;
+		pthread_mutex_unlock(&sched->lock);
+		while (co != NULL) {
+			Coroutine *next = co->next;
+			resume(sched, co);
+			co = next;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Gauge for the number of coroutines alive.
+ * @return the number of coroutines
+ */
+static long coroutines_alive(void) {
+	return atomic_load(&nalive);
+}
+
+/**
+ * Gauge for the number of stacks kept for reuse.
+ * @return the number of stacks
+ */
+static long coroutine_stacks_pooled(void) {
+	pthread_mutex_lock(&stackLock);
+	long n = npooled;
+	pthread_mutex_unlock(&stackLock);
+	return n;
+}
+
+/**
+ * Start the scheduler threads that run coroutines.
+ *
+ * @return 0 if successful, -1 with errno set if error
+ */
+int startCoroutines(void) {
+	const ServerConfig *config = serverConfig();
+	long pageSize = sysconf(_SC_PAGESIZE);
+	guardBytes = (pageSize > 0) ? (size_t)pageSize : 4096;
+	stackBytes = ((size_t)config->coroutineStackKb * 1024 + guardBytes - 1) / guardBytes * guardBytes;
+
+	schedulers = calloc(config->coroutineThreads, sizeof(Scheduler));
+	if (schedulers == NULL) {
+		return -1;
+	}
+	for (int i = 0; i < config->coroutineThreads; i++) {
+		Scheduler *sched = &schedulers[i];
+		pthread_mutex_init(&sched->lock, NULL);
+		sched->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		sched->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (sched->epoll_fd < 0 || sched->event_fd < 0) {
+			return -1;
+		}
+		// the eventfd is the only entry without a coroutine
+		struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+		if (epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, sched->event_fd, &event) != 0) {
+			return -1;
+		}
+		int status = pthread_create(&sched->thread, NULL, runScheduler, sched);
+		if (status != 0) {
+			errno = status;
+			return -1;
+		}
+		pthread_detach(sched->thread);
+		nschedulers++;
+	}
+	registerStatsGauge("coroutines_alive", coroutines_alive);
+	registerStatsGauge("coroutine_stacks_pooled", coroutine_stacks_pooled);
+	fprintf(stderr, "Serving connections on coroutines with %d threads\n", nschedulers);
+	return 0;
+}
+
+/**
+ * Determine whether connections are served on coroutines.
+ * @return true if the schedulers were started
+ */
+bool coroutinesRunning(void) {
+	return nschedulers > 0;
+}
+
+/**
+ * Determine whether the caller is running on a coroutine.
+ * @return true if the caller can be suspended
+ */
+bool runningCoroutine(void) {
+	return current != NULL;
+}
+
+/**
+ * Start a coroutine on one of the scheduler threads.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 if started, -1 if too many coroutines are alive
+ */
+int spawnCoroutine(void (*function)(void *arg), void *arg) {
+	if (atomic_fetch_add(&nalive, 1) >= serverConfig()->coroutineMax) {
+		atomic_fetch_sub(&nalive, 1);
+		return -1;
+	}
+	Coroutine *co = malloc(sizeof(Coroutine));
+	void *stack = (co != NULL) ? takeStack() : NULL;
+	if (stack == NULL) {
+		free(co);
+		atomic_fetch_sub(&nalive, 1);
+		return -1;
+	}
+	co->stack = stack;
+	co->function = function;
+	co->arg = arg;
+	co->sched = &schedulers[atomic_fetch_add(&nextScheduler, 1) % nschedulers];
+	co->config = NULL;
+	co->done = false;
+
+	getcontext(&co->context);
+	co->context.uc_stack.ss_sp = stack;
+	co->context.uc_stack.ss_size = stackBytes;
+	co->context.uc_link = &co->sched->context;
+	makecontext(&co->context, coroutineMain, 0);
+
+	statsIncrement(coroutinesStarted);
+	postCoroutine(co);
+	return 0;
+}
+
+/**
+ * Wait until a descriptor is ready. A coroutine is suspended until
+ * its scheduler sees the descriptor ready; another thread polls.
+ *
+ * @param fd the descriptor
+ * @param events POLLIN or POLLOUT
+ * @return 0 when ready, -1 with errno set if error
+ */
+int awaitReady(int fd, short events) {
+	Coroutine *co = current;
+	if (co != NULL) {
+		// hang-ups and errors are always reported, so a deadline
+		// that shuts the socket down also resumes the coroutine
+		struct epoll_event event = {
+			.events = EPOLLONESHOT | ((events & POLLIN) ? EPOLLIN | EPOLLRDHUP : 0)
+						| ((events & POLLOUT) ? EPOLLOUT : 0),
+			.data.ptr = co
+		};
+		if (epoll_ctl(co->sched->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0) {
+			suspend();
+			epoll_ctl(co->sched->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			return 0;
+		}
+	}
+	struct pollfd pfd = { .fd = fd, .events = events };
+	while (poll(&pfd, 1, -1) < 0) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Task for a disk-I/O thread that runs awaited work and
+ * resumes the waiting coroutine.
+ * @param arg the work
+ */
+static void awaited_task(void *arg) {
+	AwaitedWork *work = arg;
+	Coroutine *co = work->co;  // the work is gone once it is resumed
+	setThreadConfig(work->config);
+	work->function(work->arg);
+	setThreadConfig(NULL);
+	postCoroutine(co);
+}
+
+/**
+ * Run work on a pool while the calling coroutine is suspended.
+ * Outside a coroutine the work is run directly.
+ *
+ * @param submit queues work for the pool
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 once the work has run, -1 if the queue is full
+ */
+static int awaitWork(int (*submit)(void (*function)(void *arg), void *arg),
+					 void (*function)(void *arg), void *arg) {
+	if (current == NULL) {
+		function(arg);
+		return 0;
+	}
+	// the coroutine cannot be resumed before it switches out,
+	// since its scheduler is the thread running it
+	AwaitedWork work = { function, arg, current, getThreadConfig() };
+	if (submit(awaited_task, &work) != 0) {
+		return -1;
+	}
+	suspend();
+	return 0;
+}
+
+/**
+ * Run work on the disk-I/O pool while the calling coroutine is
+ * suspended. Outside a coroutine the work is run directly.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 once the work has run, -1 if the disk queue is full
+ */
+int awaitDiskWork(void (*function)(void *arg), void *arg) {
+	return awaitWork(submitDiskWork, function, arg);
+}
+
+/**
+ * Run work that waits on other sockets on the network workers
+ * while the calling coroutine is suspended. Outside a coroutine
+ * the work is run directly.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 once the work has run, -1 if the dispatch queue is full
+ */
+int awaitNetworkWork(void (*function)(void *arg), void *arg) {
+	return awaitWork(submitNetworkWork, function, arg);
+}
+
+/**
+ * Read from the socket of a coroutine stream.
+ *
+ * @param cookie the socket
+ * @param buf the buffer
+ * @param size the size of the buffer
+ * @return the number of bytes read, 0 at end of file, -1 if error
+ */
+static ssize_t socketRead(void *cookie, char *buf, size_t size) {
+	int fd = (int)(intptr_t)cookie;
+	for (;;) {
+		ssize_t n = recv(fd, buf, size, 0);
+		if (n >= 0) {
+			return n;
+		} else if (errno == EAGAIN) {
+			if (awaitReady(fd, POLLIN) != 0) {
+				return -1;
+			}
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+/**
+ * Write to the socket of a coroutine stream.
+ *
+ * @param cookie the socket
+ * @param buf the bytes
+ * @param size the number of bytes
+ * @return the number of bytes written, or -1 if error
+ */
+static ssize_t socketWrite(void *cookie, const char *buf, size_t size) {
+	int fd = (int)(intptr_t)cookie;
+	for (;;) {
+		// a client that went away must not raise SIGPIPE
+		ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+		if (n >= 0) {
+			return n;
+		} else if (errno == EAGAIN) {
+			if (awaitReady(fd, POLLOUT) != 0) {
+				return -1;
+			}
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+/**
+ * Close the socket of a coroutine stream.
+ *
+ * @param cookie the socket
+ * @return 0 if successful, -1 if error
+ */
+static int socketClose(void *cookie) {
+	return close((int)(intptr_t)cookie);
+}
+
+/**
+ * Open a stream over a peer socket for a connection served on
+ * coroutines. The socket is made non-blocking, and the stream's
+ * descriptor is the socket, so sendfile and splice still reach it.
+ *
+ * @param sock_fd the socket; it is closed with the stream
+ * @return the stream, or NULL with errno set if error
+ */
+FILE *openCoroutineStream(int sock_fd) {
+	int flags = fcntl(sock_fd, F_GETFL);
+	if (flags < 0 || fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		return NULL;
+	}
+	cookie_io_functions_t io = { socketRead, socketWrite, NULL, socketClose };
+	FILE *stream = fopencookie((void *)(intptr_t)sock_fd, "r+", io);
+	if (stream != NULL) {
+		// a cookie stream has no descriptor; give it the socket
+		stream->_fileno = sock_fd;
+	}
+	return stream;
+}
+
+#else  // coroutines need ucontext, fopencookie and glibc's FILE
+
+int startCoroutines(void) {
+	errno = ENOSYS;
+	return -1;
+}
+
+bool coroutinesRunning(void) {
+	return false;
+}
+
+bool runningCoroutine(void) {
+	return false;
+}
+
+int spawnCoroutine(void (*function)(void *arg), void *arg) {
+	(void)function;
+	(void)arg;
+	return -1;
+}
+
+int awaitReady(int fd, short events) {
+	struct pollfd pfd = { .fd = fd, .events = events };
+	while (poll(&pfd, 1, -1) < 0) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int awaitDiskWork(void (*function)(void *arg), void *arg) {
+	function(arg);
+	return 0;
+}
+
+int awaitNetworkWork(void (*function)(void *arg), void *arg) {
+	function(arg);
+	return 0;
+}
+
+FILE *openCoroutineStream(int sock_fd) {
+	(void)sock_fd;
+	errno = ENOSYS;
+	return NULL;
+}
+
+#endif
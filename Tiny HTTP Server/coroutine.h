@@ -0,0 +1,98 @@
+/*
+ * coroutine.h
+ *
+ * Functions that serve connections on stackful coroutines, so a
+ * request handler can be written as sequential blocking code while
+ * a few scheduler threads interleave thousands of requests.
+ *
+ * A coroutine runs on a pooled stack with a guard page below it.
+ * Its connection stream is a non-blocking socket: a read or write
+ * that would block suspends the coroutine until its scheduler's
+ * epoll set reports the socket ready. Work that blocks on the file
+ * system is run on the disk-I/O pool while the coroutine waits, and
+ * work that waits on other sockets on the network workers, which
+ * are otherwise idle while coroutines serve the connections.
+ *
+ * The same calls block the thread as before when made outside a
+ * coroutine, so the disk-I/O pool can write to a coroutine stream.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef COROUTINE_H_
+#define COROUTINE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * Start the scheduler threads that run coroutines.
+ *
+ * @return 0 if successful, -1 with errno set if error
+ */
+int startCoroutines(void);
+
+/**
+ * Determine whether connections are served on coroutines.
+ * @return true if the schedulers were started
+ */
+bool coroutinesRunning(void);
+
+/**
+ * Determine whether the caller is running on a coroutine.
+ * @return true if the caller can be suspended
+ */
+bool runningCoroutine(void);
+
+/**
+ * Start a coroutine on one of the scheduler threads.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 if started, -1 if too many coroutines are alive
+ */
+int spawnCoroutine(void (*function)(void *arg), void *arg);
+
+/**
+ * Wait until a descriptor is ready. A coroutine is suspended until
+ * its scheduler sees the descriptor ready; another thread polls.
+ *
+ * @param fd the descriptor
+ * @param events POLLIN or POLLOUT
+ * @return 0 when ready, -1 with errno set if error
+ */
+int awaitReady(int fd, short events);
+
+/**
+ * Run work on the disk-I/O pool while the calling coroutine is
+ * suspended. Outside a coroutine the work is run directly.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 once the work has run, -1 if the disk queue is full
+ */
+int awaitDiskWork(void (*function)(void *arg), void *arg);
+
+/**
+ * Run work that waits on other sockets, such as a request forwarded
+ * upstream, on the network workers while the calling coroutine is
+ * suspended, so it holds neither a scheduler thread nor a disk-I/O
+ * thread. Outside a coroutine the work is run directly.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 once the work has run, -1 if the dispatch queue is full
+ */
+int awaitNetworkWork(void (*function)(void *arg), void *arg);
+
+/**
+ * Open a stream over a peer socket for a connection served on
+ * coroutines. The socket is made non-blocking, and the stream's
+ * descriptor is the socket, so sendfile and splice still reach it.
+ *
+ * @param sock_fd the socket; it is closed with the stream
+ * @return the stream, or NULL with errno set if error
+ */
+FILE *openCoroutineStream(int sock_fd);
+
+#endif /* COROUTINE_H_ */
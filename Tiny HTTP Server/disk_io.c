@@ -0,0 +1,68 @@
+/*
+ * disk_io.c
+ *
+ * Functions that run blocking file system work on a dedicated
+ * disk-I/O pool, separate from the network workers.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdlib.h>
+
+#include "disk_io.h"
+#include "http_server.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "thpool.h"
+
+/** the disk-I/O pool */
+static threadpool diskpool = NULL;
+
+/**
+ * Gauge for the number of disk-I/O threads.
+ * @return the number of threads
+ */
+static long disk_pool_threads(void) {
+	return thpool_num_threads_alive(diskpool);
+}
+
+/**
+ * Gauge for the number of jobs waiting for a disk-I/O thread.
+ * @return the queue length
+ */
+static long disk_queue_length(void) {
+	return thpool_queue_length(diskpool);
+}
+
+/**
+ * Start the disk-I/O pool.
+ *
+ * @return 0 if successful, -1 if error
+ */
+int startDiskIo(void) {
+	const ServerConfig *config = serverConfig();
+	diskpool = thpool_init_elastic(config->diskPoolMinThreads, config->diskPoolMaxThreads,
+								   config->poolIdleTimeoutMs, config->poolTargetDelayMs);
+	if (diskpool == NULL) {
+		return -1;
+	}
+	thpool_set_queue_limit(diskpool, config->diskQueueHighWater);
+	registerStatsGauge("disk_pool_threads", disk_pool_threads);
+	registerStatsGauge("disk_queue_length", disk_queue_length);
+	return 0;
+}
+
+/**
+ * Queue work for the disk-I/O pool.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 if queued, -1 if the disk queue is full
+ */
+int submitDiskWork(void (*function)(void *arg), void *arg) {
+	if (thpool_add_work(diskpool, function, arg) != 0) {
+		return -1;
+	}
+	statsIncrement(diskTierRequests);
+	return 0;
+}
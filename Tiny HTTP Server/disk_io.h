@@ -0,0 +1,31 @@
+/*
+ * disk_io.h
+ *
+ * Functions that run blocking file system work on a dedicated
+ * disk-I/O pool, separate from the network workers, so that
+ * slow disk operations never delay requests that can be
+ * answered from the file cache.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef DISK_IO_H_
+#define DISK_IO_H_
+
+/**
+ * Start the disk-I/O pool.
+ *
+ * @return 0 if successful, -1 if error
+ */
+int startDiskIo(void);
+
+/**
+ * Queue work for the disk-I/O pool.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 if queued, -1 if the disk queue is full
+ */
+int submitDiskWork(void (*function)(void *arg), void *arg);
+
+#endif /* DISK_IO_H_ */
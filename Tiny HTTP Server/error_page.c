@@ -0,0 +1,131 @@
+/*
+ * error_page.c
+ *
+ * Functions that answer requests with error responses formatted
+ * once at startup.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "error_page.h"
+#include "http_server.h"
+
+/** length of an RFC 1123 date, such as "Mon, 19 Oct 2026 03:19:39 GMT" */
+#define DATE_LEN 29
+
+/** Definition of a preformatted error response */
+typedef struct ErrorPage {
+	int status;                     /** the response status */
+	const char *statusMsg;          /** the response message */
+	char bytes[4*MAXBUF];           /** the response, with a blank date */
+	size_t len;                     /** length of the response */
+	size_t dateAt;                  /** offset of the date */
+	size_t headersAt;               /** offset where other headers are inserted */
+} ErrorPage;
+
+/** the error responses the server sends */
+static ErrorPage errorPages[] = {
+	{ 400, "Bad Request" },
+	{ 403, "Forbidden" },
+	{ 404, "Not Found" },
+	{ 405, "Method not Allowed" },
+	{ 411, "Length Required" },
+	{ 413, "Payload Too Large" },
+	{ 416, "Range Not Satisfiable" },
+	{ 417, "Expectation Failed" },
+	{ 429, "Too Many Requests" },
+	{ 500, "Internal Server Error" },
+	{ 501, "Not Implemented" },
+	{ 502, "Bad Gateway" },
+	{ 503, "Service Unavailable" },
+	{ 504, "Gateway Timeout" },
+	{ 507, "Insufficient Storage" },
+};
+
+/** number of error responses */
+#define NERROR_PAGES (sizeof(errorPages) / sizeof(errorPages[0]))
+
+/**
+ * Format an error response with a blank date.
+ * @param page the response; its status and message are set
+ */
+static void formatErrorPage(ErrorPage *page) {
+	char body[2*MAXBUF];
+	int bodyLen = snprintf(body, sizeof(body),
+		"<html>"
+		"<head><title>%d %s</title></head>"
+		"<body>%d %s"
+		"<br>usage:http://yourHostName:port/"
+		"fileName.html</body></html>",
+		page->status, page->statusMsg, page->status, page->statusMsg);
+
+	char *buf = page->bytes;
+	size_t size = sizeof(page->bytes);
+	int n = snprintf(buf, size, "HTTP/1.1 %d %s%sServer: Tiny C Http Server%sDate: ",
+					 page->status, page->statusMsg, CRLF, CRLF);
+	page->dateAt = n;
+	n += snprintf(buf + n, size - n, "%*s%s", DATE_LEN, "", CRLF);
+	page->headersAt = n;
+	n += snprintf(buf + n, size - n, "Content-Length: %d%sContent-type: text/html%s%s%s",
+				  bodyLen, CRLF, CRLF, CRLF, body);
+	page->len = ((size_t)n < size) ? (size_t)n : 0;
+}
+
+/**
+ * Format the error responses of the statuses the server sends.
+ */
+void initErrorPages(void) {
+	for (size_t i = 0; i < NERROR_PAGES; i++) {
+		formatErrorPage(&errorPages[i]);
+	}
+}
+
+/**
+ * Format an error response from its preformatted bytes. A status
+ * that was not preformatted is formatted now.
+ *
+ * @param buf the buffer for the response
+ * @param size the size of the buffer
+ * @param status the response status
+ * @param statusMsg the response message, for a status that was not preformatted
+ * @param date the RFC 1123 date, or NULL for the current time
+ * @param headers other header lines, each ending in CRLF
+ * @return the length of the response, or 0 if it does not fit
+ */
+size_t formatErrorResponse(char *buf, size_t size, int status, const char *statusMsg,
+						   const char *date, const char *headers) {
+	const ErrorPage *page = NULL;
+	for (size_t i = 0; i < NERROR_PAGES && page == NULL; i++) {
+		if (errorPages[i].status == status) {
+			page = &errorPages[i];
+		}
+	}
+	ErrorPage other;
+	if (page == NULL || page->len == 0) {
+		other.status = status;
+		other.statusMsg = statusMsg;
+		formatErrorPage(&other);
+		page = &other;
+	}
+
+	char now[MAXBUF];
+	if (date == NULL || strlen(date) != DATE_LEN) {
+		time_t timer = time(NULL);
+		struct tm tm;
+		strftime(now, sizeof(now), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&timer, &tm));
+		date = now;
+	}
+	size_t headersLen = strlen(headers);
+	if (page->len == 0 || page->len + headersLen > size) {
+		return 0;
+	}
+	memcpy(buf, page->bytes, page->headersAt);
+	memcpy(buf + page->dateAt, date, DATE_LEN);
+	memcpy(buf + page->headersAt, headers, headersLen);
+	memcpy(buf + page->headersAt + headersLen, page->bytes + page->headersAt, page->len - page->headersAt);
+	return page->len + headersLen;
+}
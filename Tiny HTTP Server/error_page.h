@@ -0,0 +1,44 @@
+/*
+ * error_page.h
+ *
+ * Functions that answer requests with error responses formatted
+ * once at startup, so an error costs a copy and one write instead
+ * of formatting a page and staging it in a temporary file.
+ *
+ * Each response is kept complete except for its Date, which is
+ * patched into a fixed-width slot, and any headers the request
+ * added, such as Allow or Connection, which are inserted before
+ * the preformatted Content-Length.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef ERROR_PAGE_H_
+#define ERROR_PAGE_H_
+
+#include <stddef.h>
+
+/** size of a buffer that holds any error response */
+#define ERROR_RESPONSE_MAX 4096
+
+/**
+ * Format the error responses of the statuses the server sends.
+ */
+void initErrorPages(void);
+
+/**
+ * Format an error response from its preformatted bytes. A status
+ * that was not preformatted is formatted now.
+ *
+ * @param buf the buffer for the response
+ * @param size the size of the buffer
+ * @param status the response status
+ * @param statusMsg the response message, for a status that was not preformatted
+ * @param date the RFC 1123 date, or NULL for the current time
+ * @param headers other header lines, each ending in CRLF
+ * @return the length of the response, or 0 if it does not fit
+ */
+size_t formatErrorResponse(char *buf, size_t size, int status, const char *statusMsg,
+						   const char *date, const char *headers);
+
+#endif /* ERROR_PAGE_H_ */
@@ -0,0 +1,383 @@
+/*
+ * file_cache.c
+ *
+ * Functions that cache open descriptors and metadata for
+ * regular files under the content base.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "file_cache.h"
+#include "content_root.h"
+#include "file_util.h"
+#include "http_server.h"
+#include "server_config.h"
+#include "map.h"
+#include "mime_util.h"
+#include "time_util.h"
+#include "server_stats.h"
+
+/** nanoseconds per millisecond */
+#define NS_PER_MS 1000000ULL
+
+/** guards the cache, the LRU list, and entry reference counts */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** the cache entries by path */
+static map_base_t cache;
+
+/** most recently used entry */
+static FileCacheEntry *lruHead = NULL;
+
+/** least recently used entry */
+static FileCacheEntry *lruTail = NULL;
+
+/** number of cached entries */
+static long ncached = 0;
+
+/** entries are invalidated as files change, so they need no revalidation */
+static atomic_bool coherent = false;
+
+/**
+ * Determine whether an entry was validated recently enough to be used,
+ * or changes are being watched, and its MIME type is from the current
+ * configuration.
+ * @param entry the entry
+ * @param now monotonic ns now
+ * @return true if the entry is fresh
+ */
+static bool entryFresh(const FileCacheEntry *entry, uint64_t now) {
+	const ServerConfig *config = serverConfig();
+	return (atomic_load_explicit(&coherent, memory_order_relaxed)
+			|| now - atomic_load_explicit(&entry->validatedAt, memory_order_relaxed)
+					< config->fileCacheTtlMs*NS_PER_MS)
+		&& entry->mimeGeneration == config->generation;
+}
+
+/**
+ * Determine whether a file status matches the cached status,
+ * and the MIME type is from the current configuration.
+ * @param entry the entry
+ * @param sb the current file status
+ * @return true if the file is unchanged
+ */
+static bool entryMatches(const FileCacheEntry *entry, const struct stat *sb) {
+	return entry->mimeGeneration == serverConfig()->generation
+		&& entry->sb.st_dev == sb->st_dev
+		&& entry->sb.st_ino == sb->st_ino
+		&& entry->sb.st_size == sb->st_size
+		&& entry->sb.st_mtim.tv_sec == sb->st_mtim.tv_sec
+		&& entry->sb.st_mtim.tv_nsec == sb->st_mtim.tv_nsec;
+}
+
+/**
+ * Find the cached entry for a path. Caller holds cache_lock.
+ * @param path the request path
+ * @return the entry or NULL if not cached
+ */
+static FileCacheEntry *cacheGet(const char *path) {
+	FileCacheEntry **found = (FileCacheEntry **)map_get_(&cache, path);
+	return (found != NULL) ? *found : NULL;
+}
+
+/**
+ * Unlink an entry from the LRU list. Caller holds cache_lock.
+ * @param entry the entry
+ */
+static void lruUnlink(FileCacheEntry *entry) {
+	if (entry->lruPrev != NULL) {
+		entry->lruPrev->lruNext = entry->lruNext;
+	} else {
+		lruHead = entry->lruNext;
+	}
+	if (entry->lruNext != NULL) {
+		entry->lruNext->lruPrev = entry->lruPrev;
+	} else {
+		lruTail = entry->lruPrev;
+	}
+	entry->lruPrev = entry->lruNext = NULL;
+}
+
+/**
+ * Make an entry the most recently used. Caller holds cache_lock.
+ * @param entry the entry
+ */
+static void lruPushFront(FileCacheEntry *entry) {
+	entry->lruPrev = NULL;
+	entry->lruNext = lruHead;
+	if (lruHead != NULL) {
+		lruHead->lruPrev = entry;
+	}
+	lruHead = entry;
+	if (lruTail == NULL) {
+		lruTail = entry;
+	}
+}
+
+/**
+ * Drop a reference to an entry, freeing it with the last
+ * reference. Caller holds cache_lock.
+ * @param entry the entry
+ */
+static void entryUnref(FileCacheEntry *entry) {
+	if (--entry->refs == 0) {
+		close(entry->fd);
+		free(entry->path);
+		free(entry->mimeType);
+		free(entry);
+	}
+}
+
+/**
+ * Remove an entry from the cache. Caller holds cache_lock.
+ * @param entry the entry
+ */
+static void cacheRemove(FileCacheEntry *entry) {
+	map_remove_(&cache, entry->path);
+	lruUnlink(entry);
+	entry->cached = false;
+	ncached--;
+	entryUnref(entry);
+}
+
+/**
+ * Add an entry to the cache, replacing any entry for the same
+ * path and evicting the least recently used entries over the
+ * limit. Caller holds cache_lock.
+ * @param entry the entry
+ */
+static void cacheInsert(FileCacheEntry *entry) {
+	FileCacheEntry *old = cacheGet(entry->path);
+	if (old != NULL) {
+		cacheRemove(old);
+	}
+	if (map_set_(&cache, entry->path, (char *)&entry, sizeof(entry)) != 0) {
+		return;  // not cached; caller's reference still valid
+	}
+	entry->refs++;
+	entry->cached = true;
+	lruPushFront(entry);
+	ncached++;
+	while (ncached > serverConfig()->fileCacheMaxEntries && lruTail != NULL) {
+		cacheRemove(lruTail);
+	}
+}
+
+/**
+ * Create an entry for an open regular file.
+ * @param path the request path
+ * @param fd the open descriptor
+ * @param sb the file status
+ * @return the entry with one reference, or NULL if no memory
+ */
+static FileCacheEntry *newEntry(const char *path, int fd, const struct stat *sb) {
+	FileCacheEntry *entry = malloc(sizeof(FileCacheEntry));
+	if (entry == NULL) {
+		return NULL;
+	}
+	char mimeType[MAXBUF];
+	entry->path = strdup(path);
+	entry->fd = fd;
+	entry->sb = *sb;
+	const ServerConfig *config = serverConfig();
+	entry->mimeType = strdup(getMimeType_Advanced(config->mimeMap, path, mimeType));
+	entry->mimeGeneration = config->generation;
+	milliTimeToRFC_1123_Date_Time(sb->st_mtim.tv_sec, entry->lastModified);
+	atomic_init(&entry->validatedAt, monotonicTimeNanos());
+	atomic_init(&entry->residentAt, 0);
+	entry->refs = 1;
+	entry->cached = false;
+	entry->lruPrev = entry->lruNext = NULL;
+	return entry;
+}
+
+/**
+ * Find a fresh entry for a file without touching the file system.
+ *
+ * @param path the request path
+ * @return the entry with a reference held, or NULL if not cached or stale
+ */
+FileCacheEntry *fileCacheLookup(const char *path) {
+	FileCacheEntry *entry = NULL;
+	pthread_mutex_lock(&cache_lock);
+	FileCacheEntry *found = cacheGet(path);
+	if (found != NULL && entryFresh(found, monotonicTimeNanos())) {
+		entry = found;
+		entry->refs++;
+		lruUnlink(entry);
+		lruPushFront(entry);
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	if (entry != NULL) {
+		statsIncrement(fileCacheHits);
+	} else {
+		statsIncrement(fileCacheMisses);
+	}
+	return entry;
+}
+
+/**
+ * Find an entry for a regular file, revalidating or opening the
+ * file as needed. This blocks on the file system.
+ *
+ * @param path the request path
+ * @return the entry with a reference held, or NULL with errno set if
+ *  the file cannot be opened or is not a regular file
+ */
+FileCacheEntry *fileCacheOpen(const char *path) {
+	// use or revalidate a cached entry
+	pthread_mutex_lock(&cache_lock);
+	FileCacheEntry *entry = cacheGet(path);
+	if (entry != NULL) {
+		entry->refs++;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	if (entry != NULL) {
+		struct stat sb;
+		if (entryFresh(entry, monotonicTimeNanos())
+				|| (contentStat(path, &sb) == 0 && entryMatches(entry, &sb))) {
+			atomic_store_explicit(&entry->validatedAt, monotonicTimeNanos(), memory_order_relaxed);
+			return entry;
+		}
+		// changed or removed: drop the stale entry
+		pthread_mutex_lock(&cache_lock);
+		if (entry->cached) {
+			cacheRemove(entry);
+		}
+		entryUnref(entry);
+		pthread_mutex_unlock(&cache_lock);
+	}
+
+	// open the file and cache it
+	int fd = contentOpen(path, O_RDONLY, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+		close(fd);
+		errno = EISDIR;
+		return NULL;
+	}
+	entry = newEntry(path, fd, &sb);
+	if (entry == NULL) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	pthread_mutex_lock(&cache_lock);
+	cacheInsert(entry);
+	pthread_mutex_unlock(&cache_lock);
+	return entry;
+}
+
+/**
+ * Release a reference to an entry.
+ *
+ * @param entry the entry
+ */
+void fileCacheRelease(FileCacheEntry *entry) {
+	pthread_mutex_lock(&cache_lock);
+	entryUnref(entry);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Remove the entry for a file that has changed or been removed.
+ *
+ * @param path the request path
+ * @return true if the file was cached
+ */
+bool fileCacheInvalidate(const char *path) {
+	pthread_mutex_lock(&cache_lock);
+	FileCacheEntry *found = cacheGet(path);
+	if (found != NULL) {
+		cacheRemove(found);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return found != NULL;
+}
+
+/**
+ * Remove the entries for the files beneath a directory that has
+ * been moved or removed.
+ *
+ * @param dir the request path of the directory; "" for all files
+ * @return the number of entries removed
+ */
+long fileCacheInvalidateTree(const char *dir) {
+	size_t len = strlen(dir);
+	while (len > 0 && dir[len-1] == '/') {
+		len--;
+	}
+	long removed = 0;
+	pthread_mutex_lock(&cache_lock);
+	FileCacheEntry *next;
+	for (FileCacheEntry *entry = lruHead; entry != NULL; entry = next) {
+		next = entry->lruNext;
+		if (strncmp(entry->path, dir, len) == 0 && entry->path[len] == '/') {
+			cacheRemove(entry);
+			removed++;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return removed;
+}
+
+/**
+ * Trust entries until they are invalidated, instead of revalidating
+ * them after FILE_CACHE_TTL_MS. Set while every change to the
+ * content base is reported by the watcher.
+ *
+ * @param on true to trust entries until invalidated
+ */
+void fileCacheSetCoherent(bool on) {
+	atomic_store(&coherent, on);
+}
+
+/**
+ * Determine whether every change to the content base is reported
+ * by the watcher, so cached entries are trusted until invalidated.
+ *
+ * @return true if entries are trusted until invalidated
+ */
+bool fileCacheCoherent(void) {
+	return atomic_load_explicit(&coherent, memory_order_relaxed);
+}
+
+/**
+ * Call a function with the request path of each cached file, most
+ * recently used first. The cache is locked during the calls, so the
+ * function must not block or use the cache.
+ *
+ * @param fn the function
+ * @param arg argument passed to the function
+ */
+void fileCacheForEach(void (*fn)(const char *path, void *arg), void *arg) {
+	pthread_mutex_lock(&cache_lock);
+	for (FileCacheEntry *entry = lruHead; entry != NULL; entry = entry->lruNext) {
+		fn(entry->path, arg);
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Return the number of cached entries.
+ * @return the number of entries
+ */
+long fileCacheSize(void) {
+	pthread_mutex_lock(&cache_lock);
+	long size = ncached;
+	pthread_mutex_unlock(&cache_lock);
+	return size;
+}
@@ -0,0 +1,116 @@
+/*
+ * file_cache.h
+ *
+ * Functions that cache open descriptors and metadata for
+ * regular files under the content base, so requests for
+ * recently served files can be answered without a path walk,
+ * stat, or open. Files are identified by request path.
+ *
+ * Entries are revalidated against the file system once they
+ * are older than FILE_CACHE_TTL_MS, and are evicted least
+ * recently used first. While the content base is watched for
+ * changes, entries are trusted until the watcher drops them.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+/** Definition of a cached file */
+typedef struct FileCacheEntry {
+	char *path;                 /** request path (cache key) */
+	int fd;                     /** read-only descriptor of the file */
+	struct stat sb;             /** file status when validated */
+	char *mimeType;             /** MIME type of the file */
+	unsigned long mimeGeneration;  /** configuration the MIME type is from */
+	char lastModified[64];      /** RFC-1123 Last-Modified value */
+	_Atomic uint64_t validatedAt;  /** monotonic ns of last validation; read without the lock */
+	_Atomic uint64_t residentAt;   /** monotonic ns the file was last found in the page cache, or 0 */
+	int refs;                   /** references held by users and the cache */
+	bool cached;                /** still present in the cache */
+	struct FileCacheEntry *lruPrev;  /** more recently used entry */
+	struct FileCacheEntry *lruNext;  /** less recently used entry */
+} FileCacheEntry;
+
+/**
+ * Find a fresh entry for a file without touching the file system.
+ *
+ * @param path the request path
+ * @return the entry with a reference held, or NULL if not cached or stale
+ */
+FileCacheEntry *fileCacheLookup(const char *path);
+
+/**
+ * Find an entry for a regular file, revalidating or opening the
+ * file as needed. This blocks on the file system.
+ *
+ * @param path the request path
+ * @return the entry with a reference held, or NULL with errno set if
+ *  the file cannot be opened or is not a regular file
+ */
+FileCacheEntry *fileCacheOpen(const char *path);
+
+/**
+ * Release a reference to an entry.
+ *
+ * @param entry the entry
+ */
+void fileCacheRelease(FileCacheEntry *entry);
+
+/**
+ * Remove the entry for a file that has changed or been removed.
+ *
+ * @param path the request path
+ * @return true if the file was cached
+ */
+bool fileCacheInvalidate(const char *path);
+
+/**
+ * Remove the entries for the files beneath a directory that has
+ * been moved or removed.
+ *
+ * @param dir the request path of the directory; "" for all files
+ * @return the number of entries removed
+ */
+long fileCacheInvalidateTree(const char *dir);
+
+/**
+ * Trust entries until they are invalidated, instead of revalidating
+ * them after FILE_CACHE_TTL_MS. Set while every change to the
+ * content base is reported by the watcher.
+ *
+ * @param on true to trust entries until invalidated
+ */
+void fileCacheSetCoherent(bool on);
+
+/**
+ * Determine whether every change to the content base is reported
+ * by the watcher, so cached entries are trusted until invalidated.
+ *
+ * @return true if entries are trusted until invalidated
+ */
+bool fileCacheCoherent(void);
+
+/**
+ * Call a function with the request path of each cached file, most
+ * recently used first. The cache is locked during the calls, so the
+ * function must not block or use the cache.
+ *
+ * @param fn the function
+ * @param arg argument passed to the function
+ */
+void fileCacheForEach(void (*fn)(const char *path, void *arg), void *arg);
+
+/**
+ * Return the number of cached entries.
+ * @return the number of entries
+ */
+long fileCacheSize(void);
+
+#endif /* FILE_CACHE_H_ */
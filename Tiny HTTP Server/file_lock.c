@@ -0,0 +1,104 @@
+/*
+ * file_lock.c
+ *
+ * Functions that lock files by inode, so a file updated in place
+ * is never sent while part of an update has been written.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <pthread.h>
+
+#include "file_lock.h"
+#include "file_util.h"
+
+/** number of locks; a power of two */
+#define FILE_LOCKS 256
+
+/** the locks */
+static pthread_rwlock_t locks[FILE_LOCKS];
+
+/** initializes the locks once */
+static pthread_once_t locksOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Initialize the locks, preferring writers where supported.
+ */
+static void initLocks(void) {
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+#if defined(__GLIBC__)
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+	for (int i = 0; i < FILE_LOCKS; i++) {
+		pthread_rwlock_init(&locks[i], &attr);
+	}
+	pthread_rwlockattr_destroy(&attr);
+}
+
+/**
+ * Return the lock of a file.
+ * @param sb the status of the file
+ * @return the lock
+ */
+static pthread_rwlock_t *lockOf(const struct stat *sb) {
+	pthread_once(&locksOnce, initLocks);
+	uint64_t h = ((uint64_t)sb->st_dev * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)sb->st_ino;
+	h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL;
+	return &locks[(h ^ (h >> 32)) & (FILE_LOCKS - 1)];
+}
+
+/**
+ * Lock a file for sending.
+ * @param sb the status of the file
+ */
+void fileLockShared(const struct stat *sb) {
+	pthread_rwlock_rdlock(lockOf(sb));
+}
+
+/**
+ * Lock a file for updating in place.
+ * @param sb the status of the file
+ */
+void fileLockExclusive(const struct stat *sb) {
+	pthread_rwlock_wrlock(lockOf(sb));
+}
+
+/**
+ * Unlock a file.
+ * @param sb the status of the file
+ */
+void fileUnlock(const struct stat *sb) {
+	pthread_rwlock_unlock(lockOf(sb));
+}
+
+/**
+ * Send bytes of a file to an output stream, locking it shared only
+ * while each chunk of at most FILE_LOCK_CHUNK bytes is sent.
+ *
+ * @param ostream the output stream
+ * @param fd the file descriptor
+ * @param sb the status of the file
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendFileShared(FILE *ostream, int fd, const struct stat *sb, off_t offset, size_t nbytes) {
+	pthread_rwlock_t *lock = lockOf(sb);
+	while (nbytes > 0) {
+		size_t n = (nbytes < FILE_LOCK_CHUNK) ? nbytes : FILE_LOCK_CHUNK;
+		pthread_rwlock_rdlock(lock);
+		int status = sendFileBytes(ostream, fd, offset, n);
+		pthread_rwlock_unlock(lock);
+		if (status != 0) {
+			return -1;
+		}
+		offset += n;
+		nbytes -= n;
+	}
+	return 0;
+}
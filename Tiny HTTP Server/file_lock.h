@@ -0,0 +1,56 @@
+/*
+ * file_lock.h
+ *
+ * Functions that lock files by inode, so a file updated in place
+ * is never sent while part of an update has been written.
+ *
+ * Sending a file takes its lock shared, a chunk at a time, and an
+ * update takes it exclusive. Locks are read-write locks in a table indexed by a
+ * hash of the device and inode, so unrelated files rarely share
+ * one; a waiting update keeps new senders out so it cannot starve.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef FILE_LOCK_H_
+#define FILE_LOCK_H_
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+/** most bytes sent under one hold of a shared lock */
+#define FILE_LOCK_CHUNK (256 * 1024)
+
+/**
+ * Lock a file for sending.
+ * @param sb the status of the file
+ */
+void fileLockShared(const struct stat *sb);
+
+/**
+ * Lock a file for updating in place.
+ * @param sb the status of the file
+ */
+void fileLockExclusive(const struct stat *sb);
+
+/**
+ * Send bytes of a file to an output stream, locking it shared only
+ * while each chunk of at most FILE_LOCK_CHUNK bytes is sent, so a
+ * slow client cannot keep an update waiting for the whole response.
+ *
+ * @param ostream the output stream
+ * @param fd the file descriptor
+ * @param sb the status of the file
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendFileShared(FILE *ostream, int fd, const struct stat *sb, off_t offset, size_t nbytes);
+
+/**
+ * Unlock a file.
+ * @param sb the status of the file
+ */
+void fileUnlock(const struct stat *sb);
+
+#endif /* FILE_LOCK_H_ */
@@ -7,11 +7,27 @@
  *  @author: Philip Gust
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE  // splice, pipe2, copy_file_range
+#endif
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <stdio_ext.h>
+#endif
+#if defined(__linux__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#endif
 #include "http_server.h"
+#include "server_config.h"
 #include "file_util.h"
+#include "coroutine.h"
+#include "tls.h"
 
 /**
  * This function creates a temporary stream for this string.
@@ -63,6 +79,533 @@ int copyFileStreamBytes(FILE *istream, FILE *ostream, int nbytes) {
     return 0;
 }
 
+/**
+ * Copy bytes of an open file to an output stream that has no
+ * descriptor, such as a stream that frames its output.
+ *
+ * @param ostream the output stream
+ * @param fd the file descriptor
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to copy
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int copyToStream(FILE *ostream, int fd, off_t offset, size_t nbytes) {
+	char buf[BUFSIZ];
+	while (nbytes > 0) {
+		size_t ntoread = (nbytes < sizeof(buf)) ? nbytes : sizeof(buf);
+		ssize_t nread = pread(fd, buf, ntoread, offset);
+		if (nread < 0 && errno == EINTR) {
+			continue;
+		}
+		if (nread <= 0) {
+			if (nread == 0) {
+				errno = EIO;
+			}
+			return -1;
+		}
+		if (fwrite(buf, 1, nread, ostream) != (size_t)nread) {
+			return -1;
+		}
+		offset += nread;
+		nbytes -= nread;
+	}
+	return fflush(ostream);
+}
+
+/**
+ * Send bytes of an open file to an output stream. The stream is
+ * flushed first, then the bytes are sent directly to its descriptor.
+ *
+ * @param ostream the output stream
+ * @param fd the file descriptor
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendFileBytes(FILE *ostream, int fd, off_t offset, size_t nbytes) {
+	if (fflush(ostream) != 0) {
+		return -1;
+	}
+	int out_fd = fileno(ostream);
+	if (out_fd < 0) {
+		// a TLS stream with kernel TLS still sends without copying
+		if (sendTlsFile(ostream, fd, offset, nbytes) == 0) {
+			return 0;
+		} else if (errno != ENOTSUP) {
+			return -1;
+		}
+		return copyToStream(ostream, fd, offset, nbytes);
+	}
+#if defined(__linux__)
+	// copy in the kernel; fall back for descriptors sendfile cannot use
+	while (nbytes > 0) {
+		ssize_t nsent = sendfile(out_fd, fd, &offset, nbytes);
+		if (nsent > 0) {
+			nbytes -= nsent;
+		} else if (nsent == 0) {
+			errno = EIO;  // file truncated
+			return -1;
+		} else if (errno == EINVAL || errno == ENOSYS) {
+			break;
+		} else if (errno == EAGAIN) {
+			// a coroutine socket is non-blocking
+			if (awaitReady(out_fd, POLLOUT) != 0) {
+				return -1;
+			}
+		} else if (errno != EINTR) {
+			return -1;
+		}
+	}
+#endif
+	char buf[BUFSIZ];
+	while (nbytes > 0) {
+		size_t ntoread = (nbytes < sizeof(buf)) ? nbytes : sizeof(buf);
+		ssize_t nread = pread(fd, buf, ntoread, offset);
+		if (nread < 0 && errno == EINTR) {
+			continue;
+		}
+		if (nread <= 0) {
+			if (nread == 0) {
+				errno = EIO;
+			}
+			return -1;
+		}
+		for (ssize_t nwritten = 0; nwritten < nread; ) {
+			ssize_t n = write(out_fd, buf + nwritten, nread - nwritten);
+			if (n < 0) {
+				if (errno == EINTR || (errno == EAGAIN && awaitReady(out_fd, POLLOUT) == 0)) {
+					continue;
+				}
+				return -1;
+			}
+			nwritten += n;
+		}
+		offset += nread;
+		nbytes -= nread;
+	}
+	return 0;
+}
+
+/**
+ * Send a vector of buffers to an output stream. The stream is
+ * flushed first, then the buffers are gathered into as few writes
+ * to its descriptor as the socket accepts.
+ *
+ * @param ostream the output stream
+ * @param iov the buffers; updated as they are sent
+ * @param iovcnt the number of buffers
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendIoVector(FILE *ostream, struct iovec *iov, int iovcnt) {
+	if (fflush(ostream) != 0) {
+		return -1;
+	}
+	int out_fd = fileno(ostream);
+	if (out_fd < 0) {
+		// a stream without a descriptor takes the buffers one by one
+		for (int i = 0; i < iovcnt; i++) {
+			if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, ostream) != iov[i].iov_len) {
+				return -1;
+			}
+		}
+		return fflush(ostream);
+	}
+	while (iovcnt > 0) {
+		ssize_t nsent = writev(out_fd, iov, iovcnt);
+		if (nsent < 0) {
+			if (errno == EINTR || (errno == EAGAIN && awaitReady(out_fd, POLLOUT) == 0)) {
+				continue;
+			}
+			return -1;
+		}
+		// skip the buffers that were sent, then the sent part of the next
+		for (; iovcnt > 0 && (size_t)nsent >= iov->iov_len; iov++, iovcnt--) {
+			nsent -= iov->iov_len;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + nsent;
+			iov->iov_len -= nsent;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Read all bytes of a file at an offset into a buffer.
+ *
+ * @param fd the file descriptor
+ * @param buf the buffer
+ * @param nbytes the number of bytes to read
+ * @param offset the file offset
+ * @return 0 if successful, -1 with errno set if error or the file
+ *  ends first
+ */
+int readFileBytes(int fd, char *buf, size_t nbytes, off_t offset) {
+	while (nbytes > 0) {
+		ssize_t n = pread(fd, buf, nbytes, offset);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n == 0) {
+				errno = EIO;  // file truncated
+			}
+			return -1;
+		}
+		buf += n;
+		nbytes -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/**
+ * Write all bytes of a buffer to a file at an offset.
+ *
+ * @param fd the file descriptor
+ * @param buf the buffer
+ * @param nbytes the number of bytes to write
+ * @param offset the file offset
+ * @return 0 if successful, -1 with errno set if error
+ */
+int writeFileBytes(int fd, const char *buf, size_t nbytes, off_t offset) {
+	while (nbytes > 0) {
+		ssize_t n = pwrite(fd, buf, nbytes, offset);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		nbytes -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/**
+ * Copy bytes between files at given offsets. On Linux the bytes are
+ * copied in the kernel, otherwise with pread and pwrite.
+ *
+ * @param in_fd the input file descriptor
+ * @param inOffset the input file offset
+ * @param out_fd the output file descriptor
+ * @param outOffset the output file offset
+ * @param nbytes the number of bytes to copy
+ * @return 0 if successful, -1 with errno set if error
+ */
+int copyFileBytes(int in_fd, off_t inOffset, int out_fd, off_t outOffset, off_t nbytes) {
+#if defined(__linux__)
+	while (nbytes > 0) {
+		ssize_t n = copy_file_range(in_fd, &inOffset, out_fd, &outOffset, nbytes, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			if (n == 0) {
+				errno = EIO;  // the input ended early
+			} else if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+				break;  // copy the rest through user space
+			}
+			return -1;
+		}
+		nbytes -= n;
+	}
+#endif
+	char buf[BUFSIZ];
+	while (nbytes > 0) {
+		size_t ntoread = (nbytes < (off_t)sizeof(buf)) ? (size_t)nbytes : sizeof(buf);
+		ssize_t nread = pread(in_fd, buf, ntoread, inOffset);
+		if (nread < 0 && errno == EINTR) {
+			continue;
+		}
+		if (nread <= 0) {
+			if (nread == 0) {
+				errno = EIO;
+			}
+			return -1;
+		}
+		if (writeFileBytes(out_fd, buf, nread, outOffset) != 0) {
+			return -1;
+		}
+		inOffset += nread;
+		outOffset += nread;
+		nbytes -= nread;
+	}
+	return 0;
+}
+
+#if defined(__linux__)
+/**
+ * Write the bytes left in a pipe to a file with a copy.
+ *
+ * @param pipe_fd the read end of the pipe
+ * @param npiped the number of bytes in the pipe
+ * @param fd the file descriptor
+ * @param offset the file offset of the first byte, updated as bytes are written
+ * @param nbytes the number of bytes to move, updated as bytes are written
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int drainPipe(int pipe_fd, size_t npiped, int fd, off_t *offset, off_t *nbytes) {
+	char buf[BUFSIZ];
+	while (npiped > 0) {
+		ssize_t nread = read(pipe_fd, buf, (npiped < sizeof(buf)) ? npiped : sizeof(buf));
+		if (nread < 0 && errno == EINTR) {
+			continue;
+		}
+		if (nread <= 0) {
+			if (nread == 0) {
+				errno = EIO;
+			}
+			return -1;
+		}
+		if (writeFileBytes(fd, buf, nread, *offset) != 0) {
+			return -1;
+		}
+		*offset += nread;
+		*nbytes -= nread;
+		npiped -= nread;
+	}
+	return 0;
+}
+
+/**
+ * Move bytes from a descriptor to a file through a pipe with splice,
+ * so the data is not copied through user space.
+ *
+ * @param in_fd the input descriptor
+ * @param fd the file descriptor
+ * @param offset the file offset of the first byte, updated as bytes are moved
+ * @param nbytes the number of bytes to move, updated as bytes are moved
+ * @return 0 if successful, -1 with errno set if error; EINVAL if the
+ *   descriptors cannot be spliced, once every byte taken from in_fd
+ *   has been written, so the rest can be copied after them
+ */
+static int spliceFileBytes(int in_fd, int fd, off_t *offset, off_t *nbytes) {
+	int pipefd[2];
+	if (pipe2(pipefd, O_CLOEXEC) != 0) {
+		return -1;
+	}
+	off_t chunkBytes = serverConfig()->spliceChunkBytes;
+	int status = 0;
+	while (*nbytes > 0) {
+		size_t chunk = (*nbytes < chunkBytes) ? (size_t)*nbytes : (size_t)chunkBytes;
+		ssize_t nin = splice(in_fd, NULL, pipefd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (nin < 0 && (errno == EINTR || (errno == EAGAIN && awaitReady(in_fd, POLLIN) == 0))) {
+			continue;
+		}
+		if (nin <= 0) {
+			if (nin == 0) {
+				errno = ECONNRESET;  // peer closed before the whole body
+			}
+			status = -1;
+			break;
+		}
+		// drain the pipe into the file
+		while (nin > 0) {
+			ssize_t nout = splice(pipefd[0], NULL, fd, offset, nin, SPLICE_F_MOVE);
+			if (nout < 0 && errno == EINTR) {
+				continue;
+			}
+			if (nout <= 0) {
+				// the bytes taken from in_fd are still in the pipe
+				int saved = (nout == 0) ? EIO : errno;
+				if (drainPipe(pipefd[0], nin, fd, offset, nbytes) == 0) {
+					errno = saved;
+				} else if (errno == EINVAL) {
+					errno = EIO;  // bytes were lost; no copy may follow
+				}
+				status = -1;
+				break;
+			}
+			nin -= nout;
+			*nbytes -= nout;
+		}
+		if (status != 0) {
+			break;
+		}
+	}
+	int saved = errno;
+	close(pipefd[0]);
+	close(pipefd[1]);
+	errno = saved;
+	return status;
+}
+#endif
+
+/**
+ * Receive bytes from an input stream into an open file. Bytes already
+ * buffered in the stream are written first, then the rest are moved
+ * directly from the stream's descriptor to the file.
+ *
+ * @param istream the input stream
+ * @param fd the file descriptor
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to receive
+ * @return 0 if successful, -1 with errno set if error
+ */
+int receiveFileBytes(FILE *istream, int fd, off_t offset, off_t nbytes) {
+	char buf[BUFSIZ];
+
+	// bytes read ahead with the request headers
+	size_t nbuffered = streamBufferedInput(istream);
+	if ((off_t)nbuffered > nbytes) {
+		nbuffered = (size_t)nbytes;
+	}
+	while (nbuffered > 0) {
+		size_t ntoread = (nbuffered < sizeof(buf)) ? nbuffered : sizeof(buf);
+		size_t nread = fread(buf, 1, ntoread, istream);
+		if (nread == 0 || writeFileBytes(fd, buf, nread, offset) != 0) {
+			return -1;
+		}
+		offset += nread;
+		nbytes -= nread;
+		nbuffered -= nread;
+	}
+
+#if defined(__linux__)
+	int in_fd = fileno(istream);
+	if (in_fd >= 0 && spliceFileBytes(in_fd, fd, &offset, &nbytes) == 0) {
+		return 0;
+	} else if (in_fd >= 0 && errno != EINVAL) {
+		return -1;
+	}
+#endif
+	// copy through user space for descriptors splice cannot use,
+	// and for streams without one
+	while (nbytes > 0) {
+		size_t ntoread = (nbytes < (off_t)sizeof(buf)) ? (size_t)nbytes : sizeof(buf);
+		ssize_t nread = readAvailable(istream, buf, ntoread);
+		if (nread <= 0) {
+			if (nread == 0) {
+				errno = ECONNRESET;
+			}
+			return -1;
+		}
+		if (writeFileBytes(fd, buf, nread, offset) != 0) {
+			return -1;
+		}
+		offset += nread;
+		nbytes -= nread;
+	}
+	return 0;
+}
+
+/**
+ * Read up to nbytes from an input stream: bytes already buffered
+ * in the stream if there are any, otherwise one read of its
+ * descriptor, so the bytes are copied only once.
+ *
+ * @param istream the input stream
+ * @param buf the buffer
+ * @param nbytes the maximum number of bytes to read
+ * @return the number of bytes read, 0 at end of file, -1 with errno set if error
+ */
+ssize_t readAvailable(FILE *istream, char *buf, size_t nbytes) {
+	size_t nbuffered = streamBufferedInput(istream);
+	if (nbuffered == 0 && fileno(istream) < 0) {
+		// a stream without a descriptor, such as a TLS stream, fills
+		// its buffer with one read of its own
+		int c = getc(istream);
+		if (c == EOF) {
+			return ferror(istream) ? -1 : 0;
+		}
+		ungetc(c, istream);
+		nbuffered = streamBufferedInput(istream);
+	}
+	if (nbuffered > 0) {
+		return fread(buf, 1, (nbytes < nbuffered) ? nbytes : nbuffered, istream);
+	}
+	ssize_t nread;
+	do {
+		nread = read(fileno(istream), buf, nbytes);
+	} while (nread < 0 && (errno == EINTR || (errno == EAGAIN && awaitReady(fileno(istream), POLLIN) == 0)));
+	return nread;
+}
+
+/**
+ * Return the number of bytes read from the underlying descriptor
+ * that are still buffered in the input stream.
+ *
+ * @param stream the stream
+ * @return the number of buffered input bytes
+ */
+size_t streamBufferedInput(FILE *stream) {
+#if defined(__GLIBC__)
+	return stream->_IO_read_end - stream->_IO_read_ptr;
+#elif defined(__MACH__) && defined(__APPLE__)
+	return (stream->_r > 0) ? stream->_r : 0;
+#else
+	(void)stream;
+	return 0;
+#endif
+}
+
+/**
+ * Discard any buffered input of the stream.
+ *
+ * @param stream the stream
+ */
+void discardBufferedInput(FILE *stream) {
+#if defined(__GLIBC__)
+	__fpurge(stream);
+#elif defined(__MACH__) && defined(__APPLE__)
+	fpurge(stream);
+#else
+	(void)stream;
+#endif
+}
+
+/**
+ * Set aside the buffered input of the stream, so the stream can
+ * switch to writing without losing it.
+ *
+ * @param stream the stream
+ * @param len set to the number of bytes set aside
+ * @return the bytes, to be freed by the caller; NULL if there are
+ *  none or no memory, and the input is still buffered
+ */
+char *saveBufferedInput(FILE *stream, size_t *len) {
+	*len = streamBufferedInput(stream);
+	char *buf = (*len > 0) ? malloc(*len) : NULL;
+	if (buf == NULL) {
+		*len = 0;
+		return NULL;
+	}
+#if defined(__GLIBC__)
+	memcpy(buf, stream->_IO_read_ptr, *len);
+#elif defined(__MACH__) && defined(__APPLE__)
+	memcpy(buf, stream->_p, *len);
+#endif
+	discardBufferedInput(stream);
+	return buf;
+}
+
+/**
+ * Put input set aside by saveBufferedInput back into the stream,
+ * so it is read before the underlying descriptor. Call once the
+ * stream has flushed what it wrote.
+ *
+ * @param stream the stream
+ * @param buf the input
+ * @param len the number of bytes
+ * @return 0 if successful, -1 if the stream cannot hold the input
+ */
+int restoreBufferedInput(FILE *stream, const char *buf, size_t len) {
+	// switch the stream back to reading; a socket cannot seek, but the
+	// stream leaves writing first, so the pushed-back input is not taken
+	// for unwritten output when the stream switches to writing again
+	fseek(stream, 0, SEEK_CUR);
+	// glibc and BSD stdio grow their push-back buffer as needed
+	for (size_t i = len; i > 0; i--) {
+		if (ungetc((unsigned char)buf[i-1], stream) == EOF) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
 /**
  * Returns path component of the file path without trailing
  * path separator. If no path component, returns NULL.
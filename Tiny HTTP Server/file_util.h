@@ -11,7 +11,9 @@
 #define FILE_UTIL_H_
 
 #include <stdio.h>
+#include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 // MacOS uses non-standard name for stat time fields
 #if defined(__MACH__) && defined(__APPLE__)
@@ -48,6 +50,130 @@ int fileStat(FILE *stream, struct stat *buf);
  */
 int copyFileStreamBytes(FILE *istream, FILE *ostream, int nbytes);
 
+/**
+ * Send bytes of an open file to an output stream. The stream is
+ * flushed first, then the bytes are sent directly to its descriptor.
+ *
+ * @param ostream the output stream
+ * @param fd the file descriptor
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendFileBytes(FILE *ostream, int fd, off_t offset, size_t nbytes);
+
+/**
+ * Send a vector of buffers to an output stream. The stream is
+ * flushed first, then the buffers are gathered into as few writes
+ * to its descriptor as the socket accepts.
+ *
+ * @param ostream the output stream
+ * @param iov the buffers; updated as they are sent
+ * @param iovcnt the number of buffers
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendIoVector(FILE *ostream, struct iovec *iov, int iovcnt);
+
+/**
+ * Read all bytes of a file at an offset into a buffer.
+ *
+ * @param fd the file descriptor
+ * @param buf the buffer
+ * @param nbytes the number of bytes to read
+ * @param offset the file offset
+ * @return 0 if successful, -1 with errno set if error or the file
+ *  ends first
+ */
+int readFileBytes(int fd, char *buf, size_t nbytes, off_t offset);
+
+/**
+ * Write all bytes of a buffer to a file at an offset.
+ *
+ * @param fd the file descriptor
+ * @param buf the buffer
+ * @param nbytes the number of bytes to write
+ * @param offset the file offset
+ * @return 0 if successful, -1 with errno set if error
+ */
+int writeFileBytes(int fd, const char *buf, size_t nbytes, off_t offset);
+
+/**
+ * Copy bytes between files at given offsets. On Linux the bytes are
+ * copied in the kernel, otherwise with pread and pwrite.
+ *
+ * @param in_fd the input file descriptor
+ * @param inOffset the input file offset
+ * @param out_fd the output file descriptor
+ * @param outOffset the output file offset
+ * @param nbytes the number of bytes to copy
+ * @return 0 if successful, -1 with errno set if error
+ */
+int copyFileBytes(int in_fd, off_t inOffset, int out_fd, off_t outOffset, off_t nbytes);
+
+/**
+ * Receive bytes from an input stream into an open file. Bytes already
+ * buffered in the stream are written first, then the rest are moved
+ * directly from the stream's descriptor to the file.
+ *
+ * @param istream the input stream
+ * @param fd the file descriptor
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to receive
+ * @return 0 if successful, -1 with errno set if error
+ */
+int receiveFileBytes(FILE *istream, int fd, off_t offset, off_t nbytes);
+
+/**
+ * Read up to nbytes from an input stream: bytes already buffered
+ * in the stream if there are any, otherwise one read of its
+ * descriptor, so the bytes are copied only once.
+ *
+ * @param istream the input stream
+ * @param buf the buffer
+ * @param nbytes the maximum number of bytes to read
+ * @return the number of bytes read, 0 at end of file, -1 with errno set if error
+ */
+ssize_t readAvailable(FILE *istream, char *buf, size_t nbytes);
+
+/**
+ * Return the number of bytes read from the underlying descriptor
+ * that are still buffered in the input stream.
+ *
+ * @param stream the stream
+ * @return the number of buffered input bytes
+ */
+size_t streamBufferedInput(FILE *stream);
+
+/**
+ * Discard any buffered input of the stream.
+ *
+ * @param stream the stream
+ */
+void discardBufferedInput(FILE *stream);
+
+/**
+ * Set aside the buffered input of the stream, so the stream can
+ * switch to writing without losing it.
+ *
+ * @param stream the stream
+ * @param len set to the number of bytes set aside
+ * @return the bytes, to be freed by the caller; NULL if there are
+ *  none or no memory, and the input is still buffered
+ */
+char *saveBufferedInput(FILE *stream, size_t *len);
+
+/**
+ * Put input set aside by saveBufferedInput back into the stream,
+ * so it is read before the underlying descriptor. Call once the
+ * stream has flushed what it wrote.
+ *
+ * @param stream the stream
+ * @param buf the input
+ * @param len the number of bytes
+ * @return 0 if successful, -1 if the stream cannot hold the input
+ */
+int restoreBufferedInput(FILE *stream, const char *buf, size_t len);
+
 /**
  * Returns path component of the file path without trailing
  * path separator. If no path component, returns NULL.
@@ -0,0 +1,385 @@
+/*
+ * form_data.c
+ *
+ * Functions that parse HTML form submissions: URL-encoded
+ * fields from a query or request body, and multipart/form-data
+ * bodies that are parsed incrementally as they are received.
+ *
+ * The multipart parser reads the body into a fixed window and
+ * scans it for the "CRLF--boundary" delimiter with memchr, which
+ * the C library vectorizes. Content before the earliest possible
+ * delimiter is passed to the handler straight from the window, so
+ * only a delimiter split across reads is ever carried over.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  // memmem
+#endif
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "form_data.h"
+#include "file_util.h"
+#include "http_server.h"
+#include "server_config.h"
+
+/** maximum boundary length (RFC 2046) */
+#define MAX_BOUNDARY 70
+
+/** Parser states */
+typedef enum MultipartState {
+	IN_PREAMBLE,        /** before the first delimiter */
+	AFTER_DELIMITER,    /** after a delimiter: CRLF or "--" follows */
+	IN_HEADERS,         /** in the headers of a part */
+	IN_DATA,            /** in the content of a part */
+	IN_EPILOGUE         /** after the close delimiter */
+} MultipartState;
+
+/** Definition of the multipart parser window */
+typedef struct MultipartWindow {
+	FILE *istream;      /** the input stream */
+	off_t remaining;    /** body bytes not yet read */
+	char *buf;          /** the window */
+	size_t size;        /** size of the window */
+	size_t start;       /** first unparsed byte */
+	size_t end;         /** end of valid bytes */
+} MultipartWindow;
+
+/**
+ * Return the value of a hex digit.
+ * @param c the hex digit
+ * @return the value
+ */
+static int hexValue(int c) {
+	return isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+}
+
+/**
+ * Decode one URL-encoded name or value.
+ *
+ * @param p start of the encoded text
+ * @param end end of the encoded text
+ * @param decoded storage for the decoded text
+ * @param size the size of the storage
+ * @return decoded, or NULL if badly encoded or too long
+ */
+static char *decodeField(const char *p, const char *end, char *decoded, size_t size) {
+	size_t n = 0;
+	for (; p < end; n++) {
+		if (n+1 >= size) {
+			return NULL;
+		}
+		if (*p == '+') {
+			decoded[n] = ' ';
+			p++;
+		} else if (*p == '%') {
+			if (end - p < 3 || !isxdigit((unsigned char)p[1]) || !isxdigit((unsigned char)p[2])) {
+				return NULL;
+			}
+			decoded[n] = (char)(hexValue((unsigned char)p[1])*16 + hexValue((unsigned char)p[2]));
+			p += 3;
+		} else {
+			decoded[n] = *p++;
+		}
+	}
+	decoded[n] = '\0';
+	return decoded;
+}
+
+/**
+ * Parse URL-encoded "name=value&name=value" fields into
+ * a field table. '+' decodes to a space and %xx to its
+ * character code.
+ *
+ * @param encoded the encoded fields
+ * @param len the length of the encoded fields
+ * @param fields the field table
+ * @return the number of fields parsed, or -1 if badly encoded
+ */
+int parseUrlEncodedFields(const char *encoded, size_t len, Properties *fields) {
+	char name[MAX_PROP_NAME], value[MAX_PROP_VAL];
+	const char *end = encoded + len;
+	int nfields = 0;
+	while (encoded < end) {
+		const char *amp = memchr(encoded, '&', end - encoded);
+		if (amp == NULL) {
+			amp = end;
+		}
+		const char *eq = memchr(encoded, '=', amp - encoded);
+		const char *nameEnd = (eq != NULL) ? eq : amp;
+		if (nameEnd > encoded) {  // skip empty fields
+			if (decodeField(encoded, nameEnd, name, sizeof(name)) == NULL
+					|| decodeField((eq != NULL) ? eq+1 : amp, amp, value, sizeof(value)) == NULL) {
+				return -1;
+			}
+			putProperty(fields, name, value);
+			nfields++;
+		}
+		encoded = amp + 1;
+	}
+	return nfields;
+}
+
+/**
+ * Get a parameter of a header value, such as the boundary of a
+ * Content-Type or the name of a Content-Disposition. Quoted
+ * values are unquoted.
+ *
+ * @param value the header value
+ * @param name the parameter name
+ * @param param storage for the parameter value
+ * @param size the size of the storage
+ * @return param, or NULL if not found or too long
+ */
+char *getHeaderParameter(const char *value, const char *name, char *param, size_t size) {
+	size_t nameLen = strlen(name);
+	const char *p = strchr(value, ';');
+	while (p != NULL) {
+		for (p++; *p == ' ' || *p == '\t'; p++) {}
+		if (strncasecmp(p, name, nameLen) == 0 && p[nameLen] == '=') {
+			p += nameLen + 1;
+			size_t n = 0;
+			if (*p == '"') {
+				for (p++; *p != '\0' && *p != '"'; p++) {
+					if (*p == '\\' && p[1] != '\0') {
+						p++;
+					}
+					if (n+1 >= size) {
+						return NULL;
+					}
+					param[n++] = *p;
+				}
+			} else {
+				for (; *p != '\0' && *p != ';' && *p != ' ' && *p != '\t'; p++) {
+					if (n+1 >= size) {
+						return NULL;
+					}
+					param[n++] = *p;
+				}
+			}
+			param[n] = '\0';
+			return param;
+		}
+		p = strchr(p, ';');
+	}
+	return NULL;
+}
+
+/**
+ * Find the delimiter in the window. If it is not found, report how
+ * much of the window cannot be the start of a delimiter that
+ * continues past its end.
+ *
+ * @param data the window data
+ * @param len the length of the data
+ * @param delim the delimiter
+ * @param delimLen the length of the delimiter
+ * @param safe returns the length that cannot contain a delimiter
+ * @return the delimiter, or NULL if not found
+ */
+static const char *findDelimiter(const char *data, size_t len, const char *delim, size_t delimLen, size_t *safe) {
+	const char *end = data + len;
+	for (const char *p = data; (p = memchr(p, delim[0], end - p)) != NULL; p++) {
+		size_t avail = end - p;
+		if (avail < delimLen) {
+			if (memcmp(p, delim, avail) == 0) {  // may continue in the next read
+				*safe = p - data;
+				return NULL;
+			}
+		} else if (memcmp(p, delim, delimLen) == 0) {
+			return p;
+		}
+	}
+	*safe = len;
+	return NULL;
+}
+
+/**
+ * Move unparsed bytes to the front of the window and read
+ * more of the body after them.
+ *
+ * @param window the window
+ * @return the number of bytes read, 0 if the body is all read
+ *   or the window is full, or -1 if error
+ */
+static ssize_t fillWindow(MultipartWindow *window) {
+	if (window->start > 0) {
+		memmove(window->buf, window->buf + window->start, window->end - window->start);
+		window->end -= window->start;
+		window->start = 0;
+	}
+	size_t room = window->size - window->end;
+	if (room == 0 || window->remaining == 0) {
+		return 0;
+	}
+	if ((off_t)room > window->remaining) {
+		room = (size_t)window->remaining;
+	}
+	ssize_t nread = readAvailable(window->istream, window->buf + window->end, room);
+	if (nread <= 0) {
+		return -1;
+	}
+	window->end += nread;
+	window->remaining -= nread;
+	return nread;
+}
+
+/**
+ * Parse the header lines of a part into a header table.
+ *
+ * @param p the first header line
+ * @param end the end of the header lines
+ * @param partHeaders the header table
+ */
+static void parsePartHeaders(const char *p, const char *end, Properties *partHeaders) {
+	char name[MAX_PROP_NAME], value[MAX_PROP_VAL];
+	while (p < end) {
+		const char *eol = memchr(p, '\r', end - p);
+		if (eol == NULL) {
+			eol = end;
+		}
+		const char *colon = memchr(p, ':', eol - p);
+		if (colon != NULL && colon - p < MAX_PROP_NAME) {
+			memcpy(name, p, colon - p);
+			name[colon - p] = '\0';
+			for (colon++; colon < eol && (*colon == ' ' || *colon == '\t'); colon++) {}
+			size_t len = eol - colon;
+			if (len >= MAX_PROP_VAL) {
+				len = MAX_PROP_VAL-1;
+			}
+			memcpy(value, colon, len);
+			value[len] = '\0';
+			putProperty(partHeaders, name, value);
+		}
+		p = eol + 2;  // skip CRLF
+	}
+}
+
+/**
+ * Parse a multipart body from a stream as it is received, calling
+ * the handler for each part. Memory is bounded by the configured
+ * form buffer size regardless of the size of the body or its parts.
+ *
+ * @param istream the input stream
+ * @param contentLen the length of the body
+ * @param boundary the boundary from the Content-Type
+ * @param handler the part handler
+ * @return 0 if successful, -1 if the body is malformed, cannot be
+ *   read, or a callback stopped the parse
+ */
+int parseMultipart(FILE *istream, off_t contentLen, const char *boundary, const MultipartHandler *handler) {
+	size_t boundaryLen = strlen(boundary);
+	if (boundaryLen == 0 || boundaryLen > MAX_BOUNDARY) {
+		return -1;
+	}
+	char delim[MAX_BOUNDARY+5];
+	size_t delimLen = sprintf(delim, "\r\n--%s", boundary);
+
+	size_t windowSize = serverConfig()->formBufferBytes;
+	MultipartWindow window = { istream, contentLen, malloc(windowSize), windowSize, 0, 0 };
+	if (window.buf == NULL) {
+		return -1;
+	}
+	// the delimiter includes the preceding CRLF; supply it
+	// for a first boundary that starts the body
+	memcpy(window.buf, CRLF, 2);
+	window.end = 2;
+
+	MultipartState state = IN_PREAMBLE;
+	int status = 0;
+	while (status == 0) {
+		char *data = window.buf + window.start;
+		size_t len = window.end - window.start;
+		bool needMore = false;
+
+		switch (state) {
+		case IN_PREAMBLE:
+		case IN_DATA: {
+			size_t safe;
+			const char *found = findDelimiter(data, len, delim, delimLen, &safe);
+			size_t n = (found != NULL) ? (size_t)(found - data) : safe;
+			if (state == IN_DATA && n > 0 && handler->partData(handler->ctx, data, n) != 0) {
+				status = -1;
+				break;
+			}
+			window.start += n;
+			if (found == NULL) {
+				needMore = true;
+			} else {
+				if (state == IN_DATA && handler->partEnd(handler->ctx) != 0) {
+					status = -1;
+					break;
+				}
+				window.start += delimLen;
+				state = AFTER_DELIMITER;
+			}
+			break;
+		}
+		case AFTER_DELIMITER: {
+			if (len >= 2 && data[0] == '-' && data[1] == '-') {
+				state = IN_EPILOGUE;
+				break;
+			}
+			// skip transport padding before the CRLF
+			size_t i = 0;
+			while (i < len && (data[i] == ' ' || data[i] == '\t')) {
+				i++;
+			}
+			if (i+2 > len) {
+				needMore = true;
+			} else if (data[i] == '\r' && data[i+1] == '\n') {
+				window.start += i+2;
+				state = IN_HEADERS;
+			} else {
+				status = -1;
+			}
+			break;
+		}
+		case IN_HEADERS: {
+			const char *headersEnd;
+			if (len >= 2 && data[0] == '\r' && data[1] == '\n') {
+				headersEnd = data;  // part without headers
+			} else {
+				headersEnd = memmem(data, len, "\r\n\r\n", 4);
+				if (headersEnd != NULL) {
+					headersEnd += 2;
+				}
+			}
+			if (headersEnd == NULL) {
+				needMore = true;
+				break;
+			}
+			Properties *partHeaders = newProperties();
+			parsePartHeaders(data, headersEnd, partHeaders);
+			status = handler->partBegin(handler->ctx, partHeaders);
+			deleteProperties(partHeaders);
+			window.start += (headersEnd - data) + 2;
+			state = IN_DATA;
+			break;
+		}
+		case IN_EPILOGUE:
+			// drain the rest of the body
+			window.start = window.end;
+			needMore = true;
+			break;
+		}
+
+		if (status == 0 && needMore) {
+			ssize_t nread = fillWindow(&window);
+			if (nread < 0) {
+				status = -1;
+			} else if (nread == 0) {
+				// body all read, or a part header larger than the window
+				status = (state == IN_EPILOGUE && window.remaining == 0) ? 0 : -1;
+				break;
+			}
+		}
+	}
+	free(window.buf);
+	return status;
+}
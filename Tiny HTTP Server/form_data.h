@@ -0,0 +1,71 @@
+/*
+ * form_data.h
+ *
+ * Functions that parse HTML form submissions: URL-encoded
+ * fields from a query or request body, and multipart/form-data
+ * bodies that are parsed incrementally as they are received.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef FORM_DATA_H_
+#define FORM_DATA_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "properties.h"
+
+/** Callbacks for the parts of a multipart body */
+typedef struct MultipartHandler {
+	/** called with the headers of a part before its content; returns 0 to continue */
+	int (*partBegin)(void *ctx, Properties *partHeaders);
+	/** called with each piece of part content; returns 0 to continue */
+	int (*partData)(void *ctx, const char *data, size_t len);
+	/** called after the last piece of part content; returns 0 to continue */
+	int (*partEnd)(void *ctx);
+	/** context passed to the callbacks */
+	void *ctx;
+} MultipartHandler;
+
+/**
+ * Parse URL-encoded "name=value&name=value" fields into
+ * a field table. '+' decodes to a space and %xx to its
+ * character code.
+ *
+ * @param encoded the encoded fields
+ * @param len the length of the encoded fields
+ * @param fields the field table
+ * @return the number of fields parsed, or -1 if badly encoded
+ */
+int parseUrlEncodedFields(const char *encoded, size_t len, Properties *fields);
+
+/**
+ * Get a parameter of a header value, such as the boundary of a
+ * Content-Type or the name of a Content-Disposition. Quoted
+ * values are unquoted.
+ *
+ * @param value the header value
+ * @param name the parameter name
+ * @param param storage for the parameter value
+ * @param size the size of the storage
+ * @return param, or NULL if not found or too long
+ */
+char *getHeaderParameter(const char *value, const char *name, char *param, size_t size);
+
+/**
+ * Parse a multipart body from a stream as it is received, calling
+ * the handler for each part. Memory is bounded by the configured
+ * form buffer size regardless of the size of the body or its parts.
+ *
+ * @param istream the input stream
+ * @param contentLen the length of the body
+ * @param boundary the boundary from the Content-Type
+ * @param handler the part handler
+ * @return 0 if successful, -1 if the body is malformed, cannot be
+ *   read, or a callback stopped the parse
+ */
+int parseMultipart(FILE *istream, off_t contentLen, const char *boundary, const MultipartHandler *handler);
+
+#endif /* FORM_DATA_H_ */
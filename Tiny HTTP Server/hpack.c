@@ -0,0 +1,689 @@
+/*
+ * hpack.c
+ *
+ * Functions that decode and encode HTTP/2 header blocks with
+ * HPACK (RFC 7541).
+ *
+ * A dynamic table is a ring of entries, newest first, evicted
+ * oldest first when an addition would exceed its maximum size.
+ * Huffman strings are decoded a bit at a time by walking a code
+ * tree built from the code table on first use. The encoder sends
+ * a string Huffman coded when that is shorter.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hpack.h"
+
+/** number of entries of the static table */
+#define STATIC_TABLE_SIZE 61
+
+/** bytes an entry counts in the table beyond its name and value */
+#define ENTRY_OVERHEAD 32
+
+/** symbol of the end-of-string code */
+#define HUFFMAN_EOS 256
+
+/** Definition of an entry of the static table */
+typedef struct HpackStaticEntry {
+	const char *name;           /** field name */
+	const char *value;          /** field value, or "" */
+} HpackStaticEntry;
+
+/** the static table, indexed from 1 */
+static const HpackStaticEntry staticTable[STATIC_TABLE_SIZE+1] = {
+	{ NULL, NULL },
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+
+/** Huffman code of each octet, from RFC 7541 Appendix B */
+static const uint32_t huffmanCodes[256] = {
+	0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+	0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+	0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+	0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+	0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+	0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+	0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+	0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+	0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+	0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+	0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+	0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+	0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+	0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+	0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+	0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+	0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+	0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+	0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+	0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+	0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+	0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+	0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+	0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+	0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+	0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+	0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+	0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+	0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+	0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+	0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+
+/** Huffman code length in bits of each octet */
+static const uint8_t huffmanCodeLen[256] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+/** Definition of a node of the Huffman code tree */
+typedef struct HuffmanNode {
+	int16_t child[2];           /** next node for a 0 or 1 bit, or -1 */
+	int16_t symbol;             /** decoded symbol of a leaf, or -1 */
+} HuffmanNode;
+
+/** the Huffman code tree; 257 leaves */
+static HuffmanNode huffmanTree[2*(HUFFMAN_EOS+1) - 1];
+
+/** builds the tree once */
+static pthread_once_t huffmanOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Build the Huffman code tree from the code table.
+ */
+static void buildHuffmanTree(void) {
+	int nnodes = 1;
+	huffmanTree[0] = (HuffmanNode){ { -1, -1 }, -1 };
+	for (int sym = 0; sym <= HUFFMAN_EOS; sym++) {
+		uint32_t code = (sym < HUFFMAN_EOS) ? huffmanCodes[sym] : 0x3fffffff;
+		int len = (sym < HUFFMAN_EOS) ? huffmanCodeLen[sym] : 30;
+		int node = 0;
+		for (int b = len - 1; b >= 0; b--) {
+			int bit = (code >> b) & 1;
+			if (huffmanTree[node].child[bit] < 0) {
+				huffmanTree[nnodes] = (HuffmanNode){ { -1, -1 }, -1 };
+				huffmanTree[node].child[bit] = nnodes++;
+			}
+			node = huffmanTree[node].child[bit];
+		}
+		huffmanTree[node].symbol = sym;
+	}
+}
+
+/**
+ * Decode a Huffman coded string.
+ *
+ * @param in the coded string
+ * @param len the length of the coded string
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @return the decoded length, or -1 if the string is malformed or too long
+ */
+static long huffmanDecode(const unsigned char *in, size_t len, char *out, size_t size) {
+	pthread_once(&huffmanOnce, buildHuffmanTree);
+	size_t n = 0;
+	int node = 0;
+	int padBits = 0;
+	bool padOnes = true;
+	for (size_t i = 0; i < len; i++) {
+		for (int b = 7; b >= 0; b--) {
+			int bit = (in[i] >> b) & 1;
+			node = huffmanTree[node].child[bit];
+			if (node < 0) {
+				return -1;
+			}
+			padBits++;
+			padOnes = padOnes && bit;
+			int sym = huffmanTree[node].symbol;
+			if (sym >= 0) {
+				if (sym == HUFFMAN_EOS || n == size) {
+					return -1;
+				}
+				out[n++] = (char)sym;
+				node = 0;
+				padBits = 0;
+				padOnes = true;
+			}
+		}
+	}
+	// padding is a prefix of the EOS code: at most 7 one bits
+	return (padBits <= 7 && padOnes) ? (long)n : -1;
+}
+
+/**
+ * Return the Huffman coded length of a string.
+ * @param s the string
+ * @param len the length of the string
+ * @return the coded length in bytes
+ */
+static size_t huffmanLength(const char *s, size_t len) {
+	size_t bits = 0;
+	for (size_t i = 0; i < len; i++) {
+		bits += huffmanCodeLen[(unsigned char)s[i]];
+	}
+	return (bits + 7) / 8;
+}
+
+/**
+ * Huffman code a string.
+ * @param s the string
+ * @param len the length of the string
+ * @param out the output; huffmanLength bytes
+ */
+static void huffmanEncode(const char *s, size_t len, unsigned char *out) {
+	uint64_t acc = 0;
+	int nbits = 0;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = s[i];
+		acc = (acc << huffmanCodeLen[c]) | huffmanCodes[c];
+		nbits += huffmanCodeLen[c];
+		while (nbits >= 8) {
+			nbits -= 8;
+			*out++ = (unsigned char)(acc >> nbits);
+		}
+	}
+	if (nbits > 0) {
+		// pad with the most significant bits of EOS
+		*out = (unsigned char)((acc << (8 - nbits)) | ((1u << (8 - nbits)) - 1));
+	}
+}
+
+/**
+ * Decode an integer with an N-bit prefix.
+ *
+ * @param p the position in the block; advanced past the integer
+ * @param end the end of the block
+ * @param prefix the number of prefix bits
+ * @param value returns the integer
+ * @return 0 if successful, -1 if truncated or too large
+ */
+static int decodeInt(const unsigned char **p, const unsigned char *end, int prefix, size_t *value) {
+	size_t max = (1u << prefix) - 1;
+	size_t v = *(*p)++ & max;
+	if (v == max) {
+		int shift = 0;
+		unsigned char b;
+		do {
+			if (*p == end || shift > 28) {
+				return -1;
+			}
+			b = *(*p)++;
+			v += (size_t)(b & 0x7f) << shift;
+			shift += 7;
+		} while (b & 0x80);
+	}
+	*value = v;
+	return 0;
+}
+
+/**
+ * Encode an integer with an N-bit prefix.
+ *
+ * @param buf the output
+ * @param size the space in the output
+ * @param flags the bits above the prefix of the first byte
+ * @param prefix the number of prefix bits
+ * @param value the integer
+ * @return the number of bytes written, or 0 if there was no room
+ */
+static size_t encodeInt(unsigned char *buf, size_t size, unsigned char flags, int prefix, size_t value) {
+	size_t max = (1u << prefix) - 1;
+	if (size == 0) {
+		return 0;
+	}
+	if (value < max) {
+		buf[0] = flags | (unsigned char)value;
+		return 1;
+	}
+	buf[0] = flags | (unsigned char)max;
+	value -= max;
+	size_t n = 1;
+	for (; value >= 0x80; value >>= 7) {
+		if (n == size) {
+			return 0;
+		}
+		buf[n++] = (unsigned char)(value & 0x7f) | 0x80;
+	}
+	if (n == size) {
+		return 0;
+	}
+	buf[n++] = (unsigned char)value;
+	return n;
+}
+
+/**
+ * Decode a string literal.
+ *
+ * @param p the position in the block; advanced past the string
+ * @param end the end of the block
+ * @return the NUL-terminated string to free, or NULL if malformed
+ */
+static char *decodeString(const unsigned char **p, const unsigned char *end) {
+	if (*p == end) {
+		return NULL;
+	}
+	bool huffman = (**p & 0x80) != 0;
+	size_t len;
+	if (decodeInt(p, end, 7, &len) != 0 || len > (size_t)(end - *p)) {
+		return NULL;
+	}
+	size_t size = huffman ? len * 8 / 5 : len;
+	if (size > HPACK_MAX_STRING) {
+		size = HPACK_MAX_STRING;
+	}
+	char *s = malloc(size + 1);
+	if (s == NULL) {
+		return NULL;
+	}
+	long n = len;
+	if (huffman) {
+		n = huffmanDecode(*p, len, s, size);
+	} else if (len <= size) {
+		memcpy(s, *p, len);
+	} else {
+		n = -1;
+	}
+	// a NUL would end the string early
+	if (n < 0 || memchr(s, '\0', n) != NULL) {
+		free(s);
+		return NULL;
+	}
+	s[n] = '\0';
+	*p += len;
+	return s;
+}
+
+/**
+ * Encode a string literal, Huffman coded if that is shorter.
+ *
+ * @param buf the output
+ * @param size the space in the output
+ * @param s the string
+ * @return the number of bytes written, or 0 if there was no room
+ */
+static size_t encodeString(unsigned char *buf, size_t size, const char *s) {
+	size_t len = strlen(s);
+	size_t hlen = huffmanLength(s, len);
+	bool huffman = hlen < len;
+	size_t slen = huffman ? hlen : len;
+	size_t n = encodeInt(buf, size, huffman ? 0x80 : 0, 7, slen);
+	if (n == 0 || size - n < slen) {
+		return 0;
+	}
+	if (huffman) {
+		huffmanEncode(s, len, buf + n);
+	} else {
+		memcpy(buf + n, s, len);
+	}
+	return n + slen;
+}
+
+/**
+ * Return an entry of a dynamic table.
+ * @param table the table
+ * @param i the entry, 0 for the newest
+ * @return the entry
+ */
+static HpackEntry *entryAt(HpackTable *table, size_t i) {
+	return &table->entries[(table->newest + table->capacity - i) % table->capacity];
+}
+
+/**
+ * Evict the oldest entries until the table fits a size.
+ * @param table the table
+ * @param size the size
+ */
+static void evictTo(HpackTable *table, size_t size) {
+	while (table->size > size) {
+		HpackEntry *entry = entryAt(table, table->count - 1);
+		table->size -= entry->size;
+		free(entry->name);
+		entry->name = entry->value = NULL;
+		table->count--;
+	}
+}
+
+/**
+ * Add a field to a dynamic table, evicting entries to make room.
+ * A field larger than the table empties it.
+ *
+ * @param table the table
+ * @param name the field name
+ * @param value the field value
+ * @return 0 if successful, -1 if out of memory
+ */
+static int addEntry(HpackTable *table, const char *name, const char *value) {
+	size_t nameLen = strlen(name);
+	size_t valueLen = strlen(value);
+	size_t size = nameLen + valueLen + ENTRY_OVERHEAD;
+	if (size > table->maxSize) {
+		evictTo(table, 0);
+		return 0;
+	}
+	char *buf = malloc(nameLen + valueLen + 2);
+	if (buf == NULL) {
+		return -1;
+	}
+	memcpy(buf, name, nameLen + 1);
+	memcpy(buf + nameLen + 1, value, valueLen + 1);
+	evictTo(table, table->maxSize - size);
+	table->newest = (table->newest + 1) % table->capacity;
+	HpackEntry *entry = &table->entries[table->newest];
+	entry->name = buf;
+	entry->value = buf + nameLen + 1;
+	entry->size = size;
+	table->count++;
+	table->size += size;
+	return 0;
+}
+
+/**
+ * Look up a field by index in the static and dynamic tables.
+ *
+ * @param table the dynamic table
+ * @param index the index, from 1
+ * @param name returns the field name
+ * @param value returns the field value
+ * @return 0 if successful, -1 if there is no such index
+ */
+static int lookupIndex(HpackTable *table, size_t index, const char **name, const char **value) {
+	if (index == 0) {
+		return -1;
+	}
+	if (index <= STATIC_TABLE_SIZE) {
+		*name = staticTable[index].name;
+		*value = staticTable[index].value;
+		return 0;
+	}
+	index -= STATIC_TABLE_SIZE + 1;
+	if (index >= table->count) {
+		return -1;
+	}
+	HpackEntry *entry = entryAt(table, index);
+	*name = entry->name;
+	*value = entry->value;
+	return 0;
+}
+
+/**
+ * Initialize a dynamic table.
+ *
+ * @param table the table
+ * @param limit the largest size the table may have
+ * @return 0 if successful, -1 if out of memory
+ */
+int hpackInit(HpackTable *table, size_t limit) {
+	// every entry counts at least the overhead
+	table->capacity = limit / ENTRY_OVERHEAD + 1;
+	table->entries = calloc(table->capacity, sizeof(HpackEntry));
+	table->newest = 0;
+	table->count = 0;
+	table->size = 0;
+	table->maxSize = limit;
+	table->limit = limit;
+	table->sizeUpdate = false;
+	return (table->entries == NULL) ? -1 : 0;
+}
+
+/**
+ * Free the entries of a dynamic table.
+ * @param table the table
+ */
+void hpackFree(HpackTable *table) {
+	if (table->entries != NULL) {
+		evictTo(table, 0);
+		free(table->entries);
+		table->entries = NULL;
+	}
+}
+
+/**
+ * Change the largest size of an encoder's table, when the peer
+ * changes its SETTINGS_HEADER_TABLE_SIZE. The new size is signalled
+ * at the start of the next header block.
+ *
+ * @param table the table
+ * @param limit the new largest size
+ */
+void hpackSetLimit(HpackTable *table, size_t limit) {
+	// the table never grows beyond the size it was created with
+	size_t maxSize = (limit < table->limit) ? limit : table->limit;
+	if (maxSize != table->maxSize) {
+		table->maxSize = maxSize;
+		evictTo(table, maxSize);
+		table->sizeUpdate = true;
+	}
+}
+
+/**
+ * Decode a header block, calling a function for each field in order.
+ *
+ * @param table the decoder's dynamic table
+ * @param block the header block
+ * @param len the length of the block
+ * @param field called with each NUL-terminated name and value;
+ *  decoding stops if it returns non-zero
+ * @param arg passed to field
+ * @return 0 if successful, -1 if the block is malformed, or the
+ *  non-zero value of field
+ */
+int hpackDecode(HpackTable *table, const unsigned char *block, size_t len,
+				int (*field)(void *arg, const char *name, const char *value), void *arg) {
+	const unsigned char *p = block;
+	const unsigned char *end = block + len;
+	while (p < end) {
+		unsigned char b = *p;
+		size_t index;
+		const char *name, *value;
+		if (b & 0x80) {
+			// indexed field
+			if (decodeInt(&p, end, 7, &index) != 0 || lookupIndex(table, index, &name, &value) != 0) {
+				return -1;
+			}
+			int status = field(arg, name, value);
+			if (status != 0) {
+				return status;
+			}
+			continue;
+		}
+		if ((b & 0xe0) == 0x20) {
+			// dynamic table size update
+			if (decodeInt(&p, end, 5, &index) != 0 || index > table->limit) {
+				return -1;
+			}
+			table->maxSize = index;
+			evictTo(table, index);
+			continue;
+		}
+
+		// literal field, with incremental indexing (01), or
+		// without indexing (0000) or never indexed (0001)
+		bool indexing = (b & 0xc0) == 0x40;
+		if (decodeInt(&p, end, indexing ? 6 : 4, &index) != 0) {
+			return -1;
+		}
+		char *newName = NULL;
+		if (index == 0) {
+			newName = decodeString(&p, end);
+		} else if (lookupIndex(table, index, &name, &value) == 0) {
+			// copied: adding the field may evict the entry
+			newName = strdup(name);
+		}
+		char *newValue = (newName != NULL) ? decodeString(&p, end) : NULL;
+		int status = -1;
+		if (newValue != NULL) {
+			status = field(arg, newName, newValue);
+			if (status == 0 && indexing && addEntry(table, newName, newValue) != 0) {
+				status = -1;
+			}
+		}
+		free(newName);
+		free(newValue);
+		if (status != 0) {
+			return status;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Encode a field to a header block. A field already in a table is
+ * sent as its index; otherwise it is sent as a literal, and added to
+ * the dynamic table if indexing is requested. Names must be lower case.
+ *
+ * @param table the encoder's dynamic table
+ * @param buf the header block buffer
+ * @param size the space left in the buffer
+ * @param name the field name
+ * @param value the field value
+ * @param indexing add the field to the dynamic table
+ * @return the number of bytes written, or 0 if there was no room
+ */
+size_t hpackEncode(HpackTable *table, unsigned char *buf, size_t size,
+				   const char *name, const char *value, bool indexing) {
+	size_t n = 0;
+	if (table->sizeUpdate) {
+		// a reduced table size is signalled before the first field
+		if ((n = encodeInt(buf, size, 0x20, 5, table->maxSize)) == 0) {
+			return 0;
+		}
+	}
+
+	// a whole field, or failing that a name, in the tables
+	size_t nameIndex = 0;
+	for (size_t i = 1; i <= STATIC_TABLE_SIZE; i++) {
+		if (strcmp(staticTable[i].name, name) == 0) {
+			if (strcmp(staticTable[i].value, value) == 0) {
+				size_t len = encodeInt(buf + n, size - n, 0x80, 7, i);
+				if (len == 0) {
+					return 0;
+				}
+				table->sizeUpdate = false;
+				return n + len;
+			}
+			if (nameIndex == 0) {
+				nameIndex = i;
+			}
+		}
+	}
+	for (size_t i = 0; i < table->count; i++) {
+		HpackEntry *entry = entryAt(table, i);
+		if (strcmp(entry->name, name) == 0) {
+			if (strcmp(entry->value, value) == 0) {
+				size_t len = encodeInt(buf + n, size - n, 0x80, 7, STATIC_TABLE_SIZE + 1 + i);
+				if (len == 0) {
+					return 0;
+				}
+				table->sizeUpdate = false;
+				return n + len;
+			}
+			if (nameIndex == 0) {
+				nameIndex = STATIC_TABLE_SIZE + 1 + i;
+			}
+		}
+	}
+
+	// literal, with the name indexed if it was found
+	size_t len = encodeInt(buf + n, size - n, indexing ? 0x40 : 0x00, indexing ? 6 : 4, nameIndex);
+	if (len == 0) {
+		return 0;
+	}
+	n += len;
+	if (nameIndex == 0) {
+		if ((len = encodeString(buf + n, size - n, name)) == 0) {
+			return 0;
+		}
+		n += len;
+	}
+	if ((len = encodeString(buf + n, size - n, value)) == 0) {
+		return 0;
+	}
+	n += len;
+	// the decoder adds an indexed literal, so the encoder must too
+	if (indexing && addEntry(table, name, value) != 0) {
+		return 0;
+	}
+	table->sizeUpdate = false;
+	return n;
+}
@@ -0,0 +1,98 @@
+/*
+ * hpack.h
+ *
+ * Functions that decode and encode HTTP/2 header blocks with
+ * HPACK (RFC 7541): a static table of common fields, a dynamic
+ * table of recently sent fields, and Huffman coded strings.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef HPACK_H_
+#define HPACK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** default dynamic table size in bytes (SETTINGS_HEADER_TABLE_SIZE) */
+#define HPACK_TABLE_SIZE 4096
+
+/** maximum length of a decoded name or value */
+#define HPACK_MAX_STRING 8192
+
+/** Definition of an entry of a dynamic table */
+typedef struct HpackEntry {
+	char *name;                 /** field name; the value follows it */
+	char *value;                /** field value */
+	size_t size;                /** entry size: name and value lengths + 32 */
+} HpackEntry;
+
+/** Definition of a dynamic table; one for each direction of a connection */
+typedef struct HpackTable {
+	HpackEntry *entries;        /** ring of entries */
+	size_t capacity;            /** number of slots in the ring */
+	size_t newest;              /** slot of the newest entry */
+	size_t count;               /** number of entries */
+	size_t size;                /** sum of the entry sizes */
+	size_t maxSize;             /** maximum sum of the entry sizes */
+	size_t limit;               /** largest maximum the peer allows */
+	bool sizeUpdate;            /** a new maximum must be signalled (encoder) */
+} HpackTable;
+
+/**
+ * Initialize a dynamic table.
+ *
+ * @param table the table
+ * @param limit the largest size the table may have
+ * @return 0 if successful, -1 if out of memory
+ */
+int hpackInit(HpackTable *table, size_t limit);
+
+/**
+ * Free the entries of a dynamic table.
+ * @param table the table
+ */
+void hpackFree(HpackTable *table);
+
+/**
+ * Change the largest size of an encoder's table, when the peer
+ * changes its SETTINGS_HEADER_TABLE_SIZE. The new size is signalled
+ * at the start of the next header block.
+ *
+ * @param table the table
+ * @param limit the new largest size
+ */
+void hpackSetLimit(HpackTable *table, size_t limit);
+
+/**
+ * Decode a header block, calling a function for each field in order.
+ *
+ * @param table the decoder's dynamic table
+ * @param block the header block
+ * @param len the length of the block
+ * @param field called with each NUL-terminated name and value;
+ *  decoding stops if it returns non-zero
+ * @param arg passed to field
+ * @return 0 if successful, -1 if the block is malformed, or the
+ *  non-zero value of field
+ */
+int hpackDecode(HpackTable *table, const unsigned char *block, size_t len,
+				int (*field)(void *arg, const char *name, const char *value), void *arg);
+
+/**
+ * Encode a field to a header block. A field already in a table is
+ * sent as its index; otherwise it is sent as a literal, and added to
+ * the dynamic table if indexing is requested. Names must be lower case.
+ *
+ * @param table the encoder's dynamic table
+ * @param buf the header block buffer
+ * @param size the space left in the buffer
+ * @param name the field name
+ * @param value the field value
+ * @param indexing add the field to the dynamic table
+ * @return the number of bytes written, or 0 if there was no room
+ */
+size_t hpackEncode(HpackTable *table, unsigned char *buf, size_t size,
+				   const char *name, const char *value, bool indexing);
+
+#endif /* HPACK_H_ */
@@ -0,0 +1,1362 @@
+/*
+ * http2.c
+ *
+ * Functions that serve HTTP/2 over cleartext TCP (h2c).
+ *
+ * A network worker reads the frames that have arrived for a session,
+ * then parks its connection in the monitor until more arrive, as
+ * HTTP/1.1 connections are parked between requests. A complete
+ * request header block opens a stream, which is served by a disk-I/O
+ * thread. The handler writes its HTTP/1.1
+ * response to a cookie stream: the status line and headers are
+ * collected and sent as a HEADERS frame, encoded with HPACK when
+ * they are sent so the encoder's table follows the frame order, and
+ * the body is sent as DATA frames, waiting while the stream or the
+ * connection has no flow-control window left.
+ *
+ * Only HEADERS and DATA frames, and the end of a response, count as
+ * activity: a session with no stream open is closed once it has had
+ * none for the keep-alive timeout, however many other frames the
+ * client sends. The reader and the streams each hold the session;
+ * whichever ends last closes the connection.
+ *
+ * Frames are written to the socket under a write lock, so frames
+ * of concurrent streams interleave but never split. The reader
+ * credits received DATA back to the peer at once, since request
+ * bodies are discarded: only GET and HEAD are served.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  // fopencookie
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "http2.h"
+#include "hpack.h"
+#include "http_server.h"
+#include "http_methods.h"
+#include "http_util.h"
+#include "file_util.h"
+#include "time_util.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "disk_io.h"
+#include "content_bundle.h"
+#include "rate_limit.h"
+#include "thpool.h"
+
+/** frame types */
+#define FRAME_DATA          0x0
+#define FRAME_HEADERS       0x1
+#define FRAME_PRIORITY      0x2
+#define FRAME_RST_STREAM    0x3
+#define FRAME_SETTINGS      0x4
+#define FRAME_PUSH_PROMISE  0x5
+#define FRAME_PING          0x6
+#define FRAME_GOAWAY        0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION  0x9
+
+/** frame flags */
+#define FLAG_END_STREAM     0x1
+#define FLAG_ACK            0x1
+#define FLAG_END_HEADERS    0x4
+#define FLAG_PADDED         0x8
+#define FLAG_PRIORITY       0x20
+
+/** error codes */
+#define NO_ERROR            0x0
+#define PROTOCOL_ERROR      0x1
+#define INTERNAL_ERROR      0x2
+#define FLOW_CONTROL_ERROR  0x3
+#define STREAM_CLOSED       0x5
+#define FRAME_SIZE_ERROR    0x6
+#define REFUSED_STREAM      0x7
+#define CANCEL              0x8
+#define COMPRESSION_ERROR   0x9
+#define ENHANCE_YOUR_CALM   0xb
+
+/** settings */
+#define SETTINGS_HEADER_TABLE_SIZE      0x1
+#define SETTINGS_ENABLE_PUSH            0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define SETTINGS_MAX_FRAME_SIZE         0x5
+
+/** length of a frame header */
+#define FRAME_HEADER_LEN 9
+
+/** default and smallest maximum frame payload; the largest accepted */
+#define DEFAULT_FRAME_SIZE 16384
+
+/** largest frame payload a peer may allow */
+#define MAX_FRAME_SIZE 16777215
+
+/** initial flow-control window */
+#define DEFAULT_WINDOW 65535
+
+/** largest flow-control window */
+#define MAX_WINDOW 0x7fffffff
+
+/** largest request header block */
+#define MAX_HEADER_BLOCK 65536
+
+/** largest HTTP/1.1 response head a handler may write */
+#define MAX_RESPONSE_HEAD 8192
+
+/** rest of the connection preface after its request line */
+static const char prefaceTail[] = "\r\nSM\r\n\r\n";
+
+/** the whole connection preface */
+static const char preface[] = HTTP2_PREFACE_LINE "\r\n\r\nSM\r\n\r\n";
+
+typedef struct Http2Session Http2Session;
+
+/** Definition of a stream: one request and its response */
+typedef struct Http2Stream {
+	Http2Session *session;          /** the session */
+	uint32_t id;                    /** stream identifier */
+	int64_t sendWindow;             /** bytes the peer accepts on this stream */
+	bool reset;                     /** reset by the peer, or the session closed */
+	bool endStream;                 /** the request is complete */
+	bool malformed;                 /** a pseudo-header is missing, unknown, or misplaced */
+	bool regularSeen;               /** a regular request header was decoded */
+	char method[MAXBUF];            /** the :method */
+	char target[MAXBUF];            /** the :path */
+	Properties *requestHeaders;     /** the request headers */
+	char head[MAX_RESPONSE_HEAD];   /** response status line and headers */
+	size_t headLen;                 /** bytes in head */
+	bool headDone;                  /** the response head is complete */
+	bool headersSent;               /** the HEADERS frame was sent */
+	struct Http2Stream *next;       /** next stream of the session */
+} Http2Stream;
+
+/** Definition of a session: one HTTP/2 connection */
+struct Http2Session {
+	Connection *conn;               /** the connection */
+	const ServerConfig *config;     /** configuration the connection is served with */
+	pthread_mutex_t lock;           /** guards the streams and windows */
+	pthread_cond_t changed;         /** a window grew, or a stream or the session ended */
+	pthread_mutex_t writeLock;      /** serializes frames and guards the encoder */
+	HpackTable decoder;             /** request header table; used by the reader only */
+	HpackTable encoder;             /** response header table */
+	Http2Stream *streams;           /** streams being served */
+	int nstreams;                   /** number of streams being served */
+	int nopen;                      /** streams whose response has not ended */
+	uint32_t lastStreamId;          /** highest stream opened by the client */
+	int64_t sendWindow;             /** bytes the peer accepts on the connection */
+	int64_t initialWindow;          /** the peer's initial stream window */
+	uint32_t maxFrame;              /** the peer's largest frame payload */
+	atomic_bool closed;             /** the connection failed or is closing */
+	unsigned char *block;           /** request header block being assembled */
+	size_t blockLen;                /** bytes in block */
+	uint32_t blockStream;           /** stream of the header block, 0 if none */
+	bool blockEndStream;            /** the HEADERS frame ended its stream */
+	bool firstCharged;              /** the dispatch charged the rate limit for the first stream */
+	unsigned char *payload;         /** frame payload being read */
+	_Atomic uint64_t activeAt;      /** monotonic ns of the last request frame or response end */
+	bool readerDone;                /** the reader ended; the last stream frees the session */
+};
+
+/**
+ * Read a 32-bit big-endian value.
+ * @param p the bytes
+ * @return the value
+ */
+static uint32_t get32(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/**
+ * Write a 32-bit big-endian value.
+ * @param p the bytes
+ * @param v the value
+ */
+static void put32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/**
+ * Mark a session closed and wake everything waiting on it. The
+ * socket is shut down, so the reader sees the end of the connection.
+ * @param session the session
+ */
+static void closeSession(Http2Session *session) {
+	if (!atomic_exchange(&session->closed, true)) {
+		shutdown(session->conn->sock_fd, SHUT_RDWR);
+	}
+	pthread_mutex_lock(&session->lock);
+	pthread_cond_broadcast(&session->changed);
+	pthread_mutex_unlock(&session->lock);
+}
+
+/**
+ * Free a session once its reader and its streams have ended,
+ * and close its connection.
+ * @param session the session
+ */
+static void freeSession(Http2Session *session) {
+	Connection *conn = session->conn;
+	hpackFree(&session->decoder);
+	hpackFree(&session->encoder);
+	free(session->block);
+	free(session->payload);
+	pthread_cond_destroy(&session->changed);
+	pthread_mutex_destroy(&session->lock);
+	pthread_mutex_destroy(&session->writeLock);
+	releaseConfig(session->config);
+	free(session);
+	closeConnection(conn);
+}
+
+/**
+ * End the reader of a session: the streams still being served fail
+ * their next write, and the last of them frees the session.
+ * @param session the session
+ */
+static void releaseReader(Http2Session *session) {
+	cancelDeadline(session->conn);
+	closeSession(session);
+	pthread_mutex_lock(&session->lock);
+	for (Http2Stream *stream = session->streams; stream != NULL; stream = stream->next) {
+		stream->reset = true;
+	}
+	session->readerDone = true;
+	bool last = (session->nstreams == 0);
+	pthread_mutex_unlock(&session->lock);
+	if (last) {
+		freeSession(session);
+	}
+}
+
+/**
+ * Write a frame to the socket. Called with the write lock held.
+ *
+ * @param session the session
+ * @param type the frame type
+ * @param flags the frame flags
+ * @param streamId the stream, or 0 for the connection
+ * @param payload the payload
+ * @param len the payload length
+ * @return 0 if successful, -1 if the connection failed
+ */
+static int writeFrame(Http2Session *session, int type, int flags, uint32_t streamId,
+					  const void *payload, size_t len) {
+	if (atomic_load(&session->closed)) {
+		return -1;
+	}
+	unsigned char header[FRAME_HEADER_LEN];
+	header[0] = len >> 16;
+	header[1] = len >> 8;
+	header[2] = len;
+	header[3] = type;
+	header[4] = flags;
+	put32(header + 5, streamId & MAX_WINDOW);
+	struct iovec iov[2] = {
+		{ header, sizeof(header) },
+		{ (void *)payload, len }
+	};
+	struct iovec *v = iov;
+	int iovcnt = (len > 0) ? 2 : 1;
+	while (iovcnt > 0) {
+		// a client that went away must not raise SIGPIPE
+		struct msghdr msg = { .msg_iov = v, .msg_iovlen = iovcnt };
+		ssize_t n = sendmsg(session->conn->sock_fd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			closeSession(session);
+			return -1;
+		}
+		for (; iovcnt > 0 && (size_t)n >= v->iov_len; v++, iovcnt--) {
+			n -= v->iov_len;
+		}
+		if (iovcnt > 0) {
+			v->iov_base = (char *)v->iov_base + n;
+			v->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Send a frame.
+ *
+ * @param session the session
+ * @param type the frame type
+ * @param flags the frame flags
+ * @param streamId the stream, or 0 for the connection
+ * @param payload the payload
+ * @param len the payload length
+ * @return 0 if successful, -1 if the connection failed
+ */
+static int sendFrame(Http2Session *session, int type, int flags, uint32_t streamId,
+					 const void *payload, size_t len) {
+	pthread_mutex_lock(&session->writeLock);
+	int status = writeFrame(session, type, flags, streamId, payload, len);
+	pthread_mutex_unlock(&session->writeLock);
+	return status;
+}
+
+/**
+ * Send a RST_STREAM frame.
+ *
+ * @param session the session
+ * @param streamId the stream
+ * @param code the error code
+ */
+static void sendReset(Http2Session *session, uint32_t streamId, uint32_t code) {
+	unsigned char payload[4];
+	put32(payload, code);
+	sendFrame(session, FRAME_RST_STREAM, 0, streamId, payload, sizeof(payload));
+}
+
+/**
+ * Send a GOAWAY frame.
+ *
+ * @param session the session
+ * @param code the error code
+ */
+static void sendGoaway(Http2Session *session, uint32_t code) {
+	unsigned char payload[8];
+	put32(payload, session->lastStreamId);
+	put32(payload + 4, code);
+	sendFrame(session, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+/**
+ * Send a WINDOW_UPDATE frame.
+ *
+ * @param session the session
+ * @param streamId the stream, or 0 for the connection
+ * @param increment the window increment
+ */
+static void sendWindowUpdate(Http2Session *session, uint32_t streamId, uint32_t increment) {
+	unsigned char payload[4];
+	put32(payload, increment);
+	sendFrame(session, FRAME_WINDOW_UPDATE, 0, streamId, payload, sizeof(payload));
+}
+
+/**
+ * Wait until a stream may send DATA, then take what it may send
+ * from the stream and connection windows.
+ *
+ * @param stream the stream
+ * @param want the bytes the stream has to send
+ * @return the bytes it may send, or -1 if the stream was reset, the
+ *  connection failed, or the write timeout passed
+ */
+static ssize_t reserveWindow(Http2Stream *stream, size_t want) {
+	Http2Session *session = stream->session;
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += session->config->writeTimeoutMs / 1000;
+	deadline.tv_nsec += (session->config->writeTimeoutMs % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	ssize_t n = -1;
+	pthread_mutex_lock(&session->lock);
+	while (!stream->reset && !atomic_load(&session->closed)) {
+		int64_t window = (stream->sendWindow < session->sendWindow) ? stream->sendWindow : session->sendWindow;
+		if (window > 0) {
+			n = (want < (size_t)window) ? (ssize_t)want : (ssize_t)window;
+			if ((size_t)n > session->maxFrame) {
+				n = session->maxFrame;
+			}
+			stream->sendWindow -= n;
+			session->sendWindow -= n;
+			break;
+		}
+		if (pthread_cond_timedwait(&session->changed, &session->lock, &deadline) == ETIMEDOUT) {
+			statsIncrement(timeoutsWrite);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&session->lock);
+	return n;
+}
+
+/**
+ * Return whether a response header is specific to an HTTP/1.1
+ * connection and must not be sent over HTTP/2.
+ * @param name the header name
+ * @return true if the header is dropped
+ */
+static bool connectionHeader(const char *name) {
+	return strcasecmp(name, "Connection") == 0
+		|| strcasecmp(name, "Keep-Alive") == 0
+		|| strcasecmp(name, "Proxy-Connection") == 0
+		|| strcasecmp(name, "Transfer-Encoding") == 0
+		|| strcasecmp(name, "Upgrade") == 0;
+}
+
+/**
+ * Return whether a response header value changes from response to
+ * response, so adding it to the encoder's table would only evict
+ * headers that repeat.
+ * @param name the lower-case header name
+ * @return true if the header is sent without indexing
+ */
+static bool volatileHeader(const char *name) {
+	return strcmp(name, "content-length") == 0
+		|| strcmp(name, "date") == 0
+		|| strcmp(name, "last-modified") == 0
+		|| strcmp(name, "etag") == 0
+		|| strcmp(name, "content-range") == 0;
+}
+
+/**
+ * Encode the collected response head as a header block and send it
+ * in a HEADERS frame, followed by CONTINUATION frames if the block
+ * is larger than the peer's frame size.
+ *
+ * @param stream the stream
+ * @param endStream the response has no body
+ * @return 0 if successful, -1 if error
+ */
+static int sendHeaders(Http2Stream *stream, bool endStream) {
+	Http2Session *session = stream->session;
+	unsigned char block[MAX_RESPONSE_HEAD + 64];
+	size_t len = 0;
+
+	// "HTTP/1.1 200 OK", then "Name: value" lines
+	char *line = stream->head;
+	char *eol = strstr(line, CRLF);
+	char *sp = strchr(line, ' ');
+	if (eol == NULL || sp == NULL || sp > eol) {
+		return -1;
+	}
+	char status[4];
+	snprintf(status, sizeof(status), "%.3s", sp + 1);
+
+	pthread_mutex_lock(&session->writeLock);
+	size_t n = hpackEncode(&session->encoder, block, sizeof(block), ":status", status, false);
+	len += n;
+	for (line = eol + 2; n > 0 && (eol = strstr(line, CRLF)) != NULL && eol != line; line = eol + 2) {
+		*eol = '\0';
+		char *colon = strchr(line, ':');
+		if (colon == NULL) {
+			continue;
+		}
+		*colon = '\0';
+		char *value = colon + 1;
+		while (*value == ' ') {
+			value++;
+		}
+		if (connectionHeader(line)) {
+			continue;
+		}
+		for (char *p = line; *p != '\0'; p++) {
+			*p = tolower((unsigned char)*p);
+		}
+		n = hpackEncode(&session->encoder, block + len, sizeof(block) - len, line, value, !volatileHeader(line));
+		len += n;
+	}
+	int result = -1;
+	if (n > 0) {
+		// HEADERS, then CONTINUATION frames of at most the peer's frame size
+		int type = FRAME_HEADERS;
+		int flags = endStream ? FLAG_END_STREAM : 0;
+		size_t offset = 0;
+		do {
+			size_t chunk = (len - offset < session->maxFrame) ? len - offset : session->maxFrame;
+			if (offset + chunk == len) {
+				flags |= FLAG_END_HEADERS;
+			}
+			result = writeFrame(session, type, flags, stream->id, block + offset, chunk);
+			offset += chunk;
+			type = FRAME_CONTINUATION;
+			flags = 0;
+		} while (result == 0 && offset < len);
+	}
+	pthread_mutex_unlock(&session->writeLock);
+	stream->headersSent = true;
+	return result;
+}
+
+/**
+ * Send the response body in DATA frames.
+ *
+ * @param stream the stream
+ * @param buf the body bytes
+ * @param len the number of bytes
+ * @return 0 if successful, -1 if error
+ */
+static int sendData(Http2Stream *stream, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = reserveWindow(stream, len);
+		if (n < 0 || sendFrame(stream->session, FRAME_DATA, 0, stream->id, buf, n) != 0) {
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Collect bytes of the response head. An interim 1xx response is
+ * dropped, since the request is already complete.
+ *
+ * @param stream the stream
+ * @param buf the bytes written by the handler
+ * @param size the number of bytes
+ * @return the number of bytes that belong to the head, or -1 if
+ *  the head is too long
+ */
+static ssize_t collectHead(Http2Stream *stream, const char *buf, size_t size) {
+	size_t start = (stream->headLen > 3) ? stream->headLen - 3 : 0;
+	size_t n = sizeof(stream->head) - 1 - stream->headLen;
+	if (n > size) {
+		n = size;
+	}
+	memcpy(stream->head + stream->headLen, buf, n);
+	stream->headLen += n;
+	stream->head[stream->headLen] = '\0';
+	char *end = strstr(stream->head + start, "\r\n\r\n");
+	if (end == NULL) {
+		return (n == size) ? (ssize_t)n : -1;
+	}
+	size_t used = (end + 4 - stream->head) - (stream->headLen - n);
+	stream->headLen = end + 4 - stream->head;
+	stream->head[stream->headLen] = '\0';
+	char *sp = strchr(stream->head, ' ');
+	if (sp != NULL && sp[1] == '1') {
+		stream->headLen = 0;
+	} else {
+		stream->headDone = true;
+	}
+	return used;
+}
+
+/**
+ * Write function of a stream's cookie stream.
+ *
+ * @param cookie the stream
+ * @param buf the bytes
+ * @param size the number of bytes
+ * @return the number of bytes, or -1 if error
+ */
+static ssize_t streamWrite(void *cookie, const char *buf, size_t size) {
+	Http2Stream *stream = cookie;
+	size_t used = 0;
+	while (!stream->headDone && used < size) {
+		ssize_t n = collectHead(stream, buf + used, size - used);
+		if (n < 0) {
+			return -1;
+		}
+		used += n;
+	}
+	if (used == size) {
+		return size;
+	}
+	if (!stream->headersSent && sendHeaders(stream, false) != 0) {
+		return -1;
+	}
+	return (sendData(stream, buf + used, size - used) == 0) ? (ssize_t)size : -1;
+}
+
+/**
+ * Stop counting a stream against the concurrency limit, before its
+ * last frame is sent, since the client may open another stream as
+ * soon as it sees the end of this one.
+ * @param session the session
+ */
+static void closeStreamSlot(Http2Session *session) {
+	pthread_mutex_lock(&session->lock);
+	session->nopen--;
+	pthread_mutex_unlock(&session->lock);
+}
+
+/**
+ * Close function of a stream's cookie stream, which ends the stream.
+ *
+ * @param cookie the stream
+ * @return 0 if successful, -1 if error
+ */
+static int streamClose(void *cookie) {
+	Http2Stream *stream = cookie;
+	Http2Session *session = stream->session;
+	closeStreamSlot(session);
+	int status;
+	if (!stream->headDone) {
+		status = -1;
+	} else if (!stream->headersSent) {
+		status = sendHeaders(stream, true);
+	} else {
+		status = sendFrame(session, FRAME_DATA, FLAG_END_STREAM, stream->id, NULL, 0);
+	}
+	if (status != 0) {
+		sendReset(session, stream->id, INTERNAL_ERROR);
+	}
+	return status;
+}
+
+/** functions of a stream's cookie stream */
+static const cookie_io_functions_t streamIo = {
+	.read = NULL,
+	.write = streamWrite,
+	.seek = NULL,
+	.close = streamClose
+};
+
+/**
+ * Serve the request of a stream with the HTTP/1.1 handlers.
+ *
+ * @param stream the stream
+ * @param out the response stream
+ */
+static void serveStream(Http2Stream *stream, FILE *out) {
+	char buf[MAXBUF];
+	Properties *responseHeaders = newProperties();
+	putProperty(responseHeaders, "Server", "Tiny C Http Server");
+	time_t timer;
+	time(&timer);
+	putProperty(responseHeaders, "Date", milliTimeToRFC_1123_Date_Time(timer, buf));
+
+	// save the query as key "?", as for HTTP/1.1
+	char encUri[MAXBUF];
+	char uri[MAXBUF];
+	snprintf(encUri, sizeof(encUri), "%s", stream->target);
+	char *p = strpbrk(encUri, "?&");
+	if (p != NULL) {
+		putProperty(stream->requestHeaders, "?", p+1);
+		*p = '\0';
+	}
+	bool validUri = !stream->malformed && normalizeUri(encUri, uri, sizeof(uri)) != NULL;
+	bool isGet = strcmp(stream->method, "GET") == 0;
+	bool isHead = strcmp(stream->method, "HEAD") == 0;
+	if (debug) {
+		fprintf(stderr, "HTTP/2 stream %u: %s %s\n", stream->id, stream->method, stream->target);
+	}
+
+	if (!validUri) {
+		sendErrorResponse(out, 400, "Bad Request", responseHeaders);
+	} else if (!isGet && !isHead) {
+		putProperty(responseHeaders, "Allow", "GET, HEAD");
+		sendErrorResponse(out, 405, "Method not Allowed", responseHeaders);
+	} else if (contentBundleOpen() && strcmp(uri, SERVER_STATUS_URI) != 0) {
+		if (isGet) {
+			do_get_bundled(out, uri, stream->requestHeaders, responseHeaders);
+		} else {
+			do_head_bundled(out, uri, stream->requestHeaders, responseHeaders);
+		}
+	} else if (isGet && strcmp(uri, SERVER_STATUS_URI) == 0) {
+		do_server_status(out, uri, stream->requestHeaders, responseHeaders);
+	} else if (isGet) {
+		do_get(out, uri, stream->requestHeaders, responseHeaders);
+	} else {
+		do_head(out, uri, stream->requestHeaders, responseHeaders);
+	}
+	deleteProperties(responseHeaders);
+}
+
+/**
+ * Task for a disk-I/O thread that serves a stream and ends it.
+ * @param arg the stream
+ */
+static void streamTask(void *arg) {
+	Http2Stream *stream = arg;
+	Http2Session *session = stream->session;
+	setThreadConfig(session->config);
+	FILE *out = fopencookie(stream, "w", streamIo);
+	if (out != NULL) {
+		// full frames of the default size
+		setvbuf(out, NULL, _IOFBF, DEFAULT_FRAME_SIZE);
+		serveStream(stream, out);
+		fclose(out);
+	} else {
+		closeStreamSlot(session);
+		sendReset(session, stream->id, INTERNAL_ERROR);
+	}
+	setThreadConfig(NULL);
+
+	pthread_mutex_lock(&session->lock);
+	for (Http2Stream **s = &session->streams; *s != NULL; s = &(*s)->next) {
+		if (*s == stream) {
+			*s = stream->next;
+			break;
+		}
+	}
+	session->nstreams--;
+	bool last = session->readerDone && session->nstreams == 0;
+	if (!session->readerDone && session->nstreams == 0) {
+		// idle from now; the reader may be parked without a deadline
+		atomic_store_explicit(&session->activeAt, monotonicTimeNanos(), memory_order_relaxed);
+		armDeadline(session->conn, DEADLINE_KEEPALIVE);
+	}
+	pthread_cond_broadcast(&session->changed);
+	pthread_mutex_unlock(&session->lock);
+	deleteProperties(stream->requestHeaders);
+	free(stream);
+	if (last) {
+		freeSession(session);
+	}
+}
+
+/**
+ * Find a stream being served. Called with the session lock held.
+ *
+ * @param session the session
+ * @param id the stream identifier
+ * @return the stream, or NULL if it is not being served
+ */
+static Http2Stream *findStream(Http2Session *session, uint32_t id) {
+	for (Http2Stream *stream = session->streams; stream != NULL; stream = stream->next) {
+		if (stream->id == id) {
+			return stream;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Allocate a stream.
+ *
+ * @param session the session
+ * @param id the stream identifier
+ * @return the stream, or NULL if out of memory
+ */
+static Http2Stream *newStream(Http2Session *session, uint32_t id) {
+	Http2Stream *stream = calloc(1, sizeof(Http2Stream));
+	if (stream == NULL) {
+		return NULL;
+	}
+	stream->session = session;
+	stream->id = id;
+	stream->requestHeaders = newProperties();
+	return stream;
+}
+
+/**
+ * Start serving a stream, or refuse it if the client is over its
+ * rate limit, the session has too many streams or the disk-I/O pool
+ * is full, so the client can retry it.
+ *
+ * @param session the session
+ * @param stream the stream
+ */
+static void startStream(Http2Session *session, Http2Stream *stream) {
+	// each stream is a request, so HTTP/2 does not bypass the rate
+	// limit; the first was charged when the connection was dispatched
+	bool charged = session->firstCharged;
+	session->firstCharged = false;
+	bool limited = !charged && !rateLimitAllow(session->conn->peerAddr);
+	if (limited) {
+		statsIncrement(shedRateLimited);
+	}
+	pthread_mutex_lock(&session->lock);
+	bool refused = limited || session->nopen >= session->config->http2MaxConcurrentStreams;
+	if (!refused) {
+		stream->sendWindow = session->initialWindow;
+		stream->next = session->streams;
+		session->streams = stream;
+		session->nstreams++;
+		session->nopen++;
+	}
+	pthread_mutex_unlock(&session->lock);
+
+	statsIncrement(http2Streams);
+	statsIncrement(requestsServed);
+	if (!refused && submitDiskWork(streamTask, stream) != 0) {
+		// not started, so nothing else refers to it
+		pthread_mutex_lock(&session->lock);
+		session->streams = stream->next;
+		session->nstreams--;
+		session->nopen--;
+		pthread_mutex_unlock(&session->lock);
+		refused = true;
+	}
+	if (refused) {
+		sendReset(session, stream->id, REFUSED_STREAM);
+		deleteProperties(stream->requestHeaders);
+		free(stream);
+	}
+}
+
+/**
+ * Field callback that collects the request headers of a stream.
+ *
+ * @param arg the stream
+ * @param name the field name
+ * @param value the field value
+ * @return 0
+ */
+static int collectField(void *arg, const char *name, const char *value) {
+	Http2Stream *stream = arg;
+	if (*name != ':') {
+		stream->regularSeen = true;
+		putProperty(stream->requestHeaders, name, value);
+		return 0;
+	}
+	// pseudo-headers precede the regular headers
+	size_t len = strlen(value);
+	if (stream->regularSeen) {
+		stream->malformed = true;
+	} else if (strcmp(name, ":method") == 0 && len < sizeof(stream->method)) {
+		strcpy(stream->method, value);
+	} else if (strcmp(name, ":path") == 0 && len < sizeof(stream->target)) {
+		strcpy(stream->target, value);
+	} else if (strcmp(name, ":authority") == 0) {
+		putProperty(stream->requestHeaders, "Host", value);
+	} else if (strcmp(name, ":scheme") != 0) {
+		stream->malformed = true;
+	}
+	return 0;
+}
+
+/**
+ * Field callback that discards trailers.
+ *
+ * @param arg unused
+ * @param name the field name
+ * @param value the field value
+ * @return 0
+ */
+static int discardField(void *arg, const char *name, const char *value) {
+	(void)arg;
+	(void)name;
+	(void)value;
+	return 0;
+}
+
+/**
+ * Decode a complete request header block: open its stream, or take
+ * it as the trailers of a stream whose body is being discarded.
+ *
+ * @param session the session
+ * @return 0 if successful, or a connection error code
+ */
+static uint32_t endHeaderBlock(Http2Session *session) {
+	uint32_t id = session->blockStream;
+	session->blockStream = 0;
+	if (id <= session->lastStreamId) {
+		// every block updates the decoder's table, even if it is not used
+		if (hpackDecode(&session->decoder, session->block, session->blockLen, discardField, NULL) != 0) {
+			return COMPRESSION_ERROR;
+		}
+		pthread_mutex_lock(&session->lock);
+		Http2Stream *stream = findStream(session, id);
+		if (stream != NULL && session->blockEndStream) {
+			stream->endStream = true;
+		}
+		pthread_mutex_unlock(&session->lock);
+		return (stream != NULL) ? NO_ERROR : STREAM_CLOSED;
+	}
+
+	session->lastStreamId = id;
+	Http2Stream *stream = newStream(session, id);
+	if (stream == NULL) {
+		return INTERNAL_ERROR;
+	}
+	if (hpackDecode(&session->decoder, session->block, session->blockLen, collectField, stream) != 0) {
+		deleteProperties(stream->requestHeaders);
+		free(stream);
+		return COMPRESSION_ERROR;
+	}
+	stream->endStream = session->blockEndStream;
+	stream->malformed = stream->malformed || *stream->method == '\0' || *stream->target == '\0';
+	startStream(session, stream);
+	return NO_ERROR;
+}
+
+/**
+ * Apply one of the peer's settings.
+ *
+ * @param session the session
+ * @param id the setting
+ * @param value the value
+ * @return 0 if successful, or a connection error code
+ */
+static uint32_t applySetting(Http2Session *session, uint16_t id, uint32_t value) {
+	switch (id) {
+	case SETTINGS_HEADER_TABLE_SIZE:
+		pthread_mutex_lock(&session->writeLock);
+		hpackSetLimit(&session->encoder, value);
+		pthread_mutex_unlock(&session->writeLock);
+		break;
+	case SETTINGS_ENABLE_PUSH:
+		if (value > 1) {
+			return PROTOCOL_ERROR;
+		}
+		break;
+	case SETTINGS_INITIAL_WINDOW_SIZE:
+		if (value > MAX_WINDOW) {
+			return FLOW_CONTROL_ERROR;
+		}
+		// the change applies to the windows of open streams
+		pthread_mutex_lock(&session->lock);
+		int64_t delta = (int64_t)value - session->initialWindow;
+		session->initialWindow = value;
+		for (Http2Stream *stream = session->streams; stream != NULL; stream = stream->next) {
+			stream->sendWindow += delta;
+		}
+		pthread_cond_broadcast(&session->changed);
+		pthread_mutex_unlock(&session->lock);
+		break;
+	case SETTINGS_MAX_FRAME_SIZE:
+		if (value < DEFAULT_FRAME_SIZE || value > MAX_FRAME_SIZE) {
+			return PROTOCOL_ERROR;
+		}
+		pthread_mutex_lock(&session->lock);
+		session->maxFrame = value;
+		pthread_mutex_unlock(&session->lock);
+		break;
+	default:
+		break;  // unknown settings are ignored
+	}
+	return NO_ERROR;
+}
+
+/**
+ * Apply a list of settings.
+ *
+ * @param session the session
+ * @param payload the settings, six bytes each
+ * @param len the length of the list
+ * @return 0 if successful, or a connection error code
+ */
+static uint32_t applySettings(Http2Session *session, const unsigned char *payload, size_t len) {
+	if (len % 6 != 0) {
+		return FRAME_SIZE_ERROR;
+	}
+	for (size_t i = 0; i < len; i += 6) {
+		uint32_t error = applySetting(session, (uint16_t)(payload[i] << 8 | payload[i+1]), get32(payload + i + 2));
+		if (error != NO_ERROR) {
+			return error;
+		}
+	}
+	return NO_ERROR;
+}
+
+/**
+ * Strip the padding of a DATA or HEADERS frame payload.
+ *
+ * @param flags the frame flags
+ * @param payload the payload; advanced past the pad length
+ * @param len the payload length; reduced to the content
+ * @return true if successful, false if the padding is too long
+ */
+static bool stripPadding(int flags, const unsigned char **payload, size_t *len) {
+	if (!(flags & FLAG_PADDED)) {
+		return true;
+	}
+	if (*len < 1 || (size_t)(*payload)[0] >= *len) {
+		return false;
+	}
+	*len -= 1 + (*payload)[0];
+	(*payload)++;
+	return true;
+}
+
+/**
+ * Append a fragment to the header block being assembled.
+ *
+ * @param session the session
+ * @param fragment the fragment
+ * @param len the fragment length
+ * @param flags the frame flags
+ * @return 0 if successful, or a connection error code
+ */
+static uint32_t addHeaderFragment(Http2Session *session, const unsigned char *fragment, size_t len, int flags) {
+	if (session->blockLen + len > MAX_HEADER_BLOCK) {
+		return ENHANCE_YOUR_CALM;
+	}
+	memcpy(session->block + session->blockLen, fragment, len);
+	session->blockLen += len;
+	return (flags & FLAG_END_HEADERS) ? endHeaderBlock(session) : NO_ERROR;
+}
+
+/**
+ * Process one frame from the peer.
+ *
+ * @param session the session
+ * @param type the frame type
+ * @param flags the frame flags
+ * @param id the stream, or 0 for the connection
+ * @param payload the payload
+ * @param len the payload length
+ * @return 0 if successful, or a connection error code
+ */
+static uint32_t processFrame(Http2Session *session, int type, int flags, uint32_t id,
+							 const unsigned char *payload, size_t len) {
+	// a header block continues in the frames that immediately follow
+	if (session->blockStream != 0 && (type != FRAME_CONTINUATION || id != session->blockStream)) {
+		return PROTOCOL_ERROR;
+	}
+
+	switch (type) {
+	case FRAME_DATA:
+		if (id == 0) {
+			return PROTOCOL_ERROR;
+		}
+		atomic_store_explicit(&session->activeAt, monotonicTimeNanos(), memory_order_relaxed);
+		// request bodies are not used: credit them back at once
+		if (len > 0) {
+			sendWindowUpdate(session, 0, len);
+		}
+		pthread_mutex_lock(&session->lock);
+		Http2Stream *stream = findStream(session, id);
+		bool open = stream != NULL && !stream->endStream;
+		if (open && (flags & FLAG_END_STREAM)) {
+			stream->endStream = true;
+		}
+		pthread_mutex_unlock(&session->lock);
+		if (open && len > 0 && !(flags & FLAG_END_STREAM)) {
+			sendWindowUpdate(session, id, len);
+		}
+		return stripPadding(flags, &payload, &len) ? NO_ERROR : PROTOCOL_ERROR;
+
+	case FRAME_HEADERS:
+		if (id == 0 || (id % 2) == 0) {
+			return PROTOCOL_ERROR;
+		}
+		atomic_store_explicit(&session->activeAt, monotonicTimeNanos(), memory_order_relaxed);
+		if (!stripPadding(flags, &payload, &len)) {
+			return PROTOCOL_ERROR;
+		}
+		if (flags & FLAG_PRIORITY) {
+			if (len < 5) {
+				return FRAME_SIZE_ERROR;
+			}
+			payload += 5;
+			len -= 5;
+		}
+		session->blockStream = id;
+		session->blockLen = 0;
+		session->blockEndStream = (flags & FLAG_END_STREAM) != 0;
+		return addHeaderFragment(session, payload, len, flags);
+
+	case FRAME_CONTINUATION:
+		if (session->blockStream == 0) {
+			return PROTOCOL_ERROR;
+		}
+		return addHeaderFragment(session, payload, len, flags);
+
+	case FRAME_RST_STREAM:
+		if (id == 0 || len != 4) {
+			return (id == 0) ? PROTOCOL_ERROR : FRAME_SIZE_ERROR;
+		}
+		pthread_mutex_lock(&session->lock);
+		stream = findStream(session, id);
+		if (stream != NULL) {
+			stream->reset = true;
+			pthread_cond_broadcast(&session->changed);
+		}
+		pthread_mutex_unlock(&session->lock);
+		return NO_ERROR;
+
+	case FRAME_SETTINGS:
+		if (id != 0) {
+			return PROTOCOL_ERROR;
+		}
+		if (flags & FLAG_ACK) {
+			return (len == 0) ? NO_ERROR : FRAME_SIZE_ERROR;
+		}
+		uint32_t error = applySettings(session, payload, len);
+		if (error == NO_ERROR) {
+			sendFrame(session, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+		}
+		return error;
+
+	case FRAME_PING:
+		if (id != 0 || len != 8) {
+			return (id != 0) ? PROTOCOL_ERROR : FRAME_SIZE_ERROR;
+		}
+		if (!(flags & FLAG_ACK)) {
+			sendFrame(session, FRAME_PING, FLAG_ACK, 0, payload, len);
+		}
+		return NO_ERROR;
+
+	case FRAME_WINDOW_UPDATE:
+		if (len != 4) {
+			return FRAME_SIZE_ERROR;
+		}
+		uint32_t increment = get32(payload) & MAX_WINDOW;
+		if (increment == 0) {
+			return PROTOCOL_ERROR;
+		}
+		pthread_mutex_lock(&session->lock);
+		error = NO_ERROR;
+		if (id == 0) {
+			session->sendWindow += increment;
+			if (session->sendWindow > MAX_WINDOW) {
+				error = FLOW_CONTROL_ERROR;
+			}
+		} else if ((stream = findStream(session, id)) != NULL) {
+			stream->sendWindow += increment;
+			if (stream->sendWindow > MAX_WINDOW) {
+				stream->reset = true;
+				sendReset(session, id, FLOW_CONTROL_ERROR);
+			}
+		}
+		pthread_cond_broadcast(&session->changed);
+		pthread_mutex_unlock(&session->lock);
+		return error;
+
+	case FRAME_PUSH_PROMISE:
+		return PROTOCOL_ERROR;  // clients cannot push
+
+	case FRAME_GOAWAY:
+	case FRAME_PRIORITY:
+	default:
+		// the client closes after GOAWAY; priorities and unknown frames are ignored
+		return NO_ERROR;
+	}
+}
+
+/**
+ * Decode the base64url HTTP2-Settings header of an upgrade request.
+ *
+ * @param in the header value
+ * @param out the output
+ * @param size the size of the output
+ * @return the decoded length, or -1 if invalid
+ */
+static long decodeBase64Url(const char *in, unsigned char *out, size_t size) {
+	uint32_t acc = 0;
+	int nbits = 0;
+	size_t n = 0;
+	for (; *in != '\0' && *in != '='; in++) {
+		const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+		const char *p = strchr(alphabet, *in);
+		if (p == NULL) {
+			return -1;
+		}
+		acc = (acc << 6) | (uint32_t)(p - alphabet);
+		nbits += 6;
+		if (nbits >= 8) {
+			nbits -= 8;
+			if (n == size) {
+				return -1;
+			}
+			out[n++] = (unsigned char)(acc >> nbits);
+		}
+	}
+	return n;
+}
+
+/**
+ * Open stream 1 for an upgraded HTTP/1.1 request, applying the
+ * settings the client sent with it.
+ *
+ * @param session the session
+ * @param upgrade the upgraded request
+ * @return 0 if successful, or a connection error code
+ */
+static uint32_t startUpgradeStream(Http2Session *session, const Http2Upgrade *upgrade) {
+	char name[MAX_PROP_NAME], value[MAX_PROP_VAL];
+	if (findProperty(upgrade->requestHeaders, 0, "HTTP2-Settings", value) != SIZE_MAX) {
+		unsigned char settings[MAX_PROP_VAL];
+		long len = decodeBase64Url(value, settings, sizeof(settings));
+		uint32_t error = (len < 0) ? PROTOCOL_ERROR : applySettings(session, settings, len);
+		if (error != NO_ERROR) {
+			return error;
+		}
+	}
+	session->lastStreamId = 1;
+	Http2Stream *stream = newStream(session, 1);
+	if (stream == NULL) {
+		return INTERNAL_ERROR;
+	}
+	snprintf(stream->method, sizeof(stream->method), "%s", upgrade->method);
+	snprintf(stream->target, sizeof(stream->target), "%s", upgrade->target);
+	for (size_t i = 0; getProperty(upgrade->requestHeaders, i, name, value); i++) {
+		if (!connectionHeader(name) && strcasecmp(name, "HTTP2-Settings") != 0) {
+			putProperty(stream->requestHeaders, name, value);
+		}
+	}
+	stream->endStream = true;
+	startStream(session, stream);
+	return NO_ERROR;
+}
+
+/**
+ * End a session with a GOAWAY frame.
+ *
+ * @param session the session
+ * @param error NO_ERROR, or the connection error code
+ */
+static void endSession(Http2Session *session, uint32_t error) {
+	if (error != NO_ERROR && debug) {
+		fprintf(stderr, "HTTP/2 connection error %u\n", error);
+	}
+	sendGoaway(session, error);
+	releaseReader(session);
+}
+
+/**
+ * Read the frames that have arrived for a session, then park its
+ * connection until more arrive, or end the session if the client
+ * closed it, an error ends it, or it is idle while the server drains.
+ *
+ * @param session the session
+ */
+static void readFrames(Http2Session *session) {
+	Connection *conn = session->conn;
+	FILE *in = conn->stream;
+	unsigned char header[FRAME_HEADER_LEN];
+	uint32_t error = NO_ERROR;
+	bool ended = false;
+
+	// a frame cut short is waited for within the read-header
+	// timeout, as the head of an HTTP/1.1 request is
+	armDeadline(conn, DEADLINE_READ_HEADER);
+	thpool_blocking_begin();
+	do {
+		if (fread(header, 1, sizeof(header), in) != sizeof(header)) {
+			ended = true;
+			break;
+		}
+		size_t len = (size_t)header[0] << 16 | header[1] << 8 | header[2];
+		if (len > DEFAULT_FRAME_SIZE) {
+			error = FRAME_SIZE_ERROR;
+		} else if (len > 0 && fread(session->payload, 1, len, in) != len) {
+			ended = true;
+		} else {
+			error = processFrame(session, header[3], header[4], get32(header + 5) & MAX_WINDOW,
+								 session->payload, len);
+		}
+	} while (!ended && error == NO_ERROR && streamBufferedInput(in) > 0);
+	thpool_blocking_end();
+
+	if (!ended && error == NO_ERROR) {
+		// an idle session is closed once it has had no request for the
+		// keep-alive timeout; while a stream is open it has no deadline
+		pthread_mutex_lock(&session->lock);
+		bool idle = (session->nstreams == 0);
+		if (idle) {
+			armDeadlineSince(conn, DEADLINE_KEEPALIVE,
+							 atomic_load_explicit(&session->activeAt, memory_order_relaxed));
+		} else {
+			cancelDeadline(conn);
+		}
+		pthread_mutex_unlock(&session->lock);
+		if (!idle || !connectionsDraining()) {
+			parkConnection(conn);
+			return;
+		}
+	}
+	endSession(session, error);
+}
+
+/**
+ * Start serving an HTTP/2 connection. The session reads the frames
+ * that have arrived, then parks the connection between frames; it
+ * closes the connection when the client closes it, an error ends it,
+ * or it is idle past the keep-alive timeout.
+ *
+ * @param conn the connection; the request line of the preface has
+ *  been read, or the 101 response to an upgrade request sent
+ * @param upgrade the upgraded request, answered on stream 1, or
+ *  NULL if the client started with the preface
+ */
+void serveHttp2(Connection *conn, const Http2Upgrade *upgrade) {
+	Http2Session *session = calloc(1, sizeof(Http2Session));
+	if (session == NULL) {
+		closeConnection(conn);
+		return;
+	}
+	session->conn = conn;
+	session->config = retainConfig(serverConfig());
+	pthread_mutex_init(&session->lock, NULL);
+	pthread_mutex_init(&session->writeLock, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&session->changed, &attr);
+	pthread_condattr_destroy(&attr);
+	session->sendWindow = DEFAULT_WINDOW;
+	session->initialWindow = DEFAULT_WINDOW;
+	session->maxFrame = DEFAULT_FRAME_SIZE;
+	atomic_init(&session->closed, false);
+	session->firstCharged = true;
+	session->block = malloc(MAX_HEADER_BLOCK);
+	session->payload = malloc(DEFAULT_FRAME_SIZE);
+	atomic_init(&session->activeAt, monotonicTimeNanos());
+	conn->http2 = session;
+	statsIncrement(http2Sessions);
+
+	// a stalled client cannot hold a writer past the write timeout
+	struct timeval tv = {
+		.tv_sec = session->config->writeTimeoutMs / 1000,
+		.tv_usec = (session->config->writeTimeoutMs % 1000) * 1000
+	};
+	setsockopt(conn->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	// frames are read by network workers, also when the connection
+	// was read by a coroutine
+	int flags = fcntl(conn->sock_fd, F_GETFL);
+	if (flags >= 0 && (flags & O_NONBLOCK) != 0) {
+		fcntl(conn->sock_fd, F_SETFL, flags & ~O_NONBLOCK);
+	}
+
+	uint32_t error = INTERNAL_ERROR;
+	if (session->block != NULL && session->payload != NULL
+			&& hpackInit(&session->decoder, HPACK_TABLE_SIZE) == 0
+			&& hpackInit(&session->encoder, HPACK_TABLE_SIZE) == 0) {
+		// the server preface
+		unsigned char settings[6];
+		settings[0] = 0;
+		settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+		put32(settings + 2, session->config->http2MaxConcurrentStreams);
+		error = sendFrame(session, FRAME_SETTINGS, 0, 0, settings, sizeof(settings));
+	}
+	if (error == NO_ERROR) {
+		// the client preface: the rest of its request line, or all of it after an upgrade
+		const char *expected = (upgrade != NULL) ? preface : prefaceTail;
+		size_t prefaceLen = strlen(expected);
+		if (fread(session->payload, 1, prefaceLen, conn->stream) != prefaceLen
+				|| memcmp(session->payload, expected, prefaceLen) != 0) {
+			error = PROTOCOL_ERROR;
+		}
+	}
+	if (error == NO_ERROR && upgrade != NULL) {
+		error = startUpgradeStream(session, upgrade);
+	}
+	if (error == NO_ERROR) {
+		readFrames(session);
+	} else {
+		endSession(session, error);
+	}
+}
+
+/**
+ * Read the frames that have arrived for a parked session.
+ * @param conn the connection; readable, or shut down
+ */
+void resumeHttp2(Connection *conn) {
+	readFrames(conn->http2);
+}
+
+/**
+ * End a parked session without reading its frames, when no worker
+ * can take them. No GOAWAY is sent, so the caller cannot block.
+ * @param conn the connection
+ */
+void abortHttp2(Connection *conn) {
+	releaseReader(conn->http2);
+}
@@ -0,0 +1,61 @@
+/*
+ * http2.h
+ *
+ * Functions that serve HTTP/2 over cleartext TCP (h2c), either
+ * started with prior knowledge by the client sending the connection
+ * preface, or upgraded from an HTTP/1.1 request with "Upgrade: h2c".
+ *
+ * One connection carries many concurrent requests as streams. A
+ * network worker reads the frames that have arrived, and the
+ * connection waits in the monitor between frames, so an idle session
+ * holds no thread. Each request is handed to the disk-I/O pool, where
+ * it is served by the same GET and HEAD handlers as HTTP/1.1,
+ * writing to a stream that turns the response into HEADERS and
+ * DATA frames within the peer's flow-control windows.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef HTTP2_H_
+#define HTTP2_H_
+
+#include "connection.h"
+#include "properties.h"
+
+/** request line of the HTTP/2 connection preface */
+#define HTTP2_PREFACE_LINE "PRI * HTTP/2.0"
+
+/** Definition of an HTTP/1.1 request upgraded to HTTP/2 */
+typedef struct Http2Upgrade {
+	const char *method;             /** the request method */
+	const char *target;             /** the request target as sent */
+	Properties *requestHeaders;     /** the request headers */
+} Http2Upgrade;
+
+/**
+ * Start serving an HTTP/2 connection. The session reads the frames
+ * that have arrived, then parks the connection between frames; it
+ * closes the connection when the client closes it, an error ends it,
+ * or it is idle past the keep-alive timeout.
+ *
+ * @param conn the connection; the request line of the preface has
+ *  been read, or the 101 response to an upgrade request sent
+ * @param upgrade the upgraded request, answered on stream 1, or
+ *  NULL if the client started with the preface
+ */
+void serveHttp2(Connection *conn, const Http2Upgrade *upgrade);
+
+/**
+ * Read the frames that have arrived for a parked session.
+ * @param conn the connection; readable, or shut down
+ */
+void resumeHttp2(Connection *conn);
+
+/**
+ * End a parked session without reading its frames, when no worker
+ * can take them. No GOAWAY is sent, so the caller cannot block.
+ * @param conn the connection
+ */
+void abortHttp2(Connection *conn);
+
+#endif /* HTTP2_H_ */
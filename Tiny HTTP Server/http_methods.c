@@ -8,15 +8,25 @@
  *  @author: Philip Gust
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE  // fallocate
+#endif
 #include "http_methods.h"
 
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <stdatomic.h>
 
 #include "http_server.h"
 #include "http_util.h"
@@ -25,17 +35,29 @@
 #include "properties.h"
 #include "file_util.h"
 #include "map.h"
+#include "server_stats.h"
+#include "thpool.h"
+#include "file_cache.h"
+#include "form_data.h"
+#include "content_root.h"
+#include "content_bundle.h"
+#include "server_config.h"
+#include "blob_store.h"
+#include "file_lock.h"
+#include "tar_archive.h"
+#include "xxh64.h"
+#include "tls.h"
+#include "page_cache.h"
 
 
 /**
  * Create the directory listing
  *
- * @param filePath the path
  * @param uri the request URI
  * @return the FILE pointer of the tmp file for the listing page.
  */
-static FILE *sendPageForDirectory(const char* filePath, const char* uri) {
-	DIR *dir = opendir(filePath);
+static FILE *sendPageForDirectory(const char* uri) {
+	DIR *dir = contentOpenDir(uri);
 	if (dir == NULL) {
 		return NULL;
 	}
@@ -66,12 +88,11 @@ static FILE *sendPageForDirectory(const char* filePath, const char* uri) {
 
 	while ((entry = readdir(dir)) != NULL) {
 		struct stat s;
-		char fileName[strlen(filePath)+strlen(entry->d_name)+2];
 		char fileUri[strlen(uri)+strlen(entry->d_name)+2];
 
-		makeFilePath(filePath, entry->d_name, fileName);
 		makeFilePath(uri, entry->d_name, fileUri);
-		if (stat(fileName, &s) != 0) {
+		// relative to the directory; links are not followed
+		if (fstatat(dirfd(dir), entry->d_name, &s, AT_SYMLINK_NOFOLLOW) != 0) {
 			continue;
 		}
 
@@ -119,6 +140,124 @@ static FILE *sendPageForDirectory(const char* filePath, const char* uri) {
 	return tmp;
 }
 
+/**
+ * Send the response for a cached regular file.
+ *
+ * @param the socket stream
+ * @param entry the cache entry
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void send_cached_file(FILE *stream, FileCacheEntry *entry, Properties *responseHeaders, bool sendContent) {
+	char buf[MAXBUF];
+	size_t contentLen = (size_t)entry->sb.st_size;
+	sprintf(buf,"%lu", contentLen);
+	putProperty(responseHeaders,"Content-Length", buf);
+	putProperty(responseHeaders,"Last-Modified", entry->lastModified);
+	putProperty(responseHeaders, "Content-type", entry->mimeType);
+
+	// send response
+	sendResponseStatus(stream, 200, "OK");
+
+	// Send response headers
+	sendResponseHeaders(stream, responseHeaders);
+
+	if (sendContent) {  // for GET
+		// not while a range of the file is being updated
+		int status = sendFileSequential(stream, entry->fd, &entry->sb);
+		if (status != 0) {
+			perror("sendFileSequential");
+		}
+	}
+}
+
+/**
+ * Determine whether the query asks for the directory as an archive.
+ *
+ * @param requestHeaders the request headers
+ * @return true if the query has "archive=tar"
+ */
+static bool wants_archive(Properties *requestHeaders) {
+	char query[MAXBUF];
+	if (findProperty(requestHeaders, 0, "?", query) == SIZE_MAX) {
+		return false;
+	}
+	Properties *fields = newProperties();
+	char archive[MAXBUF];
+	bool wanted = parseUrlEncodedFields(query, strlen(query), fields) >= 0
+			&& findProperty(fields, 0, "archive", archive) != SIZE_MAX
+			&& strcmp(archive, "tar") == 0;
+	deleteProperties(fields);
+	return wanted;
+}
+
+/**
+ * Send the response for a directory as a tar archive of its subtree,
+ * streamed with chunked coding since its length is not known.
+ *
+ * @param the socket stream
+ * @param uri the request URI of the directory
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void send_archive(FILE *stream, const char *uri, Properties *responseHeaders, bool sendContent) {
+	thpool_blocking_begin();
+	int fd = contentOpen(uri, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+	thpool_blocking_end();
+	if (fd < 0) {
+		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
+		return;
+	}
+
+	// named for the last path component, or for the site at the root
+	char name[MAXBUF];
+	const char *end = uri + strlen(uri);
+	while (end > uri && end[-1] == '/') {
+		end--;
+	}
+	const char *start = end;
+	while (start > uri && start[-1] != '/') {
+		start--;
+	}
+	snprintf(name, sizeof(name), "%.*s", (int)(end - start), start);
+	if (*name == '\0') {
+		strcpy(name, "site");
+	}
+	for (char *p = name; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\' || !isprint((unsigned char)*p)) {
+			*p = '_';
+		}
+	}
+	char buf[MAXBUF];
+	snprintf(buf, sizeof(buf), "attachment; filename=\"%.64s.tar\"", name);
+	putProperty(responseHeaders, "Content-Type", "application/x-tar");
+	putProperty(responseHeaders, "Content-Disposition", buf);
+
+	// a stream without a socket frames the body itself (HTTP/2)
+	bool chunked = streamSocket(stream) >= 0;
+	if (chunked) {
+		putProperty(responseHeaders, "Transfer-Encoding", "chunked");
+	}
+	sendResponseStatus(stream, 200, "OK");
+	sendResponseHeaders(stream, responseHeaders);
+
+	if (!sendContent) {  // for HEAD
+		close(fd);
+		return;
+	}
+	thpool_blocking_begin();
+	int status = sendTarArchive(stream, fd, chunked);
+	thpool_blocking_end();
+	if (status != 0) {
+		perror("sendTarArchive");
+		if (chunked) {
+			// without its last chunk the archive is cut short; close
+			// the connection so the client does not wait for the rest
+			shutdown(streamSocket(stream), SHUT_RDWR);
+		}
+	}
+}
+
 /**
  * Handle GET or HEAD request.
  *
@@ -129,21 +268,35 @@ static FILE *sendPageForDirectory(const char* filePath, const char* uri) {
  * @param sendContent send content (GET)
  */
 static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
-	// get path to URI in file system
-	char filePath[MAXBUF];
-	resolveUri(uri, filePath);
+	// regular files are served from the file cache
+	thpool_blocking_begin();
+	FileCacheEntry *entry = fileCacheOpen(uri);
+	thpool_blocking_end();
+	if (entry != NULL) {
+		send_cached_file(stream, entry, responseHeaders, sendContent);
+		fileCacheRelease(entry);
+		return;
+	}
 
 	// ensure file exists
 	struct stat sb;
-	if (stat(filePath, &sb) != 0) {
+	thpool_blocking_begin();
+	int status = contentStat(uri, &sb);
+	thpool_blocking_end();
+	if (status != 0) {
 		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
 		return;
 	}
-	// ensure file is a regular file or a directory
-	if (!S_ISREG(sb.st_mode) && !S_ISDIR(sb.st_mode)) {
+	// ensure file is a directory
+	if (!S_ISDIR(sb.st_mode)) {
 		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
 		return;
 	}
+	// the whole subtree in one response
+	if (wants_archive(requestHeaders)) {
+		send_archive(stream, uri, responseHeaders, sendContent);
+		return;
+	}
 
 	// record the file length
 	size_t contentLen = 0;
@@ -151,49 +304,27 @@ static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHea
 	FILE* contentStream = NULL;
 
 	// Handle directory listing
-	if (S_ISDIR(sb.st_mode)){
-		// generate HTML page for the
-		contentStream = sendPageForDirectory(filePath, uri);
-		if (contentStream == NULL){
-			sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
-			return;
-		}
-		struct stat contentStat;
-		if (fileStat(contentStream, &contentStat) != 0){
-			sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
-			return;
-		}
-		contentLen = (size_t)contentStat.st_size;
-		sprintf(buf,"%lu", contentLen);
-		putProperty(responseHeaders,"Content-Length", buf);
-
-		putProperty(responseHeaders, "Content-Type", "text/html");
-		putProperty(responseHeaders, "Last-Modified",
-						milliTimeToRFC_1123_Date_Time(sb.st_mtim.tv_sec, buf));
-	}else{
-		contentLen = (size_t)sb.st_size;
-		sprintf(buf,"%lu", contentLen);
-		putProperty(responseHeaders,"Content-Length", buf);
-
-		// record the last-modified date/time
-		time_t timer = sb.st_mtim.tv_sec;
-		putProperty(responseHeaders,"Last-Modified",
-					milliTimeToRFC_1123_Date_Time(timer, buf));
-
-		// get mime type of file
-//		getMimeType(filePath, buf);
-		getMimeType_Advanced(filePath, buf);
-//		printf("mime type: %s\n", buf);
-		putProperty(responseHeaders, "Content-type", buf);
-
-		if (sendContent) {
-			contentStream = fopen(filePath, "r");
-			if (contentStream == NULL){
-				sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
-				return;
-			}
-		}
+	// generate HTML page for the
+	thpool_blocking_begin();
+	contentStream = sendPageForDirectory(uri);
+	thpool_blocking_end();
+	if (contentStream == NULL){
+		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
+		return;
+	}
+	struct stat contentStat;
+	if (fileStat(contentStream, &contentStat) != 0){
+		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
+		fclose(contentStream);
+		return;
 	}
+	contentLen = (size_t)contentStat.st_size;
+	sprintf(buf,"%lu", contentLen);
+	putProperty(responseHeaders,"Content-Length", buf);
+
+	putProperty(responseHeaders, "Content-Type", "text/html");
+	putProperty(responseHeaders, "Last-Modified",
+					milliTimeToRFC_1123_Date_Time(sb.st_mtim.tv_sec, buf));
 
 	// send response
 	sendResponseStatus(stream, 200, "OK");
@@ -206,6 +337,34 @@ static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHea
 	}
 	fclose(contentStream);
 }
+
+/**
+ * Handle GET or HEAD request for a file that is in the file cache
+ * and fresh, without blocking on the file system.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ * @return true if handled, false if not cached or not in the page cache
+ *  and nothing was sent
+ */
+static bool do_get_or_head_cached(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+	FileCacheEntry *entry = fileCacheLookup(uri);
+	if (entry == NULL) {
+		return false;
+	}
+	// a file not in the page cache would block on the disk
+	if (sendContent && !cachedFileResident(entry)) {
+		fileCacheRelease(entry);
+		return false;
+	}
+	send_cached_file(stream, entry, responseHeaders, sendContent);
+	fileCacheRelease(entry);
+	return true;
+}
+
 //do head and get are almost the same.
 /**
  * Handle GET request.
@@ -233,57 +392,536 @@ void do_head(FILE *stream, const char *uri, Properties *requestHeaders, Properti
 }
 
 /**
- * Handle PUT request.
+ * Handle GET request from the file cache without blocking.
  *
  * @param the socket stream
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
+ * @return true if handled, false if not cached or not in the page cache
+ *  and nothing was sent
  */
-void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
-	//get the request file path
-	char filePath[MAXBUF];
-	resolveUri(uri, filePath);
+bool do_get_cached(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	return do_get_or_head_cached(stream, uri, requestHeaders, responseHeaders, true);
+}
 
-	//create any intermediate dirs
-	char path[MAXBUF];
-	if (getPath(filePath, path) == NULL){
+/**
+ * Handle HEAD request from the file cache without blocking.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @return true if handled, false if not cached and nothing was sent
+ */
+bool do_head_cached(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	return do_get_or_head_cached(stream, uri, requestHeaders, responseHeaders, false);
+}
+
+/**
+ * Determine whether the client accepts gzip content.
+ *
+ * @param requestHeaders the request headers
+ * @return true if the Accept-Encoding lists gzip with a non-zero q
+ */
+static bool accepts_gzip(Properties *requestHeaders) {
+	char accept[MAX_PROP_VAL];
+	if (findProperty(requestHeaders, 0, "Accept-Encoding", accept) == SIZE_MAX) {
+		return false;
+	}
+	char *saveptr;
+	for (char *coding = strtok_r(accept, ",", &saveptr); coding != NULL; coding = strtok_r(NULL, ",", &saveptr)) {
+		coding += strspn(coding, " \t");
+		size_t len = strcspn(coding, " \t;");
+		if (len == 4 && strncasecmp(coding, "gzip", 4) == 0) {
+			char *q = strstr(coding + len, "q=");
+			return q == NULL || strtod(q + 2, NULL) > 0;
+		}
+	}
+	return false;
+}
+
+/**
+ * Determine whether an If-None-Match header matches an ETag.
+ *
+ * @param requestHeaders the request headers
+ * @param etag the quoted ETag
+ * @return true if the client copy is current
+ */
+static bool etag_matches(Properties *requestHeaders, const char *etag) {
+	char match[MAX_PROP_VAL];
+	if (findProperty(requestHeaders, 0, "If-None-Match", match) == SIZE_MAX) {
+		return false;
+	}
+	return strcmp(match, "*") == 0 || strstr(match, etag) != NULL;
+}
+
+/**
+ * Handle GET or HEAD request from the content bundle. The status
+ * line and per-request headers are formatted on the stack and sent
+ * with the precomputed entity headers and the mapped content in a
+ * single gathered write.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void do_get_or_head_bundled(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+	const BundleEntry *entry = bundleLookup(uri);
+	if (entry == NULL) {
+		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
+		return;
+	}
+	const char *etag = bundleString(entry->etag);
+	if (etag_matches(requestHeaders, etag)) {
+		putProperty(responseHeaders, "ETag", etag);
+		sendResponseStatus(stream, 304, "Not Modified");
+		sendResponseHeaders(stream, responseHeaders);
+		return;
+	}
+
+	// choose the gzip variant if there is one and the client takes it
+	bool gzip = entry->gzipContent != 0 && accepts_gzip(requestHeaders);
+	const char *headers = bundleString(gzip ? entry->gzipHeaders : entry->headers);
+	uint64_t content = gzip ? entry->gzipContent : entry->content;
+	uint64_t contentLen = gzip ? entry->gzipLen : entry->contentLen;
+
+	char head[2*MAXBUF];
+	size_t headLen = formatResponseHead(head, sizeof(head), 200, "OK", responseHeaders);
+	if (headLen == 0) {
 		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
 		return;
 	}
-	if(mkdirs(path,0755) != 0){
+	struct iovec iov[3] = {
+		{ head, headLen },
+		{ (char *)headers, strlen(headers) },
+		{ (char *)bundleBytes(content), sendContent ? contentLen : 0 }
+	};
+	if (sendIoVector(stream, iov, (iov[2].iov_len > 0) ? 3 : 2) != 0) {
+		perror("sendIoVector");
+	}
+}
+
+/**
+ * Handle GET request from the content bundle.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_get_bundled(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	do_get_or_head_bundled(stream, uri, requestHeaders, responseHeaders, true);
+}
+
+/**
+ * Handle HEAD request from the content bundle.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_head_bundled(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	do_get_or_head_bundled(stream, uri, requestHeaders, responseHeaders, false);
+}
+
+/**
+ * Get the length of the request body from the Content-Length header,
+ * sending an error response if it is missing or invalid.
+ *
+ * @param the socket stream
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param contentLen returns the body length
+ * @return true if successful, false if an error response was sent
+ */
+static bool get_content_length(FILE *stream, Properties *requestHeaders, Properties *responseHeaders, off_t *contentLen) {
+	char buf[MAXBUF];
+	if (findProperty(requestHeaders, 0, "Content-Length", buf) == SIZE_MAX) {
+		sendErrorResponse(stream, 411, "Length Required", responseHeaders);
+		return false;
+	}
+	char *end;
+	errno = 0;
+	long long len = strtoll(buf, &end, 10);
+	if (end == buf || *end != '\0' || len < 0 || errno == ERANGE) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+		return false;
+	}
+	*contentLen = (off_t)len;
+	return true;
+}
+
+/**
+ * Answer an "Expect: 100-continue" request once it has been accepted,
+ * so the client sends the body only for uploads that will be stored.
+ *
+ * @param the socket stream
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @return true if the body should be read, false if an error response was sent
+ */
+static bool expect_continue(FILE *stream, Properties *requestHeaders, Properties *responseHeaders) {
+	char buf[MAXBUF];
+	if (findProperty(requestHeaders, 0, "Expect", buf) == SIZE_MAX) {
+		return true;
+	}
+	if (strcasecmp(buf, "100-continue") != 0) {
+		sendErrorResponse(stream, 417, "Expectation Failed", responseHeaders);
+		return false;
+	}
+	if (streamBufferedInput(stream) == 0) {
+		// skipped if the client already started sending the body
+		sendResponseStatus(stream, 100, "Continue");
+		fprintf(stream, "%s", CRLF);
+		fflush(stream);
+	}
+	return true;
+}
+
+/**
+ * Receive the request body into a temporary file beside the target,
+ * then rename it over the target, so readers never see a partial file
+ * and a failed upload leaves the target unchanged. With a blob store,
+ * the body is hashed as it arrives and the target is linked to the
+ * stored copy of the same bytes if there is one.
+ *
+ * @param the socket stream
+ * @param uri the target request path
+ * @param contentLen the body length
+ * @param responseHeaders the response headers
+ * @return true if successful, false if an error response was sent
+ */
+static bool receive_upload(FILE *stream, const char *uri, off_t contentLen, Properties *responseHeaders) {
+	char tmpUri[MAXBUF+8];
+	thpool_blocking_begin();
+	int fd = contentCreateTemp(uri, tmpUri, sizeof(tmpUri));
+	thpool_blocking_end();
+	if (fd < 0) {
+		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
+		return false;
+	}
+
+#if defined(__linux__)
+	// reserve the space up front: fails fast when the disk is full
+	// and keeps the file contiguous
+	if (contentLen > 0 && fallocate(fd, 0, 0, contentLen) != 0 && errno == ENOSPC) {
+		close(fd);
+		contentRemove(tmpUri, false);
+		sendErrorResponse(stream, 507, "Insufficient Storage", responseHeaders);
+		return false;
+	}
+#endif
+
+	thpool_blocking_begin();
+	BlobId id;
+	bool dedup = blobStoreOpen();
+	int status = dedup ? receiveBlob(stream, fd, contentLen, &id)
+					   : receiveFileBytes(stream, fd, 0, contentLen);
+	if (close(fd) != 0) {
+		status = -1;
+	}
+	if (status == 0 && dedup) {
+		status = commitBlob(tmpUri, uri, &id);
+		if (status == 1) {
+			statsIncrement(uploadsDeduplicated);
+			status = 0;
+		}
+	} else if (status == 0) {
+		status = contentRename(tmpUri, uri);
+	}
+	if (status != 0) {
+		perror("receive_upload");
+		contentRemove(tmpUri, false);
+	}
+	thpool_blocking_end();
+	fileCacheInvalidate(uri);
+
+	if (status != 0) {
 		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Parse the value of a Content-Range request header,
+ * "bytes first-last/length", where the length of the whole file
+ * may be "*" if it is not known.
+ *
+ * @param value the header value
+ * @param first returns the offset of the first byte
+ * @param last returns the offset of the last byte
+ * @param total returns the length of the whole file, or -1 if unknown
+ * @return true if the value is valid
+ */
+static bool parse_content_range(const char *value, off_t *first, off_t *last, off_t *total) {
+	if (strncasecmp(value, "bytes ", 6) != 0) {
+		return false;
+	}
+	char *end;
+	errno = 0;
+	long long v1 = strtoll(value + 6, &end, 10);
+	if (end == value + 6 || *end != '-' || !isdigit((unsigned char)end[1])) {
+		return false;
+	}
+	const char *p = end + 1;
+	long long v2 = strtoll(p, &end, 10);
+	if (*end != '/' || v1 < 0 || v2 < v1 || errno == ERANGE) {
+		return false;
+	}
+	p = end + 1;
+	long long v3 = -1;
+	if (strcmp(p, "*") != 0) {
+		v3 = strtoll(p, &end, 10);
+		if (end == p || *end != '\0' || v3 <= v2 || errno == ERANGE) {
+			return false;
+		}
+	}
+	*first = (off_t)v1;
+	*last = (off_t)v2;
+	*total = (off_t)v3;
+	return true;
+}
+
+/**
+ * Determine whether a byte range can be written to a file: it must
+ * start within or just past the end of the file, and a whole-file
+ * length must be the length the file will have.
+ *
+ * @param size the current file length
+ * @param first the offset of the first byte
+ * @param last the offset of the last byte
+ * @param total the length of the whole file, or -1 if unknown
+ * @return true if the range can be written
+ */
+static bool range_fits(off_t size, off_t first, off_t last, off_t total) {
+	off_t newSize = (last + 1 > size) ? last + 1 : size;
+	return first <= size && (total < 0 || total == newSize);
+}
+
+/**
+ * Write a received byte range into a file. The file is locked
+ * while the range is copied in, so a concurrent GET sends it
+ * either before or after the update. A file with other hard links,
+ * such as a deduplicated upload, is copied and the copy updated and
+ * renamed over it instead, so the other links keep their content.
+ *
+ * @param uri the request path of the file
+ * @param datafd the received range
+ * @param first the offset of the first byte
+ * @param last the offset of the last byte
+ * @param total the length of the whole file, or -1 if unknown
+ * @return 0 if successful, -1 with errno set if error; ERANGE if
+ *  the range no longer fits the file
+ */
+static int write_range(const char *uri, int datafd, off_t first, off_t last, off_t total) {
+	for (int attempt = 0; attempt < 3; attempt++) {
+		int fd = contentOpen(uri, O_RDWR, 0);
+		struct stat sb;
+		if (fd < 0 || fstat(fd, &sb) != 0) {
+			if (fd >= 0) {
+				close(fd);
+			}
+			return -1;
+		}
+		fileLockExclusive(&sb);
+
+		// the path may have been replaced since it was opened
+		struct stat current;
+		if (contentStat(uri, &current) != 0 || current.st_dev != sb.st_dev || current.st_ino != sb.st_ino) {
+			fileUnlock(&sb);
+			close(fd);
+			continue;
+		}
+		int status = -1;
+		if (!range_fits(sb.st_size, first, last, total)) {
+			errno = ERANGE;
+		} else if (sb.st_nlink == 1) {
+			status = copyFileBytes(datafd, 0, fd, first, last - first + 1);
+		} else {
+			char copyUri[MAXBUF+8];
+			int copyfd = contentCreateTemp(uri, copyUri, sizeof(copyUri));
+			if (copyfd >= 0) {
+				status = copyFileBytes(fd, 0, copyfd, 0, sb.st_size);
+				if (status == 0) {
+					status = copyFileBytes(datafd, 0, copyfd, first, last - first + 1);
+				}
+				if (close(copyfd) != 0) {
+					status = -1;
+				}
+				if (status == 0) {
+					status = contentRename(copyUri, uri);
+				}
+				if (status != 0) {
+					int saved = errno;
+					contentRemove(copyUri, false);
+					errno = saved;
+				}
+			}
+		}
+		int saved = errno;
+		fileUnlock(&sb);
+		close(fd);
+		errno = saved;
+		return status;
+	}
+	errno = EAGAIN;
+	return -1;
+}
+
+/**
+ * Handle a PUT or PATCH request with a Content-Range header, which
+ * writes the body over a byte range of an existing file in place.
+ * The body is received into a temporary file first, so the file is
+ * locked only while the range is copied into it.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param contentRange the Content-Range header value
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+static void do_range_update(FILE *stream, const char *uri, const char *contentRange,
+							Properties *requestHeaders, Properties *responseHeaders) {
+	off_t contentLen, first, last, total;
+	if (!get_content_length(stream, requestHeaders, responseHeaders, &contentLen)) {
+		return;
+	}
+	if (!parse_content_range(contentRange, &first, &last, &total) || last - first + 1 != contentLen) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
 		return;
 	}
 
-	// determine if file exist
+	// the range must fit the file as it is now
 	struct stat sb;
-	//creat = 0 if file already exist, -1 if file doesn't exist
-	int created = stat(filePath, &sb);
-	FILE* fptr = fopen(filePath, "w");
+	thpool_blocking_begin();
+	int status = contentStat(uri, &sb);
+	thpool_blocking_end();
+	if (status != 0) {
+		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
+		return;
+	}
+	if (!S_ISREG(sb.st_mode)) {
+		sendErrorResponse(stream, 405, "Method not Allowed", responseHeaders);
+		return;
+	}
+	char buf[MAXBUF];
+	if (!range_fits(sb.st_size, first, last, total)) {
+		sprintf(buf, "bytes */%lld", (long long)sb.st_size);
+		putProperty(responseHeaders, "Content-Range", buf);
+		sendErrorResponse(stream, 416, "Range Not Satisfiable", responseHeaders);
+		return;
+	}
+	if (!expect_continue(stream, requestHeaders, responseHeaders)) {
+		return;
+	}
 
-	if (fptr == NULL){
+	// receive the range beside the file, then copy it in
+	char tmpUri[MAXBUF+8];
+	thpool_blocking_begin();
+	int fd = contentCreateTemp(uri, tmpUri, sizeof(tmpUri));
+	status = (fd < 0) ? -1 : receiveFileBytes(stream, fd, 0, contentLen);
+	if (fd >= 0 && close(fd) != 0) {
+		status = -1;
+	}
+	int datafd = (status == 0) ? contentOpen(tmpUri, O_RDONLY, 0) : -1;
+	if (datafd >= 0) {
+		status = write_range(uri, datafd, first, last, total);
+		close(datafd);
+	} else {
+		status = -1;
+	}
+	int err = errno;
+	if (fd >= 0) {
+		contentRemove(tmpUri, false);
+	}
+	thpool_blocking_end();
+	fileCacheInvalidate(uri);
+
+	if (status != 0 && err == ERANGE) {
+		// the file changed while the range was received
+		thpool_blocking_begin();
+		status = contentStat(uri, &sb);
+		thpool_blocking_end();
+		sprintf(buf, "bytes */%lld", (long long)((status == 0) ? sb.st_size : 0));
+		putProperty(responseHeaders, "Content-Range", buf);
+		sendErrorResponse(stream, 416, "Range Not Satisfiable", responseHeaders);
+		return;
+	}
+	if (status != 0) {
+		errno = err;
+		perror("do_range_update");
 		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
 		return;
 	}
+	sendResponseStatus(stream, 200, "OK");
+
+	// Send response headers
+	putProperty(responseHeaders, "Content-Length", "0");
+	putProperty(responseHeaders, "Content-Type", "text/html");
+	sendResponseHeaders(stream, responseHeaders);
+}
+
+/**
+ * Handle PUT request.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	// a range of the file is updated in place
+	char contentRange[MAXBUF];
+	if (findProperty(requestHeaders, 0, "Content-Range", contentRange) != SIZE_MAX) {
+		do_range_update(stream, uri, contentRange, requestHeaders, responseHeaders);
+		return;
+	}
 
 	//get stream file size
-	char buf[MAXBUF];
-	findProperty(requestHeaders, 0, "Content-Length", buf);
-	int file_size = strtol(buf, NULL, 10);
+	off_t contentLen;
+	if (!get_content_length(stream, requestHeaders, responseHeaders, &contentLen)) {
+		return;
+	}
 
-	//rewrite the content
-	if(copyFileStreamBytes(stream, fptr, file_size) == 0){
-		if(created){
-			sendResponseStatus(stream, 201, "Created");
-		}else{
-			sendResponseStatus(stream, 200, "OK");
+	//create any intermediate dirs
+	thpool_blocking_begin();
+	if(contentMkdirs(uri, 0755) != 0){
+		int err = errno;
+		thpool_blocking_end();
+		if (err == ELOOP || err == EXDEV || err == ENOTDIR) {
+			// a symbolic link or file where a directory should be
+			sendErrorResponse(stream, 403, "Forbidden", responseHeaders);
+		} else {
+			sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
 		}
-	}else{
-		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
 		return;
 	}
-	fclose(fptr);
+
+	// determine if file exist
+	struct stat sb;
+	//creat = 0 if file already exist, -1 if file doesn't exist
+	int created = contentStat(uri, &sb);
+	thpool_blocking_end();
+	if (created == 0 && !S_ISREG(sb.st_mode)) {
+		sendErrorResponse(stream, 405, "Method not Allowed", responseHeaders);
+		return;
+	}
+
+	//replace the content
+	if (!expect_continue(stream, requestHeaders, responseHeaders)
+			|| !receive_upload(stream, uri, contentLen, responseHeaders)) {
+		return;
+	}
+	if(created){
+		sendResponseStatus(stream, 201, "Created");
+	}else{
+		sendResponseStatus(stream, 200, "OK");
+	}
 
 	// Send response headers
 	putProperty(responseHeaders, "Content-Length", "0");
@@ -292,37 +930,307 @@ void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Propertie
 }
 
 /**
- * Handle POST request.
+ * Handle PATCH request, which writes the body over the byte range
+ * of an existing file given by its Content-Range header.
  *
  * @param the socket stream
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-//usually use in form data
-void do_post(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
-	//get the request file path
-	char filePath[MAXBUF];
-	resolveUri(uri, filePath);
+void do_patch(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	char contentRange[MAXBUF];
+	if (findProperty(requestHeaders, 0, "Content-Range", contentRange) == SIZE_MAX) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+		return;
+	}
+	do_range_update(stream, uri, contentRange, requestHeaders, responseHeaders);
+}
 
-	struct stat sb;
-	if (fileStat(stream, &sb) != 0) {
+/** Definition of a multipart form being received */
+typedef struct FormUpload {
+	const char *dirUri;             /** directory for uploaded files */
+	Properties *fields;             /** the field table */
+	char name[MAX_PROP_NAME];       /** name of the current part */
+	char value[MAX_PROP_VAL];       /** value of the current field part */
+	size_t valueLen;                /** length of the field value */
+	bool isFile;                    /** the current part is a file */
+	int fd;                         /** temporary file of a file part, or -1 */
+	off_t offset;                   /** bytes written to the file part */
+	char tmpUri[MAXBUF+8];          /** request path of the temporary file */
+	char fileUri[MAXBUF];           /** request path of the uploaded file */
+} FormUpload;
+
+/**
+ * Get a safe file name for an uploaded file from the name the client
+ * sent, dropping any path components.
+ *
+ * @param clientName the file name sent by the client
+ * @return the file name, or NULL if none or not allowed
+ */
+static const char *upload_file_name(const char *clientName) {
+	const char *name = clientName;
+	for (const char *p = clientName; *p != '\0'; p++) {
+		if (*p == '/' || *p == '\\') {
+			name = p+1;
+		}
+	}
+	// no empty, hidden, or relative names
+	return (*name == '\0' || *name == '.') ? NULL : name;
+}
+
+/**
+ * Start a part of a multipart form. File parts are received into a
+ * temporary file; other parts become fields.
+ *
+ * @param ctx the form upload
+ * @param partHeaders the part headers
+ * @return 0 to continue, -1 to stop
+ */
+static int form_part_begin(void *ctx, Properties *partHeaders) {
+	FormUpload *form = ctx;
+	char disposition[MAX_PROP_VAL], fileName[MAX_PROP_VAL];
+	if (findProperty(partHeaders, 0, "Content-Disposition", disposition) == SIZE_MAX
+			|| getHeaderParameter(disposition, "name", form->name, sizeof(form->name)) == NULL) {
+		return -1;
+	}
+	form->valueLen = 0;
+	form->isFile = getHeaderParameter(disposition, "filename", fileName, sizeof(fileName)) != NULL;
+	if (!form->isFile) {
+		return 0;
+	}
+
+	const char *name = upload_file_name(fileName);
+	if (name == NULL) {
+		return 0;  // no file chosen: drop the content
+	}
+	if (strlen(form->dirUri) + strlen(name) + 2 > sizeof(form->fileUri)) {
+		return -1;
+	}
+	makeFilePath(form->dirUri, name, form->fileUri);
+	form->fd = contentCreateTemp(form->fileUri, form->tmpUri, sizeof(form->tmpUri));
+	if (form->fd < 0) {
+		return -1;
+	}
+	form->offset = 0;
+	putProperty(form->fields, form->name, name);
+	return 0;
+}
+
+/**
+ * Receive content of a part of a multipart form.
+ *
+ * @param ctx the form upload
+ * @param data the content
+ * @param len the length of the content
+ * @return 0 to continue, -1 to stop
+ */
+static int form_part_data(void *ctx, const char *data, size_t len) {
+	FormUpload *form = ctx;
+	if (form->isFile) {
+		if (form->fd < 0) {
+			return 0;
+		}
+		if (writeFileBytes(form->fd, data, len, form->offset) != 0) {
+			return -1;
+		}
+		form->offset += len;
+	} else {
+		if (form->valueLen + len >= sizeof(form->value)) {
+			return -1;  // too long for the field table
+		}
+		memcpy(form->value + form->valueLen, data, len);
+		form->valueLen += len;
+	}
+	return 0;
+}
+
+/**
+ * Finish a part of a multipart form: rename a received file over
+ * its target, or add a field to the field table.
+ *
+ * @param ctx the form upload
+ * @return 0 to continue, -1 to stop
+ */
+static int form_part_end(void *ctx) {
+	FormUpload *form = ctx;
+	if (!form->isFile) {
+		form->value[form->valueLen] = '\0';
+		putProperty(form->fields, form->name, form->value);
+		return 0;
+	}
+	if (form->fd < 0) {
+		return 0;
+	}
+	int status = close(form->fd);
+	form->fd = -1;
+	if (status == 0) {
+		status = contentRename(form->tmpUri, form->fileUri);
+	}
+	if (status != 0) {
+		contentRemove(form->tmpUri, false);
+	}
+	fileCacheInvalidate(form->fileUri);
+	return status;
+}
+
+/**
+ * Receive a multipart/form-data body as it arrives, storing file
+ * parts in the directory of the target and other parts in the
+ * field table.
+ *
+ * @param the socket stream
+ * @param uri the target request path
+ * @param contentType the request content type
+ * @param contentLen the body length
+ * @param fields the field table
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @return true if successful, false if an error response was sent
+ */
+static bool receive_multipart_form(FILE *stream, const char *uri, const char *contentType, off_t contentLen,
+								   Properties *fields, Properties *requestHeaders, Properties *responseHeaders) {
+	char boundary[MAXBUF], dirUri[MAXBUF];
+	if (getHeaderParameter(contentType, "boundary", boundary, sizeof(boundary)) == NULL
+			|| getPath(uri, dirUri) == NULL) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+		return false;
+	}
+	if (!expect_continue(stream, requestHeaders, responseHeaders)) {
+		return false;
+	}
+
+	if (dirUri[0] == '\0') {
+		strcpy(dirUri, "/");
+	}
+	FormUpload form = { .dirUri = dirUri, .fields = fields, .fd = -1 };
+	MultipartHandler handler = { form_part_begin, form_part_data, form_part_end, &form };
+	thpool_blocking_begin();
+	int status = parseMultipart(stream, contentLen, boundary, &handler);
+	if (form.fd >= 0) {  // stopped within a file part
+		close(form.fd);
+		contentRemove(form.tmpUri, false);
+	}
+	thpool_blocking_end();
+	if (status != 0) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Receive an application/x-www-form-urlencoded body into the field table.
+ *
+ * @param the socket stream
+ * @param contentLen the body length
+ * @param fields the field table
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @return true if successful, false if an error response was sent
+ */
+static bool receive_urlencoded_form(FILE *stream, off_t contentLen,
+									Properties *fields, Properties *requestHeaders, Properties *responseHeaders) {
+	if (contentLen > serverConfig()->formMaxUrlEncodedBytes) {
+		sendErrorResponse(stream, 413, "Payload Too Large", responseHeaders);
+		return false;
+	}
+	if (!expect_continue(stream, requestHeaders, responseHeaders)) {
+		return false;
+	}
+	char *body = malloc(contentLen + 1);
+	if (body == NULL) {
 		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
-		return;
+		return false;
 	}
-	//get stream file size
-	char buf[MAXBUF];
-	findProperty(requestHeaders, 0, "Content-Length", buf);
-	int size = strtol(buf, NULL, 10);
+	bool ok = fread(body, 1, contentLen, stream) == (size_t)contentLen
+			&& parseUrlEncodedFields(body, contentLen, fields) >= 0;
+	free(body);
+	if (!ok) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+	}
+	return ok;
+}
 
-	//create a new file
-	FILE *new_file = fopen(filePath, "w");
-	if(new_file == NULL){
+/**
+ * Store the field table of a form over the target file.
+ *
+ * @param the socket stream
+ * @param uri the target request path
+ * @param fields the field table
+ * @param responseHeaders the response headers
+ * @return true if successful, false if an error response was sent
+ */
+static bool store_form_fields(FILE *stream, const char *uri, Properties *fields, Properties *responseHeaders) {
+	char tmpUri[MAXBUF+8];
+	thpool_blocking_begin();
+	int fd = contentCreateTemp(uri, tmpUri, sizeof(tmpUri));
+	FILE *propStream = (fd >= 0) ? fdopen(fd, "w") : NULL;
+	int status = -1;
+	if (propStream != NULL) {
+		writeProperties(propStream, fields);
+		status = (fclose(propStream) == 0) ? contentRename(tmpUri, uri) : -1;
+	} else if (fd >= 0) {
+		close(fd);
+	}
+	if (status != 0 && fd >= 0) {
+		contentRemove(tmpUri, false);
+	}
+	thpool_blocking_end();
+	fileCacheInvalidate(uri);
+	if (status != 0) {
 		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Handle POST request.
+ *
+ * Form submissions are parsed into a field table that is stored
+ * at the target; files of a multipart form are stored beside it.
+ * Any other body is stored at the target as is.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_post(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	//get stream file size
+	off_t contentLen;
+	if (!get_content_length(stream, requestHeaders, responseHeaders, &contentLen)) {
+		return;
+	}
+
+	char contentType[MAXBUF] = "";
+	findProperty(requestHeaders, 0, "Content-Type", contentType);
+	bool isMultipart = strncasecmp(contentType, "multipart/form-data", 19) == 0;
+	bool isUrlEncoded = strncasecmp(contentType, "application/x-www-form-urlencoded", 33) == 0;
+
+	if (isMultipart || isUrlEncoded) {
+		// fields from the query and the body
+		Properties *fields = newProperties();
+		char query[MAXBUF];
+		bool ok = true;
+		if (findProperty(requestHeaders, 0, "?", query) != SIZE_MAX
+				&& parseUrlEncodedFields(query, strlen(query), fields) < 0) {
+			sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+			ok = false;
+		}
+		ok = ok && (isMultipart
+				? receive_multipart_form(stream, uri, contentType, contentLen, fields, requestHeaders, responseHeaders)
+				: receive_urlencoded_form(stream, contentLen, fields, requestHeaders, responseHeaders));
+		ok = ok && store_form_fields(stream, uri, fields, responseHeaders);
+		deleteProperties(fields);
+		if (!ok) {
+			return;
+		}
+	} else if (!expect_continue(stream, requestHeaders, responseHeaders)
+			|| !receive_upload(stream, uri, contentLen, responseHeaders)) {
 		return;
 	}
-	copyFileStreamBytes(stream, new_file, size);
-	fclose(new_file);
 
 	// Send response status
 	sendResponseStatus(stream, 200, "OK");
@@ -342,13 +1250,12 @@ void do_post(FILE *stream, const char *uri, Properties *requestHeaders, Properti
  * @param responseHeaders the response headers
  */
 void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
-	// get path to URI in file system
-	char filePath[MAXBUF];
-	resolveUri(uri, filePath);
-
 	// ensure file exists
 	struct stat sb;
-	if (stat(filePath, &sb) != 0) {
+	thpool_blocking_begin();
+	int status = contentStat(uri, &sb);
+	thpool_blocking_end();
+	if (status != 0) {
 		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
 		return;
 	}
@@ -356,7 +1263,10 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
 	//1.if is a directory
 	if (!S_ISREG(sb.st_mode)) {
 		//delete the empty directory. if the directory is not empty send error
-		if(rmdir(filePath) != 0){
+		thpool_blocking_begin();
+		status = contentRemove(uri, true);
+		thpool_blocking_end();
+		if(status != 0){
 			sendErrorResponse(stream, 405, "Method not Allowed", responseHeaders);
 			return;
 		}else{
@@ -366,7 +1276,11 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
 	//2.if is a file
 	}else{
 		//remove the file. if fails, send error
-		if(unlink(filePath) != 0){
+		thpool_blocking_begin();
+		status = contentRemove(uri, false);
+		thpool_blocking_end();
+		fileCacheInvalidate(uri);
+		if(status != 0){
 			sendErrorResponse(stream, 404, "Not Found", responseHeaders);
 			return;
 		}else{
@@ -380,3 +1294,259 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
 
 	sendResponseHeaders(stream, responseHeaders);
 }
+
+/**
+ * Handle GET request for the server status page.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_server_status(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	char *content = NULL;
+	size_t contentLen = 0;
+	FILE *contentStream = open_memstream(&content, &contentLen);
+	if (contentStream == NULL) {
+		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
+		return;
+	}
+	writeServerStats(contentStream);
+	fclose(contentStream);
+
+	char buf[MAXBUF];
+	sprintf(buf, "%lu", contentLen);
+	putProperty(responseHeaders, "Content-Length", buf);
+	putProperty(responseHeaders, "Content-Type", "text/plain");
+	putProperty(responseHeaders, "Cache-Control", "no-cache");
+
+	sendResponseStatus(stream, 200, "OK");
+	sendResponseHeaders(stream, responseHeaders);
+	fwrite(content, 1, contentLen, stream);
+	free(content);
+}
+
+/** Definition of a part of a batch response */
+typedef struct BatchPart {
+	char location[MAXBUF];          /** the request path as listed */
+	int status;                     /** the part status */
+	const char *statusMsg;          /** the part status message */
+	char contentType[MAXBUF];       /** the MIME type of the file */
+	char lastModified[64];          /** the Last-Modified of the file */
+	char *body;                     /** the file bytes, or NULL */
+	size_t bodyLen;                 /** length of body */
+	char head[4*MAXBUF];            /** boundary and part headers */
+	size_t headLen;                 /** length of head */
+} BatchPart;
+
+/**
+ * Load one file of a batch from the file cache.
+ *
+ * @param part the part; its location is set
+ */
+static void load_batch_part(BatchPart *part) {
+	char encUri[MAXBUF], uri[MAXBUF];
+	snprintf(encUri, sizeof(encUri), "%s", part->location);
+	char *p = strpbrk(encUri, "?&#");
+	if (p != NULL) {
+		*p = '\0';
+	}
+	if (normalizeUri(encUri, uri, sizeof(uri)) == NULL) {
+		part->status = 400;
+		part->statusMsg = "Bad Request";
+		return;
+	}
+
+	FileCacheEntry *entry = fileCacheLookup(uri);
+	if (entry == NULL) {
+		thpool_blocking_begin();
+		entry = fileCacheOpen(uri);
+		thpool_blocking_end();
+	}
+	if (entry == NULL) {
+		part->status = (errno == EACCES) ? 403 : 404;
+		part->statusMsg = (errno == EACCES) ? "Forbidden" : "Not Found";
+		return;
+	}
+	if (entry->sb.st_size > BATCH_MAX_PART_BYTES) {
+		part->status = 413;
+		part->statusMsg = "Payload Too Large";
+		fileCacheRelease(entry);
+		return;
+	}
+
+	part->bodyLen = entry->sb.st_size;
+	part->body = malloc(part->bodyLen + 1);
+	int status = -1;
+	if (part->body != NULL) {
+		// not while a range of the file is being updated
+		fileLockShared(&entry->sb);
+		thpool_blocking_begin();
+		status = readFileBytes(entry->fd, part->body, part->bodyLen, 0);
+		thpool_blocking_end();
+		fileUnlock(&entry->sb);
+	}
+	if (status == 0) {
+		part->status = 200;
+		part->statusMsg = "OK";
+		snprintf(part->contentType, sizeof(part->contentType), "%s", entry->mimeType);
+		snprintf(part->lastModified, sizeof(part->lastModified), "%s", entry->lastModified);
+	} else {
+		part->status = 500;
+		part->statusMsg = "Internal Server Error";
+		free(part->body);
+		part->body = NULL;
+		part->bodyLen = 0;
+	}
+	fileCacheRelease(entry);
+}
+
+/**
+ * Choose a multipart boundary that occurs in none of the parts.
+ *
+ * @param parts the parts
+ * @param nparts the number of parts
+ * @param boundary the boundary
+ * @param size the size of the boundary buffer
+ */
+static void choose_boundary(const BatchPart *parts, int nparts, char *boundary, size_t size) {
+	static atomic_ulong counter = 0;
+	for (bool clash = true; clash; ) {
+		uint64_t seed[2] = { monotonicTimeNanos(), atomic_fetch_add(&counter, 1) };
+		snprintf(boundary, size, "batch-%016llx", (unsigned long long)xxh64(seed, sizeof(seed), 0));
+		clash = false;
+		for (int i = 0; i < nparts && !clash; i++) {
+			clash = parts[i].body != NULL && memmem(parts[i].body, parts[i].bodyLen, boundary, strlen(boundary)) != NULL;
+		}
+	}
+}
+
+/**
+ * Handle POST request for several files in one multipart/mixed
+ * response. The body lists request paths one per line.
+ *
+ * Each part carries a Status header as well as the Content-Type,
+ * Last-Modified and Content-Length of its file, so one missing file
+ * does not fail the batch. Files come from the file cache and are
+ * read into memory, so the whole response goes out in one writev.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_batch(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	off_t contentLen;
+	if (!get_content_length(stream, requestHeaders, responseHeaders, &contentLen)) {
+		return;
+	}
+	if (contentLen > BATCH_MAX_PATHS * MAXBUF) {
+		sendErrorResponse(stream, 413, "Payload Too Large", responseHeaders);
+		return;
+	}
+	if (!expect_continue(stream, requestHeaders, responseHeaders)) {
+		return;
+	}
+	char *list = malloc(contentLen + 1);
+	BatchPart *parts = calloc(BATCH_MAX_PATHS, sizeof(BatchPart));
+	if (list == NULL || parts == NULL) {
+		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
+		free(list);
+		free(parts);
+		return;
+	}
+	if (fread(list, 1, contentLen, stream) != (size_t)contentLen) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+		free(list);
+		free(parts);
+		return;
+	}
+	list[contentLen] = '\0';
+
+	// one path per line; blank lines and "#" comments are skipped
+	int nparts = 0;
+	bool tooMany = false;
+	char *saveptr;
+	for (char *line = strtok_r(list, "\r\n", &saveptr); line != NULL; line = strtok_r(NULL, "\r\n", &saveptr)) {
+		while (*line == ' ' || *line == '\t') {
+			line++;
+		}
+		if (*line == '\0' || *line == '#') {
+			continue;
+		}
+		if (nparts == BATCH_MAX_PATHS) {
+			tooMany = true;
+			break;
+		}
+		snprintf(parts[nparts].location, sizeof(parts[nparts].location), "%s", line);
+		nparts++;
+	}
+	free(list);
+	if (nparts == 0 || tooMany) {
+		sendErrorResponse(stream, tooMany ? 413 : 400, tooMany ? "Payload Too Large" : "Bad Request", responseHeaders);
+		free(parts);
+		return;
+	}
+	for (int i = 0; i < nparts; i++) {
+		load_batch_part(&parts[i]);
+	}
+
+	// the response head, each part's head and body, and the closing boundary
+	char boundary[32];
+	choose_boundary(parts, nparts, boundary, sizeof(boundary));
+	size_t total = 0;
+	for (int i = 0; i < nparts; i++) {
+		BatchPart *part = &parts[i];
+		int n = snprintf(part->head, sizeof(part->head),
+						 "%s--%s%sContent-Location: %s%sStatus: %d %s%s",
+						 (i == 0) ? "" : CRLF, boundary, CRLF, part->location, CRLF,
+						 part->status, part->statusMsg, CRLF);
+		if (part->body != NULL) {
+			n += snprintf(part->head + n, sizeof(part->head) - n, "Content-Type: %s%sLast-Modified: %s%s",
+						  part->contentType, CRLF, part->lastModified, CRLF);
+		}
+		n += snprintf(part->head + n, sizeof(part->head) - n, "Content-Length: %lu%s%s",
+					  part->bodyLen, CRLF, CRLF);
+		part->headLen = n;
+		total += part->headLen + part->bodyLen;
+	}
+	char closing[MAXBUF];
+	size_t closingLen = snprintf(closing, sizeof(closing), "%s--%s--%s", CRLF, boundary, CRLF);
+	total += closingLen;
+
+	char buf[MAXBUF];
+	sprintf(buf, "%lu", total);
+	putProperty(responseHeaders, "Content-Length", buf);
+	snprintf(buf, sizeof(buf), "multipart/mixed; boundary=%s", boundary);
+	putProperty(responseHeaders, "Content-Type", buf);
+	putProperty(responseHeaders, "Cache-Control", "no-cache");
+	char head[2*MAXBUF];
+	size_t headLen = formatResponseHead(head, sizeof(head), 200, "OK", responseHeaders);
+	if (headLen + 2 < sizeof(head)) {
+		headLen += snprintf(head + headLen, sizeof(head) - headLen, "%s", CRLF);
+	} else {
+		headLen = 0;
+	}
+
+	if (headLen == 0) {
+		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
+	} else {
+		struct iovec iov[2*BATCH_MAX_PATHS + 2];
+		int iovcnt = 0;
+		iov[iovcnt++] = (struct iovec){ head, headLen };
+		for (int i = 0; i < nparts; i++) {
+			iov[iovcnt++] = (struct iovec){ parts[i].head, parts[i].headLen };
+			if (parts[i].bodyLen > 0) {
+				iov[iovcnt++] = (struct iovec){ parts[i].body, parts[i].bodyLen };
+			}
+		}
+		iov[iovcnt++] = (struct iovec){ closing, closingLen };
+		if (sendIoVector(stream, iov, iovcnt) != 0) {
+			perror("sendIoVector");
+		}
+	}
+	for (int i = 0; i < nparts; i++) {
+		free(parts[i].body);
+	}
+	free(parts);
+}
@@ -12,6 +12,7 @@
 #define HTTP_METHODS_H_
 
 #include <stdio.h>
+#include <stdbool.h>
 #include "properties.h"
 
 /**
@@ -34,6 +35,49 @@ void do_get(FILE *stream, const char *uri, Properties *requestHeaders, Propertie
  */
 void do_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
 
+/**
+ * Handle GET request from the file cache without blocking.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @return true if handled, false if not cached or not in the page cache
+ *  and nothing was sent
+ */
+bool do_get_cached(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+
+/**
+ * Handle HEAD request from the file cache without blocking.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @return true if handled, false if not cached and nothing was sent
+ */
+bool do_head_cached(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+
+/**
+ * Handle GET request from the content bundle.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_get_bundled(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+
+/**
+ * Handle HEAD request from the content bundle.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_head_bundled(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+
 /**
  * Handle PUT request.
  *
@@ -44,6 +88,16 @@ void do_head(FILE *stream, const char *uri, Properties *requestHeaders, Properti
  */
 void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
 
+/**
+ * Handle PATCH request.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_patch(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+
 /**
  * Handle POST request.
  *
@@ -64,4 +118,25 @@ void do_post(FILE *stream, const char *uri, Properties *requestHeaders, Properti
  */
 void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
 
+/**
+ * Handle POST request for several files in one multipart/mixed
+ * response. The body lists request paths one per line.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_batch(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+
+/**
+ * Handle GET request for the server status page.
+ *
+ * @param the socket stream
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_server_status(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+
 #endif /* HTTP_METHODS_H_ */
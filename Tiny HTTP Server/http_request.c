@@ -8,6 +8,7 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
@@ -15,29 +16,137 @@
 #include "http_util.h"
 #include "time_util.h"
 #include "http_server.h"
+#include "http_request.h"
+#include "file_util.h"
+#include "server_stats.h"
+#include "disk_io.h"
+#include "admission.h"
+#include "content_bundle.h"
+#include "server_config.h"
+#include "network_util.h"
+#include "http2.h"
+#include "coroutine.h"
+#include "proxy.h"
+#include "tls.h"
 
 
 /**
- *  Process an http request.
- *  @param sock_fd the socket descriptor
+ * Determine whether the client asked for a persistent connection.
+ * HTTP/1.1 connections persist unless closed; HTTP/1.0 connections
+ * persist only if keep-alive is requested.
+ *
+ * @param version the request protocol version
+ * @param requestHeaders the request headers
+ * @return true if the client wants the connection kept alive
  */
-void process_request(int sock_fd) {
+static bool wantsKeepAlive(const char *version, Properties *requestHeaders) {
 	char buf[MAXBUF];
-	char request[MAXBUF];
-	char method[MAXBUF];
-	char uri[MAXBUF], encUri[MAXBUF];
-	char version[MAXBUF];
+	if (findProperty(requestHeaders, 0, "Connection", buf) != SIZE_MAX) {
+		if (strcasecmp(buf, "close") == 0) {
+			return false;
+		}
+		if (strcasecmp(buf, "keep-alive") == 0) {
+			return true;
+		}
+	}
+	return strcmp(version, "HTTP/1.1") == 0;
+}
 
-	// open socket as a stream
-	FILE *stream = fdopen(sock_fd, "r+");
-	if (stream == NULL) {
-		perror("fdopen");
-		return;
+/**
+ * Determine whether the request has a body.
+ *
+ * @param requestHeaders the request headers
+ * @return true if the request has a body
+ */
+static bool hasRequestBody(Properties *requestHeaders) {
+	char buf[MAXBUF];
+	if (findProperty(requestHeaders, 0, "Transfer-Encoding", buf) != SIZE_MAX) {
+		return true;
 	}
+	if (findProperty(requestHeaders, 0, "Content-Length", buf) != SIZE_MAX) {
+		return strtol(buf, NULL, 10) > 0;
+	}
+	return false;
+}
+
+/**
+ * Determine whether the client asked to upgrade to HTTP/2. A request
+ * with a body is not upgraded, since the body would have to be read
+ * before the switch.
+ *
+ * @param requestHeaders the request headers
+ * @return true if the connection switches to HTTP/2
+ */
+static bool wantsHttp2Upgrade(Properties *requestHeaders) {
+	char buf[MAXBUF];
+	return serverConfig()->http2Enabled
+		&& !hasRequestBody(requestHeaders)
+		&& findProperty(requestHeaders, 0, "Upgrade", buf) != SIZE_MAX
+		&& strstr(buf, "h2c") != NULL
+		&& findProperty(requestHeaders, 0, "HTTP2-Settings", buf) != SIZE_MAX;
+}
+
+/** Definition of a request read from a connection */
+typedef struct Request {
+	Connection *conn;               /** the connection */
+	char method[MAXBUF];            /** the request method */
+	char uri[MAXBUF];               /** the unescaped request URI */
+	char target[MAXBUF];            /** the request target as received */
+	bool validUri;                  /** the URI was unescaped successfully */
+	Properties *requestHeaders;     /** the request headers */
+	Properties *responseHeaders;    /** the response headers */
+	bool keepAlive;                 /** the connection can be kept alive */
+	bool corked;                    /** TCP_CORK is set while the response is written */
+	const ServerConfig *config;     /** configuration the request is served with */
+} Request;
+
+/** Definition of an HTTP/2 session served for a coroutine */
+typedef struct Http2Task {
+	Connection *conn;           /** the connection */
+	Http2Upgrade *upgrade;      /** the upgraded request, or NULL */
+} Http2Task;
+
+/**
+ *  Task for a network worker that serves an HTTP/2 session.
+ *  @param arg the session task
+ */
+static void http2_task(void *arg) {
+	Http2Task *t = arg;
+	serveHttp2(t->conn, t->upgrade);
+}
+
+/**
+ *  Serve a connection with HTTP/2; the session closes it. A session
+ *  waits on flow control and its streams, so a coroutine hands it to
+ *  the network workers; not to the disk-I/O pool, which serves its
+ *  streams. It is not served if the dispatch queue is full.
+ *  @param conn the connection
+ *  @param upgrade the upgraded request, or NULL
+ *  @return true if the session took the connection
+ */
+static bool serve_http2(Connection *conn, Http2Upgrade *upgrade) {
+	Http2Task t = { conn, upgrade };
+	return awaitNetworkWork(http2_task, &t) == 0;
+}
+
+/**
+ *  Read one http request from a connection.
+ *  @param conn the connection
+ *  @param handedOff set if an HTTP/2 session took the connection
+ *  @return the request, or NULL if the connection should be closed
+ *   or was handed off
+ */
+static Request *read_request(Connection *conn, bool *handedOff) {
+	char buf[MAXBUF];
+	char request[MAXBUF];
+	char encUri[MAXBUF];
+	char version[MAXBUF];
+	FILE *stream = conn->stream;
 
 	// get header line
+	armDeadline(conn, DEADLINE_READ_HEADER);
 	if (fgets(request, MAXBUF, stream) == NULL) {
-		return;
+		return NULL;
 	}
 	// eliminate newline
 	char *p = strstr(request, CRLF);
@@ -45,6 +154,18 @@ void process_request(int sock_fd) {
 		*p = '\0';
 	}
 
+	// an HTTP/2 client with prior knowledge starts with the preface
+	if (strcmp(request, HTTP2_PREFACE_LINE) == 0 && serverConfig()->http2Enabled && !isTlsStream(stream)) {
+		*handedOff = serve_http2(conn, NULL);
+		return NULL;
+	}
+
+	Request *req = malloc(sizeof(Request));
+	if (req == NULL) {
+		return NULL;
+	}
+	req->conn = conn;
+
 	// initialize request headers
 	Properties *responseHeaders = newProperties();
 	// name of server
@@ -60,12 +181,15 @@ void process_request(int sock_fd) {
 	// decode header
 	// encUri encoded uri by changing special chars to other characters.
 	// e.g. replace space by something else (like a character code)
-	if (sscanf(request, "%s %s %s", method, encUri, version) != 3) {
+	if (sscanf(request, "%s %s %s", req->method, encUri, version) != 3) {
 		if (debug) {
 			fprintf(stderr, "request header incomplete: %s\n", request);
 		}
+		putProperty(responseHeaders, "Connection", "close");
 		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
-		return;
+		deleteProperties(responseHeaders);
+		free(req);
+		return NULL;
 	}
 	// initialize request headers
 	Properties *requestHeaders = newProperties();
@@ -74,11 +198,49 @@ void process_request(int sock_fd) {
 		debugRequest(request, requestHeaders);
 	}
 
+	// the request is answered on stream 1 after switching to HTTP/2
+	if (wantsHttp2Upgrade(requestHeaders) && !isTlsStream(stream)) {
+		putProperty(responseHeaders, "Connection", "Upgrade");
+		putProperty(responseHeaders, "Upgrade", "h2c");
+		sendResponseStatus(stream, 101, "Switching Protocols");
+		sendResponseHeaders(stream, responseHeaders);
+		if (fflush(stream) == 0) {
+			Http2Upgrade upgrade = { req->method, encUri, requestHeaders };
+			*handedOff = serve_http2(conn, &upgrade);
+		}
+		deleteProperties(requestHeaders);
+		deleteProperties(responseHeaders);
+		free(req);
+		return NULL;
+	}
+
+	// keep the connection only for requests without a body,
+	// so a failed handler cannot leave an unread body behind,
+	// and not while the server drains
+	bool hasBody = hasRequestBody(requestHeaders);
+	bool keepAlive = !hasBody && !connectionsDraining()
+			&& conn->nrequests+1 < serverConfig()->keepAliveMaxRequests
+			&& wantsKeepAlive(version, requestHeaders);
+	if (!hasBody && streamBufferedInput(stream) > 0) {
+		// a pipelined request is buffered; the stream cannot switch to
+		// writing over unread input, so set it aside until the response
+		// is sent, or drop it if the connection closes after responding
+		if (keepAlive) {
+			conn->pipelined = saveBufferedInput(stream, &conn->npipelined);
+		}
+		if (conn->pipelined == NULL) {
+			discardBufferedInput(stream);
+			keepAlive = false;
+		}
+	}
+	putProperty(responseHeaders, "Connection", keepAlive ? "keep-alive" : "close");
+
 	// save query parameters as key "?"
 	// ? short form/long form as a query
 	// peal off the "?"
 	// ? begins the query, & is allowed to replace a ?.
 	// find either the next ? or &
+	snprintf(req->target, sizeof(req->target), "%s", encUri);
 	p = strpbrk(encUri,"?&");
 	if (p != NULL) {
 		//store the query and use later
@@ -89,38 +251,241 @@ void process_request(int sock_fd) {
 		}
 	}
 
-	// unescape URI
+	// bound the rest of the request by the body or write deadline
+	armDeadline(conn, hasBody ? DEADLINE_READ_BODY : DEADLINE_WRITE);
+	if (conn->nrequests++ > 0) {
+		statsIncrement(keepAliveReuses);
+	}
+	statsIncrement(requestsServed);
+
+	// unescape and normalize URI; reject paths above the root
 	// the "#" was never sent to the request
-	if (unescapeUri(encUri, uri) == NULL) {
-		if (debug) {
-			fprintf(stderr, "request header invalid URI encoding %s\n", request);
+	req->validUri = (normalizeUri(encUri, req->uri, sizeof(req->uri)) != NULL);
+	if (!req->validUri && debug) {
+		fprintf(stderr, "request header invalid URI encoding %s\n", request);
+	}
+	req->requestHeaders = requestHeaders;
+	req->responseHeaders = responseHeaders;
+	req->keepAlive = keepAlive;
+
+	// hold the response headers until the body fills the packet
+	req->corked = serverConfig()->tcpCork;
+	if (req->corked) {
+		set_socket_cork(conn->sock_fd, true);
+	}
+
+	// keep this configuration, even if it is reloaded while serving
+	req->config = retainConfig(serverConfig());
+	return req;
+}
+
+/**
+ *  Determine whether serving a request may block on the file system.
+ *  @param req the request
+ *  @return true if the request must be served by the disk-I/O pool
+ */
+static bool needs_disk(Request *req) {
+	if (!req->validUri) {
+		return false;
+	}
+	if (strcasecmp(req->method, "GET") == 0) {
+		return strcmp(req->uri, SERVER_STATUS_URI) != 0;
+	}
+	return strcasecmp(req->method, "HEAD") == 0
+		|| strcasecmp(req->method, "PUT") == 0
+		|| strcasecmp(req->method, "PATCH") == 0
+		|| strcasecmp(req->method, "POST") == 0
+		|| strcasecmp(req->method, "DELETE") == 0;
+}
+
+/**
+ *  Serve a request from the content bundle, which is read-only.
+ *  @param req the request
+ */
+static void serve_from_bundle(Request *req) {
+	FILE *stream = req->conn->stream;
+	const char *method = req->method;
+	if (strcasecmp(method, "GET") == 0) {
+		do_get_bundled(stream, req->uri, req->requestHeaders, req->responseHeaders);
+	} else if (strcasecmp(method, "HEAD") == 0) {
+		do_head_bundled(stream, req->uri, req->requestHeaders, req->responseHeaders);
+	} else if (strcasecmp(method, "PUT") == 0
+			|| strcasecmp(method, "PATCH") == 0
+			|| strcasecmp(method, "POST") == 0
+			|| strcasecmp(method, "DELETE") == 0) {
+		putProperty(req->responseHeaders, "Allow", "GET, HEAD");
+		sendErrorResponse(stream, 405, "Method not Allowed", req->responseHeaders);
+	} else {
+		sendErrorResponse(stream, 501, "Not Implemented", req->responseHeaders);
+	}
+}
+
+/**
+ *  Serve a request that needs no file system access, a request
+ *  for the content bundle, or a GET or HEAD request for a file in
+ *  the file cache.
+ *  @param req the request
+ *  @return true if served, false if the request needs the disk-I/O pool
+ */
+static bool serve_without_disk(Request *req) {
+	FILE *stream = req->conn->stream;
+	if (!req->validUri) {
+		sendErrorResponse(stream, 400, "Bad Request", req->responseHeaders);
+	} else if (contentBundleOpen() && strcmp(req->uri, SERVER_STATUS_URI) != 0) {
+		serve_from_bundle(req);
+	} else if (!needs_disk(req)) {
+		if (strcasecmp(req->method, "GET") == 0) {
+			do_server_status(stream, req->uri, req->requestHeaders, req->responseHeaders);
+		} else {
+			sendErrorResponse(stream, 501, "Not Implemented", req->responseHeaders);
 		}
-		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
-		return;
+	} else if (strcasecmp(req->method, "GET") == 0) {
+		return do_get_cached(stream, req->uri, req->requestHeaders, req->responseHeaders);
+	} else if (strcasecmp(req->method, "HEAD") == 0) {
+		return do_head_cached(stream, req->uri, req->requestHeaders, req->responseHeaders);
+	} else {
+		return false;
 	}
+	return true;
+}
 
+/**
+ *  Serve a request that may block on the file system.
+ *  @param req the request
+ */
+static void serve_with_disk(Request *req) {
+	FILE *stream = req->conn->stream;
+	const char *method = req->method;
 	// dispatch based on method
 	if (strcasecmp(method, "GET") == 0) {
-		do_get(stream, uri, requestHeaders, responseHeaders);
+		do_get(stream, req->uri, req->requestHeaders, req->responseHeaders);
 	} else 	if (strcasecmp(method, "HEAD") == 0) {
-		do_head(stream, uri, requestHeaders, responseHeaders);
+		do_head(stream, req->uri, req->requestHeaders, req->responseHeaders);
 	} else 	if (strcasecmp(method, "PUT") == 0) {
-		do_put(stream, uri, requestHeaders, responseHeaders);
+		do_put(stream, req->uri, req->requestHeaders, req->responseHeaders);
+	} else 	if (strcasecmp(method, "PATCH") == 0) {
+		do_patch(stream, req->uri, req->requestHeaders, req->responseHeaders);
+	} else 	if (strcasecmp(method, "POST") == 0 && strcmp(req->uri, BATCH_URI) == 0) {
+		do_batch(stream, req->uri, req->requestHeaders, req->responseHeaders);
 	} else 	if (strcasecmp(method, "POST") == 0) {
-		do_post(stream, uri, requestHeaders, responseHeaders);
+		do_post(stream, req->uri, req->requestHeaders, req->responseHeaders);
 	} else 	if (strcasecmp(method, "DELETE") == 0) {
-		do_delete(stream, uri, requestHeaders, responseHeaders);
+		do_delete(stream, req->uri, req->requestHeaders, req->responseHeaders);
+	}
+}
+
+/**
+ *  Free a request and its headers.
+ *  @param req the request
+ */
+static void delete_request(Request *req) {
+	deleteProperties(req->requestHeaders);
+	deleteProperties(req->responseHeaders);
+	releaseConfig(req->config);
+	free(req);
+}
+
+/**
+ *  Finish a served request, then park the connection for
+ *  its next request or close it.
+ *  @param req the request
+ */
+static void finish_request(Request *req) {
+	Connection *conn = req->conn;
+
+	// flush the response; keep the connection only if it was all sent
+	fflush(conn->stream);
+	if (req->corked) {
+		set_socket_cork(conn->sock_fd, false);
+	}
+	if (conn->pipelined != NULL) {
+		// the next request is read from where it was set aside
+		if (restoreBufferedInput(conn->stream, conn->pipelined, conn->npipelined) != 0) {
+			req->keepAlive = false;
+		}
+		free(conn->pipelined);
+		conn->pipelined = NULL;
+		conn->npipelined = 0;
+	}
+	if (req->keepAlive && !ferror(conn->stream) && !connectionExpired(conn)) {
+		parkConnection(conn);
 	} else {
-		sendErrorResponse(stream, 501, "Not Implemented", responseHeaders);
+		closeConnection(conn);
 	}
+	// the request configuration was in use until now
+	delete_request(req);
+}
+
+/**
+ *  Task for a disk-I/O thread that serves a request and
+ *  hands the connection back.
+ *  @param arg the request
+ */
+static void disk_task(void *arg) {
+	Request *req = arg;
+	setThreadConfig(req->config);
+	serve_with_disk(req);
+	finish_request(req);
+	setThreadConfig(NULL);
+}
 
-	// delete headers
-	deleteProperties(requestHeaders);
-	deleteProperties(responseHeaders);
+/**
+ *  Task for a disk-I/O thread that serves a request for a
+ *  coroutine, which finishes the request when resumed.
+ *  @param arg the request
+ */
+static void disk_serve_task(void *arg) {
+	serve_with_disk(arg);
+}
 
-	// close socket stream
-	fflush(stream);
-	fclose(stream);
-	close(sock_fd);
+/**
+ *  Task that forwards a request to its upstream server. A coroutine
+ *  runs it on a network worker, as the upstream sockets block, so
+ *  slow upstreams cannot hold the disk-I/O pool.
+ *  @param arg the request
+ */
+static void proxy_task(void *arg) {
+	Request *req = arg;
+	Connection *conn = req->conn;
+	if (!proxyRequest(conn->stream, req->method, req->uri, req->target, conn->peerAddr,
+					  req->requestHeaders, req->responseHeaders)) {
+		req->keepAlive = false;
+	}
 }
 
+/**
+ *  Process an http request on a connection. Requests that can be
+ *  answered without blocking on the file system are served here;
+ *  the rest are handed to the disk-I/O pool. The connection is
+ *  then parked for its next request or closed.
+ *  @param conn the connection
+ */
+void process_request(Connection *conn) {
+	bool handedOff = false;
+	Request *req = read_request(conn, &handedOff);
+	if (req == NULL) {
+		if (!handedOff) {
+			closeConnection(conn);
+		}
+	} else if (req->validUri && isProxied(req->uri)) {
+		if (awaitNetworkWork(proxy_task, req) != 0) {
+			delete_request(req);
+			shedConnection(conn, SHED_QUEUE_FULL);
+		} else {
+			finish_request(req);
+		}
+	} else if (serve_without_disk(req)) {
+		finish_request(req);
+	} else if (runningCoroutine()) {
+		// the coroutine waits for the disk-I/O pool, then finishes
+		if (awaitDiskWork(disk_serve_task, req) != 0) {
+			delete_request(req);
+			shedConnection(conn, SHED_DISK_QUEUE_FULL);
+		} else {
+			finish_request(req);
+		}
+	} else if (submitDiskWork(disk_task, req) != 0) {
+		delete_request(req);
+		shedConnection(conn, SHED_DISK_QUEUE_FULL);
+	}
+}
@@ -10,11 +10,16 @@
 #ifndef HTTP_REQUEST_H_
 #define HTTP_REQUEST_H_
 
+#include "connection.h"
+
 /**
- *  Process an http request.
- *  @param sock_fd the socket descriptor
+ *  Process an http request on a connection. Requests that can be
+ *  answered without blocking on the file system are served here;
+ *  the rest are handed to the disk-I/O pool. The connection is
+ *  then parked for its next request or closed.
+ *  @param conn the connection
  */
-void process_request(int sock_fd);
+void process_request(Connection *conn);
 
 
 #endif /* HTTP_REQUEST_H_ */
@@ -24,9 +24,25 @@
 #include "thpool.h"
 #include "map.h"
 #include "mime_util.h"
-
-#define DEFAULT_HTTP_PORT 1500
-#define MIN_PORT 1000
+#include "connection.h"
+#include "server_stats.h"
+#include "admission.h"
+#include "disk_io.h"
+#include "file_cache.h"
+#include "content_root.h"
+#include "content_bundle.h"
+#include "server_config.h"
+#include "server_lifecycle.h"
+#include "rate_limit.h"
+#include "blob_store.h"
+#include "error_page.h"
+#include "coroutine.h"
+#include "prefork.h"
+#include "cache_warmer.h"
+#include "content_watch.h"
+#include "proxy.h"
+#include "tls.h"
+#include "http2.h"
 
 /** debug flag */
 const bool debug = true;
@@ -35,79 +51,326 @@ const bool debug = true;
 const char *CONTENT_BASE = "content";
 //when run it, need to be in root path. "content" is relative to the root path.
 
+/** the worker thread pool */
+static threadpool thpool;
+
 /**
  * Task for thread
- * @param socket_fd: the socket number.
+ * @param conn: the connection.
+ */
+void task(void* conn){
+	Connection *c = conn;
+	const ServerConfig *config = acquireConfig();
+	setThreadConfig(config);
+	if (config->codelEnabled && codelShouldDrop(c->queuedAt, monotonicTimeNanos())) {
+		shedConnection(c, SHED_QUEUE_DELAY);
+	} else {
+		process_request(c);
+	}
+	setThreadConfig(NULL);
+	releaseConfig(config);
+}
+
+/**
+ * Task for a network worker that reads the frames of an HTTP/2
+ * session parked between frames.
+ * @param conn the connection
+ */
+static void session_task(void *conn) {
+	const ServerConfig *config = acquireConfig();
+	setThreadConfig(config);
+	resumeHttp2(conn);
+	setThreadConfig(NULL);
+	releaseConfig(config);
+}
+
+/**
+ * Dispatch a connection with a pending request to a pool worker,
+ * or to a new coroutine when they are enabled, or shed it if the
+ * dispatch queue is above its high-water mark or too many
+ * coroutines are alive.
+ * A client over its rate limit is refused before its request is
+ * read, so it never reaches a worker.
+ * The frames of an HTTP/2 session go to a pool worker also with
+ * coroutines; its streams are charged to the rate limit as they
+ * open, and it is ended without a response if the queue is full.
+ * @param conn the connection
+ */
+static void dispatch_connection(Connection *conn) {
+	const ServerConfig *config = acquireConfig();
+	setThreadConfig(config);
+	if (conn->http2 != NULL) {
+		if (thpool_add_work(thpool, session_task, conn) != 0) {
+			statsIncrement(shedQueueFull);
+			abortHttp2(conn);
+		}
+	} else if (!rateLimitAllow(conn->peerAddr)) {
+		shedConnection(conn, SHED_RATE_LIMITED);
+	} else {
+		conn->queuedAt = monotonicTimeNanos();
+		int status = coroutinesRunning() ? spawnCoroutine(task, conn)
+										 : thpool_add_work(thpool, task, conn);
+		if (status != 0) {
+			shedConnection(conn, SHED_QUEUE_FULL);
+		}
+	}
+	setThreadConfig(NULL);
+	releaseConfig(config);
+}
+
+/**
+ * Queue work for the network workers, which serve connections
+ * unless coroutines do.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 if queued, -1 if the dispatch queue is full
+ */
+int submitNetworkWork(void (*function)(void *arg), void *arg) {
+	return thpool_add_work(thpool, function, arg);
+}
+
+/**
+ * Gauge for the number of requests waiting for a worker.
+ * @return the dispatch queue length
+ */
+static long dispatch_queue_length(void) {
+	return thpool_queue_length(thpool);
+}
+
+/**
+ * Gauge for the number of worker threads.
+ * @return the number of worker threads
  */
-void task(void* socket_fd){
-	process_request(*(int*)socket_fd);
+static long pool_threads(void) {
+	return thpool_num_threads_alive(thpool);
+}
+
+/**
+ * Gauge for the number of worker threads serving requests.
+ * @return the number of working threads
+ */
+static long pool_threads_working(void) {
+	return thpool_num_threads_working(thpool);
+}
+
+/**
+ * Gauge for the number of worker threads blocked in disk I/O.
+ * @return the number of blocked threads
+ */
+static long pool_threads_blocked(void) {
+	return thpool_num_threads_blocked(thpool);
 }
 
 /**
  * Main program starts the server and processes requests
- * @param argv[1]: optional port number (default: 1500)
+ * @param argv[1]: optional port number (default: configured port)
+ * @param argv[2]: optional content bundle to serve instead of the content base
  */
 int main(int argc, char* argv[argc]) {
-	int port = DEFAULT_HTTP_PORT;
+	if (loadServerConfig(SERVER_CONFIG_FILE) != 0) {
+		fprintf(stderr, "Invalid configuration %s\n", SERVER_CONFIG_FILE);
+		return EXIT_FAILURE;
+	}
+	const ServerConfig *config = acquireConfig();
+	setThreadConfig(config);
 
-    if (argc == 2) {
+	int port = config->port;
+    if (argc >= 2) {
 		if ((sscanf(argv[1], "%d", &port) != 1) || (port < MIN_PORT)) {
 			fprintf(stderr, "Invalid port %s\n", argv[1]);
 			return EXIT_FAILURE;
 		}
 	}
-    //return is a file descriptor of the socket.
-    // bind the socket and listen.
-    int listen_sock_fd = get_listener_socket(port);
-	if (listen_sock_fd == 0) {
-		perror("listen_sock_fd");
+	// a read-only site is served from a bundle instead of the content base
+	if (argc == 3) {
+		if (openContentBundle(argv[2]) != 0) {
+			perror(argv[2]);
+			return EXIT_FAILURE;
+		}
+		fprintf(stderr, "Serving %ld files from bundle %s\n", bundleSize(), argv[2]);
+	}
+	// on upgrade the listener is handed over by the running server
+	int listen_sock_fd;
+	if (receiveListener(&listen_sock_fd) != 0) {
+		perror("receiveListener");
+		return EXIT_FAILURE;
+	}
+	if (listen_sock_fd < 0) {
+	    //return is a file descriptor of the socket.
+	    // bind the socket and listen.
+	    listen_sock_fd = get_listener_socket(port);
+		if (listen_sock_fd == 0) {
+			perror("listen_sock_fd");
+			return EXIT_FAILURE;
+		}
+	} else if (configure_listener_socket(listen_sock_fd) != 0) {
+		perror("configure_listener_socket");
 		return EXIT_FAILURE;
 	}
 
 	fprintf(stderr, "HttpServer running on port %d\n", port);
 
-	puts("Making threadpool with 4 threads");
-	threadpool thpool = thpool_init(4);
+	// the certificate is loaded and the ticket secret chosen before
+	// any worker is forked, so tickets resume in every worker
+	if (initTls() != 0) {
+		perror("initTls");
+		return EXIT_FAILURE;
+	}
 
-	FILE* mime_type = fopen("./mime.types", "r+");
-	if (mime_type == NULL){
-		fprintf(stderr, "No mime type file.\n");
-		exit(1);
+	// the token buckets are shared, so prefork workers limit a client
+	// together instead of each granting it the full rate
+	if (initRateLimit() != 0) {
+		perror("initRateLimit");
+		return EXIT_FAILURE;
+	}
+
+	// the master forks the workers before any thread is started and
+	// supervises them; each worker serves the listener as below
+	if (config->preforkWorkers > 0) {
+		completeHandoff(false);
+		if (startPreforkWorkers() != 0) {
+			perror("startPreforkWorkers");
+			return EXIT_FAILURE;
+		}
+	}
+	// control signals; started before any other thread so no other thread receives them
+	if (startSignalHandler(argv) != 0) {
+		perror("startSignalHandler");
+		return EXIT_FAILURE;
 	}
-	buildMap(mime_type, &mime_map);
-	fclose(mime_type);
 
-	while (true) {
+	// size the pool from the machine; it grows on queue delay or
+	// blocking disk I/O and shrinks back when idle
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = (ncpus > 0 ? ncpus : 1) * config->poolThreadsPerCpu;
+	if (max_threads < config->poolMinThreads) {
+		max_threads = config->poolMinThreads;
+	}
+	printf("Making threadpool with %d to %d threads\n", config->poolMinThreads, max_threads);
+	thpool = thpool_init_elastic(config->poolMinThreads, max_threads,
+								 config->poolIdleTimeoutMs, config->poolTargetDelayMs);
+	thpool_set_queue_limit(thpool, config->dispatchQueueHighWater);
+	initErrorPages();
+	initAdmission();
+	// paths beneath a proxy route are forwarded to upstream servers
+	if (initProxy() != 0) {
+		perror("initProxy");
+		return EXIT_FAILURE;
+	}
+	registerStatsGauge("dispatch_queue_length", dispatch_queue_length);
+	registerStatsGauge("pool_threads", pool_threads);
+	registerStatsGauge("pool_threads_working", pool_threads_working);
+	registerStatsGauge("pool_threads_blocked", pool_threads_blocked);
+	registerStatsGauge("open_connections", openConnections);
+	registerStatsGauge("rate_limit_entries", rateLimitSize);
+	if (contentBundleOpen()) {
+		// the bundle is served from memory, so nothing touches the file system
+		registerStatsGauge("bundle_entries", bundleSize);
+	} else {
+		registerStatsGauge("file_cache_entries", fileCacheSize);
+		registerStatsGauge("dir_cache_entries", contentDirCacheSize);
+
+		// all request paths resolve beneath the content base
+		if (openContentRoot(config->contentBase) != 0) {
+			perror(config->contentBase);
+			return EXIT_FAILURE;
+		}
+
+		// uploads are linked to their blobs beside the content base
+		if (*config->blobStore != '\0' && openBlobStore(config->blobStore) != 0) {
+			perror(config->blobStore);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// requests that block on the file system are served by a separate
+	// pool, so cache hits are never queued behind them; HTTP/2 streams
+	// are served there too, also from a bundle
+	if (startDiskIo() != 0) {
+		perror("startDiskIo");
+		return EXIT_FAILURE;
+	}
+
+	// requests are served on coroutines, which wait for the socket
+	// or the disk-I/O pool without holding a thread
+	if (config->coroutinesEnabled && startCoroutines() != 0) {
+		perror("startCoroutines");
+		return EXIT_FAILURE;
+	}
+
+	// deadlines and idle connections are watched by the monitor
+	if (startConnectionMonitor(dispatch_connection) != 0) {
+		perror("startConnectionMonitor");
+		return EXIT_FAILURE;
+	}
+	if (!contentBundleOpen()) {
+		// cached files are trusted until the watcher sees them change
+		if (config->contentWatch && startContentWatch() != 0) {
+			perror("startContentWatch");
+		}
+		// the first requests find the caches warm; on upgrade they are
+		// warmed with the files the old server had cached instead
+		if (!upgradePending()) {
+			warmCaches();
+		}
+	}
+	// on upgrade, start accepting once the old server stops
+	completeHandoff(true);
+	if (config->preforkWorkers == 0) {
+		acceptUpgrades(listen_sock_fd);
+	}
+	setThreadConfig(NULL);
+	releaseConfig(config);
+
+	while (waitForConnection(listen_sock_fd)) {
         // accept client connection
 		// socket_fd here is a peer socket
-		int socket_fd = accept_peer_connection(listen_sock_fd);
+		struct sockaddr_in peer_addr;
+		int socket_fd = accept_peer_connection(listen_sock_fd, &peer_addr);
+		if (socket_fd < 0) {
+			continue;
+		}
 
 		if (debug) {
-			int port;
-			char host[MAXBUF];
-			//use the socket_fd to get host and port info
-			if (get_peer_host_and_port(socket_fd, host, &port) != 0) {
-			    perror("get_peer_host_and_port");
-			} else {
-				fprintf(stderr, "New connection accepted  %s:%u\n", host, port);
-			}
+			char host[INET_ADDRSTRLEN];
+			//the peer address came with the connection
+			inet_ntop(AF_INET, &peer_addr.sin_addr, host, sizeof(host));
+			fprintf(stderr, "New connection accepted  %s:%u\n", host, ntohs(peer_addr.sin_port));
 		}
 
-		int *ptr_socket_fd = malloc(sizeof(int));
-		*ptr_socket_fd = socket_fd;
-		// Use thread pool worker to handle request
-		thpool_add_work(thpool, (void *)task, (void *)ptr_socket_fd);
-		free(ptr_socket_fd);
-
-		// handle request
-//		process_request(socket_fd);
+		statsIncrement(connectionsAccepted);
+		Connection *conn = newConnection(socket_fd, peer_addr.sin_addr.s_addr);
+		if (conn == NULL) {
+			close(socket_fd);
+			continue;
+		}
+		// Park until the request arrives, so idle clients never hold
+		// a pool worker; the worker is dispatched when it is readable
+		config = acquireConfig();
+		setThreadConfig(config);
+		configure_peer_socket(socket_fd);
+		parkConnection(conn);
+		setThreadConfig(NULL);
+		releaseConfig(config);
     }
 
+	// stopped by a signal: finish in-flight requests, then exit
+	config = acquireConfig();
+	setThreadConfig(config);
+	int status = drainServer(listen_sock_fd);
+	// the next server warms its cache with the files hot in this one
+	if (saveHotPaths() != 0) {
+		perror(config->cacheWarmList);
+	}
+	setThreadConfig(NULL);
+	releaseConfig(config);
+	if (status != 0) {
+		// workers still serving would keep thpool_destroy waiting
+		return EXIT_FAILURE;
+	}
 	puts("Killing threadpool");
 	thpool_destroy(thpool);
-	//code will never get to here.
-    //close listener socket
-    close(listen_sock_fd);
     return EXIT_SUCCESS;
 
 }
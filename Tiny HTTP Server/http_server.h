@@ -15,6 +15,224 @@
 /** maximum buffer size */
 #define MAXBUF 256
 
+/*
+ * The settings below are defaults that the configuration file
+ * can change (see server_config.h).
+ */
+
+/** configuration file, in the application home directory */
+#define SERVER_CONFIG_FILE "./http_server.properties"
+
+/** MIME types file, in the application home directory */
+#define MIME_TYPES_FILE "./mime.types"
+
+/** default listener port */
+#define DEFAULT_HTTP_PORT 1500
+
+/** lowest listener port allowed */
+#define MIN_PORT 1000
+
+/** milliseconds to wait for the request line and headers */
+#define READ_HEADER_TIMEOUT_MS 10000
+
+/** milliseconds to wait for the request body */
+#define READ_BODY_TIMEOUT_MS 60000
+
+/** milliseconds allowed for sending a response */
+#define WRITE_TIMEOUT_MS 60000
+
+/** milliseconds an idle keep-alive connection is kept open */
+#define KEEPALIVE_TIMEOUT_MS 5000
+
+/** maximum requests served on one keep-alive connection */
+#define KEEPALIVE_MAX_REQUESTS 100
+
+/** minimum worker threads */
+#define POOL_MIN_THREADS 2
+
+/** maximum worker threads per online CPU */
+#define POOL_THREADS_PER_CPU 4
+
+/** milliseconds an idle worker above the minimum waits before retiring */
+#define POOL_IDLE_TIMEOUT_MS 30000
+
+/** queue wait in milliseconds above which the pool grows */
+#define POOL_TARGET_DELAY_MS 10
+
+/** minimum disk-I/O threads */
+#define DISK_POOL_MIN_THREADS 1
+
+/** maximum disk-I/O threads */
+#define DISK_POOL_MAX_THREADS 16
+
+/** queued disk-I/O requests above which new ones are shed with 503 */
+#define DISK_QUEUE_HIGH_WATER 256
+
+/** milliseconds a cached file is trusted before it is revalidated */
+#define FILE_CACHE_TTL_MS 1000
+
+/** maximum number of cached files */
+#define FILE_CACHE_MAX_ENTRIES 1024
+
+/** maximum number of cached content directory descriptors */
+#define DIR_CACHE_MAX_ENTRIES 256
+
+/** probe cached files with mincore and serve cold ones on the disk-I/O pool */
+#define PAGE_CACHE_PROBE true
+
+/** KiB of a file probed; larger files are served on the disk-I/O pool */
+#define PAGE_CACHE_PROBE_MAX_KB 8192
+
+/** KiB read ahead of the send cursor of a large file; 0 for kernel readahead */
+#define PAGE_CACHE_READAHEAD_KB 2048
+
+/** MiB above which a file is dropped from the page cache behind the send cursor; 0 never */
+#define PAGE_CACHE_DONTNEED_MB 64
+
+/** warm the file cache before accepting connections */
+#define CACHE_WARM true
+
+/** threads that open files while warming the file cache */
+#define CACHE_WARM_THREADS 4
+
+/** file the hot paths are saved to on shutdown and warmed from; empty walks the content base */
+#define CACHE_WARM_LIST ""
+
+/** watch the content base with inotify, so cached files are trusted until they change */
+#define CONTENT_WATCH true
+
+/** most content directories watched; beyond it cached files are revalidated after the TTL */
+#define CONTENT_WATCH_MAX_DIRS 8192
+
+/** size of the window a multipart form body is parsed in */
+#define FORM_BUFFER_BYTES 65536
+
+/** maximum size of a URL-encoded form body */
+#define FORM_MAX_URLENCODED_BYTES 65536
+
+/** bytes moved per splice of an upload body */
+#define SPLICE_CHUNK_BYTES 65536
+
+/** queued requests above which new requests are shed with 503 */
+#define DISPATCH_QUEUE_HIGH_WATER 256
+
+/** seconds a shed client is asked to wait before retrying */
+#define SHED_RETRY_AFTER_SEC 1
+
+/** enable CoDel shedding of requests that waited too long in the queue */
+#define CODEL_ENABLED true
+
+/** CoDel target queue delay in milliseconds */
+#define CODEL_TARGET_MS 50
+
+/** CoDel interval in milliseconds */
+#define CODEL_INTERVAL_MS 500
+
+/** limit the request rate of each client address */
+#define RATE_LIMIT_ENABLED false
+
+/** requests per second each client address may sustain */
+#define RATE_LIMIT_REQUESTS_PER_SEC 50
+
+/** requests a client address may send in a burst */
+#define RATE_LIMIT_BURST 100
+
+/** client addresses the rate limiter can track */
+#define RATE_LIMIT_TABLE_SLOTS 65536
+
+/** maximum connections waiting to be accepted */
+#define LISTEN_BACKLOG 4096
+
+/** seconds the kernel holds a new connection until its request arrives; 0 disables */
+#define TCP_DEFER_ACCEPT_SEC 10
+
+/** pending TCP Fast Open requests allowed; 0 disables */
+#define TCP_FASTOPEN_QUEUE 256
+
+/** socket send buffer in bytes; 0 leaves the kernel to size it */
+#define SOCKET_SEND_BUFFER_BYTES 0
+
+/** socket receive buffer in bytes; 0 leaves the kernel to size it */
+#define SOCKET_RECV_BUFFER_BYTES 0
+
+/** send small writes without waiting for acknowledgements */
+#define TCP_NODELAY_ENABLED true
+
+/** hold partial frames while a response is written, so headers and body share packets */
+#define TCP_CORK_ENABLED true
+
+/** milliseconds allowed for in-flight requests when the server stops */
+#define DRAIN_TIMEOUT_MS 30000
+
+/** milliseconds a new server has to start when the listener is handed to it */
+#define HANDOFF_TIMEOUT_MS 30000
+
+/** directory of the deduplicating upload store; empty disables it */
+#define BLOB_STORE_DIR ""
+
+/** accept HTTP/2 over cleartext TCP, by prior knowledge or upgrade */
+#define HTTP2_ENABLED true
+
+/** HTTP/2 streams served at once on one connection */
+#define HTTP2_MAX_CONCURRENT_STREAMS 100
+
+/** serve connections on coroutines instead of pool workers */
+#define COROUTINES_ENABLED false
+
+/** threads that run coroutines */
+#define COROUTINE_THREADS 2
+
+/** stack of each coroutine in KiB, above a guard page */
+#define COROUTINE_STACK_KB 256
+
+/** most coroutines alive at once */
+#define COROUTINE_MAX 10000
+
+/** worker processes forked to share the listener; 0 serves in one process */
+#define PREFORK_WORKERS 0
+
+/** milliseconds a prefork worker must run before it is restarted at once */
+#define PREFORK_RESTART_DELAY_MS 1000
+
+/** path prefixes forwarded to upstream servers, as "/prefix=host:port,host:port ..."; empty disables */
+#define PROXY_ROUTES ""
+
+/** idle connections kept open to each upstream server */
+#define PROXY_POOL_SIZE 32
+
+/** milliseconds allowed to connect to an upstream server or for it to send or receive */
+#define PROXY_TIMEOUT_MS 30000
+
+/** milliseconds between health checks of the upstream servers */
+#define PROXY_HEALTH_INTERVAL_MS 2000
+
+/** PEM certificate chain served over TLS; empty serves plain TCP */
+#define TLS_CERTIFICATE ""
+
+/** PEM private key of the certificate; empty if in the certificate file */
+#define TLS_PRIVATE_KEY ""
+
+/** TLS sessions kept for resumption by session ID */
+#define TLS_SESSION_CACHE_SIZE 20480
+
+/** seconds each session ticket key encrypts tickets; 0 for no tickets */
+#define TLS_TICKET_ROTATION_S 3600
+
+/** hand the session keys to kernel TLS after the handshake */
+#define TLS_KTLS true
+
+/** URI that reports the server counters */
+#define SERVER_STATUS_URI "/server-status"
+
+/** URI that returns several files in one multipart response */
+#define BATCH_URI "/batch"
+
+/** most paths in one batch request */
+#define BATCH_MAX_PATHS 64
+
+/** largest file returned in a batch response */
+#define BATCH_MAX_PART_BYTES 65536
+
 /** web newline sequence */
 static const char *CRLF = "\r\n";
 
@@ -24,4 +242,14 @@ extern const bool debug;
 /** subdirectory of application home directory for web content */
 extern const char *CONTENT_BASE;
 
+/**
+ * Queue work for the network workers, which serve connections
+ * unless coroutines do.
+ *
+ * @param function the function to run
+ * @param arg the function argument
+ * @return 0 if queued, -1 if the dispatch queue is full
+ */
+int submitNetworkWork(void (*function)(void *arg), void *arg);
+
 #endif /* CONSTANTS_H_ */
@@ -8,10 +8,17 @@
  */
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "properties.h"
 #include "file_util.h"
 #include "http_server.h"
+#include "error_page.h"
 
 
 /** The default response protocol */
@@ -91,7 +98,37 @@ void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
 }
 
 /**
- * Set error response and error page to the response output stream.
+ * Format the status line and headers of a response into a buffer,
+ * for a response sent with a single gathered write. The blank line
+ * that ends the headers is not included.
+ *
+ * @param buf the buffer
+ * @param size the size of the buffer
+ * @param status the response status
+ * @param statusMsg the response message
+ * @param responseHeaders the response headers
+ * @return the formatted length, or 0 if it does not fit
+ */
+size_t formatResponseHead(char *buf, size_t size, int status, const char *statusMsg, Properties *responseHeaders) {
+	int len = snprintf(buf, size, "%s %d %s%s", responseProtocol, status, statusMsg, CRLF);
+	if (debug) {
+		fprintf(stderr, "%s %d %s\n", responseProtocol, status, statusMsg);
+	}
+	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
+	for (int i = 0; len >= 0 && (size_t)len < size && getProperty(responseHeaders, i, name, val); i++) {
+		int n = snprintf(buf + len, size - len, "%s: %s%s", name, val, CRLF);
+		len = (n < 0) ? -1 : len + n;
+		if (debug) {
+			fprintf(stderr, "%s: %s\n", name, val);
+		}
+	}
+	return (len >= 0 && (size_t)len < size) ? (size_t)len : 0;
+}
+
+/**
+ * Send an error response and error page to the response output
+ * stream with one write, from the preformatted response of its
+ * status, with the date and added headers of the response headers.
  *
  * @param ostream the output socket stream
  * @param status the response status
@@ -99,31 +136,104 @@ void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
  * @param responseHeaders the response headers
  */
 void sendErrorResponse(FILE* ostream, int responseCode, const char *responseStr, Properties *responseHeaders) {
-	sendResponseStatus(ostream, responseCode, responseStr);
-
-	char errorBody[2*MAXBUF];  // because of data substitution.
-	const char *errorPage =
-		"<html>"
-	    "<head><title>%d %s</title></head>"
-	    "<body>%d %s"
-	    "<br>usage:http://yourHostName:port/"
-	    "fileName.html</body></html>";
-	sprintf(errorBody, errorPage, responseCode, responseStr, responseCode, responseStr);
-	FILE *tmpStream = tmpStringFile(errorBody);
+	// the rest of the request is not read; unread buffered input
+	// would keep the stream from switching to writing
+	discardBufferedInput(ostream);
+	if (debug) {
+		fprintf(stderr, "%s %d %s\n", responseProtocol, responseCode, responseStr);
+	}
 
-	char buf[MAXBUF];
-	size_t contentLen = strlen(errorBody);
-	sprintf(buf, "%lu", contentLen);
-	putProperty(responseHeaders,"Content-Length", buf);
-	putProperty(responseHeaders,"Content-type", "text/html");
+	// the preformatted response takes the request's date and the
+	// headers it added; it has its own server, length and type
+	char date[MAX_PROP_VAL] = "";
+	char headers[ERROR_RESPONSE_MAX/2];
+	size_t len = 0;
+	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
+	for (int i = 0; getProperty(responseHeaders, i, name, val); i++) {
+		if (strcasecmp(name, "Date") == 0) {
+			strcpy(date, val);
+		} else if (strcasecmp(name, "Server") != 0
+				&& strcasecmp(name, "Content-Length") != 0
+				&& strcasecmp(name, "Content-type") != 0) {
+			int n = snprintf(headers + len, sizeof(headers) - len, "%s: %s%s", name, val, CRLF);
+			if (n < 0 || (size_t)n >= sizeof(headers) - len) {
+				break;
+			}
+			len += n;
+		}
+	}
+	headers[len] = '\0';
 
+	char response[ERROR_RESPONSE_MAX];
+	struct iovec iov;
+	iov.iov_base = response;
+	iov.iov_len = formatErrorResponse(response, sizeof(response), responseCode, responseStr, date, headers);
+	if (iov.iov_len > 0) {
+		sendIoVector(ostream, &iov, 1);
+	}
+}
 
-	// Send the headers
-	sendResponseHeaders(ostream, responseHeaders);
+/**
+ * Return the value of a hex digit.
+ * @param c the character
+ * @return the value, or -1 if not a hex digit
+ */
+static int hexValue(int c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c |= 0x20;  // lower case
+	return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
 
-	// Send the error page body.
-	copyFileStreamBytes(tmpStream, ostream, contentLen);
-	fclose(tmpStream);
+/**
+ * Decode the %xx escape at the start of a string.
+ * @param esc the escape
+ * @return the character code, or -1 if not a valid escape
+ */
+static int decodeEscape(const char *esc) {
+	int hi = hexValue((unsigned char)esc[1]);
+	if (hi < 0) {  // also stops at the end of the string
+		return -1;
+	}
+	int lo = hexValue((unsigned char)esc[2]);
+	return (lo < 0) ? -1 : (hi << 4) | lo;
+}
+
+/**
+ * Return the length of the run of characters at the start of a
+ * string that need no decoding: up to the next '%', '/', or the
+ * end of the string. Scans 16 bytes at a time where available.
+ *
+ * @param s the string
+ * @return the length of the run
+ */
+static size_t plainRunLength(const char *s) {
+#if defined(__SSE2__)
+	// aligned loads never cross into the next page, so reading
+	// past the end of the string within a block is safe
+	const char *p = s;
+	for (; ((uintptr_t)p & 15) != 0; p++) {
+		if (*p == '%' || *p == '/' || *p == '\0') {
+			return p - s;
+		}
+	}
+	const __m128i percent = _mm_set1_epi8('%');
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i nul = _mm_setzero_si128();
+	for (;; p += 16) {
+		__m128i block = _mm_load_si128((const __m128i *)p);
+		__m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, percent),
+													_mm_cmpeq_epi8(block, slash)),
+									   _mm_cmpeq_epi8(block, nul));
+		int mask = _mm_movemask_epi8(special);
+		if (mask != 0) {
+			return (p - s) + __builtin_ctz(mask);
+		}
+	}
+#else
+	return strcspn(s, "%/");
+#endif
 }
 
 /**
@@ -137,8 +247,8 @@ char *unescapeUri(const char *escUri, char *uri) {
 	char *p = uri;
 	while (*escUri) {
 		if ( *escUri == '%') {
-			int c;
-			if (sscanf(escUri, "%%%02x", &c) == 0) {
+			int c = decodeEscape(escUri);
+			if (c < 0) {
 				return NULL;
 			}
 			*p++ = (unsigned char)c;
@@ -151,16 +261,84 @@ char *unescapeUri(const char *escUri, char *uri) {
 	return uri;
 }
 
+/**
+ * Decode and normalize a request URI path in a single pass.
+ * %xx escapes are decoded, empty and "." segments are removed,
+ * and ".." segments remove the segment before them. A trailing
+ * '/' is kept. The result always begins with '/'.
+ *
+ * @param escUri the escaped URI path
+ * @param uri storage for the normalized path
+ * @param size the size of the storage
+ * @return uri if successful, or NULL if the path is not absolute,
+ *  has a bad escape, an escaped '/' or NUL, a ".." above the root,
+ *  or does not fit
+ */
+char *normalizeUri(const char *escUri, char *uri, size_t size) {
+	if (*escUri != '/' || size < 2) {
+		return NULL;
+	}
+	size_t n = 0;
+	uri[n++] = '/';
+	size_t segStart = n;  // start of the current segment
+	const char *p = escUri + 1;
+	while (true) {
+		// copy the plain run, then handle the character that ends it
+		size_t run = plainRunLength(p);
+		if (n + run >= size) {
+			return NULL;
+		}
+		memcpy(uri + n, p, run);
+		n += run;
+		p += run;
+
+		if (*p == '%') {
+			int c = decodeEscape(p);
+			if (c <= 0 || c == '/' || n + 1 >= size) {
+				return NULL;
+			}
+			uri[n++] = (char)c;
+			p += 3;
+			continue;
+		}
+
+		// end of a segment at '/' or the end of the path
+		size_t segLen = n - segStart;
+		if (segLen == 0 || (segLen == 1 && uri[segStart] == '.')) {
+			n = segStart;  // drop empty and "." segments
+		} else if (segLen == 2 && uri[segStart] == '.' && uri[segStart+1] == '.') {
+			if (segStart == 1) {
+				return NULL;  // above the root
+			}
+			// drop ".." and the segment before it
+			for (n = segStart - 1; uri[n-1] != '/'; n--) {}
+			segStart = n;
+		} else if (*p == '/') {
+			if (n + 1 >= size) {
+				return NULL;
+			}
+			uri[n++] = '/';
+			segStart = n;
+		}
+		if (*p == '\0') {
+			break;
+		}
+		p++;
+	}
+	uri[n] = '\0';
+	return uri;
+}
+
 /**
  * Resolves server URI to file system path.
  * @param uri the request URI
  * @param fspath the file system path
- * @return the file system path
+ * @param size the size of the file system path storage
+ * @return the file system path, or NULL if it does not fit
  */
-char *resolveUri(const char *uri, char *fspath) {
-	strcpy(fspath, CONTENT_BASE);
-	strcat(fspath, uri);
-	return fspath;
+char *resolveUri(const char *uri, char *fspath, size_t size) {
+	int len = snprintf(fspath, size, "%s%s", CONTENT_BASE, uri);
+	return (len < 0 || (size_t)len >= size) ? NULL : fspath;
 }
 
 /**
@@ -10,6 +10,7 @@
 #ifndef HTTP_UTIL_H_
 #define HTTP_UTIL_H_
 
+#include <stddef.h>
 #include <time.h>
 
 #include "properties.h"
@@ -43,7 +44,23 @@ void sendResponseStatus(FILE *ostream, int status, const char *statusMsg);
 void sendResponseHeaders(FILE *ostream, Properties *responseHeaders);
 
 /**
- * Set error response and error page to the response output stream.
+ * Format the status line and headers of a response into a buffer,
+ * for a response sent with a single gathered write. The blank line
+ * that ends the headers is not included.
+ *
+ * @param buf the buffer
+ * @param size the size of the buffer
+ * @param status the response status
+ * @param statusMsg the response message
+ * @param responseHeaders the response headers
+ * @return the formatted length, or 0 if it does not fit
+ */
+size_t formatResponseHead(char *buf, size_t size, int status, const char *statusMsg, Properties *responseHeaders);
+
+/**
+ * Send an error response and error page to the response output
+ * stream with one write, from the preformatted response of its
+ * status, with the date and added headers of the response headers.
  *
  * @param ostream the output socket stream
  * @param status the response status
@@ -61,13 +78,29 @@ void sendErrorResponse(FILE* ostream, int responseCode, const char *responseStr,
  */
 char *unescapeUri(const char *escUri, char *uri);
 
+/**
+ * Decode and normalize a request URI path in a single pass.
+ * %xx escapes are decoded, empty and "." segments are removed,
+ * and ".." segments remove the segment before them. A trailing
+ * '/' is kept. The result always begins with '/'.
+ *
+ * @param escUri the escaped URI path
+ * @param uri storage for the normalized path
+ * @param size the size of the storage
+ * @return uri if successful, or NULL if the path is not absolute,
+ *  has a bad escape, an escaped '/' or NUL, a ".." above the root,
+ *  or does not fit
+ */
+char *normalizeUri(const char *escUri, char *uri, size_t size);
+
 /**
  * Resolves server URI to file system path.
  * @param uri the request URI
  * @param fspath the file system path
- * @return the file system path
+ * @param size the size of the file system path storage
+ * @return the file system path, or NULL if it does not fit
  */
-char *resolveUri(const char *uri, char *fspath);
+char *resolveUri(const char *uri, char *fspath, size_t size);
 
 /**
  * Debug request by printing request and request headers
@@ -27,26 +27,28 @@ void buildMap(FILE* mime, map_base_t *mime_map){
 //	        	break;
 //	        }
 //	}
+	// strtok_r, since maps are rebuilt while requests are served
 	while(fgets(line, MAXBUF, mime) != NULL){
+		char *line_save, *token_save;
 		char* token;
-		char* _line = strdup(line);
-		token = strtok(_line, "\t\n");
+		token = strtok_r(line, "\t\n", &line_save);
 		char* value = token;
-		token = strtok(NULL, "\t");
+		token = strtok_r(NULL, "\t", &line_save);
 		while(token != NULL){
-			char* token_key = strtok(token, " ");
+			char* token_key = strtok_r(token, " ", &token_save);
 			while(token_key != NULL){
 				char *pos;
 				if ((pos = strchr(token_key, '\n'))!= NULL){
 					*pos = '\0';
 				}
-				if(map_set_(mime_map, token_key, value, strlen(value))< 0){
+				// store the terminator, so values can be used as strings
+				if(map_set_(mime_map, token_key, value, strlen(value)+1)< 0){
 					fprintf(stderr, "Unable to add mime types to map\n");
 				}
 //				printf("token: %s, value: %s\n", token_key, value);
-				token_key = strtok(NULL, " ");
+				token_key = strtok_r(NULL, " ", &token_save);
 			}
-			token = strtok(NULL, "\t");
+			token = strtok_r(NULL, "\t", &line_save);
 		}
 	}
 }
@@ -62,7 +64,16 @@ char *strlower(char *s)
     return s;
 }
 
-char* getMimeType_Advanced(const char *filename, char *mimeType)
+/**
+ * Return a MIME type for a given filename from a map
+ * of MIME types by file extension.
+ *
+ * @param mimeMap the map of MIME types
+ * @param filename the name of the file
+ * @param mimeType output buffer for mime type
+ * @return pointer to mime type string
+ */
+char* getMimeType_Advanced(map_base_t *mimeMap, const char *filename, char *mimeType)
 {
 	// special-case directory based on trailing '/'
 	if (filename[strlen(filename)-1] == '/') {
@@ -84,7 +95,7 @@ char* getMimeType_Advanced(const char *filename, char *mimeType)
 
 //    const char *mtstr;
 
-	const char* mtstr = (char*)map_get_(&mime_map, ext);
+	const char* mtstr = (char*)map_get_(mimeMap, ext);
 	if (mtstr == NULL){
 		mtstr = DEFAULT_MIME_TYPE;
 	}
@@ -19,9 +19,13 @@
 #ifndef MIME_UTIL_H_
 #define MIME_UTIL_H_
 
-/** declare the map */
-map_base_t mime_map;
-
+/**
+ * Build a map of MIME types by file extension from a
+ * mime.types file.
+ *
+ * @param mime the mime.types stream
+ * @param mime_map the map
+ */
 void buildMap(FILE* mime, map_base_t *mime_map);
 /**
  * Return a MIME type for a given filename.
@@ -32,6 +36,15 @@ void buildMap(FILE* mime, map_base_t *mime_map);
  */
 char *getMimeType(const char *filename, char *mimeType);
 
-char* getMimeType_Advanced(const char *filename, char *mimeType);
+/**
+ * Return a MIME type for a given filename from a map
+ * of MIME types by file extension.
+ *
+ * @param mimeMap the map of MIME types
+ * @param filename the name of the file
+ * @param mimeType output buffer for mime type
+ * @return pointer to mime type string
+ */
+char* getMimeType_Advanced(map_base_t *mimeMap, const char *filename, char *mimeType);
 
 #endif /* MIME_UTIL_H_ */
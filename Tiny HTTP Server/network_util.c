@@ -7,14 +7,41 @@
  *  @author: Philip Gust
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE  // accept4
+#endif
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 
+#include "network_util.h"
+#include "server_config.h"
+
+/**
+ * Set a socket option, reporting a failure.
+ *
+ * @param sock_fd the socket
+ * @param level the option level
+ * @param name the option name
+ * @param value the option value
+ * @param what the option name to report
+ * @return 0 if successful, -1 if error
+ */
+static int set_int_option(int sock_fd, int level, int name, int value, const char *what) {
+	if (setsockopt(sock_fd, level, name, &value, sizeof(value)) != 0) {
+		perror(what);
+		return -1;
+	}
+	return 0;
+}
+
 /**
  * Get listener socket
  *
@@ -23,8 +50,8 @@
  */
 int get_listener_socket(int port) {
     // Creating internet socket stream file descriptor
-    int listen_sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_sock_fd == 0) {
+    int listen_sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_sock_fd < 0) {
         return 0;
     }
 
@@ -50,9 +77,8 @@ int get_listener_socket(int port) {
 		return 0;
     }
 
-    // set up queue for clients connections up to default
-    // maximum pending socket connections (usually 128)
-    if (listen(listen_sock_fd, SOMAXCONN) < 0) {
+    // listen with the configured backlog and options
+    if (configure_listener_socket(listen_sock_fd) != 0) {
     	close(listen_sock_fd);
     	return 0;
     }
@@ -60,24 +86,107 @@ int get_listener_socket(int port) {
 	return listen_sock_fd;
 }
 
+/**
+ * Apply the configured options to a listener and listen with the
+ * configured backlog. The listener is made non-blocking, since
+ * connections are accepted after polling for them. Options that
+ * the kernel does not support are reported and skipped.
+ *
+ * @param listen_sock_fd the bound or listening socket
+ * @return 0 if successful, -1 if the socket cannot listen
+ */
+int configure_listener_socket(int listen_sock_fd) {
+	const ServerConfig *config = serverConfig();
+
+	// accepted sockets inherit the buffer sizes; set them before
+	// listening so the window scale advertised in the handshake fits
+	if (config->socketSendBufferBytes > 0) {
+		set_int_option(listen_sock_fd, SOL_SOCKET, SO_SNDBUF,
+					   config->socketSendBufferBytes, "SO_SNDBUF");
+	}
+	if (config->socketRecvBufferBytes > 0) {
+		set_int_option(listen_sock_fd, SOL_SOCKET, SO_RCVBUF,
+					   config->socketRecvBufferBytes, "SO_RCVBUF");
+	}
+
+	// listening again on a handed-over listener only resizes its backlog
+	if (listen(listen_sock_fd, config->listenBacklog) < 0) {
+		return -1;
+	}
+	int flags = fcntl(listen_sock_fd, F_GETFL);
+	if (flags < 0 || fcntl(listen_sock_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		return -1;
+	}
+
+#if defined(TCP_DEFER_ACCEPT)
+	// wake the acceptor only when the request arrives; a connection
+	// that sends nothing stays in the kernel until the timeout
+	set_int_option(listen_sock_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+				   config->tcpDeferAcceptSec, "TCP_DEFER_ACCEPT");
+#endif
+#if defined(TCP_FASTOPEN)
+	// let returning clients send the request in the SYN; needs the
+	// server bit (2) of the net.ipv4.tcp_fastopen sysctl
+	if (config->tcpFastOpenQueue > 0) {
+		set_int_option(listen_sock_fd, IPPROTO_TCP, TCP_FASTOPEN,
+					   config->tcpFastOpenQueue, "TCP_FASTOPEN");
+	}
+#endif
+	return 0;
+}
+
 /**
  * Accept new peer connection on a listen socket.
  *
  * @param listen_sock_fd the listen socket
- * @return the peer socket fd
+ * @param peer_addr set to the peer address
+ * @return the peer socket fd, or -1 if no connection is pending
  */
-int accept_peer_connection(int listen_sock_fd) {
+int accept_peer_connection(int listen_sock_fd, struct sockaddr_in *peer_addr) {
 	while (true) {
-		struct sockaddr_in peer_addr;
-		socklen_t peer_size = sizeof(peer_addr);
-		int peer_sock_fd = accept(listen_sock_fd, (struct sockaddr *)&peer_addr, &peer_size);
-		if (peer_sock_fd > 0) {
+		socklen_t peer_size = sizeof(*peer_addr);
+		// peers stay blocking: workers read them through stdio streams,
+		// and deadlines unblock them by shutting the socket down
+		int peer_sock_fd = accept4(listen_sock_fd, (struct sockaddr *)peer_addr, &peer_size, SOCK_CLOEXEC);
+		if (peer_sock_fd >= 0) {
 			return peer_sock_fd;
 		}
-		perror("accept");
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return -1;
+		}
+		if (errno != EINTR && errno != ECONNABORTED) {
+			perror("accept");
+			return -1;
+		}
 	}
 }
 
+/**
+ * Apply the configured options to an accepted socket.
+ *
+ * @param sock_fd the peer socket
+ */
+void configure_peer_socket(int sock_fd) {
+	if (serverConfig()->tcpNoDelay) {
+		set_int_option(sock_fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+	}
+}
+
+/**
+ * Set or clear TCP_CORK on a socket. While set, partial frames are
+ * held back, so a response's headers and body go out in full-sized
+ * packets; clearing it sends what is held at once.
+ *
+ * @param sock_fd the peer socket
+ * @param cork true to hold partial frames, false to send them
+ */
+void set_socket_cork(int sock_fd, bool cork) {
+#if defined(TCP_CORK)
+	int value = cork;
+	setsockopt(sock_fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+#endif
+}
+
 /**
  * Get the local host and port for a socket.
  *
@@ -10,6 +10,9 @@
 #ifndef NETWORK_UTIL_H_
 #define NETWORK_UTIL_H_
 
+#include <stdbool.h>
+#include <netinet/in.h>
+
 /**
  * Get listener socket
  *
@@ -18,13 +21,42 @@
  */
 int get_listener_socket(int port) ;
 
+/**
+ * Apply the configured options to a listener and listen with the
+ * configured backlog. The listener is made non-blocking, since
+ * connections are accepted after polling for them. Options that
+ * the kernel does not support are reported and skipped.
+ *
+ * @param listen_sock_fd the bound or listening socket
+ * @return 0 if successful, -1 if the socket cannot listen
+ */
+int configure_listener_socket(int listen_sock_fd);
+
 /**
  * Accept new peer connection on a listen socket.
  *
  * @param listen_sock_fd the listen socket
- * @return the peer socket fd
+ * @param peer_addr set to the peer address
+ * @return the peer socket fd, or -1 if no connection is pending
+ */
+int accept_peer_connection(int listen_sock_fd, struct sockaddr_in *peer_addr);
+
+/**
+ * Apply the configured options to an accepted socket.
+ *
+ * @param sock_fd the peer socket
+ */
+void configure_peer_socket(int sock_fd);
+
+/**
+ * Set or clear TCP_CORK on a socket. While set, partial frames are
+ * held back, so a response's headers and body go out in full-sized
+ * packets; clearing it sends what is held at once.
+ *
+ * @param sock_fd the peer socket
+ * @param cork true to hold partial frames, false to send them
  */
-int accept_peer_connection(int listen_sock_fd);
+void set_socket_cork(int sock_fd, bool cork);
 
 /**
  * Get the local host and port for a socket.
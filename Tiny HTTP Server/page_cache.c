@@ -0,0 +1,163 @@
+/*
+ * page_cache.c
+ *
+ * Functions that apply the page cache policy to the files served.
+ *
+ * The probe maps the file without touching it and asks mincore about
+ * a chunk of pages at a time; no page is faulted in, so unmapping it
+ * costs no TLB shootdown.
+ *
+ * Pages are dropped one window behind the send cursor, since the
+ * window just sent may still be queued on the socket; pages still in
+ * use are skipped by the kernel either way.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  // readahead
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "page_cache.h"
+#include "file_util.h"
+#include "file_lock.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "time_util.h"
+
+/** pages asked about in one mincore call */
+#define PROBE_CHUNK_PAGES 256
+
+/** nanoseconds per millisecond */
+#define NS_PER_MS 1000000ULL
+
+/** bytes sent at a time when only dropping pages */
+#define DONTNEED_CHUNK (1 << 20)
+
+/**
+ * Determine whether all of a file is in the page cache, so sending
+ * it will not wait for the disk.
+ *
+ * @param fd the file descriptor
+ * @param size the file size
+ * @return true if the file is resident or the probe is off, false if
+ *  some of it is not or it is too large to probe
+ */
+bool fileResident(int fd, off_t size) {
+#if defined(__linux__)
+	const ServerConfig *config = serverConfig();
+	if (!config->pageCacheProbe || size == 0) {
+		return true;
+	}
+	statsIncrement(pageCacheProbes);
+	if (size > (off_t)config->pageCacheProbeMaxKb * 1024) {
+		statsIncrement(pageCacheColdFiles);
+		return false;
+	}
+	char *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		return true;  // cannot tell; served as before
+	}
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t npages = (size + pageSize - 1) / pageSize;
+	unsigned char vec[PROBE_CHUNK_PAGES];
+	bool resident = true;
+	for (size_t page = 0; resident && page < npages; page += PROBE_CHUNK_PAGES) {
+		size_t n = (npages - page < PROBE_CHUNK_PAGES) ? npages - page : PROBE_CHUNK_PAGES;
+		if (mincore(addr + page * pageSize, n * pageSize, vec) != 0) {
+			break;
+		}
+		for (size_t i = 0; i < n && resident; i++) {
+			resident = (vec[i] & 1) != 0;
+		}
+	}
+	munmap(addr, size);
+	if (!resident) {
+		statsIncrement(pageCacheColdFiles);
+	}
+	return resident;
+#else
+	(void)fd;
+	(void)size;
+	return true;
+#endif
+}
+
+/**
+ * Determine whether all of a cached file is in the page cache,
+ * probing it only if it was not found resident recently.
+ *
+ * @param entry the file cache entry
+ * @return true if the file is resident or the probe is off
+ */
+bool cachedFileResident(FileCacheEntry *entry) {
+	uint64_t now = monotonicTimeNanos();
+	uint64_t residentAt = atomic_load_explicit(&entry->residentAt, memory_order_relaxed);
+	if (residentAt != 0 && now - residentAt < PAGE_CACHE_RESIDENT_MS * NS_PER_MS) {
+		return true;
+	}
+	if (!fileResident(entry->fd, entry->sb.st_size)) {
+		return false;
+	}
+	atomic_store_explicit(&entry->residentAt, now, memory_order_relaxed);
+	return true;
+}
+
+/**
+ * Send a whole file to an output stream, reading ahead of the send
+ * cursor and dropping a large file from the page cache behind it.
+ * The file is locked shared only while each chunk is sent.
+ *
+ * @param ostream the output stream
+ * @param fd the file descriptor
+ * @param sb the status of the file
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendFileSequential(FILE *ostream, int fd, const struct stat *sb) {
+	size_t nbytes = (size_t)sb->st_size;
+#if defined(__linux__)
+	const ServerConfig *config = serverConfig();
+	size_t window = (size_t)config->pageCacheReadaheadKb * 1024;
+	size_t dropAt = (size_t)config->pageCacheDontneedMb << 20;
+	bool drop = (dropAt > 0 && nbytes >= dropAt);
+	size_t chunk = (window > 0) ? window : DONTNEED_CHUNK;
+	if (nbytes <= chunk || (window == 0 && !drop)) {
+		return sendFileShared(ostream, fd, sb, 0, nbytes);
+	}
+	if (window > 0) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+	for (size_t cursor = 0; cursor < nbytes; ) {
+		size_t n = (nbytes - cursor < chunk) ? nbytes - cursor : chunk;
+		// the next window is read while this one is sent
+		if (window > 0 && cursor + n < nbytes) {
+			size_t ahead = (nbytes - cursor - n < window) ? nbytes - cursor - n : window;
+			if (readahead(fd, cursor + n, ahead) == 0) {
+				statsAdd(pageCacheReadahead, ahead);
+			}
+		}
+		if (sendFileShared(ostream, fd, sb, cursor, n) != 0) {
+			return -1;
+		}
+		if (drop && cursor >= chunk) {
+			posix_fadvise(fd, cursor - chunk, chunk, POSIX_FADV_DONTNEED);
+			statsAdd(pageCacheDropped, chunk);
+		}
+		cursor += n;
+	}
+	if (drop) {
+		// the last window; what the socket still holds is skipped
+		size_t rest = (nbytes % chunk != 0) ? nbytes % chunk : chunk;
+		posix_fadvise(fd, nbytes - rest, rest, POSIX_FADV_DONTNEED);
+		statsAdd(pageCacheDropped, rest);
+	}
+	return 0;
+#else
+	return sendFileShared(ostream, fd, sb, 0, nbytes);
+#endif
+}
@@ -0,0 +1,65 @@
+/*
+ * page_cache.h
+ *
+ * Functions that apply the page cache policy to the files served,
+ * so large downloads are read ahead of the socket and one-off huge
+ * downloads do not evict the hot small files.
+ *
+ * A cached file is served without the disk-I/O pool only if mincore
+ * finds all of it in the page cache; otherwise sending it could block
+ * the request thread on a disk read. A file found resident is trusted
+ * for PAGE_CACHE_RESIDENT_MS before it is probed again, since each
+ * probe takes the process's mmap lock. A file sent in more than one
+ * readahead window is marked sequential and the next window is read
+ * ahead of each one sent. A file at least page_cache_dontneed_mb long
+ * is dropped from the page cache a window behind the send cursor.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef PAGE_CACHE_H_
+#define PAGE_CACHE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "file_cache.h"
+
+/** milliseconds a cached file found resident is not probed again */
+#define PAGE_CACHE_RESIDENT_MS 1000
+
+/**
+ * Determine whether all of a file is in the page cache, so sending
+ * it will not wait for the disk.
+ *
+ * @param fd the file descriptor
+ * @param size the file size
+ * @return true if the file is resident or the probe is off, false if
+ *  some of it is not or it is too large to probe
+ */
+bool fileResident(int fd, off_t size);
+
+/**
+ * Determine whether all of a cached file is in the page cache,
+ * probing it only if it was not found resident recently.
+ *
+ * @param entry the file cache entry
+ * @return true if the file is resident or the probe is off
+ */
+bool cachedFileResident(FileCacheEntry *entry);
+
+/**
+ * Send a whole file to an output stream, reading ahead of the send
+ * cursor and dropping a large file from the page cache behind it.
+ * The file is locked shared only while each chunk is sent.
+ *
+ * @param ostream the output stream
+ * @param fd the file descriptor
+ * @param sb the status of the file
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendFileSequential(FILE *ostream, int fd, const struct stat *sb);
+
+#endif /* PAGE_CACHE_H_ */
@@ -0,0 +1,245 @@
+/*
+ * prefork.c
+ *
+ * Functions that serve from several worker processes forked to
+ * share the listener.
+ *
+ * The master blocks its control signals and takes them with
+ * sigtimedwait, so it never runs a handler and needs no thread.
+ * Workers run with the signal mask the server started with, and
+ * their own signal thread drains and stops them as before.
+ *
+ * A worker that exits soon after it started is restarted after
+ * a delay, so one that fails at startup does not fork in a loop.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+#include "prefork.h"
+#include "http_server.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "time_util.h"
+
+/** nanoseconds per millisecond */
+#define NS_PER_MS 1000000ULL
+
+/** nanoseconds per second */
+#define NS_PER_SEC 1000000000ULL
+
+/** Definition of a worker process */
+typedef struct Worker {
+	pid_t pid;              /** the process, or 0 if not running */
+	uint64_t startedAt;     /** monotonic ns when forked */
+	uint64_t restartAt;     /** monotonic ns when it may be forked again */
+} Worker;
+
+/** the worker processes */
+static Worker *workers = NULL;
+
+/** number of worker processes */
+static int nworkers = 0;
+
+/** the master process */
+static pid_t masterPid = 0;
+
+/** the signals the master takes */
+static sigset_t masterSignals;
+
+/** the signal mask the server started with */
+static sigset_t startMask;
+
+/**
+ * Fork a worker process.
+ *
+ * @param worker the worker
+ * @return 0 in the worker, the process ID in the master, -1 if error
+ */
+static pid_t forkWorker(Worker *worker) {
+	pid_t pid = fork();
+	if (pid == 0) {
+#if defined(__linux__)
+		// a worker drains and exits if the master dies
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		if (getppid() != masterPid) {
+			_exit(EXIT_FAILURE);
+		}
+#endif
+		sigprocmask(SIG_SETMASK, &startMask, NULL);
+		free(workers);
+		workers = NULL;
+		return 0;
+	}
+	uint64_t now = monotonicTimeNanos();
+	if (pid < 0) {
+		perror("fork");
+		worker->pid = 0;
+		worker->restartAt = now + PREFORK_RESTART_DELAY_MS * NS_PER_MS;
+		return -1;
+	}
+	worker->pid = pid;
+	worker->startedAt = now;
+	return pid;
+}
+
+/**
+ * Send a signal to the running workers.
+ * @param sig the signal
+ */
+static void signalWorkers(int sig) {
+	for (int i = 0; i < nworkers; i++) {
+		if (workers[i].pid > 0) {
+			kill(workers[i].pid, sig);
+		}
+	}
+}
+
+/**
+ * Collect the workers that exited and schedule their restart.
+ * @param stopping the server is stopping, so they are not restarted
+ */
+static void reapWorkers(bool stopping) {
+	pid_t pid;
+	int status;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		Worker *worker = NULL;
+		for (int i = 0; i < nworkers && worker == NULL; i++) {
+			if (workers[i].pid == pid) {
+				worker = &workers[i];
+			}
+		}
+		if (worker == NULL) {
+			continue;
+		}
+		worker->pid = 0;
+		if (stopping) {
+			continue;
+		}
+		if (WIFSIGNALED(status)) {
+			fprintf(stderr, "Worker %d killed by signal %d\n", (int)pid, WTERMSIG(status));
+		} else {
+			fprintf(stderr, "Worker %d exited with status %d\n", (int)pid, WEXITSTATUS(status));
+		}
+		uint64_t now = monotonicTimeNanos();
+		uint64_t delay = PREFORK_RESTART_DELAY_MS * NS_PER_MS;
+		worker->restartAt = (now - worker->startedAt < delay) ? now + delay : now;
+	}
+}
+
+/**
+ * Supervise the workers until they have stopped.
+ *
+ * @return 0 in a restarted worker; the master exits
+ */
+static int superviseWorkers(void) {
+	bool stopping = false;
+	while (true) {
+		// restart the workers that are due
+		uint64_t now = monotonicTimeNanos();
+		uint64_t next = UINT64_MAX;
+		int alive = 0;
+		for (int i = 0; i < nworkers; i++) {
+			Worker *worker = &workers[i];
+			if (worker->pid == 0 && !stopping) {
+				if (worker->restartAt > now) {
+					next = (worker->restartAt < next) ? worker->restartAt : next;
+				} else if (forkWorker(worker) == 0) {
+					return 0;
+				} else if (worker->pid > 0) {
+					statsIncrement(preforkRestarts);
+					fprintf(stderr, "Restarted worker %d\n", (int)worker->pid);
+				}
+			}
+			if (worker->pid > 0) {
+				alive++;
+			}
+		}
+		if (stopping && alive == 0) {
+			break;
+		}
+
+		int sig;
+		if (next != UINT64_MAX) {
+			uint64_t wait = (next > now) ? next - now : 0;
+			struct timespec timeout = { wait / NS_PER_SEC, wait % NS_PER_SEC };
+			sig = sigtimedwait(&masterSignals, NULL, &timeout);
+		} else {
+			sig = sigwaitinfo(&masterSignals, NULL);
+		}
+		switch (sig) {
+		case SIGCHLD:
+			reapWorkers(stopping);
+			break;
+		case SIGHUP:
+			signalWorkers(SIGHUP);
+			break;
+		case SIGTERM:
+		case SIGINT:
+			// a second signal makes the workers exit at once
+			if (!stopping) {
+				fprintf(stderr, "Stopping %d workers\n", alive);
+			}
+			stopping = true;
+			signalWorkers(sig);
+			break;
+		case SIGUSR1:
+			writeServerStats(stderr);
+			break;
+		case SIGUSR2:
+			fprintf(stderr, "Upgrades are not supported with prefork workers\n");
+			break;
+		default:  // timed out or interrupted
+			break;
+		}
+	}
+	fprintf(stderr, "Workers stopped\n");
+	writeServerStats(stderr);
+	exit(EXIT_SUCCESS);
+}
+
+/**
+ * Fork the worker processes and supervise them. Call this before
+ * starting any thread. Returns only in a worker; the master exits
+ * once the workers have stopped.
+ *
+ * @return 0 in a worker, -1 if the workers cannot be started
+ */
+int startPreforkWorkers(void) {
+	nworkers = serverConfig()->preforkWorkers;
+	workers = calloc(nworkers, sizeof(Worker));
+	if (workers == NULL || shareServerStats() != 0) {
+		return -1;
+	}
+	masterPid = getpid();
+	sigemptyset(&masterSignals);
+	sigaddset(&masterSignals, SIGCHLD);
+	sigaddset(&masterSignals, SIGHUP);
+	sigaddset(&masterSignals, SIGTERM);
+	sigaddset(&masterSignals, SIGINT);
+	sigaddset(&masterSignals, SIGUSR1);
+	sigaddset(&masterSignals, SIGUSR2);
+	if (sigprocmask(SIG_BLOCK, &masterSignals, &startMask) != 0) {
+		return -1;
+	}
+
+	for (int i = 0; i < nworkers; i++) {
+		if (forkWorker(&workers[i]) == 0) {
+			return 0;
+		}
+	}
+	fprintf(stderr, "Master %d serving with %d workers\n", (int)masterPid, nworkers);
+	return superviseWorkers();
+}
@@ -0,0 +1,32 @@
+/*
+ * prefork.h
+ *
+ * Functions that serve from several worker processes forked to
+ * share the listener, so a handler that crashes takes down one
+ * worker instead of the whole server.
+ *
+ * The master opens the listener and forks the workers before it
+ * starts any thread; each worker then starts its own thread pools
+ * and connection monitor. The master restarts a worker that exits,
+ * passes SIGHUP, SIGTERM and SIGINT on to the workers, and writes
+ * the counters on SIGUSR1 and when it stops. The counters are kept
+ * in shared memory, so they add up the requests of all workers.
+ * A content bundle mapped before the fork is shared by the workers
+ * through the page cache; file caches are per worker.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef PREFORK_H_
+#define PREFORK_H_
+
+/**
+ * Fork the worker processes and supervise them. Call this before
+ * starting any thread. Returns only in a worker; the master exits
+ * once the workers have stopped.
+ *
+ * @return 0 in a worker, -1 if the workers cannot be started
+ */
+int startPreforkWorkers(void);
+
+#endif /* PREFORK_H_ */
@@ -120,6 +120,21 @@ size_t nProperties(const Properties *props) {
 	return props->nprops;
 }
 
+/**
+ * Write properties to a stream in properties file format.
+ *
+ * @param propStream the stream
+ * @param props the properties
+ */
+void writeProperties(FILE *propStream, Properties *props) {
+	// get next line
+	int nprops = props->nprops;
+	fprintf(propStream, "# Properties size=%d\n", nprops);
+	for (int i = 0; i < nprops; i++) {
+		fprintf(propStream, "%s=%s\n", props->props[i].name, props->props[i].val);
+	}
+}
+
 /**
  * Store properties to properties file.
  *
@@ -133,12 +148,7 @@ bool storeProperties(const char *propFile, Properties *props) {
 		return -1;
 	}
 
-	// get next line
-	int nprops = props->nprops;
-	fprintf(propStream, "# Properties size=%d\n", nprops);
-	for (int i = 0; i < nprops; i++) {
-		fprintf(propStream, "%s=%s\n", props->props[i].name, props->props[i].val);
-	}
+	writeProperties(propStream, props);
 	fclose(propStream);
 	return 0;
 }
@@ -163,6 +173,7 @@ int loadProperties(const char *propFile, Properties *props) {
 		if (buf[0] == '#') { // ignore comment
 			continue;
 		}
+		buf[strcspn(buf, "\r\n")] = '\0';  // eliminate newline
 		char *p = strchr(buf, '=');
 		if (p != NULL) {
 			*p++ = '\0';
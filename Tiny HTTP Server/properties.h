@@ -9,6 +9,7 @@
 
 #ifndef PROPERTIES_H_
 #define PROPERTIES_H_
+#include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -66,6 +67,14 @@ size_t findProperty(Properties *props, size_t propIndex, const char *name, char
  */
 size_t nProperties(const Properties *props);
 
+/**
+ * Write properties to a stream in properties file format.
+ *
+ * @param propStream the stream
+ * @param props the properties
+ */
+void writeProperties(FILE *propStream, Properties *props);
+
 /**
  * Store properties to properties file.
  *
@@ -0,0 +1,1074 @@
+/*
+ * proxy.c
+ *
+ * Functions that forward requests for configured path prefixes to
+ * upstream servers and relay their responses.
+ *
+ * Routes are read at startup from proxy_routes, a list of
+ * "/prefix=host:port,host:port" entries; the longest prefix that
+ * matches whole path segments selects the route. The request goes
+ * upstream as HTTP/1.1 with its headers, less the hop-by-hop ones
+ * and those its Connection header names, and an X-Forwarded-For.
+ * The response headers are filtered the same way, and the response
+ * is relayed with its own framing: by length, chunk by chunk, or
+ * until the upstream closes, in which case the client connection is
+ * closed too. Interim 1xx responses are dropped; "Expect:
+ * 100-continue" is answered here.
+ *
+ * Upstream sockets block with the proxy timeout as their send and
+ * receive timeouts. An idle pooled connection the upstream closed
+ * is detected before reuse; if one fails before any response byte
+ * arrives, a request without a body is sent again on another.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  // splice
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "proxy.h"
+#include "http_server.h"
+#include "http_util.h"
+#include "file_util.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "coroutine.h"
+
+/** most proxy routes */
+#define PROXY_MAX_ROUTES 16
+
+/** most upstream servers, and most per route */
+#define PROXY_MAX_UPSTREAMS 32
+
+/** size of a forwarded request head */
+#define PROXY_HEAD_MAX 8192
+
+/** longest response line relayed */
+#define PROXY_LINE_MAX 8192
+
+/** bytes moved per splice */
+#define PROXY_SPLICE_CHUNK 65536
+
+/** Outcomes of forwarding a request */
+typedef enum ProxyResult {
+	PROXY_KEEP,             /** relayed; the client connection can be kept */
+	PROXY_CLOSE,            /** relayed; the client connection must close */
+	PROXY_RETRY,            /** a pooled connection was stale; nothing was sent */
+	PROXY_BAD_GATEWAY,      /** the upstream failed before responding */
+	PROXY_TIMEOUT,          /** the upstream did not respond in time */
+	PROXY_ABORTED           /** the response was cut short */
+} ProxyResult;
+
+/** Definition of an upstream server */
+typedef struct Upstream {
+	char name[MAXBUF];              /** host:port as configured */
+	struct sockaddr_in addr;        /** the address */
+	atomic_int outstanding;         /** requests being forwarded to it */
+	atomic_bool healthy;            /** it accepted its last connection */
+	pthread_mutex_t lock;           /** guards the idle connections */
+	int *idle;                      /** idle connections, most recent last */
+	int nidle;                      /** number of idle connections */
+} Upstream;
+
+/** Definition of a proxy route */
+typedef struct ProxyRoute {
+	char prefix[MAXBUF];            /** path prefix, without a trailing '/' */
+	size_t prefixLen;               /** length of the prefix */
+	Upstream *upstreams[PROXY_MAX_UPSTREAMS];  /** its upstream servers */
+	int nupstreams;                 /** number of upstream servers */
+	atomic_uint next;               /** where the search for an upstream starts */
+} ProxyRoute;
+
+/** Definition of a buffered reader of an upstream response */
+typedef struct UpstreamReader {
+	int fd;                         /** the upstream connection */
+	char buf[PROXY_LINE_MAX];       /** bytes received */
+	size_t pos;                     /** next byte to read */
+	size_t len;                     /** bytes in the buffer */
+	size_t nread;                   /** bytes received in all */
+} UpstreamReader;
+
+/** the proxy routes */
+static ProxyRoute routes[PROXY_MAX_ROUTES];
+
+/** number of proxy routes */
+static int nroutes = 0;
+
+/** the upstream servers of all routes */
+static Upstream *upstreams[PROXY_MAX_UPSTREAMS];
+
+/** number of upstream servers */
+static int nupstreams = 0;
+
+/** headers that apply to one connection and are not forwarded */
+static const char *hopByHopHeaders[] = {
+	"Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate",
+	"Proxy-Authorization", "TE", "Trailer", "Transfer-Encoding", "Upgrade"
+};
+
+/**
+ * Determine whether a header name is a given name.
+ *
+ * @param name the header name, not terminated
+ * @param len the length of the name
+ * @param want the name to compare with
+ * @return true if the names are equal ignoring case
+ */
+static bool headerNamed(const char *name, size_t len, const char *want) {
+	return strlen(want) == len && strncasecmp(name, want, len) == 0;
+}
+
+/**
+ * Determine whether a header applies to one connection only.
+ *
+ * @param name the header name, not terminated
+ * @param len the length of the name
+ * @return true if the header is not forwarded
+ */
+static bool isHopByHop(const char *name, size_t len) {
+	for (size_t i = 0; i < sizeof(hopByHopHeaders) / sizeof(hopByHopHeaders[0]); i++) {
+		if (headerNamed(name, len, hopByHopHeaders[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Determine whether a Connection header value lists a header name.
+ *
+ * @param list the comma-separated header names
+ * @param name the header name, not terminated
+ * @param len the length of the name
+ * @return true if the name is listed, ignoring case
+ */
+static bool listsHeader(const char *list, const char *name, size_t len) {
+	for (const char *p = list + strspn(list, " \t,\r\n"); *p != '\0'; ) {
+		size_t n = strcspn(p, " \t,\r\n");
+		if (n == len && strncasecmp(p, name, len) == 0) {
+			return true;
+		}
+		p += n;
+		p += strspn(p, " \t,\r\n");
+	}
+	return false;
+}
+
+/**
+ * Set the health of an upstream, and drop its idle connections
+ * when it goes down.
+ *
+ * @param up the upstream
+ * @param healthy whether it accepts connections
+ */
+static void setHealth(Upstream *up, bool healthy) {
+	if (atomic_exchange(&up->healthy, healthy) == healthy) {
+		return;
+	}
+	fprintf(stderr, "Upstream %s is %s\n", up->name, healthy ? "up" : "down");
+	if (!healthy) {
+		pthread_mutex_lock(&up->lock);
+		while (up->nidle > 0) {
+			close(up->idle[--up->nidle]);
+		}
+		pthread_mutex_unlock(&up->lock);
+	}
+}
+
+/**
+ * Open a connection to an upstream.
+ *
+ * @param up the upstream
+ * @param timeoutMs milliseconds allowed to connect
+ * @return the connection, or -1 with errno set if error
+ */
+static int connectUpstream(Upstream *up, int timeoutMs) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&up->addr, sizeof(up->addr)) != 0) {
+		struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+		int err = 0;
+		socklen_t errlen = sizeof(err);
+		int n = (errno == EINPROGRESS) ? poll(&pfd, 1, timeoutMs) : -1;
+		if (n <= 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0 || err != 0) {
+			close(fd);
+			errno = (n == 0) ? ETIMEDOUT : (err != 0) ? err : errno;
+			return -1;
+		}
+	}
+	// requests block on the upstream for at most the timeout
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	struct timeval tv = { .tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000 };
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+/**
+ * Take an idle connection to an upstream that is still open.
+ *
+ * @param up the upstream
+ * @return the connection, or -1 if there is none
+ */
+static int takeIdle(Upstream *up) {
+	while (true) {
+		pthread_mutex_lock(&up->lock);
+		int fd = (up->nidle > 0) ? up->idle[--up->nidle] : -1;
+		pthread_mutex_unlock(&up->lock);
+		if (fd < 0) {
+			return -1;
+		}
+		// an idle connection has nothing to read unless it was closed
+		char c;
+		if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN) {
+			return fd;
+		}
+		close(fd);
+	}
+}
+
+/**
+ * Return a connection to the idle connections of an upstream,
+ * or close it if the pool is full.
+ *
+ * @param up the upstream
+ * @param fd the connection
+ */
+static void releaseIdle(Upstream *up, int fd) {
+	pthread_mutex_lock(&up->lock);
+	if (up->nidle < serverConfig()->proxyPoolSize && atomic_load(&up->healthy)) {
+		up->idle[up->nidle++] = fd;
+		fd = -1;
+	}
+	pthread_mutex_unlock(&up->lock);
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+/**
+ * Choose the healthy upstream of a route with the fewest requests
+ * outstanding; ties go to each upstream in turn.
+ *
+ * @param route the route
+ * @return the upstream, or NULL if none is healthy
+ */
+static Upstream *chooseUpstream(ProxyRoute *route) {
+	unsigned start = atomic_fetch_add(&route->next, 1);
+	Upstream *best = NULL;
+	int bestLoad = 0;
+	for (int i = 0; i < route->nupstreams; i++) {
+		Upstream *up = route->upstreams[(start + i) % route->nupstreams];
+		int load = atomic_load(&up->outstanding);
+		if (atomic_load(&up->healthy) && (best == NULL || load < bestLoad)) {
+			best = up;
+			bestLoad = load;
+		}
+	}
+	return best;
+}
+
+/**
+ * Open a connection for a request: a pooled one if there is one,
+ * otherwise a new one. An upstream that refuses is marked down and
+ * the next is tried.
+ *
+ * @param route the route
+ * @param up set to the upstream
+ * @param reused set to whether the connection was pooled
+ * @return the connection, or -1 if no upstream accepts one
+ */
+static int openUpstream(ProxyRoute *route, Upstream **up, bool *reused) {
+	for (int i = 0; i < route->nupstreams; i++) {
+		*up = chooseUpstream(route);
+		if (*up == NULL) {
+			return -1;
+		}
+		int fd = takeIdle(*up);
+		*reused = (fd >= 0);
+		if (*reused) {
+			statsIncrement(proxyReuses);
+			return fd;
+		}
+		fd = connectUpstream(*up, serverConfig()->proxyTimeoutMs);
+		if (fd >= 0) {
+			statsIncrement(proxyConnects);
+			return fd;
+		}
+		setHealth(*up, false);
+	}
+	return -1;
+}
+
+/**
+ * Send all of a buffer on an upstream connection.
+ *
+ * @param fd the connection
+ * @param buf the bytes
+ * @param len the number of bytes
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int sendAll(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Wait for a descriptor that returned EAGAIN if it is non-blocking,
+ * as a client socket served on coroutines is. On a blocking socket
+ * EAGAIN means its timeout expired.
+ *
+ * @param fd the descriptor
+ * @param events POLLIN or POLLOUT
+ * @return true if it is ready to try again
+ */
+static bool awaitNonBlocking(int fd, short events) {
+	int flags = fcntl(fd, F_GETFL);
+	return flags >= 0 && (flags & O_NONBLOCK) != 0 && awaitReady(fd, events) == 0;
+}
+
+/**
+ * Move bytes from one socket to another, with splice through a
+ * pipe kept by the thread where possible.
+ *
+ * @param in_fd the input socket
+ * @param out_fd the output socket
+ * @param nbytes the number of bytes, or -1 for all until end of file
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int relaySocket(int in_fd, int out_fd, off_t nbytes) {
+#if defined(__linux__)
+	static __thread int relayPipe[2] = { -1, -1 };
+	if (relayPipe[0] < 0 && pipe2(relayPipe, O_CLOEXEC) != 0) {
+		return -1;
+	}
+	while (nbytes != 0) {
+		size_t chunk = (nbytes < 0 || nbytes > PROXY_SPLICE_CHUNK) ? PROXY_SPLICE_CHUNK : (size_t)nbytes;
+		ssize_t nin = splice(in_fd, NULL, relayPipe[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (nin < 0 && (errno == EINTR || (errno == EAGAIN && awaitNonBlocking(in_fd, POLLIN)))) {
+			continue;
+		}
+		if (nin == 0 && nbytes < 0) {
+			break;
+		}
+		if (nin == 0) {
+			// closed before the declared length; the pipe is empty
+			errno = ECONNRESET;
+			return -1;
+		}
+		while (nin > 0) {
+			ssize_t nout = splice(relayPipe[0], NULL, out_fd, NULL, nin, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (nout < 0 && (errno == EINTR || (errno == EAGAIN && awaitNonBlocking(out_fd, POLLOUT)))) {
+				continue;
+			}
+			if (nout <= 0) {
+				break;
+			}
+			nin -= nout;
+			if (nbytes > 0) {
+				nbytes -= nout;
+			}
+		}
+		if (nin != 0) {
+			// the pipe may hold bytes of this exchange
+			int saved = (nin > 0) ? errno : ECONNRESET;
+			close(relayPipe[0]);
+			close(relayPipe[1]);
+			relayPipe[0] = relayPipe[1] = -1;
+			errno = saved;
+			return -1;
+		}
+	}
+	return 0;
+#else
+	char buf[PROXY_SPLICE_CHUNK];
+	while (nbytes != 0) {
+		size_t chunk = (nbytes < 0 || nbytes > (off_t)sizeof(buf)) ? sizeof(buf) : (size_t)nbytes;
+		ssize_t nin = recv(in_fd, buf, chunk, 0);
+		if (nin < 0 && (errno == EINTR || (errno == EAGAIN && awaitNonBlocking(in_fd, POLLIN)))) {
+			continue;
+		}
+		if (nin == 0 && nbytes < 0) {
+			break;
+		}
+		if (nin <= 0) {
+			if (nin == 0) {
+				errno = ECONNRESET;
+			}
+			return -1;
+		}
+		for (ssize_t nsent = 0; nsent < nin; ) {
+			ssize_t n = send(out_fd, buf + nsent, nin - nsent, MSG_NOSIGNAL);
+			if (n < 0 && (errno == EINTR || (errno == EAGAIN && awaitNonBlocking(out_fd, POLLOUT)))) {
+				continue;
+			}
+			if (n < 0) {
+				return -1;
+			}
+			nsent += n;
+		}
+		if (nbytes > 0) {
+			nbytes -= nin;
+		}
+	}
+	return 0;
+#endif
+}
+
+/**
+ * Receive more of an upstream response into its reader.
+ *
+ * @param r the reader; its buffer must be empty
+ * @return the number of bytes received, 0 at end of file, -1 if error
+ */
+static ssize_t readerFill(UpstreamReader *r) {
+	ssize_t n;
+	do {
+		n = recv(r->fd, r->buf, sizeof(r->buf), 0);
+	} while (n < 0 && errno == EINTR);
+	r->pos = 0;
+	r->len = (n > 0) ? (size_t)n : 0;
+	r->nread += r->len;
+	return n;
+}
+
+/**
+ * Read a line of an upstream response, with its line end.
+ *
+ * @param r the reader
+ * @param line the buffer for the line
+ * @param size the size of the buffer
+ * @return the length of the line, 0 at end of file, -1 with errno set if error
+ */
+static ssize_t readerLine(UpstreamReader *r, char *line, size_t size) {
+	size_t len = 0;
+	while (true) {
+		if (r->pos == r->len) {
+			ssize_t n = readerFill(r);
+			if (n <= 0) {
+				if (n == 0 && len == 0) {
+					return 0;
+				} else if (n == 0) {
+					errno = ECONNRESET;
+				}
+				return -1;
+			}
+		}
+		char *start = r->buf + r->pos;
+		char *end = memchr(start, '\n', r->len - r->pos);
+		size_t take = (end != NULL) ? (size_t)(end - start + 1) : r->len - r->pos;
+		if (len + take >= size) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		memcpy(line + len, start, take);
+		len += take;
+		r->pos += take;
+		if (end != NULL) {
+			line[len] = '\0';
+			return len;
+		}
+	}
+}
+
+/**
+ * Relay bytes of an upstream response body to the client: those
+ * already read, then the rest directly from the upstream socket,
+ * or through the reader to a stream without a socket, as over TLS.
+ *
+ * @param r the reader
+ * @param stream the client stream
+ * @param nbytes the number of bytes, or -1 for all until end of file
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int relayBody(UpstreamReader *r, FILE *stream, off_t nbytes) {
+	size_t nbuffered = r->len - r->pos;
+	if (nbytes >= 0 && (off_t)nbuffered > nbytes) {
+		nbuffered = (size_t)nbytes;
+	}
+	fwrite(r->buf + r->pos, 1, nbuffered, stream);
+	r->pos += nbuffered;
+	if (nbytes > 0) {
+		nbytes -= nbuffered;
+	}
+	if (fileno(stream) >= 0) {
+		if (fflush(stream) != 0) {
+			return -1;
+		}
+		return (nbytes != 0) ? relaySocket(r->fd, fileno(stream), nbytes) : 0;
+	}
+	while (nbytes != 0) {
+		ssize_t n = readerFill(r);
+		if (n <= 0) {
+			if (n == 0 && nbytes < 0) {
+				break;
+			} else if (n == 0) {
+				errno = ECONNRESET;
+			}
+			return -1;
+		}
+		size_t take = (nbytes < 0 || n <= nbytes) ? (size_t)n : (size_t)nbytes;
+		fwrite(r->buf, 1, take, stream);
+		r->pos = take;
+		if (nbytes > 0) {
+			nbytes -= take;
+		}
+	}
+	return fflush(stream);
+}
+
+/**
+ * Relay a chunked upstream response body to the client as it is
+ * framed, through its last chunk and trailers.
+ *
+ * @param r the reader
+ * @param stream the client stream
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int relayChunked(UpstreamReader *r, FILE *stream) {
+	char line[MAXBUF];
+	ssize_t len;
+	while (true) {
+		len = readerLine(r, line, sizeof(line));
+		unsigned long long size;
+		if (len <= 0 || sscanf(line, "%llx", &size) != 1) {
+			errno = (len < 0) ? errno : EPROTO;
+			return -1;
+		}
+		fwrite(line, 1, len, stream);
+		if (size == 0) {
+			break;
+		}
+		// the chunk data and its line end
+		if (relayBody(r, stream, (off_t)size + 2) != 0) {
+			return -1;
+		}
+	}
+	// trailers, ending with a blank line
+	do {
+		len = readerLine(r, line, sizeof(line));
+		if (len <= 0) {
+			errno = (len < 0) ? errno : ECONNRESET;
+			return -1;
+		}
+		fwrite(line, 1, len, stream);
+	} while (line[0] != '\r' && line[0] != '\n');
+	return fflush(stream);
+}
+
+/**
+ * Relay the request body from the client to the upstream.
+ *
+ * @param stream the client stream
+ * @param fd the upstream connection
+ * @param nbytes the length of the body
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int relayRequestBody(FILE *stream, int fd, off_t nbytes) {
+	char buf[BUFSIZ];
+	// bytes read ahead with the headers, then the rest socket to socket;
+	// a stream without a socket, as over TLS, is read through
+	size_t nbuffered = streamBufferedInput(stream);
+	while (nbytes > 0 && (nbuffered > 0 || fileno(stream) < 0)) {
+		size_t n = ((off_t)sizeof(buf) < nbytes) ? sizeof(buf) : (size_t)nbytes;
+		ssize_t nread = readAvailable(stream, buf, n);
+		if (nread <= 0 || sendAll(fd, buf, nread) != 0) {
+			if (nread == 0) {
+				errno = ECONNRESET;
+			}
+			return -1;
+		}
+		nbuffered = ((size_t)nread < nbuffered) ? nbuffered - nread : 0;
+		nbytes -= nread;
+	}
+	return (nbytes > 0) ? relaySocket(fileno(stream), fd, nbytes) : 0;
+}
+
+/**
+ * Forward a request on an upstream connection and relay the response.
+ * The connection is pooled again or closed.
+ *
+ * @param up the upstream
+ * @param fd the connection
+ * @param reused the connection was pooled
+ * @param stream the client stream
+ * @param head the request head
+ * @param headLen the length of the head
+ * @param contentLen the length of the request body
+ * @param headRequest the request is a HEAD request
+ * @param clientKeep the client connection is kept alive
+ * @return the outcome
+ */
+static ProxyResult forwardRequest(Upstream *up, int fd, bool reused, FILE *stream,
+								  const char *head, size_t headLen, off_t contentLen,
+								  bool headRequest, bool clientKeep) {
+	// a pooled connection the upstream closed fails on send or first read
+	bool retry = reused && contentLen == 0;
+	if (sendAll(fd, head, headLen) != 0) {
+		close(fd);
+		return retry ? PROXY_RETRY : PROXY_BAD_GATEWAY;
+	}
+	if (contentLen > 0 && relayRequestBody(stream, fd, contentLen) != 0) {
+		close(fd);
+		return PROXY_BAD_GATEWAY;
+	}
+
+	UpstreamReader *r = malloc(sizeof(UpstreamReader));
+	if (r == NULL) {
+		close(fd);
+		return PROXY_BAD_GATEWAY;
+	}
+	r->fd = fd;
+	r->pos = r->len = r->nread = 0;
+	char line[PROXY_LINE_MAX];
+	ssize_t len;
+	int minor = 0;
+	int status = 0;
+	// interim responses are read and dropped
+	do {
+		len = readerLine(r, line, sizeof(line));
+		if (len <= 0) {
+			ProxyResult result = (retry && r->nread == 0) ? PROXY_RETRY
+							   : (len < 0 && errno == EAGAIN) ? PROXY_TIMEOUT : PROXY_BAD_GATEWAY;
+			free(r);
+			close(fd);
+			return result;
+		}
+		if (sscanf(line, "HTTP/1.%d %3d", &minor, &status) != 2 || status < 100 || len < 13) {
+			free(r);
+			close(fd);
+			return PROXY_BAD_GATEWAY;
+		}
+		if (status < 200) {
+			while ((len = readerLine(r, line, sizeof(line))) > 2) {
+			}
+		}
+	} while (status < 200 && len > 0);
+
+	// the status line as received, then the headers; they are held
+	// until all are read, as the Connection header can name others
+	char headers[PROXY_HEAD_MAX];
+	size_t statusLen = snprintf(headers, sizeof(headers), "HTTP/1.1 %s", line + 9);
+	size_t headersLen = statusLen;
+	char connection[PROXY_LINE_MAX] = "";
+	size_t connectionLen = 0;
+	bool upstreamKeep = (minor >= 1);
+	bool chunked = false;
+	off_t length = -1;
+	while ((len = readerLine(r, line, sizeof(line))) > 0 && line[0] != '\r' && line[0] != '\n') {
+		char *colon = strchr(line, ':');
+		if (colon == NULL) {
+			continue;
+		}
+		size_t nameLen = colon - line;
+		const char *value = colon + 1 + strspn(colon + 1, " \t");
+		if (headerNamed(line, nameLen, "Content-Length")) {
+			length = strtoll(value, NULL, 10);
+		} else if (headerNamed(line, nameLen, "Transfer-Encoding")) {
+			chunked = (strcasestr(value, "chunked") != NULL);
+		} else if (headerNamed(line, nameLen, "Connection")) {
+			upstreamKeep = (minor >= 1) ? strcasestr(value, "close") == NULL
+										: strcasestr(value, "keep-alive") != NULL;
+			int n = snprintf(connection + connectionLen, sizeof(connection) - connectionLen, "%s,", value);
+			if (n > 0 && (size_t)n < sizeof(connection) - connectionLen) {
+				connectionLen += n;
+			} else {
+				connection[connectionLen] = '\0';
+			}
+		}
+		if (headersLen + len >= sizeof(headers)) {
+			len = -1;  // too large to relay
+			break;
+		}
+		memcpy(headers + headersLen, line, len);
+		headersLen += len;
+	}
+	if (len <= 0 || statusLen >= sizeof(headers)) {
+		free(r);
+		close(fd);
+		return PROXY_BAD_GATEWAY;
+	}
+
+	// the framing headers are relayed as the body is framed; a length
+	// is not sent with chunked framing, which would contradict it
+	fwrite(headers, 1, statusLen, stream);
+	for (char *p = headers + statusLen, *next; p < headers + headersLen; p = next) {
+		next = (char *)memchr(p, '\n', headers + headersLen - p) + 1;
+		size_t nameLen = (char *)memchr(p, ':', next - p) - p;
+		bool forward = headerNamed(p, nameLen, "Transfer-Encoding") ? true
+					 : headerNamed(p, nameLen, "Content-Length") ? !chunked
+					 : !isHopByHop(p, nameLen) && !listsHeader(connection, p, nameLen);
+		if (forward) {
+			fwrite(p, 1, next - p, stream);
+		}
+	}
+
+	bool noBody = headRequest || status == 204 || status == 304;
+	bool untilClose = !noBody && !chunked && length < 0;
+	bool keep = clientKeep && !untilClose;
+	fprintf(stream, "Connection: %s%s%s", keep ? "keep-alive" : "close", CRLF, CRLF);
+	int rc = noBody ? fflush(stream)
+		   : chunked ? relayChunked(r, stream)
+		   : relayBody(r, stream, length);
+	bool drained = (r->pos == r->len);
+	free(r);
+	if (rc != 0 || ferror(stream)) {
+		close(fd);
+		return PROXY_ABORTED;
+	}
+	if (upstreamKeep && !untilClose && drained) {
+		releaseIdle(up, fd);
+	} else {
+		close(fd);
+	}
+	return keep ? PROXY_KEEP : PROXY_CLOSE;
+}
+
+/**
+ * Format the head of a forwarded request.
+ *
+ * @param head the buffer for the head
+ * @param size the size of the buffer
+ * @param method the request method
+ * @param target the request target
+ * @param peerAddr the client IPv4 address in network byte order
+ * @param requestHeaders the request headers
+ * @return the length of the head, or 0 if it does not fit
+ */
+static size_t formatRequestHead(char *head, size_t size, const char *method, const char *target,
+								uint32_t peerAddr, Properties *requestHeaders) {
+	char name[MAX_PROP_NAME];
+	char val[MAX_PROP_VAL];
+	char forwardedFor[MAXBUF] = "";
+	char connection[MAX_PROP_VAL] = "";
+	findProperty(requestHeaders, 0, "Connection", connection);
+	size_t n = snprintf(head, size, "%s %s HTTP/1.1%s", method, target, CRLF);
+	for (size_t i = 0; n < size && getProperty(requestHeaders, i, name, val); i++) {
+		if (strcmp(name, "?") == 0 || strcasecmp(name, "Expect") == 0
+				|| isHopByHop(name, strlen(name))
+				|| (listsHeader(connection, name, strlen(name)) && strcasecmp(name, "Content-Length") != 0)) {
+			continue;
+		}
+		if (strcasecmp(name, "X-Forwarded-For") == 0) {
+			snprintf(forwardedFor, sizeof(forwardedFor), "%s, ", val);
+			continue;
+		}
+		n += snprintf(head + n, size - n, "%s: %s%s", name, val, CRLF);
+	}
+	char addr[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &peerAddr, addr, sizeof(addr));
+	if (n < size) {
+		n += snprintf(head + n, size - n, "X-Forwarded-For: %s%s%sConnection: keep-alive%s%s",
+					  forwardedFor, addr, CRLF, CRLF, CRLF);
+	}
+	return (n < size) ? n : 0;
+}
+
+/**
+ * Find the route of a request path: the longest prefix that
+ * matches whole path segments.
+ *
+ * @param uri the unescaped request path
+ * @return the route, or NULL if the path is not forwarded
+ */
+static ProxyRoute *findRoute(const char *uri) {
+	ProxyRoute *best = NULL;
+	for (int i = 0; i < nroutes; i++) {
+		ProxyRoute *route = &routes[i];
+		if (strncmp(uri, route->prefix, route->prefixLen) == 0
+				&& (uri[route->prefixLen] == '\0' || uri[route->prefixLen] == '/')
+				&& (best == NULL || route->prefixLen > best->prefixLen)) {
+			best = route;
+		}
+	}
+	return best;
+}
+
+/**
+ * Determine whether a request path is forwarded to an upstream.
+ *
+ * @param uri the unescaped request path
+ * @return true if the path is beneath a proxy route
+ */
+bool isProxied(const char *uri) {
+	return nroutes > 0 && findRoute(uri) != NULL;
+}
+
+/**
+ * Answer an "Expect: 100-continue" request, so the client sends
+ * the body that is forwarded.
+ *
+ * @param stream the socket stream
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @return true if the body should be forwarded, false if an error response was sent
+ */
+static bool expectContinue(FILE *stream, Properties *requestHeaders, Properties *responseHeaders) {
+	char buf[MAXBUF];
+	if (findProperty(requestHeaders, 0, "Expect", buf) == SIZE_MAX) {
+		return true;
+	}
+	if (strcasecmp(buf, "100-continue") != 0) {
+		sendErrorResponse(stream, 417, "Expectation Failed", responseHeaders);
+		return false;
+	}
+	if (streamBufferedInput(stream) == 0) {
+		sendResponseStatus(stream, 100, "Continue");
+		fprintf(stream, "%s", CRLF);
+		fflush(stream);
+	}
+	return true;
+}
+
+/**
+ * Forward a request to an upstream server of its route and relay
+ * the response. An error response is sent if no upstream answers.
+ *
+ * @param stream the socket stream
+ * @param method the request method
+ * @param uri the unescaped request path, which selects the route
+ * @param target the request target as received, sent upstream
+ * @param peerAddr the client IPv4 address in network byte order
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers; only Connection is sent
+ * @return true if the client connection can be kept alive
+ */
+bool proxyRequest(FILE *stream, const char *method, const char *uri, const char *target,
+				  uint32_t peerAddr, Properties *requestHeaders, Properties *responseHeaders) {
+	ProxyRoute *route = findRoute(uri);
+	statsIncrement(proxyRequests);
+
+	// a body is forwarded only with a known length
+	char buf[MAXBUF];
+	off_t contentLen = 0;
+	if (findProperty(requestHeaders, 0, "Transfer-Encoding", buf) != SIZE_MAX) {
+		sendErrorResponse(stream, 411, "Length Required", responseHeaders);
+		return false;
+	}
+	if (findProperty(requestHeaders, 0, "Content-Length", buf) != SIZE_MAX) {
+		char *end;
+		contentLen = strtoll(buf, &end, 10);
+		if (end == buf || *end != '\0' || contentLen < 0) {
+			sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+			return false;
+		}
+	}
+	char head[PROXY_HEAD_MAX];
+	size_t headLen = formatRequestHead(head, sizeof(head), method, target, peerAddr, requestHeaders);
+	if (headLen == 0) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+		return false;
+	}
+	if (contentLen > 0 && !expectContinue(stream, requestHeaders, responseHeaders)) {
+		return false;
+	}
+
+	bool clientKeep = (findProperty(responseHeaders, 0, "Connection", buf) != SIZE_MAX
+					   && strcasecmp(buf, "keep-alive") == 0);
+	bool headRequest = (strcasecmp(method, "HEAD") == 0);
+	ProxyResult result = PROXY_RETRY;
+	// a stale pooled connection is retried, at most once per pooled one
+	for (int attempt = 0; result == PROXY_RETRY && attempt <= serverConfig()->proxyPoolSize; attempt++) {
+		Upstream *up;
+		bool reused;
+		int fd = openUpstream(route, &up, &reused);
+		if (fd < 0) {
+			break;
+		}
+		atomic_fetch_add(&up->outstanding, 1);
+		result = forwardRequest(up, fd, reused, stream, head, headLen, contentLen, headRequest, clientKeep);
+		atomic_fetch_sub(&up->outstanding, 1);
+	}
+
+	switch (result) {
+	case PROXY_KEEP:
+		return true;
+	case PROXY_CLOSE:
+		return false;
+	case PROXY_RETRY:  // no upstream accepted a connection
+		statsIncrement(proxyErrors);
+		sendErrorResponse(stream, 503, "Service Unavailable", responseHeaders);
+		return contentLen == 0;
+	case PROXY_TIMEOUT:
+		statsIncrement(proxyErrors);
+		sendErrorResponse(stream, 504, "Gateway Timeout", responseHeaders);
+		return false;
+	case PROXY_BAD_GATEWAY:
+		statsIncrement(proxyErrors);
+		sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+		return false;
+	default:  // cut short after the response started
+		statsIncrement(proxyErrors);
+		return false;
+	}
+}
+
+/**
+ * The health thread checks that each upstream accepts connections.
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void *checkUpstreams(void *arg) {
+	(void)arg;
+	int intervalMs = serverConfig()->proxyHealthIntervalMs;
+	struct timespec interval = { intervalMs / 1000, (intervalMs % 1000) * 1000000L };
+	while (true) {
+		nanosleep(&interval, NULL);
+		const ServerConfig *config = acquireConfig();
+		setThreadConfig(config);
+		int timeoutMs = (config->proxyTimeoutMs < intervalMs) ? config->proxyTimeoutMs : intervalMs;
+		for (int i = 0; i < nupstreams; i++) {
+			int fd = connectUpstream(upstreams[i], timeoutMs);
+			if (fd >= 0) {
+				close(fd);
+			}
+			setHealth(upstreams[i], fd >= 0);
+		}
+		setThreadConfig(NULL);
+		releaseConfig(config);
+	}
+	return NULL;
+}
+
+/**
+ * Gauge for the number of upstream servers that are up.
+ * @return the number of healthy upstreams
+ */
+static long proxy_upstreams_up(void) {
+	long n = 0;
+	for (int i = 0; i < nupstreams; i++) {
+		n += atomic_load(&upstreams[i]->healthy);
+	}
+	return n;
+}
+
+/**
+ * Find the upstream server for "host:port", adding it if it is new.
+ *
+ * @param hostPort the host and port
+ * @return the upstream, or NULL if it cannot be resolved
+ */
+static Upstream *findUpstream(const char *hostPort) {
+	for (int i = 0; i < nupstreams; i++) {
+		if (strcmp(upstreams[i]->name, hostPort) == 0) {
+			return upstreams[i];
+		}
+	}
+	char host[MAXBUF];
+	snprintf(host, sizeof(host), "%s", hostPort);
+	char *port = strrchr(host, ':');
+	if (port == NULL || nupstreams == PROXY_MAX_UPSTREAMS) {
+		return NULL;
+	}
+	*port++ = '\0';
+	struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+	struct addrinfo *info;
+	if (getaddrinfo(host, port, &hints, &info) != 0) {
+		return NULL;
+	}
+	Upstream *up = calloc(1, sizeof(Upstream));
+	int poolSize = serverConfig()->proxyPoolSize;
+	if (up != NULL) {
+		up->idle = calloc((poolSize > 0) ? poolSize : 1, sizeof(int));
+	}
+	if (up == NULL || up->idle == NULL) {
+		free(up);
+		freeaddrinfo(info);
+		return NULL;
+	}
+	snprintf(up->name, sizeof(up->name), "%s", hostPort);
+	memcpy(&up->addr, info->ai_addr, sizeof(up->addr));
+	freeaddrinfo(info);
+	atomic_init(&up->outstanding, 0);
+	atomic_init(&up->healthy, true);
+	pthread_mutex_init(&up->lock, NULL);
+	upstreams[nupstreams++] = up;
+	return up;
+}
+
+/**
+ * Parse the proxy routes and start checking the health of their
+ * upstream servers. Does nothing if no routes are configured.
+ *
+ * @return 0 if successful, -1 if a route is invalid or a host unknown
+ */
+int initProxy(void) {
+	char list[MAXBUF];
+	snprintf(list, sizeof(list), "%s", serverConfig()->proxyRoutes);
+	char *saveRoute;
+	for (char *entry = strtok_r(list, " \t;", &saveRoute); entry != NULL;
+			entry = strtok_r(NULL, " \t;", &saveRoute)) {
+		char *hosts = strchr(entry, '=');
+		if (entry[0] != '/' || hosts == NULL || nroutes == PROXY_MAX_ROUTES) {
+			fprintf(stderr, "Invalid proxy route %s\n", entry);
+			return -1;
+		}
+		*hosts++ = '\0';
+		ProxyRoute *route = &routes[nroutes];
+		snprintf(route->prefix, sizeof(route->prefix), "%s", entry);
+		route->prefixLen = strlen(route->prefix);
+		while (route->prefixLen > 0 && route->prefix[route->prefixLen-1] == '/') {
+			route->prefix[--route->prefixLen] = '\0';  // "/" forwards every path
+		}
+		char *saveHost;
+		for (char *host = strtok_r(hosts, ",", &saveHost); host != NULL; host = strtok_r(NULL, ",", &saveHost)) {
+			Upstream *up = findUpstream(host);
+			if (up == NULL || route->nupstreams == PROXY_MAX_UPSTREAMS) {
+				fprintf(stderr, "Invalid proxy upstream %s\n", host);
+				return -1;
+			}
+			route->upstreams[route->nupstreams++] = up;
+		}
+		if (route->nupstreams == 0) {
+			fprintf(stderr, "Proxy route %s has no upstream\n", entry);
+			return -1;
+		}
+		atomic_init(&route->next, 0);
+		nroutes++;
+	}
+	if (nroutes == 0) {
+		return 0;
+	}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, checkUpstreams, NULL) != 0) {
+		return -1;
+	}
+	pthread_detach(thread);
+	registerStatsGauge("proxy_upstreams_up", proxy_upstreams_up);
+	fprintf(stderr, "Proxying %d routes to %d upstream servers\n", nroutes, nupstreams);
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * proxy.h
+ *
+ * Functions that forward requests for configured path prefixes to
+ * upstream servers and relay their responses, so local backend
+ * services can be reached through this server.
+ *
+ * Each upstream keeps a pool of idle keep-alive connections, so a
+ * forwarded request usually costs no TCP handshake. A request goes
+ * to the healthy upstream of its route with the fewest requests
+ * outstanding; a thread checks every upstream periodically, and one
+ * that refuses a connection is marked down until it accepts again.
+ * Bodies are moved between the sockets with splice.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef PROXY_H_
+#define PROXY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "properties.h"
+
+/**
+ * Parse the proxy routes and start checking the health of their
+ * upstream servers. Does nothing if no routes are configured.
+ *
+ * @return 0 if successful, -1 if a route is invalid or a host unknown
+ */
+int initProxy(void);
+
+/**
+ * Determine whether a request path is forwarded to an upstream.
+ *
+ * @param uri the unescaped request path
+ * @return true if the path is beneath a proxy route
+ */
+bool isProxied(const char *uri);
+
+/**
+ * Forward a request to an upstream server of its route and relay
+ * the response. An error response is sent if no upstream answers.
+ *
+ * @param stream the socket stream
+ * @param method the request method
+ * @param uri the unescaped request path, which selects the route
+ * @param target the request target as received, sent upstream
+ * @param peerAddr the client IPv4 address in network byte order
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers; only Connection is sent
+ * @return true if the client connection can be kept alive
+ */
+bool proxyRequest(FILE *stream, const char *method, const char *uri, const char *target,
+				  uint32_t peerAddr, Properties *requestHeaders, Properties *responseHeaders);
+
+#endif /* PROXY_H_ */
@@ -0,0 +1,237 @@
+/*
+ * rate_limit.c
+ *
+ * Functions that limit the request rate of each client IP address
+ * with a token bucket.
+ *
+ * A bucket is one 64-bit word, the tokens in thousandths above the
+ * millisecond it was last updated, so taking a token is a single
+ * compare-and-swap. A client's slot is found by linear probing of a
+ * short window of its shard; slots are claimed by swapping in the
+ * client's key and are never emptied, so probe chains stay intact.
+ *
+ * When a new client finds its window full, a clock sweep of the
+ * window gives each recently used entry a second chance by clearing
+ * its referenced flag, and reclaims an entry that was not used since
+ * the last sweep and whose bucket has refilled. Such a client would
+ * start again with a full bucket, so reclaiming it loses nothing.
+ *
+ * The table is one shared anonymous mapping made before prefork
+ * workers are forked, so the workers take tokens from the same
+ * buckets; the atomic operations work the same across processes.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "rate_limit.h"
+#include "server_config.h"
+#include "server_stats.h"
+#include "time_util.h"
+
+/** number of shards; a power of two */
+#define RATE_LIMIT_SHARDS 16
+
+/** slots probed for a client */
+#define PROBE_WINDOW 8
+
+/** bucket units per token */
+#define MILLI_TOKENS 1000
+
+/** nanoseconds per millisecond */
+#define NS_PER_MS 1000000ULL
+
+/** Definition of a slot of the table */
+typedef struct RateSlot {
+	_Atomic uint64_t key;       /** client address with bit 32 set, 0 if free */
+	_Atomic uint64_t bucket;    /** milli-tokens << 32 | ms of the last update */
+	atomic_bool referenced;     /** used since the last sweep */
+} RateSlot;
+
+/** Definition of a shard of the table */
+typedef struct RateShard {
+	RateSlot *slots;            /** the slots */
+	uint32_t mask;              /** number of slots - 1 */
+} RateShard;
+
+/** the shards */
+static RateShard shards[RATE_LIMIT_SHARDS];
+
+/** number of clients in the table; in the shared mapping */
+static atomic_long *nentries = NULL;
+
+/** monotonic ns when the table was created */
+static uint64_t epoch = 0;
+
+/**
+ * Return the milliseconds since the table was created,
+ * wrapping every 49 days.
+ * @return the milliseconds
+ */
+static uint32_t nowMs(void) {
+	return (uint32_t)((monotonicTimeNanos() - epoch) / NS_PER_MS);
+}
+
+/**
+ * Mix the bits of an address to spread clients over the table.
+ * @param addr the address
+ * @return the hash
+ */
+static uint64_t hashAddr(uint32_t addr) {
+	uint64_t h = addr + 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+/**
+ * Return the milli-tokens in a bucket after refilling it to now.
+ *
+ * @param bucket the bucket
+ * @param now the current ms
+ * @param config the configuration
+ * @return the milli-tokens, at most the burst
+ */
+static uint64_t refill(uint64_t bucket, uint32_t now, const ServerConfig *config) {
+	uint32_t elapsed = now - (uint32_t)bucket;
+	// the rate in tokens per second is also milli-tokens per ms
+	uint64_t tokens = (bucket >> 32) + (uint64_t)elapsed * config->rateLimitRequestsPerSec;
+	uint64_t burst = (uint64_t)config->rateLimitBurst * MILLI_TOKENS;
+	return (tokens < burst) ? tokens : burst;
+}
+
+/**
+ * Return a full bucket.
+ *
+ * @param now the current ms
+ * @param config the configuration
+ * @return the bucket
+ */
+static uint64_t fullBucket(uint32_t now, const ServerConfig *config) {
+	return ((uint64_t)config->rateLimitBurst * MILLI_TOKENS) << 32 | now;
+}
+
+/**
+ * Take a token from the bucket of a slot.
+ *
+ * @param slot the slot
+ * @param now the current ms
+ * @param config the configuration
+ * @return true if there was a token
+ */
+static bool takeToken(RateSlot *slot, uint32_t now, const ServerConfig *config) {
+	uint64_t old = atomic_load_explicit(&slot->bucket, memory_order_relaxed);
+	uint64_t tokens;
+	do {
+		tokens = refill(old, now, config);
+		if (tokens < MILLI_TOKENS) {
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak(&slot->bucket, &old,
+										   (tokens - MILLI_TOKENS) << 32 | now));
+	return true;
+}
+
+/**
+ * Allocate the table of token buckets, shared with the processes
+ * forked afterwards. Call before prefork workers are started.
+ *
+ * @return 0 if successful, -1 if error
+ */
+int initRateLimit(void) {
+	uint32_t perShard = PROBE_WINDOW;
+	while (perShard * RATE_LIMIT_SHARDS < (uint32_t)serverConfig()->rateLimitTableSlots) {
+		perShard <<= 1;
+	}
+	// the count is padded to a slot, so the slots stay aligned
+	size_t size = sizeof(RateSlot) * ((size_t)perShard * RATE_LIMIT_SHARDS + 1);
+	char *table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (table == MAP_FAILED) {
+		return -1;
+	}
+	nentries = (atomic_long *)table;
+	RateSlot *slots = (RateSlot *)table + 1;
+	for (int i = 0; i < RATE_LIMIT_SHARDS; i++) {
+		shards[i].slots = slots + (size_t)i * perShard;
+		shards[i].mask = perShard - 1;
+	}
+	epoch = monotonicTimeNanos();
+	return 0;
+}
+
+/**
+ * Take a token from the bucket of a client for a request. A client
+ * seen for the first time starts with a full bucket. If the table
+ * has no room for a new client, the request is allowed.
+ *
+ * @param addr the client IPv4 address in network byte order
+ * @return true if the request is allowed, false if the client is
+ *  over its rate
+ */
+bool rateLimitAllow(uint32_t addr) {
+	const ServerConfig *config = serverConfig();
+	if (!config->rateLimitEnabled) {
+		return true;
+	}
+	uint64_t key = (uint64_t)addr | (1ULL << 32);
+	uint64_t h = hashAddr(addr);
+	RateShard *shard = &shards[h & (RATE_LIMIT_SHARDS - 1)];
+	uint32_t start = (uint32_t)(h >> 32);
+	uint32_t now = nowMs();
+
+	// find the client, or claim a free slot for it
+	RateSlot *slot = NULL;
+	for (int i = 0; i < PROBE_WINDOW && slot == NULL; i++) {
+		RateSlot *s = &shard->slots[(start + i) & shard->mask];
+		uint64_t k = atomic_load(&s->key);
+		if (k == 0) {
+			// a free bucket is unused, so racing claimers may all fill it
+			atomic_store(&s->bucket, fullBucket(now, config));
+			if (atomic_compare_exchange_strong(&s->key, &k, key)) {
+				atomic_fetch_add(nentries, 1);
+				k = key;
+			}
+		}
+		if (k == key) {
+			slot = s;
+		}
+	}
+
+	// window full: clock sweep for an entry to reclaim
+	for (int i = 0; i < PROBE_WINDOW && slot == NULL; i++) {
+		RateSlot *s = &shard->slots[(start + i) & shard->mask];
+		if (atomic_exchange(&s->referenced, false)) {
+			continue;  // second chance
+		}
+		uint64_t k = atomic_load(&s->key);
+		uint64_t burst = (uint64_t)config->rateLimitBurst * MILLI_TOKENS;
+		if (refill(atomic_load(&s->bucket), now, config) < burst) {
+			continue;  // still limiting its client
+		}
+		atomic_store(&s->bucket, fullBucket(now, config));
+		if (atomic_compare_exchange_strong(&s->key, &k, key)) {
+			slot = s;
+		}
+	}
+	if (slot == NULL) {
+		// fail open: a full table must not turn clients away
+		statsIncrement(rateLimitTableFull);
+		return true;
+	}
+
+	if (!atomic_load_explicit(&slot->referenced, memory_order_relaxed)) {
+		atomic_store(&slot->referenced, true);
+	}
+	return takeToken(slot, now, config);
+}
+
+/**
+ * Return the number of clients in the table.
+ * @return the number of clients
+ */
+long rateLimitSize(void) {
+	return (nentries != NULL) ? atomic_load(nentries) : 0;
+}
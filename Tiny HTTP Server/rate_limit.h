@@ -0,0 +1,48 @@
+/*
+ * rate_limit.h
+ *
+ * Functions that limit the request rate of each client IP address
+ * with a token bucket, so a client that sends more than its rate
+ * is answered with a preformatted 429 before its request is read.
+ *
+ * The buckets are kept in a table of shards, each an open-addressed
+ * array of slots updated with atomic operations, so the check takes
+ * no locks. When a client's probe window is full, entries are aged
+ * out by a clock sweep of the window. The table is shared by the
+ * prefork workers, so a client's rate and burst hold across them.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef RATE_LIMIT_H_
+#define RATE_LIMIT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Allocate the table of token buckets, shared with the processes
+ * forked afterwards. Call before prefork workers are started.
+ *
+ * @return 0 if successful, -1 if error
+ */
+int initRateLimit(void);
+
+/**
+ * Take a token from the bucket of a client for a request. A client
+ * seen for the first time starts with a full bucket. If the table
+ * has no room for a new client, the request is allowed.
+ *
+ * @param addr the client IPv4 address in network byte order
+ * @return true if the request is allowed, false if the client is
+ *  over its rate
+ */
+bool rateLimitAllow(uint32_t addr);
+
+/**
+ * Return the number of clients in the table.
+ * @return the number of clients
+ */
+long rateLimitSize(void);
+
+#endif /* RATE_LIMIT_H_ */
@@ -0,0 +1,485 @@
+/*
+ * server_config.c
+ *
+ * Server settings loaded from a properties file, with the MIME
+ * type map, as an immutable snapshot that is rebuilt on SIGHUP.
+ *
+ * Snapshots are reference counted. A reader counts itself in
+ * "acquiring" while it loads the current pointer and takes its
+ * reference; a reload swaps the pointer, waits for readers that
+ * may have loaded the old one to finish taking their reference,
+ * then drops the reference the current pointer held. Readers
+ * only do atomic increments, so a reload never blocks requests.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "server_config.h"
+#include "properties.h"
+#include "mime_util.h"
+#include "server_stats.h"
+
+/** Types of setting */
+typedef enum SettingType {
+	SETTING_INT,        /** int field */
+	SETTING_BOOL,       /** bool field: true or false */
+	SETTING_STRING      /** char[MAXBUF] field */
+} SettingType;
+
+/** Definition of a setting in the configuration file */
+typedef struct Setting {
+	const char *name;   /** property name */
+	SettingType type;   /** setting type */
+	size_t offset;      /** offset of the field in ServerConfig */
+	int min;            /** minimum int value, or minimum string length */
+	int max;            /** maximum int value */
+	bool startup;       /** read at startup only */
+} Setting;
+
+/** Define an int setting */
+#define INT_SETTING(name, field, min, max, startup) \
+	{ name, SETTING_INT, offsetof(ServerConfig, field), min, max, startup }
+
+/** the settings of the configuration file */
+static const Setting settings[] = {
+	INT_SETTING("port", port, MIN_PORT, 65535, true),
+	{ "content_base", SETTING_STRING, offsetof(ServerConfig, contentBase), 1, 0, true },
+	{ "mime_types", SETTING_STRING, offsetof(ServerConfig, mimeTypes), 1, 0, false },
+	{ "blob_store", SETTING_STRING, offsetof(ServerConfig, blobStore), 0, 0, true },
+	INT_SETTING("pool_min_threads", poolMinThreads, 1, 4096, true),
+	INT_SETTING("pool_threads_per_cpu", poolThreadsPerCpu, 1, 1024, true),
+	INT_SETTING("pool_idle_timeout_ms", poolIdleTimeoutMs, 1, 3600000, true),
+	INT_SETTING("pool_target_delay_ms", poolTargetDelayMs, 1, 60000, true),
+	INT_SETTING("dispatch_queue_high_water", dispatchQueueHighWater, 1, 1000000, true),
+	INT_SETTING("disk_pool_min_threads", diskPoolMinThreads, 1, 4096, true),
+	INT_SETTING("disk_pool_max_threads", diskPoolMaxThreads, 1, 4096, true),
+	INT_SETTING("disk_queue_high_water", diskQueueHighWater, 1, 1000000, true),
+	INT_SETTING("shed_retry_after_sec", shedRetryAfterSec, 0, 3600, true),
+	INT_SETTING("read_header_timeout_ms", readHeaderTimeoutMs, 1, 3600000, false),
+	INT_SETTING("read_body_timeout_ms", readBodyTimeoutMs, 1, 3600000, false),
+	INT_SETTING("write_timeout_ms", writeTimeoutMs, 1, 3600000, false),
+	INT_SETTING("keepalive_timeout_ms", keepAliveTimeoutMs, 1, 3600000, false),
+	INT_SETTING("keepalive_max_requests", keepAliveMaxRequests, 1, 1000000, false),
+	INT_SETTING("file_cache_ttl_ms", fileCacheTtlMs, 0, 3600000, false),
+	INT_SETTING("file_cache_max_entries", fileCacheMaxEntries, 0, 1000000, false),
+	INT_SETTING("dir_cache_max_entries", dirCacheMaxEntries, 0, 100000, false),
+	{ "page_cache_probe", SETTING_BOOL, offsetof(ServerConfig, pageCacheProbe), 0, 0, false },
+	INT_SETTING("page_cache_probe_max_kb", pageCacheProbeMaxKb, 0, 16777216, false),
+	INT_SETTING("page_cache_readahead_kb", pageCacheReadaheadKb, 0, 1048576, false),
+	INT_SETTING("page_cache_dontneed_mb", pageCacheDontneedMb, 0, 16777216, false),
+	{ "cache_warm", SETTING_BOOL, offsetof(ServerConfig, cacheWarm), 0, 0, true },
+	INT_SETTING("cache_warm_threads", cacheWarmThreads, 1, 256, true),
+	{ "cache_warm_list", SETTING_STRING, offsetof(ServerConfig, cacheWarmList), 0, 0, true },
+	{ "content_watch", SETTING_BOOL, offsetof(ServerConfig, contentWatch), 0, 0, true },
+	INT_SETTING("content_watch_max_dirs", contentWatchMaxDirs, 1, 1000000, true),
+	INT_SETTING("form_buffer_bytes", formBufferBytes, 1024, 64*1024*1024, false),
+	INT_SETTING("form_max_urlencoded_bytes", formMaxUrlEncodedBytes, 0, 64*1024*1024, false),
+	INT_SETTING("splice_chunk_bytes", spliceChunkBytes, 4096, 64*1024*1024, false),
+	{ "codel_enabled", SETTING_BOOL, offsetof(ServerConfig, codelEnabled), 0, 0, false },
+	INT_SETTING("codel_target_ms", codelTargetMs, 1, 60000, false),
+	INT_SETTING("codel_interval_ms", codelIntervalMs, 1, 600000, false),
+	{ "rate_limit_enabled", SETTING_BOOL, offsetof(ServerConfig, rateLimitEnabled), 0, 0, false },
+	INT_SETTING("rate_limit_requests_per_sec", rateLimitRequestsPerSec, 1, 1000000, false),
+	INT_SETTING("rate_limit_burst", rateLimitBurst, 1, 1000000, false),
+	INT_SETTING("rate_limit_table_slots", rateLimitTableSlots, 1024, 16*1024*1024, true),
+	INT_SETTING("listen_backlog", listenBacklog, 1, 65535, true),
+	INT_SETTING("tcp_defer_accept_sec", tcpDeferAcceptSec, 0, 3600, true),
+	INT_SETTING("tcp_fastopen_queue", tcpFastOpenQueue, 0, 65535, true),
+	INT_SETTING("socket_send_buffer_bytes", socketSendBufferBytes, 0, 64*1024*1024, true),
+	INT_SETTING("socket_recv_buffer_bytes", socketRecvBufferBytes, 0, 64*1024*1024, true),
+	{ "tcp_nodelay", SETTING_BOOL, offsetof(ServerConfig, tcpNoDelay), 0, 0, false },
+	{ "tcp_cork", SETTING_BOOL, offsetof(ServerConfig, tcpCork), 0, 0, false },
+	INT_SETTING("drain_timeout_ms", drainTimeoutMs, 0, 3600000, false),
+	INT_SETTING("handoff_timeout_ms", handoffTimeoutMs, 1, 3600000, false),
+	{ "http2_enabled", SETTING_BOOL, offsetof(ServerConfig, http2Enabled), 0, 0, false },
+	INT_SETTING("http2_max_concurrent_streams", http2MaxConcurrentStreams, 1, 1000, false),
+	{ "coroutines_enabled", SETTING_BOOL, offsetof(ServerConfig, coroutinesEnabled), 0, 0, true },
+	INT_SETTING("coroutine_threads", coroutineThreads, 1, 256, true),
+	INT_SETTING("coroutine_stack_kb", coroutineStackKb, 64, 64*1024, true),
+	INT_SETTING("coroutine_max", coroutineMax, 1, 1000000, false),
+	INT_SETTING("prefork_workers", preforkWorkers, 0, 1024, true),
+	{ "proxy_routes", SETTING_STRING, offsetof(ServerConfig, proxyRoutes), 0, 0, true },
+	INT_SETTING("proxy_pool_size", proxyPoolSize, 0, 4096, true),
+	INT_SETTING("proxy_timeout_ms", proxyTimeoutMs, 1, 3600000, false),
+	INT_SETTING("proxy_health_interval_ms", proxyHealthIntervalMs, 100, 3600000, true),
+	{ "tls_certificate", SETTING_STRING, offsetof(ServerConfig, tlsCertificate), 0, 0, true },
+	{ "tls_private_key", SETTING_STRING, offsetof(ServerConfig, tlsPrivateKey), 0, 0, true },
+	INT_SETTING("tls_session_cache_size", tlsSessionCacheSize, 0, 10000000, true),
+	INT_SETTING("tls_ticket_rotation_s", tlsTicketRotationS, 0, 604800, true),
+	{ "tls_ktls", SETTING_BOOL, offsetof(ServerConfig, tlsKtls), 0, 0, true },
+};
+
+/** number of settings */
+#define NSETTINGS (sizeof(settings) / sizeof(settings[0]))
+
+/** Definition of a published snapshot */
+typedef struct ConfigSnapshot {
+	ServerConfig config;        /** the settings */
+	atomic_int refs;            /** references held by requests and the current pointer */
+} ConfigSnapshot;
+
+/** the current snapshot */
+static _Atomic(ConfigSnapshot *) current = NULL;
+
+/** readers between loading the current pointer and taking a reference */
+static atomic_int acquiring = 0;
+
+/** the snapshot set for this thread */
+static __thread const ServerConfig *threadConfig = NULL;
+
+/** the configuration file */
+static char configFile[MAXBUF];
+
+/** serializes reloads */
+static pthread_mutex_t reloadLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** number of the last snapshot built */
+static unsigned long generation = 0;
+
+/**
+ * Set the default settings.
+ * @param config the settings
+ */
+static void setDefaults(ServerConfig *config) {
+	config->port = DEFAULT_HTTP_PORT;
+	snprintf(config->contentBase, sizeof(config->contentBase), "%s", CONTENT_BASE);
+	snprintf(config->mimeTypes, sizeof(config->mimeTypes), "%s", MIME_TYPES_FILE);
+	snprintf(config->blobStore, sizeof(config->blobStore), "%s", BLOB_STORE_DIR);
+	config->poolMinThreads = POOL_MIN_THREADS;
+	config->poolThreadsPerCpu = POOL_THREADS_PER_CPU;
+	config->poolIdleTimeoutMs = POOL_IDLE_TIMEOUT_MS;
+	config->poolTargetDelayMs = POOL_TARGET_DELAY_MS;
+	config->dispatchQueueHighWater = DISPATCH_QUEUE_HIGH_WATER;
+	config->diskPoolMinThreads = DISK_POOL_MIN_THREADS;
+	config->diskPoolMaxThreads = DISK_POOL_MAX_THREADS;
+	config->diskQueueHighWater = DISK_QUEUE_HIGH_WATER;
+	config->shedRetryAfterSec = SHED_RETRY_AFTER_SEC;
+	config->readHeaderTimeoutMs = READ_HEADER_TIMEOUT_MS;
+	config->readBodyTimeoutMs = READ_BODY_TIMEOUT_MS;
+	config->writeTimeoutMs = WRITE_TIMEOUT_MS;
+	config->keepAliveTimeoutMs = KEEPALIVE_TIMEOUT_MS;
+	config->keepAliveMaxRequests = KEEPALIVE_MAX_REQUESTS;
+	config->fileCacheTtlMs = FILE_CACHE_TTL_MS;
+	config->fileCacheMaxEntries = FILE_CACHE_MAX_ENTRIES;
+	config->dirCacheMaxEntries = DIR_CACHE_MAX_ENTRIES;
+	config->pageCacheProbe = PAGE_CACHE_PROBE;
+	config->pageCacheProbeMaxKb = PAGE_CACHE_PROBE_MAX_KB;
+	config->pageCacheReadaheadKb = PAGE_CACHE_READAHEAD_KB;
+	config->pageCacheDontneedMb = PAGE_CACHE_DONTNEED_MB;
+	config->cacheWarm = CACHE_WARM;
+	config->cacheWarmThreads = CACHE_WARM_THREADS;
+	snprintf(config->cacheWarmList, sizeof(config->cacheWarmList), "%s", CACHE_WARM_LIST);
+	config->contentWatch = CONTENT_WATCH;
+	config->contentWatchMaxDirs = CONTENT_WATCH_MAX_DIRS;
+	config->formBufferBytes = FORM_BUFFER_BYTES;
+	config->formMaxUrlEncodedBytes = FORM_MAX_URLENCODED_BYTES;
+	config->spliceChunkBytes = SPLICE_CHUNK_BYTES;
+	config->codelEnabled = CODEL_ENABLED;
+	config->codelTargetMs = CODEL_TARGET_MS;
+	config->codelIntervalMs = CODEL_INTERVAL_MS;
+	config->rateLimitEnabled = RATE_LIMIT_ENABLED;
+	config->rateLimitRequestsPerSec = RATE_LIMIT_REQUESTS_PER_SEC;
+	config->rateLimitBurst = RATE_LIMIT_BURST;
+	config->rateLimitTableSlots = RATE_LIMIT_TABLE_SLOTS;
+	config->listenBacklog = LISTEN_BACKLOG;
+	config->tcpDeferAcceptSec = TCP_DEFER_ACCEPT_SEC;
+	config->tcpFastOpenQueue = TCP_FASTOPEN_QUEUE;
+	config->socketSendBufferBytes = SOCKET_SEND_BUFFER_BYTES;
+	config->socketRecvBufferBytes = SOCKET_RECV_BUFFER_BYTES;
+	config->tcpNoDelay = TCP_NODELAY_ENABLED;
+	config->tcpCork = TCP_CORK_ENABLED;
+	config->drainTimeoutMs = DRAIN_TIMEOUT_MS;
+	config->handoffTimeoutMs = HANDOFF_TIMEOUT_MS;
+	config->http2Enabled = HTTP2_ENABLED;
+	config->http2MaxConcurrentStreams = HTTP2_MAX_CONCURRENT_STREAMS;
+	config->coroutinesEnabled = COROUTINES_ENABLED;
+	config->coroutineThreads = COROUTINE_THREADS;
+	config->coroutineStackKb = COROUTINE_STACK_KB;
+	config->coroutineMax = COROUTINE_MAX;
+	config->preforkWorkers = PREFORK_WORKERS;
+	snprintf(config->proxyRoutes, sizeof(config->proxyRoutes), "%s", PROXY_ROUTES);
+	config->proxyPoolSize = PROXY_POOL_SIZE;
+	config->proxyTimeoutMs = PROXY_TIMEOUT_MS;
+	config->proxyHealthIntervalMs = PROXY_HEALTH_INTERVAL_MS;
+	snprintf(config->tlsCertificate, sizeof(config->tlsCertificate), "%s", TLS_CERTIFICATE);
+	snprintf(config->tlsPrivateKey, sizeof(config->tlsPrivateKey), "%s", TLS_PRIVATE_KEY);
+	config->tlsSessionCacheSize = TLS_SESSION_CACHE_SIZE;
+	config->tlsTicketRotationS = TLS_TICKET_ROTATION_S;
+	config->tlsKtls = TLS_KTLS;
+	config->mimeMap = NULL;
+	config->generation = 0;
+}
+
+/**
+ * Find a setting by name.
+ * @param name the property name
+ * @return the setting, or NULL if unknown
+ */
+static const Setting *findSetting(const char *name) {
+	for (size_t i = 0; i < NSETTINGS; i++) {
+		if (strcmp(settings[i].name, name) == 0) {
+			return &settings[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Parse the value of a setting into its field.
+ *
+ * @param setting the setting
+ * @param val the property value
+ * @param config the settings
+ * @return 0 if successful, -1 if the value is invalid
+ */
+static int parseSetting(const Setting *setting, const char *val, ServerConfig *config) {
+	void *field = (char *)config + setting->offset;
+	switch (setting->type) {
+	case SETTING_STRING:
+		// an empty value turns off a setting that is off unless set
+		if (strlen(val) < (size_t)setting->min || strlen(val) >= MAXBUF) {
+			return -1;
+		}
+		strcpy(field, val);
+		return 0;
+	case SETTING_BOOL:
+		if (strcasecmp(val, "true") == 0) {
+			*(bool *)field = true;
+		} else if (strcasecmp(val, "false") == 0) {
+			*(bool *)field = false;
+		} else {
+			return -1;
+		}
+		return 0;
+	default: {
+		char *end;
+		long n = strtol(val, &end, 10);
+		if (end == val || *end != '\0' || n < setting->min || n > setting->max) {
+			return -1;
+		}
+		*(int *)field = (int)n;
+		return 0;
+	}
+	}
+}
+
+/**
+ * Determine whether a setting has the same value in two snapshots.
+ *
+ * @param setting the setting
+ * @param a the first settings
+ * @param b the second settings
+ * @return true if the values are the same
+ */
+static bool sameSetting(const Setting *setting, const ServerConfig *a, const ServerConfig *b) {
+	const char *fa = (const char *)a + setting->offset;
+	const char *fb = (const char *)b + setting->offset;
+	switch (setting->type) {
+	case SETTING_STRING: return strcmp(fa, fb) == 0;
+	case SETTING_BOOL:   return *(const bool *)fa == *(const bool *)fb;
+	default:             return *(const int *)fa == *(const int *)fb;
+	}
+}
+
+/**
+ * Build a snapshot from the configuration file and MIME types.
+ *
+ * @param running the running settings, or NULL at startup
+ * @return the snapshot with one reference, or NULL if error
+ */
+static ConfigSnapshot *buildSnapshot(const ServerConfig *running) {
+	ConfigSnapshot *snap = malloc(sizeof(ConfigSnapshot));
+	if (snap == NULL) {
+		return NULL;
+	}
+	ServerConfig *config = &snap->config;
+	setDefaults(config);
+	atomic_init(&snap->refs, 1);
+
+	Properties *props = newProperties();
+	loadProperties(configFile, props);
+	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
+	int status = 0;
+	for (int i = 0; getProperty(props, i, name, val); i++) {
+		const Setting *setting = findSetting(name);
+		if (setting == NULL) {
+			fprintf(stderr, "%s: unknown setting %s\n", configFile, name);
+		} else if (parseSetting(setting, val, config) != 0) {
+			fprintf(stderr, "%s: invalid value for %s: %s\n", configFile, name, val);
+			status = -1;
+		}
+	}
+	deleteProperties(props);
+
+	// keep the running values of settings read at startup only
+	for (size_t i = 0; status == 0 && running != NULL && i < NSETTINGS; i++) {
+		const Setting *setting = &settings[i];
+		if (setting->startup && !sameSetting(setting, config, running)) {
+			fprintf(stderr, "%s: %s takes effect on restart\n", configFile, setting->name);
+			memcpy((char *)config + setting->offset, (const char *)running + setting->offset,
+				   (setting->type == SETTING_STRING) ? MAXBUF
+				   : (setting->type == SETTING_BOOL) ? sizeof(bool) : sizeof(int));
+		}
+	}
+
+	FILE *mime = (status == 0) ? fopen(config->mimeTypes, "r") : NULL;
+	if (mime == NULL) {
+		if (status == 0) {
+			perror(config->mimeTypes);
+		}
+		free(snap);
+		return NULL;
+	}
+	config->mimeMap = calloc(1, sizeof(map_base_t));
+	if (config->mimeMap != NULL) {
+		buildMap(mime, config->mimeMap);
+	}
+	fclose(mime);
+	if (config->mimeMap == NULL) {
+		free(snap);
+		return NULL;
+	}
+	config->generation = ++generation;
+	return snap;
+}
+
+/**
+ * Release a reference to a snapshot, freeing it with the last one.
+ * @param snap the snapshot
+ */
+static void releaseSnapshot(ConfigSnapshot *snap) {
+	if (atomic_fetch_sub(&snap->refs, 1) == 1) {
+		map_deinit_(snap->config.mimeMap);
+		free(snap->config.mimeMap);
+		free(snap);
+	}
+}
+
+/**
+ * Publish a snapshot and release the one it replaces once no
+ * reader can still be taking a reference to it.
+ *
+ * @param snap the snapshot
+ */
+static void publishSnapshot(ConfigSnapshot *snap) {
+	ConfigSnapshot *old = atomic_exchange(&current, snap);
+	while (atomic_load(&acquiring) != 0) {
+		sched_yield();
+	}
+	if (old != NULL) {
+		releaseSnapshot(old);
+	}
+}
+
+/**
+ * Load the configuration and publish the first snapshot.
+ *
+ * @param file the properties file; defaults are used if it is missing
+ * @return 0 if successful, -1 if a setting is invalid or the MIME
+ *  types cannot be read
+ */
+int loadServerConfig(const char *file) {
+	snprintf(configFile, sizeof(configFile), "%s", file);
+	ConfigSnapshot *snap = buildSnapshot(NULL);
+	if (snap == NULL) {
+		return -1;
+	}
+	publishSnapshot(snap);
+	return 0;
+}
+
+/**
+ * Reload the configuration file and MIME types and publish a new
+ * snapshot. The current snapshot is kept if they cannot be loaded.
+ *
+ * @return 0 if successful, -1 if error
+ */
+int reloadServerConfig(void) {
+	pthread_mutex_lock(&reloadLock);
+	ConfigSnapshot *snap = buildSnapshot(&atomic_load(&current)->config);
+	if (snap != NULL) {
+		publishSnapshot(snap);
+	}
+	pthread_mutex_unlock(&reloadLock);
+
+	if (snap == NULL) {
+		fprintf(stderr, "Keeping current configuration\n");
+		return -1;
+	}
+	statsIncrement(configReloads);
+	fprintf(stderr, "Configuration reloaded from %s\n", configFile);
+	return 0;
+}
+
+/**
+ * Get a reference to the current snapshot.
+ * @return the snapshot
+ */
+const ServerConfig *acquireConfig(void) {
+	atomic_fetch_add(&acquiring, 1);
+	ConfigSnapshot *snap = atomic_load(&current);
+	atomic_fetch_add(&snap->refs, 1);
+	atomic_fetch_sub(&acquiring, 1);
+	return &snap->config;
+}
+
+/**
+ * Get another reference to a snapshot.
+ *
+ * @param config the snapshot
+ * @return the snapshot
+ */
+const ServerConfig *retainConfig(const ServerConfig *config) {
+	ConfigSnapshot *snap = (ConfigSnapshot *)((char *)config - offsetof(ConfigSnapshot, config));
+	atomic_fetch_add(&snap->refs, 1);
+	return config;
+}
+
+/**
+ * Release a reference to a snapshot.
+ *
+ * @param config the snapshot
+ */
+void releaseConfig(const ServerConfig *config) {
+	releaseSnapshot((ConfigSnapshot *)((char *)config - offsetof(ConfigSnapshot, config)));
+}
+
+/**
+ * Set the snapshot that serverConfig() returns for the calling
+ * thread. The caller keeps a reference to it while it is set.
+ *
+ * @param config the snapshot, or NULL to clear it
+ */
+void setThreadConfig(const ServerConfig *config) {
+	threadConfig = config;
+}
+
+/**
+ * Return the snapshot set for the calling thread. A thread without
+ * one gets the current snapshot, which it must not use after a
+ * reload; only startup code may rely on this.
+ *
+ * @return the snapshot
+ */
+const ServerConfig *serverConfig(void) {
+	return (threadConfig != NULL) ? threadConfig : &atomic_load(&current)->config;
+}
+
+/**
+ * Return the snapshot set for the calling thread, without falling
+ * back to the current one.
+ *
+ * @return the snapshot, or NULL if none is set
+ */
+const ServerConfig *getThreadConfig(void) {
+	return threadConfig;
+}
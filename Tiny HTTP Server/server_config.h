@@ -0,0 +1,162 @@
+/*
+ * server_config.h
+ *
+ * Server settings loaded from a properties file, with the MIME
+ * type map, as an immutable snapshot that is rebuilt on SIGHUP.
+ *
+ * A reload publishes a new snapshot with a pointer swap. Requests
+ * hold a reference to the snapshot current when they started and
+ * keep using it; readers never take a lock. A snapshot is freed
+ * when the last request that holds it finishes.
+ *
+ * Settings in the file are "name=value" lines named as in
+ * http_server.properties; missing settings take the defaults in
+ * http_server.h. The port, content base, pool sizes, queue limits,
+ * Retry-After value and listener options are read at startup only.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef SERVER_CONFIG_H_
+#define SERVER_CONFIG_H_
+
+#include <stdbool.h>
+
+#include "http_server.h"
+#include "map.h"
+
+/** Definition of a configuration snapshot */
+typedef struct ServerConfig {
+	int port;                       /** listener port (startup) */
+	char contentBase[MAXBUF];       /** content base directory (startup) */
+	char mimeTypes[MAXBUF];         /** MIME types file */
+	char blobStore[MAXBUF];         /** deduplicating upload store, empty if off (startup) */
+	int poolMinThreads;             /** minimum worker threads (startup) */
+	int poolThreadsPerCpu;          /** maximum worker threads per CPU (startup) */
+	int poolIdleTimeoutMs;          /** idle time before a worker retires (startup) */
+	int poolTargetDelayMs;          /** queue wait above which a pool grows (startup) */
+	int dispatchQueueHighWater;     /** dispatch queue limit (startup) */
+	int diskPoolMinThreads;         /** minimum disk-I/O threads (startup) */
+	int diskPoolMaxThreads;         /** maximum disk-I/O threads (startup) */
+	int diskQueueHighWater;         /** disk-I/O queue limit (startup) */
+	int shedRetryAfterSec;          /** Retry-After of a shed request (startup) */
+	int readHeaderTimeoutMs;        /** wait for the request line and headers */
+	int readBodyTimeoutMs;          /** wait for the request body */
+	int writeTimeoutMs;             /** time allowed to send a response */
+	int keepAliveTimeoutMs;         /** time an idle connection is kept open */
+	int keepAliveMaxRequests;       /** requests served on one connection */
+	int fileCacheTtlMs;             /** time a cached file is trusted */
+	int fileCacheMaxEntries;        /** maximum cached files */
+	int dirCacheMaxEntries;         /** maximum cached directory descriptors */
+	bool pageCacheProbe;            /** serve files not in the page cache on the disk pool */
+	int pageCacheProbeMaxKb;        /** largest file probed for residence */
+	int pageCacheReadaheadKb;       /** window read ahead of a send, 0 for none */
+	int pageCacheDontneedMb;        /** file size dropped behind a send, 0 for never */
+	bool cacheWarm;                 /** warm the file cache before accepting (startup) */
+	int cacheWarmThreads;           /** threads that warm the file cache (startup) */
+	char cacheWarmList[MAXBUF];     /** saved hot paths, empty to walk the content base (startup) */
+	bool contentWatch;              /** invalidate cached files as they change (startup) */
+	int contentWatchMaxDirs;        /** most directories watched (startup) */
+	int formBufferBytes;            /** window a multipart body is parsed in */
+	int formMaxUrlEncodedBytes;     /** maximum URL-encoded form body */
+	int spliceChunkBytes;           /** bytes moved per splice of an upload */
+	bool codelEnabled;              /** shed requests that waited too long */
+	int codelTargetMs;              /** CoDel target queue delay */
+	int codelIntervalMs;            /** CoDel interval */
+	bool rateLimitEnabled;          /** limit the request rate of each client */
+	int rateLimitRequestsPerSec;    /** requests per second a client may sustain */
+	int rateLimitBurst;             /** requests a client may send in a burst */
+	int rateLimitTableSlots;        /** client addresses tracked (startup) */
+	int listenBacklog;              /** connections waiting to be accepted (startup) */
+	int tcpDeferAcceptSec;          /** TCP_DEFER_ACCEPT seconds, 0 if off (startup) */
+	int tcpFastOpenQueue;           /** TCP_FASTOPEN queue, 0 if off (startup) */
+	int socketSendBufferBytes;      /** SO_SNDBUF, 0 for the kernel default (startup) */
+	int socketRecvBufferBytes;      /** SO_RCVBUF, 0 for the kernel default (startup) */
+	bool tcpNoDelay;                /** set TCP_NODELAY on connections */
+	bool tcpCork;                   /** set TCP_CORK while a response is written */
+	int drainTimeoutMs;             /** time allowed for in-flight requests on exit */
+	int handoffTimeoutMs;           /** time a new server has to start on upgrade */
+	bool http2Enabled;              /** accept HTTP/2 over cleartext TCP */
+	int http2MaxConcurrentStreams;  /** HTTP/2 streams served at once per connection */
+	bool coroutinesEnabled;         /** serve connections on coroutines (startup) */
+	int coroutineThreads;           /** threads that run coroutines (startup) */
+	int coroutineStackKb;           /** stack of each coroutine in KiB (startup) */
+	int coroutineMax;               /** most coroutines alive at once */
+	int preforkWorkers;             /** worker processes, 0 for one process (startup) */
+	char proxyRoutes[MAXBUF];       /** path prefixes forwarded upstream, empty if off (startup) */
+	int proxyPoolSize;              /** idle connections kept to each upstream (startup) */
+	int proxyTimeoutMs;             /** upstream connect, send and receive timeout */
+	int proxyHealthIntervalMs;      /** time between upstream health checks (startup) */
+	char tlsCertificate[MAXBUF];    /** certificate chain file, empty for plain TCP (startup) */
+	char tlsPrivateKey[MAXBUF];     /** private key file, empty if in the certificate (startup) */
+	int tlsSessionCacheSize;        /** sessions cached for resumption, 0 for none (startup) */
+	int tlsTicketRotationS;         /** lifetime of a ticket key, 0 for no tickets (startup) */
+	bool tlsKtls;                   /** use kernel TLS after the handshake (startup) */
+	map_base_t *mimeMap;            /** MIME types by file extension */
+	unsigned long generation;       /** snapshot number, increasing with each reload */
+} ServerConfig;
+
+/**
+ * Load the configuration and publish the first snapshot.
+ *
+ * @param file the properties file; defaults are used if it is missing
+ * @return 0 if successful, -1 if a setting is invalid or the MIME
+ *  types cannot be read
+ */
+int loadServerConfig(const char *file);
+
+/**
+ * Reload the configuration file and MIME types and publish a new
+ * snapshot. The current snapshot is kept if they cannot be loaded.
+ *
+ * @return 0 if successful, -1 if error
+ */
+int reloadServerConfig(void);
+
+/**
+ * Get a reference to the current snapshot.
+ * @return the snapshot
+ */
+const ServerConfig *acquireConfig(void);
+
+/**
+ * Get another reference to a snapshot.
+ *
+ * @param config the snapshot
+ * @return the snapshot
+ */
+const ServerConfig *retainConfig(const ServerConfig *config);
+
+/**
+ * Release a reference to a snapshot.
+ *
+ * @param config the snapshot
+ */
+void releaseConfig(const ServerConfig *config);
+
+/**
+ * Set the snapshot that serverConfig() returns for the calling
+ * thread. The caller keeps a reference to it while it is set.
+ *
+ * @param config the snapshot, or NULL to clear it
+ */
+void setThreadConfig(const ServerConfig *config);
+
+/**
+ * Return the snapshot set for the calling thread. A thread without
+ * one gets the current snapshot, which it must not use after a
+ * reload; only startup code may rely on this.
+ *
+ * @return the snapshot
+ */
+const ServerConfig *serverConfig(void);
+
+/**
+ * Return the snapshot set for the calling thread, without falling
+ * back to the current one.
+ *
+ * @return the snapshot, or NULL if none is set
+ */
+const ServerConfig *getThreadConfig(void);
+
+#endif /* SERVER_CONFIG_H_ */
@@ -0,0 +1,516 @@
+/*
+ * server_lifecycle.c
+ *
+ * Functions that stop the server gracefully and upgrade it
+ * without refusing connections.
+ *
+ * The upgrade handoff is a short exchange on a socket pair:
+ *   old -> new   HANDOFF_LISTENER with the listener (SCM_RIGHTS),
+ *                then the cached paths, one per line, and a blank line
+ *   new -> old   HANDOFF_READY once the new server has started
+ *   old -> new   HANDOFF_GO once the old server stopped accepting
+ * Only one server accepts at a time, so the old server never
+ * blocks in accept() on a connection the new one took.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  // execvpe
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "server_lifecycle.h"
+#include "server_config.h"
+#include "connection.h"
+#include "cache_warmer.h"
+#include "content_bundle.h"
+#include "time_util.h"
+
+/** message carrying the listener */
+#define HANDOFF_LISTENER 'L'
+
+/** message from the new server that it has started */
+#define HANDOFF_READY 'R'
+
+/** message from the old server that it stopped accepting */
+#define HANDOFF_GO 'G'
+
+/** descriptor of the handoff socket in the new server */
+#define HANDOFF_FD 3
+
+/** milliseconds between checks for open connections while draining */
+#define DRAIN_POLL_MS 50
+
+/** nanoseconds per millisecond */
+#define NS_PER_MS 1000000ULL
+
+/** the arguments the server was started with */
+static char **serverArgv = NULL;
+
+/** the control signals */
+static sigset_t signals;
+
+/** the listener that can be handed to a new server, or -1 */
+static atomic_int upgradeListener = -1;
+
+/** the server is stopping */
+static atomic_bool stopping = false;
+
+/** wakes the accept loop when the server stops */
+static int wakeFd = -1;
+
+/** handoff socket to the new server, or -1 */
+static int successorSock = -1;
+
+/** handoff stream from the old server, or NULL */
+static FILE *predecessor = NULL;
+
+/** paths cached by the old server, most recently used first */
+static char **handedPaths = NULL;
+
+/** number of paths cached by the old server */
+static size_t nhandedPaths = 0;
+
+/**
+ * Set the send and receive timeouts of a socket.
+ *
+ * @param sock the socket
+ * @param ms the timeout in milliseconds
+ */
+static void setSocketTimeouts(int sock, int ms) {
+	struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * Send all of a buffer on a socket.
+ *
+ * @param sock the socket
+ * @param buf the buffer
+ * @param len the number of bytes
+ * @return 0 if successful, -1 if error
+ */
+static int sendAll(int sock, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(sock, buf, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Send the listener and the cached paths to a new server.
+ *
+ * @param sock the handoff socket
+ * @param listen_sock_fd the listener
+ * @return 0 if successful, -1 if error
+ */
+static int sendListener(int sock, int listen_sock_fd) {
+	char msg = HANDOFF_LISTENER;
+	struct iovec iov = { .iov_base = &msg, .iov_len = 1 };
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct msghdr mh;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &listen_sock_fd, sizeof(int));
+	if (sendmsg(sock, &mh, MSG_NOSIGNAL) != 1) {
+		return -1;
+	}
+
+	// the bundle is shared through the page cache, so only
+	// the file cache is worth warming
+	size_t len = 0;
+	char *list = contentBundleOpen() ? NULL : hotPathList(&len);
+	int status = (len > 0) ? sendAll(sock, list, len) : 0;
+	free(list);
+	return (status == 0) ? sendAll(sock, "\n", 1) : -1;
+}
+
+/**
+ * Start a new server from the executable and hand it the listener.
+ * Returns once the new server has started.
+ *
+ * @param listen_sock_fd the listener
+ * @return 0 if successful, -1 if the new server did not start
+ */
+static int startSuccessor(int listen_sock_fd) {
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+		perror("socketpair");
+		return -1;
+	}
+
+	// build the environment now: the child of a threaded process
+	// may only make async-signal-safe calls before exec
+	extern char **environ;
+	size_t nenv = 0;
+	while (environ[nenv] != NULL) {
+		nenv++;
+	}
+	char **envp = malloc((nenv + 2) * sizeof(char *));
+	if (envp == NULL) {
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	char handoffVar[64];
+	snprintf(handoffVar, sizeof(handoffVar), "%s=%d", HANDOFF_FD_ENV, HANDOFF_FD);
+	size_t prefixLen = strlen(HANDOFF_FD_ENV "=");
+	size_t n = 0;
+	for (size_t i = 0; i < nenv; i++) {
+		if (strncmp(environ[i], HANDOFF_FD_ENV "=", prefixLen) != 0) {
+			envp[n++] = environ[i];
+		}
+	}
+	envp[n++] = handoffVar;
+	envp[n] = NULL;
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		// the new server gets only the standard streams and the handoff
+		// socket; the listener is passed over the socket
+		if (sv[1] == HANDOFF_FD) {
+			fcntl(HANDOFF_FD, F_SETFD, 0);
+		} else if (dup2(sv[1], HANDOFF_FD) < 0) {
+			_exit(127);
+		}
+		close_range(HANDOFF_FD + 1, ~0U, 0);
+		sigset_t none;
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		execvpe(serverArgv[0], serverArgv, envp);
+		_exit(127);
+	}
+	free(envp);
+	close(sv[1]);
+	if (pid < 0) {
+		perror("fork");
+		close(sv[0]);
+		return -1;
+	}
+
+	setSocketTimeouts(sv[0], serverConfig()->handoffTimeoutMs);
+	char msg = 0;
+	if (sendListener(sv[0], listen_sock_fd) != 0
+			|| recv(sv[0], &msg, 1, 0) != 1 || msg != HANDOFF_READY) {
+		fprintf(stderr, "New server %d did not start; still serving\n", (int)pid);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		close(sv[0]);
+		return -1;
+	}
+	fprintf(stderr, "Listener handed to new server %d\n", (int)pid);
+	successorSock = sv[0];
+	return 0;
+}
+
+/**
+ * Stop accepting connections and wake the accept loop.
+ */
+static void stopServer(void) {
+	atomic_store(&stopping, true);
+	uint64_t one = 1;
+	if (write(wakeFd, &one, sizeof(one)) < 0) {
+		perror("stopServer");
+	}
+}
+
+/**
+ * The signal thread handles the control signals.
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void *signalHandler(void *arg) {
+	(void)arg;
+	while (true) {
+		int sig;
+		if (sigwait(&signals, &sig) != 0) {
+			continue;
+		}
+		switch (sig) {
+		case SIGHUP:
+			reloadServerConfig();
+			break;
+		case SIGTERM:
+		case SIGINT:
+			if (atomic_load(&stopping)) {
+				fprintf(stderr, "Exiting without draining\n");
+				_exit(EXIT_FAILURE);
+			}
+			fprintf(stderr, "Shutting down\n");
+			stopServer();
+			break;
+		case SIGUSR2: {
+			int listen_sock_fd = atomic_load(&upgradeListener);
+			if (listen_sock_fd < 0 || atomic_load(&stopping) || successorSock >= 0) {
+				break;
+			}
+			fprintf(stderr, "Upgrading\n");
+			const ServerConfig *config = acquireConfig();
+			setThreadConfig(config);
+			if (startSuccessor(listen_sock_fd) == 0) {
+				stopServer();
+			}
+			setThreadConfig(NULL);
+			releaseConfig(config);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Start the thread that handles the control signals. The signals
+ * are blocked in the calling thread, so call this before starting
+ * any other thread.
+ *
+ * @param argv the arguments the server was started with, used to
+ *  start a new server on upgrade
+ * @return 0 if successful, -1 if error
+ */
+int startSignalHandler(char *argv[]) {
+	serverArgv = argv;
+	wakeFd = eventfd(0, EFD_CLOEXEC);
+	if (wakeFd < 0) {
+		return -1;
+	}
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGUSR2);
+	if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) {
+		return -1;
+	}
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, signalHandler, NULL) != 0) {
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+/**
+ * Receive the listener from the server that started this one
+ * on upgrade.
+ *
+ * @param listen_sock_fd set to the listener, or -1 if this server
+ *  was not started by an upgrade
+ * @return 0 if successful, -1 if the handoff failed
+ */
+int receiveListener(int *listen_sock_fd) {
+	*listen_sock_fd = -1;
+	const char *var = getenv(HANDOFF_FD_ENV);
+	int sock;
+	if (var == NULL || sscanf(var, "%d", &sock) != 1) {
+		return 0;
+	}
+	// a later upgrade of this server passes its own socket
+	unsetenv(HANDOFF_FD_ENV);
+	fcntl(sock, F_SETFD, FD_CLOEXEC);
+	setSocketTimeouts(sock, serverConfig()->handoffTimeoutMs);
+
+	char msg = 0;
+	struct iovec iov = { .iov_base = &msg, .iov_len = 1 };
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr mh;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	if (recvmsg(sock, &mh, MSG_CMSG_CLOEXEC) != 1 || msg != HANDOFF_LISTENER) {
+		close(sock);
+		errno = EPROTO;
+		return -1;
+	}
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+			|| cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+		close(sock);
+		errno = EPROTO;
+		return -1;
+	}
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	predecessor = fdopen(sock, "r+");
+	if (predecessor == NULL) {
+		close(fd);
+		close(sock);
+		return -1;
+	}
+	// the paths the old server had cached; the list ends with a blank line
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	size_t maxPaths = serverConfig()->fileCacheMaxEntries;
+	while ((len = getline(&line, &size, predecessor)) > 1) {
+		if (nhandedPaths == maxPaths) {
+			continue;
+		}
+		char **paths = realloc(handedPaths, (nhandedPaths + 1) * sizeof(char *));
+		if (paths == NULL) {
+			break;
+		}
+		handedPaths = paths;
+		line[len-1] = '\0';
+		handedPaths[nhandedPaths] = strdup(line);
+		if (handedPaths[nhandedPaths] != NULL) {
+			nhandedPaths++;
+		}
+	}
+	free(line);
+	*listen_sock_fd = fd;
+	return 0;
+}
+
+/**
+ * Complete an upgrade once the server has started: warm the file
+ * cache with the files the old server had cached, tell the old
+ * server this one is ready, and wait until it stops accepting.
+ * Does nothing if this server was not started by an upgrade.
+ *
+ * @param warmCache warm the file cache; a prefork master has none
+ */
+void completeHandoff(bool warmCache) {
+	if (predecessor == NULL) {
+		return;
+	}
+	// opened least recently used first, so the cache ends up in the same order
+	size_t warmed = warmCache ? warmFileCache(handedPaths, nhandedPaths) : 0;
+	for (size_t i = 0; i < nhandedPaths; i++) {
+		free(handedPaths[i]);
+	}
+	free(handedPaths);
+	handedPaths = NULL;
+	if (nhandedPaths > 0 && warmCache) {
+		fprintf(stderr, "Warmed file cache with %zu of %zu files\n", warmed, nhandedPaths);
+	}
+
+	// the old server keeps accepting until it is told this one is ready
+	char msg = HANDOFF_READY;
+	if (sendAll(fileno(predecessor), &msg, 1) == 0) {
+		int c = fgetc(predecessor);
+		if (c != HANDOFF_GO) {
+			fprintf(stderr, "Previous server did not stop accepting\n");
+		}
+	}
+	fclose(predecessor);
+	predecessor = NULL;
+}
+
+/**
+ * Determine whether this server was started by an upgrade that
+ * completeHandoff has not completed yet.
+ *
+ * @return true if started by an upgrade
+ */
+bool upgradePending(void) {
+	return predecessor != NULL;
+}
+
+/**
+ * Allow the listener to be handed to a new server on SIGUSR2.
+ * Until called, SIGUSR2 is ignored.
+ *
+ * @param listen_sock_fd the listener
+ */
+void acceptUpgrades(int listen_sock_fd) {
+	atomic_store(&upgradeListener, listen_sock_fd);
+}
+
+/**
+ * Wait until a connection can be accepted or the server stops.
+ *
+ * @param listen_sock_fd the listener
+ * @return true if a connection is pending, false if the server
+ *  is stopping and should not accept any more
+ */
+bool waitForConnection(int listen_sock_fd) {
+	struct pollfd fds[2] = {
+		{ .fd = listen_sock_fd, .events = POLLIN },
+		{ .fd = wakeFd, .events = POLLIN }
+	};
+	while (!atomic_load(&stopping)) {
+		if (poll(fds, 2, -1) > 0 && (fds[0].revents & POLLIN) && !atomic_load(&stopping)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Stop the server: close the listener, let a new server begin
+ * accepting, and wait for open connections to finish, up to
+ * the drain timeout.
+ *
+ * @param listen_sock_fd the listener
+ * @return 0 if all connections finished, -1 if some are still open
+ */
+int drainServer(int listen_sock_fd) {
+	atomic_store(&upgradeListener, -1);
+	close(listen_sock_fd);
+	if (successorSock >= 0) {
+		// the new server accepts from here on
+		char msg = HANDOFF_GO;
+		sendAll(successorSock, &msg, 1);
+		close(successorSock);
+		successorSock = -1;
+	}
+
+	drainConnections();
+	fprintf(stderr, "Draining %ld connections\n", openConnections());
+	uint64_t deadline = monotonicTimeNanos() + serverConfig()->drainTimeoutMs * NS_PER_MS;
+	struct timespec pause = { 0, DRAIN_POLL_MS * NS_PER_MS };
+	while (openConnections() > 0 && monotonicTimeNanos() < deadline) {
+		nanosleep(&pause, NULL);
+	}
+	long remaining = openConnections();
+	if (remaining > 0) {
+		fprintf(stderr, "%ld connections still open after drain timeout\n", remaining);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * server_lifecycle.h
+ *
+ * Functions that stop the server gracefully and upgrade it
+ * without refusing connections.
+ *
+ * A signal thread handles the control signals:
+ *   SIGHUP           reload the configuration
+ *   SIGTERM, SIGINT  stop accepting, finish in-flight requests
+ *                    and exit; a second signal exits at once
+ *   SIGUSR2          start a new server from the executable and
+ *                    hand it the listener, then drain and exit
+ *
+ * On upgrade the new server receives the listening socket over a
+ * Unix socket pair (SCM_RIGHTS) with the paths in the file cache.
+ * It starts up and warms its cache while the old server is still
+ * accepting, and begins accepting once the old server stops, so
+ * queued connections wait in the shared listen backlog.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef SERVER_LIFECYCLE_H_
+#define SERVER_LIFECYCLE_H_
+
+#include <stdbool.h>
+
+/** environment variable with the handoff socket of an upgraded server */
+#define HANDOFF_FD_ENV "HTTP_SERVER_HANDOFF_FD"
+
+/**
+ * Start the thread that handles the control signals. The signals
+ * are blocked in the calling thread, so call this before starting
+ * any other thread.
+ *
+ * @param argv the arguments the server was started with, used to
+ *  start a new server on upgrade
+ * @return 0 if successful, -1 if error
+ */
+int startSignalHandler(char *argv[]);
+
+/**
+ * Receive the listener from the server that started this one
+ * on upgrade.
+ *
+ * @param listen_sock_fd set to the listener, or -1 if this server
+ *  was not started by an upgrade
+ * @return 0 if successful, -1 if the handoff failed
+ */
+int receiveListener(int *listen_sock_fd);
+
+/**
+ * Complete an upgrade once the server has started: warm the file
+ * cache with the files the old server had cached, tell the old
+ * server this one is ready, and wait until it stops accepting.
+ * Does nothing if this server was not started by an upgrade.
+ *
+ * @param warmCache warm the file cache; a prefork master has none
+ */
+void completeHandoff(bool warmCache);
+
+/**
+ * Determine whether this server was started by an upgrade that
+ * completeHandoff has not completed yet.
+ *
+ * @return true if started by an upgrade
+ */
+bool upgradePending(void);
+
+/**
+ * Allow the listener to be handed to a new server on SIGUSR2.
+ * Until called, SIGUSR2 is ignored.
+ *
+ * @param listen_sock_fd the listener
+ */
+void acceptUpgrades(int listen_sock_fd);
+
+/**
+ * Wait until a connection can be accepted or the server stops.
+ *
+ * @param listen_sock_fd the listener
+ * @return true if a connection is pending, false if the server
+ *  is stopping and should not accept any more
+ */
+bool waitForConnection(int listen_sock_fd);
+
+/**
+ * Stop the server: close the listener, let a new server begin
+ * accepting, and wait for open connections to finish, up to
+ * the drain timeout.
+ *
+ * @param listen_sock_fd the listener
+ * @return 0 if all connections finished, -1 if some are still open
+ */
+int drainServer(int listen_sock_fd);
+
+#endif /* SERVER_LIFECYCLE_H_ */
@@ -0,0 +1,142 @@
+/*
+ * server_stats.c
+ *
+ * Counters that report on the running server.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  // memfd_create
+#endif
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "server_stats.h"
+
+/** maximum number of registered gauges */
+#define MAX_GAUGES 16
+
+/** the counters of this process, until they are shared */
+static ServerStats localStats;
+
+/** the server counters */
+ServerStats *serverStats = &localStats;
+
+/** Definition of a registered gauge */
+typedef struct Gauge {
+	const char *name;     /** gauge name */
+	long (*read)(void);   /** reads the current value */
+} Gauge;
+
+/** the registered gauges */
+static Gauge gauges[MAX_GAUGES];
+
+/** number of registered gauges */
+static int ngauges = 0;
+
+/**
+ * Write one counter as a "name value" line.
+ *
+ * @param ostream the output stream
+ * @param name the counter name
+ * @param counter the counter
+ */
+static void writeCounter(FILE *ostream, const char *name, atomic_ulong *counter) {
+	fprintf(ostream, "%s %lu\n", name, atomic_load_explicit(counter, memory_order_relaxed));
+}
+
+/**
+ * Move the server counters to a shared memory segment, so processes
+ * forked afterwards add to the same counters.
+ *
+ * @return 0 if successful, -1 with errno set if error
+ */
+int shareServerStats(void) {
+#if defined(__linux__)
+	// a memfd is named in /proc/<pid>/maps, so the segment can be found
+	int fd = memfd_create("server-stats", MFD_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	if (ftruncate(fd, sizeof(ServerStats)) != 0) {
+		close(fd);
+		return -1;
+	}
+	void *shared = mmap(NULL, sizeof(ServerStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+#else
+	void *shared = mmap(NULL, sizeof(ServerStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+#endif
+	if (shared == MAP_FAILED) {
+		return -1;
+	}
+	memcpy(shared, serverStats, sizeof(ServerStats));
+	serverStats = shared;
+	return 0;
+}
+
+/**
+ * Register a gauge whose current value is reported with the counters.
+ *
+ * @param name the gauge name
+ * @param read function that returns the current value
+ * @return 0 if successful, -1 if no room for another gauge
+ */
+int registerStatsGauge(const char *name, long (*read)(void)) {
+	if (ngauges >= MAX_GAUGES) {
+		return -1;
+	}
+	gauges[ngauges].name = name;
+	gauges[ngauges].read = read;
+	ngauges++;
+	return 0;
+}
+
+/**
+ * Write the server counters as "name value" lines.
+ *
+ * @param ostream the output stream
+ */
+void writeServerStats(FILE *ostream) {
+	writeCounter(ostream, "connections_accepted", &serverStats->connectionsAccepted);
+	writeCounter(ostream, "requests_served", &serverStats->requestsServed);
+	writeCounter(ostream, "keepalive_reuses", &serverStats->keepAliveReuses);
+	writeCounter(ostream, "timeouts_read_header", &serverStats->timeoutsReadHeader);
+	writeCounter(ostream, "timeouts_read_body", &serverStats->timeoutsReadBody);
+	writeCounter(ostream, "timeouts_write", &serverStats->timeoutsWrite);
+	writeCounter(ostream, "timeouts_keepalive", &serverStats->timeoutsKeepAlive);
+	writeCounter(ostream, "shed_queue_full", &serverStats->shedQueueFull);
+	writeCounter(ostream, "shed_queue_delay", &serverStats->shedQueueDelay);
+	writeCounter(ostream, "shed_disk_queue_full", &serverStats->shedDiskQueueFull);
+	writeCounter(ostream, "shed_rate_limited", &serverStats->shedRateLimited);
+	writeCounter(ostream, "rate_limit_table_full", &serverStats->rateLimitTableFull);
+	writeCounter(ostream, "file_cache_hits", &serverStats->fileCacheHits);
+	writeCounter(ostream, "file_cache_misses", &serverStats->fileCacheMisses);
+	writeCounter(ostream, "disk_tier_requests", &serverStats->diskTierRequests);
+	writeCounter(ostream, "uploads_deduplicated", &serverStats->uploadsDeduplicated);
+	writeCounter(ostream, "http2_sessions", &serverStats->http2Sessions);
+	writeCounter(ostream, "http2_streams", &serverStats->http2Streams);
+	writeCounter(ostream, "coroutines_started", &serverStats->coroutinesStarted);
+	writeCounter(ostream, "coroutine_waits", &serverStats->coroutineWaits);
+	writeCounter(ostream, "config_reloads", &serverStats->configReloads);
+	writeCounter(ostream, "prefork_restarts", &serverStats->preforkRestarts);
+	writeCounter(ostream, "proxy_requests", &serverStats->proxyRequests);
+	writeCounter(ostream, "proxy_connects", &serverStats->proxyConnects);
+	writeCounter(ostream, "proxy_reuses", &serverStats->proxyReuses);
+	writeCounter(ostream, "proxy_errors", &serverStats->proxyErrors);
+	writeCounter(ostream, "tls_handshakes", &serverStats->tlsHandshakes);
+	writeCounter(ostream, "tls_resumptions", &serverStats->tlsResumptions);
+	writeCounter(ostream, "tls_ktls_sessions", &serverStats->tlsKtlsSessions);
+	writeCounter(ostream, "page_cache_probes", &serverStats->pageCacheProbes);
+	writeCounter(ostream, "page_cache_cold_files", &serverStats->pageCacheColdFiles);
+	writeCounter(ostream, "page_cache_readahead_bytes", &serverStats->pageCacheReadahead);
+	writeCounter(ostream, "page_cache_dropped_bytes", &serverStats->pageCacheDropped);
+	writeCounter(ostream, "cache_warmed_files", &serverStats->cacheWarmedFiles);
+	writeCounter(ostream, "content_watch_invalidations", &serverStats->contentWatchInvalidations);
+	writeCounter(ostream, "content_watch_overflows", &serverStats->contentWatchOverflows);
+	for (int i = 0; i < ngauges; i++) {
+		fprintf(ostream, "%s %ld\n", gauges[i].name, gauges[i].read());
+	}
+}
@@ -0,0 +1,95 @@
+/*
+ * server_stats.h
+ *
+ * Counters that report on the running server.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef SERVER_STATS_H_
+#define SERVER_STATS_H_
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+/** Definition of the server counters */
+typedef struct ServerStats {
+	atomic_ulong connectionsAccepted;   /** connections accepted */
+	atomic_ulong requestsServed;        /** requests dispatched to a handler */
+	atomic_ulong keepAliveReuses;       /** requests on a reused connection */
+	atomic_ulong timeoutsReadHeader;    /** connections closed waiting for headers */
+	atomic_ulong timeoutsReadBody;      /** connections closed waiting for a body */
+	atomic_ulong timeoutsWrite;         /** connections closed sending a response */
+	atomic_ulong timeoutsKeepAlive;     /** idle keep-alive connections closed */
+	atomic_ulong shedQueueFull;         /** requests shed because the queue was full */
+	atomic_ulong shedQueueDelay;        /** requests shed for excess queue delay */
+	atomic_ulong shedDiskQueueFull;     /** requests shed because the disk queue was full */
+	atomic_ulong shedRateLimited;       /** requests refused because the client was over its rate */
+	atomic_ulong rateLimitTableFull;    /** requests allowed because the rate limiter was full */
+	atomic_ulong fileCacheHits;         /** lookups answered from the file cache */
+	atomic_ulong fileCacheMisses;       /** lookups that missed the file cache */
+	atomic_ulong diskTierRequests;      /** requests handed to the disk-I/O pool */
+	atomic_ulong uploadsDeduplicated;   /** uploads linked to an existing blob */
+	atomic_ulong http2Sessions;         /** HTTP/2 connections served */
+	atomic_ulong http2Streams;          /** HTTP/2 requests received */
+	atomic_ulong coroutinesStarted;     /** coroutines started for connections */
+	atomic_ulong coroutineWaits;        /** coroutine suspensions on a socket or the disk pool */
+	atomic_ulong configReloads;         /** configuration reloads published */
+	atomic_ulong preforkRestarts;       /** prefork workers restarted after exiting */
+	atomic_ulong proxyRequests;         /** requests forwarded to an upstream */
+	atomic_ulong proxyConnects;         /** connections opened to an upstream */
+	atomic_ulong proxyReuses;           /** requests sent on a pooled upstream connection */
+	atomic_ulong proxyErrors;           /** forwarded requests that failed */
+	atomic_ulong tlsHandshakes;         /** TLS handshakes completed */
+	atomic_ulong tlsResumptions;        /** TLS handshakes that resumed a session */
+	atomic_ulong tlsKtlsSessions;       /** TLS connections sending with kernel TLS */
+	atomic_ulong pageCacheProbes;       /** cached files probed for page cache residence */
+	atomic_ulong pageCacheColdFiles;    /** files served on the disk pool as not resident */
+	atomic_ulong pageCacheReadahead;    /** bytes read ahead of a send cursor */
+	atomic_ulong pageCacheDropped;      /** bytes dropped from the page cache behind a send */
+	atomic_ulong cacheWarmedFiles;      /** files opened into the file cache before accepting */
+	atomic_ulong contentWatchInvalidations;  /** cached files dropped as they changed */
+	atomic_ulong contentWatchOverflows; /** inotify queue overflows that flushed the caches */
+} ServerStats;
+
+/** the server counters; shared by the processes of a prefork server */
+extern ServerStats *serverStats;
+
+/**
+ * Increment a server counter.
+ * @param counter the counter
+ */
+#define statsIncrement(counter) atomic_fetch_add_explicit(&serverStats->counter, 1, memory_order_relaxed)
+
+/**
+ * Add to a server counter.
+ * @param counter the counter
+ * @param n the amount
+ */
+#define statsAdd(counter, n) atomic_fetch_add_explicit(&serverStats->counter, (n), memory_order_relaxed)
+
+/**
+ * Move the server counters to a shared memory segment, so processes
+ * forked afterwards add to the same counters.
+ *
+ * @return 0 if successful, -1 with errno set if error
+ */
+int shareServerStats(void);
+
+/**
+ * Register a gauge whose current value is reported with the counters.
+ *
+ * @param name the gauge name
+ * @param read function that returns the current value
+ * @return 0 if successful, -1 if no room for another gauge
+ */
+int registerStatsGauge(const char *name, long (*read)(void));
+
+/**
+ * Write the server counters as "name value" lines.
+ *
+ * @param ostream the output stream
+ */
+void writeServerStats(FILE *ostream);
+
+#endif /* SERVER_STATS_H_ */
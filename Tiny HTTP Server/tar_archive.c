@@ -0,0 +1,329 @@
+/*
+ * tar_archive.c
+ *
+ * Functions that stream a directory subtree as a POSIX tar archive.
+ *
+ * Each entry is a 512-byte ustar header, preceded by a pax extended
+ * header when its path is longer than the 100-byte name field or its
+ * size does not fit the 11 octal digits of the size field, and
+ * followed by the file body padded to a whole block. With chunked
+ * coding, the padding of a body and the headers of the next entry go
+ * in one chunk, and each body is its own chunk sent with sendfile.
+ *
+ * A file is sent at the length it had when opened, under its shared
+ * file lock, so an update in place is never archived half written.
+ * Entries that vanish during the walk are skipped; a file that is
+ * truncated while it is sent ends the archive with an error.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "tar_archive.h"
+#include "file_util.h"
+#include "file_lock.h"
+#include "http_server.h"
+
+/** tar block size */
+#define TAR_BLOCK 512
+
+/** largest size of the ustar size field: 11 octal digits */
+#define USTAR_MAX_SIZE 077777777777LL
+
+/** Definition of a ustar header block */
+typedef struct TarHeader {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+} TarHeader;
+
+/** Definition of an archive being sent */
+typedef struct TarWriter {
+	FILE *ostream;              /** the output stream */
+	bool chunked;               /** frame the archive in chunks */
+	char path[PATH_MAX];        /** path of the current directory, ending in '/' or empty */
+	size_t pathLen;             /** length of path */
+	size_t pad;                 /** zero bytes owed after the last body */
+} TarWriter;
+
+/** zero bytes for padding and the end of the archive */
+static const char zeros[2*TAR_BLOCK];
+
+/**
+ * Write bytes of the archive, after the padding owed by the last body.
+ *
+ * @param w the archive
+ * @param buf the bytes
+ * @param len the number of bytes
+ * @return 0 if successful, -1 if error
+ */
+static int writeArchiveBytes(TarWriter *w, const void *buf, size_t len) {
+	if (w->chunked) {
+		fprintf(w->ostream, "%zx%s", w->pad + len, CRLF);
+	}
+	fwrite(zeros, 1, w->pad, w->ostream);
+	fwrite(buf, 1, len, w->ostream);
+	if (w->chunked) {
+		fputs(CRLF, w->ostream);
+	}
+	w->pad = 0;
+	return ferror(w->ostream) ? -1 : 0;
+}
+
+/**
+ * Send the body of a file and owe its padding.
+ *
+ * @param w the archive
+ * @param fd the file
+ * @param sb the status of the file
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int sendArchiveFile(TarWriter *w, int fd, const struct stat *sb) {
+	off_t size = sb->st_size;
+	if (size == 0) {
+		return 0;
+	}
+	if (w->chunked) {
+		fprintf(w->ostream, "%llx%s", (unsigned long long)size, CRLF);
+	}
+	// not while a range of the file is being updated
+	if (sendFileShared(w->ostream, fd, sb, 0, size) != 0) {
+		return -1;
+	}
+	if (w->chunked) {
+		fputs(CRLF, w->ostream);
+	}
+	w->pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+	return 0;
+}
+
+/**
+ * Fill a ustar header and its checksum.
+ *
+ * @param h the header
+ * @param name the name, truncated to the name field
+ * @param sb the status of the entry
+ * @param type the type flag
+ * @param size the size of the entry data
+ */
+static void formatHeader(TarHeader *h, const char *name, const struct stat *sb, char type, off_t size) {
+	memset(h, 0, sizeof(TarHeader));
+	size_t nameLen = strlen(name);
+	memcpy(h->name, name, (nameLen < sizeof(h->name)) ? nameLen : sizeof(h->name));  // unterminated if full
+	snprintf(h->mode, sizeof(h->mode), "%07o", (unsigned)(sb->st_mode & 07777));
+	snprintf(h->uid, sizeof(h->uid), "%07o", (unsigned)(sb->st_uid & 07777777));
+	snprintf(h->gid, sizeof(h->gid), "%07o", (unsigned)(sb->st_gid & 07777777));
+	snprintf(h->size, sizeof(h->size), "%011llo",
+			 (unsigned long long)(size <= USTAR_MAX_SIZE ? size : 0));
+	snprintf(h->mtime, sizeof(h->mtime), "%011llo",
+			 (unsigned long long)(sb->st_mtime > 0 ? sb->st_mtime : 0) & USTAR_MAX_SIZE);
+	h->typeflag = type;
+	memcpy(h->magic, "ustar", 6);
+	memcpy(h->version, "00", 2);
+
+	// the checksum is taken with its own field as spaces
+	memset(h->chksum, ' ', sizeof(h->chksum));
+	unsigned sum = 0;
+	for (size_t i = 0; i < sizeof(TarHeader); i++) {
+		sum += ((unsigned char *)h)[i];
+	}
+	snprintf(h->chksum, sizeof(h->chksum), "%06o", sum);
+}
+
+/**
+ * Append a pax record, "length key=value\n", where the length
+ * counts the whole record including its own digits.
+ *
+ * @param buf the buffer
+ * @param size the size of the buffer
+ * @param key the key
+ * @param value the value
+ * @return the length of the record, or 0 if it does not fit
+ */
+static size_t formatPaxRecord(char *buf, size_t size, const char *key, const char *value) {
+	size_t len = strlen(key) + strlen(value) + 3;  // space, '=' and newline
+	size_t total = len + 1;
+	for (size_t n = total; n >= 10; n /= 10) {
+		total++;
+	}
+	if (total >= size) {
+		return 0;
+	}
+	snprintf(buf, size, "%zu %s=%s\n", total, key, value);
+	return total;
+}
+
+/**
+ * Write the headers of an entry: a pax header if its path or size
+ * does not fit the ustar fields, then its ustar header.
+ *
+ * @param w the archive; its path names the entry
+ * @param sb the status of the entry
+ * @param type the type flag
+ * @param size the size of the entry data
+ * @return 0 if successful, -1 if error
+ */
+static int writeHeaders(TarWriter *w, const struct stat *sb, char type, off_t size) {
+	char blocks[PATH_MAX + 4*TAR_BLOCK];
+	size_t len = 0;
+	if (w->pathLen > sizeof(((TarHeader *)0)->name) || size > USTAR_MAX_SIZE) {
+		char records[PATH_MAX + 2*TAR_BLOCK];
+		size_t recordsLen = 0;
+		if (w->pathLen > sizeof(((TarHeader *)0)->name)) {
+			recordsLen += formatPaxRecord(records, sizeof(records), "path", w->path);
+		}
+		if (size > USTAR_MAX_SIZE) {
+			char value[32];
+			snprintf(value, sizeof(value), "%llu", (unsigned long long)size);
+			recordsLen += formatPaxRecord(records + recordsLen, sizeof(records) - recordsLen, "size", value);
+		}
+		formatHeader((TarHeader *)blocks, "PaxHeader", sb, 'x', recordsLen);
+		len = TAR_BLOCK;
+		memcpy(blocks + len, records, recordsLen);
+		len += recordsLen;
+		memset(blocks + len, 0, (TAR_BLOCK - len % TAR_BLOCK) % TAR_BLOCK);
+		len += (TAR_BLOCK - len % TAR_BLOCK) % TAR_BLOCK;
+	}
+	formatHeader((TarHeader *)(blocks + len), w->path, sb, type, size);
+	len += TAR_BLOCK;
+	return writeArchiveBytes(w, blocks, len);
+}
+
+/**
+ * Archive a regular file.
+ *
+ * @param w the archive; its path names the file
+ * @param dirfd the directory of the file
+ * @param name the name of the file
+ * @return 0 if successful or the file vanished, -1 with errno set if error
+ */
+static int archiveFile(TarWriter *w, int dirfd, const char *name) {
+	int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;
+	}
+	// the length and body are taken from the open file
+	struct stat sb;
+	int status = 0;
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+		status = writeHeaders(w, &sb, '0', sb.st_size);
+		if (status == 0) {
+			status = sendArchiveFile(w, fd, &sb);
+		}
+	}
+	close(fd);
+	return status;
+}
+
+/**
+ * Archive the entries of a directory and its subdirectories.
+ *
+ * @param w the archive; its path names the directory
+ * @param dirfd the directory; it is closed
+ * @param depth the level of the directory
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int archiveDirectory(TarWriter *w, int dirfd, int depth) {
+	DIR *dir = fdopendir(dirfd);
+	if (dir == NULL) {
+		close(dirfd);
+		return 0;
+	}
+	int status = 0;
+	size_t pathLen = w->pathLen;
+	struct dirent *entry;
+	while (status == 0 && (entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		// relative to the directory; links are not followed
+		struct stat sb;
+		if (fstatat(dirfd, entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+			continue;
+		}
+		bool isDir = S_ISDIR(sb.st_mode);
+		if (!isDir && !S_ISREG(sb.st_mode)) {
+			continue;
+		}
+		int n = snprintf(w->path + pathLen, sizeof(w->path) - pathLen, "%s%s", entry->d_name, isDir ? "/" : "");
+		if (n < 0 || (size_t)n >= sizeof(w->path) - pathLen) {
+			continue;  // too long to name
+		}
+		w->pathLen = pathLen + n;
+
+		if (!isDir) {
+			status = archiveFile(w, dirfd, entry->d_name);
+		} else if (depth < TAR_MAX_DEPTH) {
+			int subfd = openat(dirfd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+			if (subfd >= 0) {
+				status = writeHeaders(w, &sb, '5', 0);
+				if (status == 0) {
+					status = archiveDirectory(w, subfd, depth + 1);
+				} else {
+					close(subfd);
+				}
+			}
+		}
+	}
+	w->pathLen = pathLen;
+	w->path[pathLen] = '\0';
+	closedir(dir);
+	return status;
+}
+
+/**
+ * Send the regular files and directories beneath a directory as a
+ * tar archive, with paths relative to the directory.
+ *
+ * @param ostream the output stream
+ * @param dirfd the directory; it is closed
+ * @param chunked frame the archive with chunked transfer coding
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendTarArchive(FILE *ostream, int dirfd, bool chunked) {
+	TarWriter w;
+	w.ostream = ostream;
+	w.chunked = chunked;
+	w.path[0] = '\0';
+	w.pathLen = 0;
+	w.pad = 0;
+
+	int status = archiveDirectory(&w, dirfd, 0);
+	if (status == 0) {
+		// two zero blocks end the archive
+		status = writeArchiveBytes(&w, zeros, sizeof(zeros));
+	}
+	if (status == 0 && chunked) {
+		fprintf(ostream, "0%s%s", CRLF, CRLF);
+	}
+	if (status == 0 && fflush(ostream) != 0) {
+		status = -1;
+	}
+	return status;
+}
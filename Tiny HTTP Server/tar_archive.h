@@ -0,0 +1,36 @@
+/*
+ * tar_archive.h
+ *
+ * Functions that stream a directory subtree as a POSIX tar archive,
+ * so a client can mirror a directory with one request.
+ *
+ * The tree is walked with openat and fstatat from the directory's
+ * descriptor, without following symbolic links, so the archive
+ * never reaches outside the content base. Headers are formatted in
+ * a small buffer and file bodies are sent with sendfile, so memory
+ * use is bounded by the depth of the tree, not its size.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef TAR_ARCHIVE_H_
+#define TAR_ARCHIVE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/** deepest directory level archived */
+#define TAR_MAX_DEPTH 32
+
+/**
+ * Send the regular files and directories beneath a directory as a
+ * tar archive, with paths relative to the directory.
+ *
+ * @param ostream the output stream
+ * @param dirfd the directory; it is closed
+ * @param chunked frame the archive with chunked transfer coding
+ * @return 0 if successful, -1 with errno set if error
+ */
+int sendTarArchive(FILE *ostream, int dirfd, bool chunked);
+
+#endif /* TAR_ARCHIVE_H_ */
@@ -16,6 +16,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <time.h>
+#include <stdint.h>
 #if defined(__linux__)
 #include <sys/prctl.h>
 #endif
@@ -34,8 +35,8 @@
 #define err(str)
 #endif
 
-static volatile int threads_keepalive;
-static volatile int threads_on_hold;
+/* Pool thread running on the calling thread, NULL if none */
+static __thread struct thread* current_thread = NULL;
 
 
 
@@ -55,6 +56,7 @@ typedef struct job{
 	struct job*  prev;                   /* pointer to previous job   */
 	void   (*function)(void* arg);       /* function pointer          */
 	void*  arg;                          /* function's argument       */
+	uint64_t queued_ns;                  /* monotonic time queued     */
 } job;
 
 
@@ -65,6 +67,7 @@ typedef struct jobqueue{
 	job  *rear;                          /* pointer to rear  of queue */
 	bsem *has_jobs;                      /* flag as binary semaphore  */
 	int   len;                           /* number of jobs in queue   */
+	int   max_len;                       /* queue limit, 0 if none    */
 } jobqueue;
 
 
@@ -78,12 +81,23 @@ typedef struct thread{
 
 /* Threadpool */
 typedef struct thpool_{
-	thread**   threads;                  /* pointer to threads        */
+	thread**   threads;                  /* thread slots, NULL if free*/
 	volatile int num_threads_alive;      /* threads currently alive   */
 	volatile int num_threads_working;    /* threads currently working */
+	volatile int num_threads_blocked;    /* threads blocked in disk IO*/
+	int        num_threads_total;        /* slots in use              */
+	int        min_threads;              /* lower bound on threads    */
+	int        max_threads;              /* upper bound on threads    */
+	int        idle_timeout_ms;          /* idle time before retiring */
+	uint64_t   target_delay_ns;          /* queue wait before growing */
 	pthread_mutex_t  thcount_lock;       /* used for thread count etc */
 	pthread_cond_t  threads_all_idle;    /* signal to thpool_wait     */
 	jobqueue  jobqueue;                  /* job queue                 */
+	volatile int threads_keepalive;      /* threads keep serving      */
+	volatile int threads_on_hold;        /* threads paused            */
+	pthread_t  manager;                  /* grows an elastic pool     */
+	int        has_manager;              /* manager thread started    */
+	bsem       manager_wake;             /* wakes the manager to exit */
 } thpool_;
 
 
@@ -95,12 +109,16 @@ typedef struct thpool_{
 
 static int  thread_init(thpool_* thpool_p, struct thread** thread_p, int id);
 static void* thread_do(struct thread* thread_p);
+static void  thread_spawn(thpool_* thpool_p);
+static void  thpool_maybe_grow(thpool_* thpool_p);
+static void* thpool_manage(thpool_* thpool_p);
+static uint64_t monotonic_ns(void);
 static void  thread_hold(int sig_id);
 static void  thread_destroy(struct thread* thread_p);
 
 static int   jobqueue_init(jobqueue* jobqueue_p);
 static void  jobqueue_clear(jobqueue* jobqueue_p);
-static void  jobqueue_push(jobqueue* jobqueue_p, struct job* newjob_p);
+static int   jobqueue_push(jobqueue* jobqueue_p, struct job* newjob_p);
 static struct job* jobqueue_pull(jobqueue* jobqueue_p);
 static void  jobqueue_destroy(jobqueue* jobqueue_p);
 
@@ -109,6 +127,7 @@ static void  bsem_reset(struct bsem *bsem_p);
 static void  bsem_post(struct bsem *bsem_p);
 static void  bsem_post_all(struct bsem *bsem_p);
 static void  bsem_wait(struct bsem *bsem_p);
+static int   bsem_timedwait(struct bsem *bsem_p, int timeout_ms);
 
 
 
@@ -119,13 +138,20 @@ static void  bsem_wait(struct bsem *bsem_p);
 
 /* Initialise thread pool */
 struct thpool_* thpool_init(int num_threads){
+	return thpool_init_elastic(num_threads, num_threads, 0, 0);
+}
+
 
-	threads_on_hold   = 0;
-	threads_keepalive = 1;
+/* Initialise thread pool that grows and shrinks between bounds */
+struct thpool_* thpool_init_elastic(int min_threads, int max_threads, int idle_timeout_ms, int target_delay_ms){
 
-	if (num_threads < 0){
-		num_threads = 0;
+	if (min_threads < 0){
+		min_threads = 0;
+	}
+	if (max_threads < min_threads){
+		max_threads = min_threads;
 	}
+	int num_threads = min_threads;
 
 	/* Make new thread pool */
 	thpool_* thpool_p;
@@ -136,6 +162,16 @@ struct thpool_* thpool_init(int num_threads){
 	}
 	thpool_p->num_threads_alive   = 0;
 	thpool_p->num_threads_working = 0;
+	thpool_p->num_threads_blocked = 0;
+	thpool_p->num_threads_total   = 0;
+	thpool_p->min_threads         = min_threads;
+	thpool_p->max_threads         = max_threads;
+	thpool_p->idle_timeout_ms     = idle_timeout_ms;
+	thpool_p->target_delay_ns     = (uint64_t)target_delay_ms * 1000000;
+	thpool_p->threads_keepalive   = 1;
+	thpool_p->threads_on_hold     = 0;
+	thpool_p->has_manager         = 0;
+	bsem_init(&thpool_p->manager_wake, 0);
 
 	/* Initialise the job queue */
 	if (jobqueue_init(&thpool_p->jobqueue) == -1){
@@ -145,7 +181,7 @@ struct thpool_* thpool_init(int num_threads){
 	}
 
 	/* Make threads in pool */
-	thpool_p->threads = (struct thread**)malloc(num_threads * sizeof(struct thread *));
+	thpool_p->threads = (struct thread**)calloc(max_threads ? max_threads : 1, sizeof(struct thread *));
 	if (thpool_p->threads == NULL){
 		err("thpool_init(): Could not allocate memory for threads\n");
 		jobqueue_destroy(&thpool_p->jobqueue);
@@ -159,15 +195,24 @@ struct thpool_* thpool_init(int num_threads){
 	/* Thread init */
 	int n;
 	for (n=0; n<num_threads; n++){
-		thread_init(thpool_p, &thpool_p->threads[n], n);
-#if THPOOL_DEBUG
-			printf("THPOOL_DEBUG: Created thread %d in pool \n", n);
-#endif
+		pthread_mutex_lock(&thpool_p->thcount_lock);
+		thread_spawn(thpool_p);
+		pthread_mutex_unlock(&thpool_p->thcount_lock);
 	}
 
 	/* Wait for threads to initialize */
 	while (thpool_p->num_threads_alive != num_threads) {}
 
+	/* Elastic pools also grow when queued work goes unserved */
+	if (max_threads > min_threads){
+		if (pthread_create(&thpool_p->manager, NULL, (void *)thpool_manage, thpool_p) == 0){
+			thpool_p->has_manager = 1;
+		}
+		else {
+			err("thpool_init_elastic(): Could not create manager thread\n");
+		}
+	}
+
 	return thpool_p;
 }
 
@@ -185,14 +230,36 @@ int thpool_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p){
 	/* add function and argument */
 	newjob->function=function_p;
 	newjob->arg=arg_p;
+	newjob->queued_ns=monotonic_ns();
 
 	/* add job to queue */
-	jobqueue_push(&thpool_p->jobqueue, newjob);
+	if (jobqueue_push(&thpool_p->jobqueue, newjob) == -1){
+		free(newjob);
+		return -1;
+	}
 
+	thpool_maybe_grow(thpool_p);
 	return 0;
 }
 
 
+/* Limit the number of queued jobs */
+void thpool_set_queue_limit(thpool_* thpool_p, int max_jobs){
+	pthread_mutex_lock(&thpool_p->jobqueue.rwmutex);
+	thpool_p->jobqueue.max_len = (max_jobs > 0) ? max_jobs : 0;
+	pthread_mutex_unlock(&thpool_p->jobqueue.rwmutex);
+}
+
+
+/* Number of jobs waiting in the queue */
+int thpool_queue_length(thpool_* thpool_p){
+	pthread_mutex_lock(&thpool_p->jobqueue.rwmutex);
+	int len = thpool_p->jobqueue.len;
+	pthread_mutex_unlock(&thpool_p->jobqueue.rwmutex);
+	return len;
+}
+
+
 /* Wait until all jobs have finished */
 void thpool_wait(thpool_* thpool_p){
 	pthread_mutex_lock(&thpool_p->thcount_lock);
@@ -208,10 +275,14 @@ void thpool_destroy(thpool_* thpool_p){
 	/* No need to destory if it's NULL */
 	if (thpool_p == NULL) return ;
 
-	volatile int threads_total = thpool_p->num_threads_alive;
-
 	/* End each thread 's infinite loop */
-	threads_keepalive = 0;
+	thpool_p->threads_keepalive = 0;
+
+	/* The manager must be gone before the pool is freed */
+	if (thpool_p->has_manager){
+		bsem_post(&thpool_p->manager_wake);
+		pthread_join(thpool_p->manager, NULL);
+	}
 
 	/* Give one second to kill idle threads */
 	double TIMEOUT = 1.0;
@@ -232,10 +303,12 @@ void thpool_destroy(thpool_* thpool_p){
 
 	/* Job queue cleanup */
 	jobqueue_destroy(&thpool_p->jobqueue);
-	/* Deallocs */
+	/* Deallocs; retired threads have already freed their slots */
 	int n;
-	for (n=0; n < threads_total; n++){
-		thread_destroy(thpool_p->threads[n]);
+	for (n=0; n < thpool_p->max_threads; n++){
+		if (thpool_p->threads[n] != NULL){
+			thread_destroy(thpool_p->threads[n]);
+		}
 	}
 	free(thpool_p->threads);
 	free(thpool_p);
@@ -245,20 +318,19 @@ void thpool_destroy(thpool_* thpool_p){
 /* Pause all threads in threadpool */
 void thpool_pause(thpool_* thpool_p) {
 	int n;
-	for (n=0; n < thpool_p->num_threads_alive; n++){
-		pthread_kill(thpool_p->threads[n]->pthread, SIGUSR1);
+	pthread_mutex_lock(&thpool_p->thcount_lock);
+	for (n=0; n < thpool_p->max_threads; n++){
+		if (thpool_p->threads[n] != NULL){
+			pthread_kill(thpool_p->threads[n]->pthread, SIGUSR1);
+		}
 	}
+	pthread_mutex_unlock(&thpool_p->thcount_lock);
 }
 
 
 /* Resume all threads in threadpool */
 void thpool_resume(thpool_* thpool_p) {
-    // resuming a single threadpool hasn't been
-    // implemented yet, meanwhile this supresses
-    // the warnings
-    (void)thpool_p;
-
-	threads_on_hold = 0;
+	thpool_p->threads_on_hold = 0;
 }
 
 
@@ -267,6 +339,105 @@ int thpool_num_threads_working(thpool_* thpool_p){
 }
 
 
+int thpool_num_threads_alive(thpool_* thpool_p){
+	return thpool_p->num_threads_alive;
+}
+
+
+int thpool_num_threads_blocked(thpool_* thpool_p){
+	return thpool_p->num_threads_blocked;
+}
+
+
+/* Mark the calling pool thread as blocked in disk I/O */
+void thpool_blocking_begin(void){
+	if (current_thread == NULL) return;
+	thpool_* thpool_p = current_thread->thpool_p;
+	pthread_mutex_lock(&thpool_p->thcount_lock);
+	thpool_p->num_threads_blocked++;
+	pthread_mutex_unlock(&thpool_p->thcount_lock);
+}
+
+
+/* Mark the calling pool thread as no longer blocked in disk I/O */
+void thpool_blocking_end(void){
+	if (current_thread == NULL) return;
+	thpool_* thpool_p = current_thread->thpool_p;
+	pthread_mutex_lock(&thpool_p->thcount_lock);
+	thpool_p->num_threads_blocked--;
+	pthread_mutex_unlock(&thpool_p->thcount_lock);
+}
+
+
+/* Monotonic clock in nanoseconds */
+static uint64_t monotonic_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Manager of an elastic pool
+ *
+ * Growth is checked when work is added or taken, but a job that waits
+ * behind busy threads with no further traffic would never trigger it,
+ * so the manager also checks each target delay.
+ */
+static void* thpool_manage(thpool_* thpool_p){
+	uint64_t period_ms = thpool_p->target_delay_ns ? thpool_p->target_delay_ns / 1000000 : 10;
+	if (period_ms == 0) period_ms = 1;
+	/* thpool_destroy posts manager_wake, so the pool is never used after it */
+	while (bsem_timedwait(&thpool_p->manager_wake, (int)period_ms) == -1){
+		thpool_maybe_grow(thpool_p);
+	}
+	return NULL;
+}
+
+
+/* Start a thread in a free slot
+ *
+ * Notice: Caller MUST hold thcount_lock
+ */
+static void thread_spawn(thpool_* thpool_p){
+	int n;
+	for (n=0; n < thpool_p->max_threads; n++){
+		if (thpool_p->threads[n] == NULL){
+			if (thread_init(thpool_p, &thpool_p->threads[n], n) == 0){
+				thpool_p->num_threads_total++;
+#if THPOOL_DEBUG
+				printf("THPOOL_DEBUG: Created thread %d in pool \n", n);
+#endif
+			}
+			return;
+		}
+	}
+}
+
+
+/* Grow the pool by one thread if queued jobs are waiting longer than
+ * the target delay, or if most working threads are blocked in disk I/O
+ * while jobs are waiting. */
+static void thpool_maybe_grow(thpool_* thpool_p){
+	if (thpool_p->max_threads <= thpool_p->min_threads) return;
+
+	pthread_mutex_lock(&thpool_p->jobqueue.rwmutex);
+	int len = thpool_p->jobqueue.len;
+	uint64_t oldest = len ? thpool_p->jobqueue.front->queued_ns : 0;
+	pthread_mutex_unlock(&thpool_p->jobqueue.rwmutex);
+	if (len == 0) return;
+
+	uint64_t waited = monotonic_ns() - oldest;
+	pthread_mutex_lock(&thpool_p->thcount_lock);
+	int idle = thpool_p->num_threads_total - thpool_p->num_threads_working;
+	int delayed = waited > thpool_p->target_delay_ns;
+	int blocked = thpool_p->num_threads_blocked * 2 > thpool_p->num_threads_working;
+	if (thpool_p->num_threads_total < thpool_p->max_threads && idle < len && (delayed || blocked)){
+		thread_spawn(thpool_p);
+	}
+	pthread_mutex_unlock(&thpool_p->thcount_lock);
+}
+
+
 
 
 
@@ -282,7 +453,7 @@ int thpool_num_threads_working(thpool_* thpool_p){
 static int thread_init (thpool_* thpool_p, struct thread** thread_p, int id){
 
 	*thread_p = (struct thread*)malloc(sizeof(struct thread));
-	if (thread_p == NULL){
+	if (*thread_p == NULL){
 		err("thread_init(): Could not allocate memory for thread\n");
 		return -1;
 	}
@@ -290,7 +461,12 @@ static int thread_init (thpool_* thpool_p, struct thread** thread_p, int id){
 	(*thread_p)->thpool_p = thpool_p;
 	(*thread_p)->id       = id;
 
-	pthread_create(&(*thread_p)->pthread, NULL, (void *)thread_do, (*thread_p));
+	if (pthread_create(&(*thread_p)->pthread, NULL, (void *)thread_do, (*thread_p)) != 0){
+		err("thread_init(): Could not create thread\n");
+		free(*thread_p);
+		*thread_p = NULL;
+		return -1;
+	}
 	pthread_detach((*thread_p)->pthread);
 	return 0;
 }
@@ -299,8 +475,10 @@ static int thread_init (thpool_* thpool_p, struct thread** thread_p, int id){
 /* Sets the calling thread on hold */
 static void thread_hold(int sig_id) {
     (void)sig_id;
-	threads_on_hold = 1;
-	while (threads_on_hold){
+	if (current_thread == NULL) return;
+	thpool_* thpool_p = current_thread->thpool_p;
+	thpool_p->threads_on_hold = 1;
+	while (thpool_p->threads_on_hold){
 		sleep(1);
 	}
 }
@@ -331,6 +509,8 @@ static void* thread_do(struct thread* thread_p){
 
 	/* Assure all threads have been created before starting serving */
 	thpool_* thpool_p = thread_p->thpool_p;
+	current_thread = thread_p;
+	int retired = 0;
 
 	/* Register signal handler */
 	struct sigaction act;
@@ -346,11 +526,30 @@ static void* thread_do(struct thread* thread_p){
 	thpool_p->num_threads_alive += 1;
 	pthread_mutex_unlock(&thpool_p->thcount_lock);
 
-	while(threads_keepalive){
-
-		bsem_wait(thpool_p->jobqueue.has_jobs);
+	while(thpool_p->threads_keepalive){
+
+		if (thpool_p->idle_timeout_ms > 0 && thpool_p->max_threads > thpool_p->min_threads){
+			if (bsem_timedwait(thpool_p->jobqueue.has_jobs, thpool_p->idle_timeout_ms) == -1){
+				/* Idle for the timeout: retire if above the lower bound */
+				pthread_mutex_lock(&thpool_p->jobqueue.rwmutex);
+				int queued = thpool_p->jobqueue.len;
+				pthread_mutex_unlock(&thpool_p->jobqueue.rwmutex);
+				pthread_mutex_lock(&thpool_p->thcount_lock);
+				if (queued == 0 && thpool_p->num_threads_total > thpool_p->min_threads){
+					thpool_p->threads[thread_p->id] = NULL;
+					thpool_p->num_threads_total--;
+					retired = 1;
+				}
+				pthread_mutex_unlock(&thpool_p->thcount_lock);
+				if (retired) break;
+				continue;
+			}
+		}
+		else {
+			bsem_wait(thpool_p->jobqueue.has_jobs);
+		}
 
-		if (threads_keepalive){
+		if (thpool_p->threads_keepalive){
 
 			pthread_mutex_lock(&thpool_p->thcount_lock);
 			thpool_p->num_threads_working++;
@@ -360,6 +559,7 @@ static void* thread_do(struct thread* thread_p){
 			void (*func_buff)(void*);
 			void*  arg_buff;
 			job* job_p = jobqueue_pull(&thpool_p->jobqueue);
+			thpool_maybe_grow(thpool_p);
 			if (job_p) {
 				func_buff = job_p->function;
 				arg_buff  = job_p->arg;
@@ -380,6 +580,12 @@ static void* thread_do(struct thread* thread_p){
 	thpool_p->num_threads_alive --;
 	pthread_mutex_unlock(&thpool_p->thcount_lock);
 
+	if (retired){
+#if THPOOL_DEBUG
+		printf("THPOOL_DEBUG: Retired idle thread %d in pool \n", thread_p->id);
+#endif
+		thread_destroy(thread_p);
+	}
 	return NULL;
 }
 
@@ -399,6 +605,7 @@ static void thread_destroy (thread* thread_p){
 /* Initialize queue */
 static int jobqueue_init(jobqueue* jobqueue_p){
 	jobqueue_p->len = 0;
+	jobqueue_p->max_len = 0;
 	jobqueue_p->front = NULL;
 	jobqueue_p->rear  = NULL;
 
@@ -430,10 +637,16 @@ static void jobqueue_clear(jobqueue* jobqueue_p){
 
 
 /* Add (allocated) job to queue
+ *
+ * @return 0 on success, -1 if the queue is at its limit
  */
-static void jobqueue_push(jobqueue* jobqueue_p, struct job* newjob){
+static int jobqueue_push(jobqueue* jobqueue_p, struct job* newjob){
 
 	pthread_mutex_lock(&jobqueue_p->rwmutex);
+	if (jobqueue_p->max_len && jobqueue_p->len >= jobqueue_p->max_len){
+		pthread_mutex_unlock(&jobqueue_p->rwmutex);
+		return -1;
+	}
 	newjob->prev = NULL;
 
 	switch(jobqueue_p->len){
@@ -452,6 +665,7 @@ static void jobqueue_push(jobqueue* jobqueue_p, struct job* newjob){
 
 	bsem_post(jobqueue_p->has_jobs);
 	pthread_mutex_unlock(&jobqueue_p->rwmutex);
+	return 0;
 }
 
 
@@ -540,6 +754,34 @@ static void bsem_post_all(bsem *bsem_p) {
 }
 
 
+/* Wait on semaphore until semaphore has value 1, or until timeout
+ *
+ * @return 0 if the semaphore was taken, -1 on timeout
+ */
+static int bsem_timedwait(bsem* bsem_p, int timeout_ms) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec  += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000){
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	int status = 0;
+	pthread_mutex_lock(&bsem_p->mutex);
+	while (bsem_p->v != 1 && status != ETIMEDOUT) {
+		status = pthread_cond_timedwait(&bsem_p->cond, &bsem_p->mutex, &deadline);
+	}
+	int taken = (bsem_p->v == 1);
+	if (taken) {
+		bsem_p->v = 0;
+	}
+	pthread_mutex_unlock(&bsem_p->mutex);
+	return taken ? 0 : -1;
+}
+
+
 /* Wait on semaphore until semaphore has value 0 */
 static void bsem_wait(bsem* bsem_p) {
 	pthread_mutex_lock(&bsem_p->mutex);
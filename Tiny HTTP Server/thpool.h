@@ -37,6 +37,31 @@ typedef struct thpool_* threadpool;
 threadpool thpool_init(int num_threads);
 
 
+/**
+ * @brief  Initialize a threadpool that grows and shrinks
+ *
+ * Starts min_threads threads. When jobs have waited in the queue longer
+ * than target_delay_ms, or most working threads are blocked in disk I/O
+ * (see thpool_blocking_begin) while jobs are waiting, another thread is
+ * started, up to max_threads. Threads above min_threads that stay idle
+ * for idle_timeout_ms retire.
+ *
+ * @example
+ *
+ *    ..
+ *    threadpool thpool = thpool_init_elastic(2, 16, 30000, 10);
+ *    ..
+ *
+ * @param  min_threads      threads kept even when idle
+ * @param  max_threads      upper bound on threads
+ * @param  idle_timeout_ms  idle time before a thread above min retires
+ * @param  target_delay_ms  queue wait above which the pool grows
+ * @return threadpool       created threadpool on success,
+ *                          NULL on error
+ */
+threadpool thpool_init_elastic(int min_threads, int max_threads, int idle_timeout_ms, int target_delay_ms);
+
+
 /**
  * @brief Add work to the job queue
  *
@@ -62,11 +87,44 @@ threadpool thpool_init(int num_threads);
  * @param  threadpool    threadpool to which the work will be added
  * @param  function_p    pointer to function to add as work
  * @param  arg_p         pointer to an argument
- * @return 0 on successs, -1 otherwise.
+ * @return 0 on successs, -1 otherwise (including when the queue is at
+ *         the limit set by thpool_set_queue_limit).
  */
 int thpool_add_work(threadpool, void (*function_p)(void*), void* arg_p);
 
 
+/**
+ * @brief Limit the number of queued jobs
+ *
+ * Once the job queue holds max_jobs jobs, thpool_add_work() refuses
+ * further work and returns -1, so the caller can shed load instead
+ * of letting the queue grow without bound.
+ *
+ * @example
+ *
+ *    threadpool thpool = thpool_init(4);
+ *    thpool_set_queue_limit(thpool, 256);
+ *    ..
+ *    if (thpool_add_work(thpool, (void*)task, arg) == -1) {
+ *       reject(arg);
+ *    }
+ *
+ * @param  threadpool    the threadpool to limit
+ * @param  max_jobs      maximum queued jobs, 0 for no limit
+ * @return nothing
+ */
+void thpool_set_queue_limit(threadpool, int max_jobs);
+
+
+/**
+ * @brief Number of jobs waiting in the queue
+ *
+ * @param  threadpool    the threadpool of interest
+ * @return integer       number of queued jobs not yet started
+ */
+int thpool_queue_length(threadpool);
+
+
 /**
  * @brief Wait for all queued jobs to finish
  *
@@ -180,6 +238,49 @@ void thpool_destroy(threadpool);
 int thpool_num_threads_working(threadpool);
 
 
+/**
+ * @brief Show currently alive threads
+ *
+ * @param threadpool     the threadpool of interest
+ * @return integer       number of threads alive
+ */
+int thpool_num_threads_alive(threadpool);
+
+
+/**
+ * @brief Show threads currently blocked in disk I/O
+ *
+ * @param threadpool     the threadpool of interest
+ * @return integer       number of threads between thpool_blocking_begin
+ *                       and thpool_blocking_end
+ */
+int thpool_num_threads_blocked(threadpool);
+
+
+/**
+ * @brief Mark the calling pool thread as blocked in disk I/O
+ *
+ * An elastic pool grows when most of its working threads are blocked.
+ * Calls from threads that do not belong to a pool are ignored.
+ *
+ * @example
+ *    thpool_blocking_begin();
+ *    fd = open(path, O_RDONLY);
+ *    thpool_blocking_end();
+ *
+ * @return nothing
+ */
+void thpool_blocking_begin(void);
+
+
+/**
+ * @brief Mark the calling pool thread as no longer blocked in disk I/O
+ *
+ * @return nothing
+ */
+void thpool_blocking_end(void);
+
+
 #ifdef __cplusplus
 }
 #endif
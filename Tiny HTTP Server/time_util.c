@@ -35,3 +35,13 @@ char *milliTimeToShortHM_Date_Time(time_t timer, char *buf) {
 	strftime(buf, 128, "%F %H:%M", tm_info);
 	return buf;
 }
+
+/**
+ * Returns the current time of the monotonic clock in nanoseconds.
+ * @return the monotonic time
+ */
+uint64_t monotonicTimeNanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
@@ -11,6 +11,7 @@
 #define TIME_UTIL_H_
 
 #include <time.h>
+#include <stdint.h>
 
 /**
  * Converts timer to a RFC-1123 formatted date-time string.
@@ -30,4 +31,10 @@ char *milliTimeToRFC_1123_Date_Time(time_t timer, char *buf);
  */
 char *milliTimeToShortHM_Date_Time(time_t timer, char *buf);
 
+/**
+ * Returns the current time of the monotonic clock in nanoseconds.
+ * @return the monotonic time
+ */
+uint64_t monotonicTimeNanos(void);
+
 #endif /* TIME_UTIL_H_ */
@@ -0,0 +1,226 @@
+/*
+ * timer_wheel.c
+ *
+ * Functions that implement a hierarchical timer wheel.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdlib.h>
+#include "timer_wheel.h"
+
+/** number of bits of tick resolved by each level */
+#define WHEEL_BITS 6
+/** number of slots per level */
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+/** mask for slot index within a level */
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+/** number of levels */
+#define WHEEL_LEVELS 4
+
+/** Definition of a timer wheel */
+typedef struct TimerWheel {
+	uint64_t current;                            /** next tick to process */
+	TimerEntry slots[WHEEL_LEVELS][WHEEL_SIZE];  /** slot list heads */
+} TimerWheel;
+
+/**
+ * Make an empty circular list head.
+ * @param head the list head
+ */
+static void listInit(TimerEntry *head) {
+	head->next = head;
+	head->prev = head;
+}
+
+/**
+ * Append a timer to a list.
+ * @param head the list head
+ * @param timer the timer entry
+ */
+static void listAppend(TimerEntry *head, TimerEntry *timer) {
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+/**
+ * Move all timers in one list to another empty list.
+ * @param from the source list head
+ * @param to the destination list head
+ */
+static void listMove(TimerEntry *from, TimerEntry *to) {
+	if (from->next == from) {
+		listInit(to);
+		return;
+	}
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	listInit(from);
+}
+
+/**
+ * Place a timer into the slot for its expiration.
+ * @param wheel the timer wheel
+ * @param timer the timer entry
+ */
+static void wheelInsert(TimerWheel *wheel, TimerEntry *timer) {
+	uint64_t expires = timer->expires;
+	if (expires < wheel->current) {  // already due: fire on next tick
+		expires = wheel->current;
+	}
+	uint64_t delta = expires - wheel->current;
+
+	int level = 0;
+	while (level < WHEEL_LEVELS-1 && delta >= ((uint64_t)1 << (WHEEL_BITS*(level+1)))) {
+		level++;
+	}
+	if (delta >= ((uint64_t)1 << (WHEEL_BITS*WHEEL_LEVELS))) {
+		// beyond the range of the wheel: park in the farthest slot
+		expires = wheel->current + ((uint64_t)1 << (WHEEL_BITS*WHEEL_LEVELS)) - 1;
+	}
+	int slot = (expires >> (WHEEL_BITS*level)) & WHEEL_MASK;
+	listAppend(&wheel->slots[level][slot], timer);
+}
+
+/**
+ * Re-insert the timers of one upper level slot into the wheel.
+ * @param wheel the timer wheel
+ * @param level the level to cascade
+ * @return the slot index that was cascaded
+ */
+static int wheelCascade(TimerWheel *wheel, int level) {
+	int slot = (wheel->current >> (WHEEL_BITS*level)) & WHEEL_MASK;
+	TimerEntry pending;
+	listMove(&wheel->slots[level][slot], &pending);
+	while (pending.next != &pending) {
+		TimerEntry *timer = pending.next;
+		timerWheelCancel(timer);
+		wheelInsert(wheel, timer);
+	}
+	return slot;
+}
+
+/**
+ * Initialize a timer entry.
+ * @param timer the timer entry
+ * @param callback function called when the timer expires
+ */
+void initTimerEntry(TimerEntry *timer, void (*callback)(TimerEntry *timer)) {
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->expires = 0;
+	timer->callback = callback;
+}
+
+/**
+ * Return whether a timer entry is armed.
+ * @param timer the timer entry
+ * @return true if the timer is armed
+ */
+bool timerEntryArmed(const TimerEntry *timer) {
+	return timer->next != NULL;
+}
+
+/**
+ * Create a new timer wheel.
+ * @param now the current tick
+ * @return a new timer wheel or NULL if unavailable
+ */
+TimerWheel *newTimerWheel(uint64_t now) {
+	TimerWheel *wheel = malloc(sizeof(TimerWheel));
+	if (wheel == NULL) {
+		return NULL;
+	}
+	wheel->current = now;
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		for (int slot = 0; slot < WHEEL_SIZE; slot++) {
+			listInit(&wheel->slots[level][slot]);
+		}
+	}
+	return wheel;
+}
+
+/**
+ * Delete a timer wheel. Armed timers are not fired.
+ * @param wheel the timer wheel
+ */
+void deleteTimerWheel(TimerWheel *wheel) {
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		for (int slot = 0; slot < WHEEL_SIZE; slot++) {
+			TimerEntry *head = &wheel->slots[level][slot];
+			while (head->next != head) {
+				timerWheelCancel(head->next);
+			}
+		}
+	}
+	free(wheel);
+}
+
+/**
+ * Arm a timer to expire at the specified tick. A timer that
+ * is already armed is moved to its new expiration.
+ *
+ * @param wheel the timer wheel
+ * @param timer the timer entry
+ * @param expires the expiration tick
+ */
+void timerWheelArm(TimerWheel *wheel, TimerEntry *timer, uint64_t expires) {
+	timerWheelCancel(timer);
+	timer->expires = expires;
+	wheelInsert(wheel, timer);
+}
+
+/**
+ * Cancel a timer. Cancelling a timer that is not armed is harmless.
+ *
+ * @param timer the timer entry
+ */
+void timerWheelCancel(TimerEntry *timer) {
+	if (timer->next == NULL) {
+		return;
+	}
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+/**
+ * Advance the wheel to the specified tick, firing callbacks
+ * for all timers that expire on the way. Callbacks may arm
+ * or cancel timers.
+ *
+ * @param wheel the timer wheel
+ * @param now the current tick
+ * @return the number of timers fired
+ */
+int timerWheelAdvance(TimerWheel *wheel, uint64_t now) {
+	int nfired = 0;
+	while (wheel->current <= now) {
+		int slot = wheel->current & WHEEL_MASK;
+		// cascade upper levels each time a lower level wraps
+		if (slot == 0) {
+			for (int level = 1; level < WHEEL_LEVELS; level++) {
+				if (wheelCascade(wheel, level) != 0) {
+					break;
+				}
+			}
+		}
+
+		TimerEntry expired;
+		listMove(&wheel->slots[0][slot], &expired);
+		wheel->current++;
+
+		while (expired.next != &expired) {
+			TimerEntry *timer = expired.next;
+			timerWheelCancel(timer);
+			timer->callback(timer);
+			nfired++;
+		}
+	}
+	return nfired;
+}
@@ -0,0 +1,87 @@
+/*
+ * timer_wheel.h
+ *
+ * Functions that implement a hierarchical timer wheel.
+ *
+ * Timers are kept in four levels of 64 slots. Arming and
+ * cancelling a timer are O(1) list operations; timers in the
+ * upper levels are cascaded down as the wheel turns.
+ *
+ * The wheel does no locking of its own; callers serialize access.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Declaration of a timer entry embedded in the owner's struct */
+typedef struct TimerEntry {
+	struct TimerEntry *next;   /** next entry in slot */
+	struct TimerEntry *prev;   /** previous entry in slot */
+	uint64_t expires;          /** expiration tick */
+	void (*callback)(struct TimerEntry *timer);  /** expiration callback */
+} TimerEntry;
+
+/** Declaration of TimerWheel as opaque type */
+typedef struct TimerWheel TimerWheel;
+
+/**
+ * Initialize a timer entry.
+ * @param timer the timer entry
+ * @param callback function called when the timer expires
+ */
+void initTimerEntry(TimerEntry *timer, void (*callback)(TimerEntry *timer));
+
+/**
+ * Return whether a timer entry is armed.
+ * @param timer the timer entry
+ * @return true if the timer is armed
+ */
+bool timerEntryArmed(const TimerEntry *timer);
+
+/**
+ * Create a new timer wheel.
+ * @param now the current tick
+ * @return a new timer wheel or NULL if unavailable
+ */
+TimerWheel *newTimerWheel(uint64_t now);
+
+/**
+ * Delete a timer wheel. Armed timers are not fired.
+ * @param wheel the timer wheel
+ */
+void deleteTimerWheel(TimerWheel *wheel);
+
+/**
+ * Arm a timer to expire at the specified tick. A timer that
+ * is already armed is moved to its new expiration.
+ *
+ * @param wheel the timer wheel
+ * @param timer the timer entry
+ * @param expires the expiration tick
+ */
+void timerWheelArm(TimerWheel *wheel, TimerEntry *timer, uint64_t expires);
+
+/**
+ * Cancel a timer. Cancelling a timer that is not armed is harmless.
+ *
+ * @param timer the timer entry
+ */
+void timerWheelCancel(TimerEntry *timer);
+
+/**
+ * Advance the wheel to the specified tick, firing callbacks
+ * for all timers that expire on the way. Callbacks may arm
+ * or cancel timers.
+ *
+ * @param wheel the timer wheel
+ * @param now the current tick
+ * @return the number of timers fired
+ */
+int timerWheelAdvance(TimerWheel *wheel, uint64_t now);
+
+#endif /* TIMER_WHEEL_H_ */
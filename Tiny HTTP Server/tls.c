@@ -0,0 +1,546 @@
+/*
+ * tls.c
+ *
+ * Functions that serve connections over TLS.
+ *
+ * A TLS stream is a cookie stream that reads and writes through
+ * SSL_read and SSL_write, so the handshake runs on the thread or
+ * coroutine that reads the first request, bounded by its deadline.
+ * A call that would block on a non-blocking coroutine socket waits
+ * with awaitReady, as socket reads and writes do. The stream has
+ * no descriptor, so code that writes to the descriptor of a stream
+ * takes its stream path instead; sendTlsFile finds the session of
+ * a stream in a table.
+ *
+ * Ticket keys are derived from a secret chosen at startup and the
+ * number of the current rotation period, so processes forked after
+ * initTls derive the same keys without sharing anything. A ticket
+ * is accepted in its period and the next, and renewed in the next.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE  // fopencookie
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tls.h"
+#include "server_config.h"
+
+#if defined(HAVE_OPENSSL) && defined(__GLIBC__)
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/core_names.h>
+
+#include "http_server.h"
+#include "server_stats.h"
+#include "coroutine.h"
+
+/** buckets of the table of TLS streams */
+#define TLS_STREAM_BUCKETS 1024
+
+/** Definition of the TLS session of a stream */
+typedef struct TlsSession {
+	SSL *ssl;                       /** the connection state */
+	int fd;                         /** the socket */
+	FILE *stream;                   /** the stream */
+	bool established;               /** the handshake completed */
+	bool failed;                    /** a fatal error ended the session */
+	struct TlsSession *next;        /** next session in the bucket */
+} TlsSession;
+
+/** Definition of the session ticket key of a rotation period */
+typedef struct TicketKey {
+	unsigned char name[16];         /** the key name sent in tickets */
+	unsigned char aesKey[32];       /** encrypts the ticket */
+	unsigned char hmacKey[32];      /** authenticates the ticket */
+} TicketKey;
+
+/** the TLS context of all connections */
+static SSL_CTX *tlsContext = NULL;
+
+/** secret the ticket keys are derived from */
+static unsigned char ticketSecret[32];
+
+/** seconds in a ticket key rotation period */
+static int ticketRotationS = 0;
+
+/** TLS sessions by stream */
+static TlsSession *sessions[TLS_STREAM_BUCKETS];
+
+/** guards the table of TLS sessions */
+static pthread_mutex_t sessionsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Return the bucket of a stream in the table of TLS sessions.
+ *
+ * @param stream the stream
+ * @return the bucket index
+ */
+static size_t sessionBucket(FILE *stream) {
+	return ((uintptr_t)stream / sizeof(void *)) % TLS_STREAM_BUCKETS;
+}
+
+/**
+ * Find the TLS session of a stream.
+ *
+ * @param stream the stream
+ * @return the session, or NULL if the stream is not a TLS stream
+ */
+static TlsSession *findSession(FILE *stream) {
+	if (tlsContext == NULL) {
+		return NULL;
+	}
+	pthread_mutex_lock(&sessionsLock);
+	TlsSession *session = sessions[sessionBucket(stream)];
+	while (session != NULL && session->stream != stream) {
+		session = session->next;
+	}
+	pthread_mutex_unlock(&sessionsLock);
+	return session;
+}
+
+/**
+ * Derive the ticket key of a rotation period from the secret.
+ *
+ * @param period the rotation period
+ * @param key the key
+ */
+static void deriveTicketKey(uint64_t period, TicketKey *key) {
+	unsigned char msg[9];
+	for (int i = 0; i < 8; i++) {
+		msg[i] = (unsigned char)(period >> (56 - 8 * i));
+	}
+	unsigned char out[EVP_MAX_MD_SIZE];
+	unsigned int len;
+	msg[8] = 'k';
+	HMAC(EVP_sha512(), ticketSecret, sizeof(ticketSecret), msg, sizeof(msg), out, &len);
+	memcpy(key->aesKey, out, sizeof(key->aesKey));
+	memcpy(key->hmacKey, out + sizeof(key->aesKey), sizeof(key->hmacKey));
+	// the name is derived apart from the keys, so it reveals nothing of them
+	msg[8] = 'n';
+	HMAC(EVP_sha256(), ticketSecret, sizeof(ticketSecret), msg, sizeof(msg), out, &len);
+	memcpy(key->name, out, sizeof(key->name));
+	OPENSSL_cleanse(out, sizeof(out));
+}
+
+/**
+ * Set up the cipher and MAC of a session ticket: for a new ticket
+ * with the key of the current period, for a received one with the
+ * key named in it.
+ *
+ * @param ssl the connection
+ * @param keyName the key name; set for a new ticket
+ * @param iv the initialization vector; set for a new ticket
+ * @param cipherCtx the ticket cipher
+ * @param macCtx the ticket MAC
+ * @param enc 1 for a new ticket, 0 for a received one
+ * @return 1 if the key is current, 2 to renew the ticket,
+ *  0 if the key is unknown, -1 if error
+ */
+static int ticketKeyCallback(SSL *ssl, unsigned char keyName[16], unsigned char *iv,
+							 EVP_CIPHER_CTX *cipherCtx, EVP_MAC_CTX *macCtx, int enc) {
+	(void)ssl;
+	uint64_t period = (uint64_t)time(NULL) / ticketRotationS;
+	TicketKey key;
+	int status = 1;
+	deriveTicketKey(period, &key);
+	if (enc) {
+		if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1) {
+			return -1;
+		}
+		memcpy(keyName, key.name, sizeof(key.name));
+	} else if (memcmp(keyName, key.name, sizeof(key.name)) != 0) {
+		// a ticket of the previous period is accepted and renewed
+		deriveTicketKey(period - 1, &key);
+		if (memcmp(keyName, key.name, sizeof(key.name)) != 0) {
+			OPENSSL_cleanse(&key, sizeof(key));
+			return 0;
+		}
+		status = 2;
+	}
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmacKey, sizeof(key.hmacKey)),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+		OSSL_PARAM_construct_end()
+	};
+	int ok = EVP_MAC_CTX_set_params(macCtx, params)
+		&& (enc ? EVP_EncryptInit_ex(cipherCtx, EVP_aes_256_cbc(), NULL, key.aesKey, iv)
+				: EVP_DecryptInit_ex(cipherCtx, EVP_aes_256_cbc(), NULL, key.aesKey, iv));
+	OPENSSL_cleanse(&key, sizeof(key));
+	return ok ? status : -1;
+}
+
+/**
+ * Set up TLS with the configured certificate. Does nothing if no
+ * certificate is configured. Call before forking prefork workers,
+ * so they share the ticket keys.
+ *
+ * @return 0 if successful, -1 if TLS cannot be set up
+ */
+int initTls(void) {
+	const ServerConfig *config = serverConfig();
+	if (*config->tlsCertificate == '\0') {
+		return 0;
+	}
+	SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+	if (ctx == NULL) {
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+	const char *keyFile = (*config->tlsPrivateKey != '\0') ? config->tlsPrivateKey : config->tlsCertificate;
+	if (SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION) != 1
+			|| SSL_CTX_use_certificate_chain_file(ctx, config->tlsCertificate) != 1
+			|| SSL_CTX_use_PrivateKey_file(ctx, keyFile, SSL_FILETYPE_PEM) != 1
+			|| SSL_CTX_check_private_key(ctx) != 1) {
+		ERR_print_errors_fp(stderr);
+		SSL_CTX_free(ctx);
+		return -1;
+	}
+	// writes of a coroutine stream may be retried after a partial write;
+	// a client that closes without close_notify ends its stream normally
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF | SSL_OP_NO_RENEGOTIATION);
+
+	// sessions resume by ID from the cache of this process
+	static const unsigned char sessionIdContext[] = "tiny-http";
+	SSL_CTX_set_session_id_context(ctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+	if (config->tlsSessionCacheSize > 0) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(ctx, config->tlsSessionCacheSize);
+	} else {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	}
+
+	// or from tickets encrypted with the key of the rotation period
+	ticketRotationS = config->tlsTicketRotationS;
+	if (ticketRotationS > 0) {
+		if (RAND_bytes(ticketSecret, sizeof(ticketSecret)) != 1
+				|| SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticketKeyCallback) != 1) {
+			ERR_print_errors_fp(stderr);
+			SSL_CTX_free(ctx);
+			return -1;
+		}
+		SSL_CTX_set_timeout(ctx, 2 * ticketRotationS);
+	} else {
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	}
+
+	// the keys go to the kernel after the handshake where it supports the cipher
+	if (config->tlsKtls) {
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	}
+
+	// OpenSSL writes to the socket itself, without MSG_NOSIGNAL
+	signal(SIGPIPE, SIG_IGN);
+	tlsContext = ctx;
+	fprintf(stderr, "Serving TLS with certificate %s\n", config->tlsCertificate);
+	return 0;
+}
+
+/**
+ * Determine whether connections are served over TLS.
+ * @return true if a certificate was loaded
+ */
+bool tlsEnabled(void) {
+	return tlsContext != NULL;
+}
+
+/**
+ * Count a completed handshake, and whether it resumed a session
+ * and handed the keys to the kernel.
+ *
+ * @param session the session
+ */
+static void handshakeDone(TlsSession *session) {
+	session->established = true;
+	statsIncrement(tlsHandshakes);
+	if (SSL_session_reused(session->ssl)) {
+		statsIncrement(tlsResumptions);
+	}
+	if (BIO_get_ktls_send(SSL_get_wbio(session->ssl))) {
+		statsIncrement(tlsKtlsSessions);
+	}
+}
+
+/**
+ * Wait for the socket after an SSL call that did not complete.
+ *
+ * @param session the session
+ * @param ret what the call returned
+ * @return 0 to repeat the call, -1 with errno set if it failed
+ */
+static int awaitTls(TlsSession *session, int ret) {
+	int saved = errno;
+	switch (SSL_get_error(session->ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		return awaitReady(session->fd, POLLIN);
+	case SSL_ERROR_WANT_WRITE:
+		return awaitReady(session->fd, POLLOUT);
+	case SSL_ERROR_SYSCALL:
+		if (saved == EINTR) {
+			return 0;
+		}
+		errno = (saved != 0) ? saved : ECONNRESET;
+		break;
+	default:
+		errno = EPROTO;
+		break;
+	}
+	ERR_clear_error();
+	session->failed = true;
+	return -1;
+}
+
+/**
+ * Read from a TLS stream; the first read completes the handshake.
+ *
+ * @param cookie the session
+ * @param buf the buffer
+ * @param size the size of the buffer
+ * @return the number of bytes read, 0 at end of file, -1 if error
+ */
+static ssize_t tlsRead(void *cookie, char *buf, size_t size) {
+	TlsSession *session = cookie;
+	while (true) {
+		int n = SSL_read(session->ssl, buf, (size < INT_MAX) ? (int)size : INT_MAX);
+		if (n > 0) {
+			if (!session->established) {
+				handshakeDone(session);
+			}
+			return n;
+		}
+		if (SSL_get_error(session->ssl, n) == SSL_ERROR_ZERO_RETURN) {
+			return 0;
+		}
+		if (awaitTls(session, n) != 0) {
+			return -1;
+		}
+	}
+}
+
+/**
+ * Write to a TLS stream.
+ *
+ * @param cookie the session
+ * @param buf the bytes
+ * @param size the number of bytes
+ * @return the number of bytes written, or -1 if error
+ */
+static ssize_t tlsWrite(void *cookie, const char *buf, size_t size) {
+	TlsSession *session = cookie;
+	while (true) {
+		int n = SSL_write(session->ssl, buf, (size < INT_MAX) ? (int)size : INT_MAX);
+		if (n > 0) {
+			return n;
+		}
+		if (awaitTls(session, n) != 0) {
+			return -1;
+		}
+	}
+}
+
+/**
+ * Close a TLS stream: send close_notify if the session is intact,
+ * without waiting for the client's, and close the socket. A session
+ * closed without close_notify would be dropped from the cache.
+ *
+ * @param cookie the session
+ * @return 0 if successful, -1 if error
+ */
+static int tlsClose(void *cookie) {
+	TlsSession *session = cookie;
+	pthread_mutex_lock(&sessionsLock);
+	TlsSession **link = &sessions[sessionBucket(session->stream)];
+	while (*link != session) {
+		link = &(*link)->next;
+	}
+	*link = session->next;
+	pthread_mutex_unlock(&sessionsLock);
+
+	if (SSL_is_init_finished(session->ssl) && !session->failed) {
+		// a client that stopped reading does not hold up the close
+		fcntl(session->fd, F_SETFL, fcntl(session->fd, F_GETFL) | O_NONBLOCK);
+		SSL_shutdown(session->ssl);
+	}
+	SSL_free(session->ssl);
+	int status = close(session->fd);
+	free(session);
+	return status;
+}
+
+/**
+ * Open a TLS stream over a peer socket. The handshake runs on the
+ * first read from the stream.
+ *
+ * @param sock_fd the socket; it is closed with the stream
+ * @return the stream, or NULL with errno set if error
+ */
+FILE *openTlsStream(int sock_fd) {
+	// a coroutine waits for its socket instead of blocking on it
+	if (coroutinesRunning()) {
+		int flags = fcntl(sock_fd, F_GETFL);
+		if (flags < 0 || fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+			return NULL;
+		}
+	}
+	TlsSession *session = calloc(1, sizeof(TlsSession));
+	if (session == NULL) {
+		return NULL;
+	}
+	session->fd = sock_fd;
+	session->ssl = SSL_new(tlsContext);
+	if (session->ssl == NULL || SSL_set_fd(session->ssl, sock_fd) != 1) {
+		ERR_clear_error();
+		SSL_free(session->ssl);
+		free(session);
+		errno = ENOMEM;
+		return NULL;
+	}
+	SSL_set_accept_state(session->ssl);
+
+	cookie_io_functions_t io = { tlsRead, tlsWrite, NULL, tlsClose };
+	session->stream = fopencookie(session, "r+", io);
+	if (session->stream == NULL) {
+		SSL_free(session->ssl);
+		free(session);
+		return NULL;
+	}
+	pthread_mutex_lock(&sessionsLock);
+	size_t bucket = sessionBucket(session->stream);
+	session->next = sessions[bucket];
+	sessions[bucket] = session;
+	pthread_mutex_unlock(&sessionsLock);
+	return session->stream;
+}
+
+/**
+ * Determine whether a stream is a TLS stream.
+ *
+ * @param stream the stream
+ * @return true if it was opened by openTlsStream
+ */
+bool isTlsStream(FILE *stream) {
+	return findSession(stream) != NULL;
+}
+
+/**
+ * Determine whether the handshake of a TLS stream has completed, so
+ * a response can be written to it.
+ *
+ * @param stream the stream
+ * @return true if it is a TLS stream whose handshake completed
+ */
+bool tlsEstablished(FILE *stream) {
+	TlsSession *session = findSession(stream);
+	return session != NULL && session->established && !session->failed;
+}
+
+/**
+ * Return the socket under a stream: its descriptor, or the socket
+ * of a TLS stream.
+ *
+ * @param stream the stream
+ * @return the socket, or -1 if the stream has none, as for HTTP/2
+ */
+int streamSocket(FILE *stream) {
+	int fd = fileno(stream);
+	if (fd < 0) {
+		TlsSession *session = findSession(stream);
+		fd = (session != NULL) ? session->fd : -1;
+	}
+	return fd;
+}
+
+/**
+ * Send bytes of an open file to a TLS stream with sendfile, if the
+ * stream encrypts with kernel TLS. The stream must be flushed.
+ *
+ * @param ostream the output stream
+ * @param fd the file descriptor
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send
+ * @return 0 if successful, -1 with errno set if error; ENOTSUP if
+ *  the stream does not use kernel TLS and nothing was sent
+ */
+int sendTlsFile(FILE *ostream, int fd, off_t offset, size_t nbytes) {
+	TlsSession *session = findSession(ostream);
+	if (session == NULL || !BIO_get_ktls_send(SSL_get_wbio(session->ssl))) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	while (nbytes > 0) {
+		ossl_ssize_t nsent = SSL_sendfile(session->ssl, fd, offset, nbytes, 0);
+		if (nsent > 0) {
+			offset += nsent;
+			nbytes -= nsent;
+		} else if (nsent == 0) {
+			errno = EIO;  // file truncated
+			return -1;
+		} else if (awaitTls(session, (int)nsent) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+#else  // TLS needs OpenSSL and fopencookie
+
+int initTls(void) {
+	if (*serverConfig()->tlsCertificate == '\0') {
+		return 0;
+	}
+	fprintf(stderr, "TLS needs a server built with -DHAVE_OPENSSL\n");
+	errno = ENOTSUP;
+	return -1;
+}
+
+bool tlsEnabled(void) {
+	return false;
+}
+
+FILE *openTlsStream(int sock_fd) {
+	(void)sock_fd;
+	errno = ENOTSUP;
+	return NULL;
+}
+
+bool isTlsStream(FILE *stream) {
+	(void)stream;
+	return false;
+}
+
+bool tlsEstablished(FILE *stream) {
+	(void)stream;
+	return false;
+}
+
+int streamSocket(FILE *stream) {
+	return fileno(stream);
+}
+
+int sendTlsFile(FILE *ostream, int fd, off_t offset, size_t nbytes) {
+	(void)ostream;
+	(void)fd;
+	(void)offset;
+	(void)nbytes;
+	errno = ENOTSUP;
+	return -1;
+}
+
+#endif
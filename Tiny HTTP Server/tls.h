@@ -0,0 +1,95 @@
+/*
+ * tls.h
+ *
+ * Functions that serve connections over TLS, so the server can face
+ * clients without a separate TLS terminator in front of it.
+ *
+ * TLS is on when tls_certificate is set, for a server built with
+ * OpenSSL:
+ *   gcc -DHAVE_OPENSSL -O2 -pthread -o http_server *.c -lssl -lcrypto
+ *
+ * Sessions resume without a full handshake from a session cache
+ * shared by the threads of a process, or from session tickets whose
+ * key changes every tls_ticket_rotation_s seconds. Ticket keys are
+ * the same in all prefork workers, so a ticket resumes in any of them.
+ * With tls_ktls the record encryption is handed to the kernel after
+ * the handshake where the kernel and cipher support it, and files are
+ * sent with sendfile as over plain TCP.
+ *
+ * HTTP/2 is not offered over TLS, since it would be negotiated with
+ * ALPN; h2c upgrades apply to plain TCP only.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef TLS_H_
+#define TLS_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * Set up TLS with the configured certificate. Does nothing if no
+ * certificate is configured. Call before forking prefork workers,
+ * so they share the ticket keys.
+ *
+ * @return 0 if successful, -1 if TLS cannot be set up
+ */
+int initTls(void);
+
+/**
+ * Determine whether connections are served over TLS.
+ * @return true if a certificate was loaded
+ */
+bool tlsEnabled(void);
+
+/**
+ * Open a TLS stream over a peer socket. The handshake runs on the
+ * first read from the stream.
+ *
+ * @param sock_fd the socket; it is closed with the stream
+ * @return the stream, or NULL with errno set if error
+ */
+FILE *openTlsStream(int sock_fd);
+
+/**
+ * Determine whether a stream is a TLS stream.
+ *
+ * @param stream the stream
+ * @return true if it was opened by openTlsStream
+ */
+bool isTlsStream(FILE *stream);
+
+/**
+ * Determine whether the handshake of a TLS stream has completed, so
+ * a response can be written to it.
+ *
+ * @param stream the stream
+ * @return true if it is a TLS stream whose handshake completed
+ */
+bool tlsEstablished(FILE *stream);
+
+/**
+ * Return the socket under a stream: its descriptor, or the socket
+ * of a TLS stream.
+ *
+ * @param stream the stream
+ * @return the socket, or -1 if the stream has none, as for HTTP/2
+ */
+int streamSocket(FILE *stream);
+
+/**
+ * Send bytes of an open file to a TLS stream with sendfile, if the
+ * stream encrypts with kernel TLS. The stream must be flushed.
+ *
+ * @param ostream the output stream
+ * @param fd the file descriptor
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send
+ * @return 0 if successful, -1 with errno set if error; ENOTSUP if
+ *  the stream does not use kernel TLS and nothing was sent
+ */
+int sendTlsFile(FILE *ostream, int fd, off_t offset, size_t nbytes);
+
+#endif /* TLS_H_ */
@@ -0,0 +1,301 @@
+/*
+ * bench_load.c
+ *
+ * Load generator for comparing server settings. Each client thread
+ * sends GET requests for one path for a fixed time, either on one
+ * keep-alive connection or on a new connection per request, and
+ * the run reports throughput and latency percentiles.
+ *
+ * With -f, new connections send the request in the SYN with TCP
+ * Fast Open; this needs the client bit (1) of the net.ipv4.tcp_fastopen
+ * sysctl, and falls back to a normal handshake until the server
+ * has issued a cookie.
+ *
+ * Build from the server directory:
+ *   gcc -O2 -pthread -o bench_load tools/bench_load.c
+ *
+ * Usage:
+ *   bench_load [-c clients] [-d seconds] [-k] [-f] host port path
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE  // MSG_FASTOPEN
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/** latency histogram resolution in microseconds */
+#define BUCKET_US 10
+
+/** latency histogram buckets; the last holds everything slower */
+#define NBUCKETS 100000
+
+/** response buffer size */
+#define RESPONSE_BUF 65536
+
+/** Definition of the run settings */
+typedef struct Options {
+	struct sockaddr_in addr;    /** server address */
+	char request[512];          /** the request to send */
+	size_t requestLen;          /** length of the request */
+	bool keepAlive;             /** reuse one connection per client */
+	bool fastOpen;              /** connect with TCP Fast Open */
+	uint64_t endNanos;          /** monotonic ns when the run ends */
+} Options;
+
+/** Definition of the results of one client */
+typedef struct Client {
+	pthread_t thread;           /** client thread */
+	const Options *options;     /** run settings */
+	uint64_t requests;          /** responses received */
+	uint64_t errors;            /** failed requests */
+	uint64_t bytes;             /** response bytes received */
+	uint32_t *histogram;        /** latencies in BUCKET_US buckets */
+} Client;
+
+/**
+ * Return the monotonic time.
+ * @return nanoseconds
+ */
+static uint64_t nowNanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Open a connection and send the request on it.
+ *
+ * @param options the run settings
+ * @return the socket, or -1 if error
+ */
+static int connectAndSend(const Options *options) {
+	int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		return -1;
+	}
+	ssize_t sent;
+	if (options->fastOpen) {
+		// the request rides in the SYN when the server's cookie is known
+		sent = sendto(sock, options->request, options->requestLen, MSG_FASTOPEN,
+					  (const struct sockaddr *)&options->addr, sizeof(options->addr));
+	} else if (connect(sock, (const struct sockaddr *)&options->addr, sizeof(options->addr)) == 0) {
+		sent = send(sock, options->request, options->requestLen, MSG_NOSIGNAL);
+	} else {
+		sent = -1;
+	}
+	if (sent != (ssize_t)options->requestLen) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * Read one response. A keep-alive response is read to the end of
+ * its Content-Length; otherwise to the end of the connection.
+ *
+ * @param sock the socket
+ * @param buf a RESPONSE_BUF buffer
+ * @param keepAlive the response has a Content-Length and the connection stays open
+ * @param closing set if the server closes the connection after the response
+ * @return the number of bytes read, or -1 if error
+ */
+static long readResponse(int sock, char *buf, bool keepAlive, bool *closing) {
+	size_t len = 0;
+	long total = 0;
+	long expected = -1;
+	while (true) {
+		ssize_t n = recv(sock, buf + len, RESPONSE_BUF - 1 - len, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return (n == 0 && !keepAlive && total > 0) ? total : -1;
+		}
+		total += n;
+		if (expected < 0) {
+			len += n;
+			buf[len] = '\0';
+			char *end = strstr(buf, "\r\n\r\n");
+			if (end == NULL) {
+				if (len == RESPONSE_BUF - 1) {
+					return -1;
+				}
+				continue;
+			}
+			if (strncmp(buf, "HTTP/1.1 200", 12) != 0) {
+				return -1;
+			}
+			char *conn = strcasestr(buf, "\r\nConnection: close");
+			*closing = (conn != NULL && conn < end);
+			char *cl = strcasestr(buf, "\r\nContent-Length:");
+			if (cl == NULL || cl > end) {
+				if (keepAlive) {
+					return -1;
+				}
+				expected = 0;  // read to the end of the connection
+			} else {
+				expected = (end + 4 - buf) + strtol(cl + 17, NULL, 10);
+			}
+			len = 0;
+		}
+		if (keepAlive && total >= expected) {
+			return total;
+		}
+	}
+}
+
+/**
+ * Client thread that sends requests until the run ends.
+ *
+ * @param arg the client
+ * @return NULL
+ */
+static void *runClient(void *arg) {
+	Client *client = arg;
+	const Options *options = client->options;
+	char *buf = malloc(RESPONSE_BUF);
+	int sock = -1;
+	while (nowNanos() < options->endNanos) {
+		uint64_t start = nowNanos();
+		bool sent;
+		if (options->keepAlive && sock >= 0) {
+			sent = send(sock, options->request, options->requestLen, MSG_NOSIGNAL)
+					== (ssize_t)options->requestLen;
+		} else {
+			sock = connectAndSend(options);
+			sent = (sock >= 0);
+		}
+		bool closing = false;
+		long n = sent ? readResponse(sock, buf, options->keepAlive, &closing) : -1;
+		if (n < 0) {
+			client->errors++;
+		} else {
+			uint64_t us = (nowNanos() - start) / 1000;
+			uint64_t bucket = us / BUCKET_US;
+			client->histogram[bucket < NBUCKETS ? bucket : NBUCKETS - 1]++;
+			client->requests++;
+			client->bytes += n;
+		}
+		if (n < 0 || !options->keepAlive || closing) {
+			if (sock >= 0) {
+				close(sock);
+			}
+			sock = -1;
+		}
+	}
+	if (sock >= 0) {
+		close(sock);
+	}
+	free(buf);
+	return NULL;
+}
+
+/**
+ * Return a latency percentile.
+ *
+ * @param histogram the combined histogram
+ * @param count the number of samples
+ * @param pct the percentile
+ * @return the latency in milliseconds
+ */
+static double percentile(const uint64_t *histogram, uint64_t count, double pct) {
+	uint64_t rank = (uint64_t)(count * pct / 100.0);
+	uint64_t seen = 0;
+	for (int i = 0; i < NBUCKETS; i++) {
+		seen += histogram[i];
+		if (seen > rank) {
+			return (i + 1) * BUCKET_US / 1000.0;
+		}
+	}
+	return NBUCKETS * BUCKET_US / 1000.0;
+}
+
+/**
+ * Run the load and print one line of results.
+ */
+int main(int argc, char* argv[argc]) {
+	Options options;
+	memset(&options, 0, sizeof(options));
+	int nclients = 8;
+	int seconds = 5;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:d:kf")) != -1) {
+		switch (opt) {
+		case 'c': nclients = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'k': options.keepAlive = true; break;
+		case 'f': options.fastOpen = true; break;
+		default:  argc = 0;
+		}
+	}
+	if (argc - optind != 3 || nclients < 1 || seconds < 1) {
+		fprintf(stderr, "Usage: %s [-c clients] [-d seconds] [-k] [-f] host port path\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	options.addr.sin_family = AF_INET;
+	options.addr.sin_port = htons(atoi(argv[optind+1]));
+	if (inet_pton(AF_INET, argv[optind], &options.addr.sin_addr) != 1) {
+		fprintf(stderr, "Invalid address %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	int len = snprintf(options.request, sizeof(options.request),
+					   "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+					   argv[optind+2], argv[optind], options.keepAlive ? "keep-alive" : "close");
+	if (len < 0 || (size_t)len >= sizeof(options.request)) {
+		fprintf(stderr, "Path too long\n");
+		return EXIT_FAILURE;
+	}
+	options.requestLen = len;
+
+	Client *clients = calloc(nclients, sizeof(Client));
+	uint64_t *histogram = calloc(NBUCKETS, sizeof(uint64_t));
+	if (clients == NULL || histogram == NULL) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	uint64_t start = nowNanos();
+	options.endNanos = start + seconds * 1000000000ULL;
+	for (int i = 0; i < nclients; i++) {
+		clients[i].options = &options;
+		clients[i].histogram = calloc(NBUCKETS, sizeof(uint32_t));
+		if (clients[i].histogram == NULL
+				|| pthread_create(&clients[i].thread, NULL, runClient, &clients[i]) != 0) {
+			perror("client");
+			return EXIT_FAILURE;
+		}
+	}
+
+	uint64_t requests = 0, errors = 0, bytes = 0;
+	for (int i = 0; i < nclients; i++) {
+		pthread_join(clients[i].thread, NULL);
+		requests += clients[i].requests;
+		errors += clients[i].errors;
+		bytes += clients[i].bytes;
+		for (int b = 0; b < NBUCKETS; b++) {
+			histogram[b] += clients[i].histogram[b];
+		}
+		free(clients[i].histogram);
+	}
+	double elapsed = (nowNanos() - start) / 1e9;
+	printf("%10.0f req/s %9.1f MB/s   p50 %7.2f ms   p99 %7.2f ms   errors %llu\n",
+		   requests / elapsed, bytes / elapsed / (1024*1024),
+		   percentile(histogram, requests, 50), percentile(histogram, requests, 99),
+		   (unsigned long long)errors);
+	free(histogram);
+	free(clients);
+	return EXIT_SUCCESS;
+}
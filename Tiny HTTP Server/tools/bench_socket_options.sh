@@ -0,0 +1,87 @@
+#!/bin/sh
+#
+# bench_socket_options.sh
+#
+# Benchmark scenario that shows the effect of each socket option.
+# The server is started once per setting: with every option off,
+# with each option turned on by itself, and with the defaults. Each
+# setting is measured with bench_load for
+#   small  a small file on keep-alive connections (TCP_NODELAY, TCP_CORK)
+#   conn   a small file on a new connection per request
+#          (TCP_DEFER_ACCEPT, TCP_FASTOPEN, listen backlog)
+#   large  a 4 MB file on keep-alive connections (SO_SNDBUF, SO_RCVBUF)
+#
+# Run from the server directory:
+#   tools/bench_socket_options.sh [seconds] [clients] [port]
+#
+# TCP Fast Open needs "sysctl -w net.ipv4.tcp_fastopen=3" to be
+# used over loopback by both client and server.
+#
+#  @since 2026-10-19
+#
+
+set -e
+
+SECONDS_PER_RUN=${1:-5}
+CLIENTS=${2:-16}
+PORT=${3:-18080}
+SERVER_DIR=$(pwd)
+WORK=$(mktemp -d)
+trap 'kill $SERVER_PID 2>/dev/null; rm -rf "$WORK"' EXIT
+
+gcc -O2 -pthread -o "$WORK/http_server" ./*.c
+gcc -O2 -pthread -o "$WORK/bench_load" tools/bench_load.c
+
+# content with an added large file
+cp -r "$SERVER_DIR/content" "$WORK/content"
+head -c 4194304 /dev/urandom > "$WORK/content/large.bin"
+
+# every option off
+BASELINE="listen_backlog=128
+tcp_defer_accept_sec=0
+tcp_fastopen_queue=0
+socket_send_buffer_bytes=0
+socket_recv_buffer_bytes=0
+tcp_nodelay=false
+tcp_cork=false"
+
+# run one setting: name, then the settings that differ from the baseline
+run() {
+	name=$1
+	shift
+	{
+		echo "content_base=$WORK/content"
+		echo "mime_types=$SERVER_DIR/mime.types"
+		echo "$BASELINE"
+		for setting in "$@"; do
+			echo "$setting"
+		done
+	} > "$WORK/http_server.properties"
+	(cd "$WORK" && exec ./http_server "$PORT" > /dev/null 2>&1) &
+	SERVER_PID=$!
+	sleep 1
+
+	fastopen=""
+	case "$*" in *tcp_fastopen_queue=[1-9]*) fastopen="-f" ;; esac
+	echo "== $name"
+	printf "  small "
+	"$WORK/bench_load" -c "$CLIENTS" -d "$SECONDS_PER_RUN" -k 127.0.0.1 "$PORT" /index.html
+	printf "  conn  "
+	"$WORK/bench_load" -c "$CLIENTS" -d "$SECONDS_PER_RUN" $fastopen 127.0.0.1 "$PORT" /index.html
+	printf "  large "
+	"$WORK/bench_load" -c "$CLIENTS" -d "$SECONDS_PER_RUN" -k 127.0.0.1 "$PORT" /large.bin
+
+	kill "$SERVER_PID"
+	wait "$SERVER_PID" 2>/dev/null || true
+}
+
+run "all options off"
+run "tcp_nodelay" tcp_nodelay=true
+run "tcp_cork" tcp_cork=true
+run "tcp_nodelay + tcp_cork" tcp_nodelay=true tcp_cork=true
+run "tcp_defer_accept_sec=10" tcp_defer_accept_sec=10
+run "tcp_fastopen_queue=256" tcp_fastopen_queue=256
+run "listen_backlog=4096" listen_backlog=4096
+run "socket buffers 1 MB" socket_send_buffer_bytes=1048576 socket_recv_buffer_bytes=1048576
+run "defaults" listen_backlog=4096 tcp_defer_accept_sec=10 tcp_fastopen_queue=256 \
+	tcp_nodelay=true tcp_cork=true
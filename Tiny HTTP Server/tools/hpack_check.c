@@ -0,0 +1,239 @@
+/*
+ * hpack_check.c
+ *
+ * Offline check of the HPACK decoder (hpack.c) against the examples
+ * of RFC 7541 Appendix C: requests without and with Huffman coding
+ * (C.3, C.4), and responses with a 256-byte dynamic table that
+ * evicts entries (C.5, C.6). Each example is decoded in order on one
+ * table, and the fields and the table size are compared with the
+ * RFC. Dynamic table size updates are checked after the responses.
+ *
+ * Build from the server directory:
+ *   gcc -pthread -o hpack_check tools/hpack_check.c hpack.c
+ *
+ * Usage:
+ *   hpack_check
+ *
+ * The exit status is 0 if every example decodes as in the RFC.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../hpack.h"
+
+/** largest decoded example block or field list */
+#define CHECK_BUF 1024
+
+/** Definition of one example: a header block and what it decodes to */
+typedef struct Example {
+	const char *name;           /** RFC section */
+	const char *block;          /** header block in hex; spaces ignored */
+	const char *fields;         /** expected "name: value\n" lines */
+	size_t tableSize;           /** expected dynamic table size after */
+} Example;
+
+/** Definition of a sequence of examples decoded on one table */
+typedef struct Sequence {
+	size_t limit;               /** dynamic table size */
+	const Example *examples;    /** the examples, ending with a NULL name */
+} Sequence;
+
+/** C.3: requests without Huffman coding */
+static const Example requests[] = {
+	{"C.3.1", "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+	 ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n", 57},
+	{"C.3.2", "8286 84be 5808 6e6f 2d63 6163 6865",
+	 ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+	 "cache-control: no-cache\n", 110},
+	{"C.3.3", "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+	 ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\n"
+	 "custom-key: custom-value\n", 164},
+	{NULL, NULL, NULL, 0}
+};
+
+/** C.4: requests with Huffman coding */
+static const Example huffmanRequests[] = {
+	{"C.4.1", "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+	 ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n", 57},
+	{"C.4.2", "8286 84be 5886 a8eb 1064 9cbf",
+	 ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+	 "cache-control: no-cache\n", 110},
+	{"C.4.3", "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+	 ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\n"
+	 "custom-key: custom-value\n", 164},
+	{NULL, NULL, NULL, 0}
+};
+
+/** fields of the three responses of C.5 and C.6 */
+#define RESPONSE_1 \
+	":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n" \
+	"location: https://www.example.com\n"
+#define RESPONSE_2 \
+	":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n" \
+	"location: https://www.example.com\n"
+#define RESPONSE_3 \
+	":status: 200\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:22 GMT\n" \
+	"location: https://www.example.com\ncontent-encoding: gzip\n" \
+	"set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n"
+
+/**
+ * C.5: responses without Huffman coding, then dynamic table size
+ * updates: to 0, which empties the table, so its entries can no
+ * longer be referenced; back to the limit; and past the limit.
+ */
+static const Example responses[] = {
+	{"C.5.1", "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420"
+			  "3230 3133 2032 303a 3133 3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77"
+			  "7777 2e65 7861 6d70 6c65 2e63 6f6d",
+	 RESPONSE_1, 222},
+	{"C.5.2", "4803 3330 37c1 c0bf", RESPONSE_2, 222},
+	{"C.5.3", "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32"
+			  "3220 474d 54c0 5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a"
+			  "584f 5157 454f 5049 5541 5851 5745 4f49 553b 206d 6178 2d61 6765 3d33"
+			  "3630 303b 2076 6572 7369 6f6e 3d31",
+	 RESPONSE_3, 215},
+	{"size update to 0", "20 88", ":status: 200\n", 0},
+	{"evicted entry", "be", NULL, 0},
+	{"size update to 256", "3fe1 0140 0161 0162", "a: b\n", 34},
+	{"size update past limit", "3fe2 01", NULL, 34},
+	{NULL, NULL, NULL, 0}
+};
+
+/** C.6: responses with Huffman coding */
+static const Example huffmanResponses[] = {
+	{"C.6.1", "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81"
+			  "66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+	 RESPONSE_1, 222},
+	{"C.6.2", "4883 640e ffc1 c0bf", RESPONSE_2, 222},
+	{"C.6.3", "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a"
+			  "839b d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36"
+			  "72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+	 RESPONSE_3, 215},
+	{NULL, NULL, NULL, 0}
+};
+
+/** the sequences */
+static const Sequence sequences[] = {
+	{HPACK_TABLE_SIZE, requests},
+	{HPACK_TABLE_SIZE, huffmanRequests},
+	{256, responses},
+	{256, huffmanResponses},
+	{0, NULL}
+};
+
+/** Definition of the fields decoded so far */
+typedef struct Decoded {
+	char text[CHECK_BUF];       /** "name: value\n" lines */
+	size_t len;                 /** length of the text */
+} Decoded;
+
+/**
+ * Append a decoded field to the decoded text.
+ *
+ * @param arg the decoded fields
+ * @param name the field name
+ * @param value the field value
+ * @return 0 to continue, -1 if there is no room
+ */
+static int addField(void *arg, const char *name, const char *value) {
+	Decoded *decoded = arg;
+	int n = snprintf(decoded->text + decoded->len, sizeof(decoded->text) - decoded->len,
+					 "%s: %s\n", name, value);
+	if (n < 0 || (size_t)n >= sizeof(decoded->text) - decoded->len) {
+		return -1;
+	}
+	decoded->len += n;
+	return 0;
+}
+
+/**
+ * Convert an example block from hex to bytes.
+ *
+ * @param hex the hex digits; spaces are ignored
+ * @param buf the byte buffer
+ * @param size the size of the buffer
+ * @return the number of bytes, or 0 if the hex is malformed
+ */
+static size_t fromHex(const char *hex, unsigned char *buf, size_t size) {
+	size_t len = 0;
+	while (*hex != '\0') {
+		if (*hex == ' ') {
+			hex++;
+			continue;
+		}
+		unsigned int byte;
+		if (!isxdigit((unsigned char)hex[0]) || !isxdigit((unsigned char)hex[1])
+				|| sscanf(hex, "%2x", &byte) != 1 || len == size) {
+			return 0;
+		}
+		buf[len++] = byte;
+		hex += 2;
+	}
+	return len;
+}
+
+/**
+ * Decode an example and compare it with the RFC.
+ *
+ * @param table the decoder's dynamic table
+ * @param example the example
+ * @return true if it decodes as expected
+ */
+static bool checkExample(HpackTable *table, const Example *example) {
+	unsigned char block[CHECK_BUF];
+	size_t len = fromHex(example->block, block, sizeof(block));
+	if (len == 0) {
+		fprintf(stderr, "%s: bad example\n", example->name);
+		return false;
+	}
+	Decoded decoded = {.len = 0};
+	decoded.text[0] = '\0';
+	int status = hpackDecode(table, block, len, addField, &decoded);
+	if (example->fields == NULL) {
+		// the block must be refused
+		if (status == 0) {
+			fprintf(stderr, "%s: decoded a malformed block\n", example->name);
+			return false;
+		}
+	} else if (status != 0) {
+		fprintf(stderr, "%s: decoding failed\n", example->name);
+		return false;
+	} else if (strcmp(decoded.text, example->fields) != 0) {
+		fprintf(stderr, "%s: decoded\n%sexpected\n%s", example->name, decoded.text, example->fields);
+		return false;
+	}
+	if (table->size != example->tableSize) {
+		fprintf(stderr, "%s: table size %zu, expected %zu\n", example->name, table->size, example->tableSize);
+		return false;
+	}
+	printf("ok %s\n", example->name);
+	return true;
+}
+
+int main(void) {
+	int failed = 0;
+	for (const Sequence *seq = sequences; seq->examples != NULL; seq++) {
+		HpackTable table;
+		if (hpackInit(&table, seq->limit) != 0) {
+			perror("hpackInit");
+			return EXIT_FAILURE;
+		}
+		for (const Example *example = seq->examples; example->name != NULL; example++) {
+			if (!checkExample(&table, example)) {
+				failed++;
+			}
+		}
+		hpackFree(&table);
+	}
+	if (failed > 0) {
+		fprintf(stderr, "%d failed\n", failed);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
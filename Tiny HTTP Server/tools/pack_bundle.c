@@ -0,0 +1,382 @@
+/*
+ * pack_bundle.c
+ *
+ * Offline packer that turns a content tree into a content bundle
+ * for the server to map and serve read-only (see content_bundle.h).
+ *
+ * Each regular file is stored with its MIME type, ETag and
+ * Last-Modified value already formatted as response headers. With
+ * -z, files that gzip to less than 90% of their size also get a
+ * gzip variant; this needs the packer built with zlib.
+ *
+ * Build from the server directory:
+ *   gcc -o pack_bundle tools/pack_bundle.c mime_util.c map.c time_util.c
+ *   gcc -DHAVE_ZLIB -o pack_bundle tools/pack_bundle.c mime_util.c map.c time_util.c -lz
+ *
+ * Usage:
+ *   pack_bundle [-z] content mime.types site.bundle
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE  // asprintf
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#include "../content_bundle.h"
+#include "../http_server.h"
+#include "../mime_util.h"
+#include "../time_util.h"
+#include "../file_util.h"
+
+/** MIME types by file extension */
+static map_base_t mimeMap;
+
+/** Definition of a file to pack */
+typedef struct PackFile {
+	char uri[MAXBUF];           /** request path */
+	char *path;                 /** file system path */
+	struct stat sb;             /** file status */
+} PackFile;
+
+/** Definition of the files to pack */
+typedef struct PackList {
+	PackFile *files;            /** the files */
+	size_t nfiles;              /** number of files */
+	size_t capacity;            /** allocated files */
+} PackList;
+
+/**
+ * Add the regular files of a directory tree to the list.
+ * Symbolic links and special files are skipped.
+ *
+ * @param list the list
+ * @param dirPath the file system path of the directory
+ * @param dirUri the request path of the directory, ending with '/'
+ * @return 0 if successful, -1 if error
+ */
+static int addDirectory(PackList *list, const char *dirPath, const char *dirUri) {
+	DIR *dir = opendir(dirPath);
+	if (dir == NULL) {
+		perror(dirPath);
+		return -1;
+	}
+	int status = 0;
+	for (struct dirent *entry; status == 0 && (entry = readdir(dir)) != NULL; ) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		char *path;
+		if (asprintf(&path, "%s/%s", dirPath, entry->d_name) < 0) {
+			status = -1;
+			break;
+		}
+		PackFile file;
+		if (lstat(path, &file.sb) != 0) {
+			perror(path);
+			free(path);
+			status = -1;
+			break;
+		}
+		int len = snprintf(file.uri, sizeof(file.uri), "%s%s%s",
+						   dirUri, entry->d_name, S_ISDIR(file.sb.st_mode) ? "/" : "");
+		if (len < 0 || (size_t)len >= sizeof(file.uri)) {
+			fprintf(stderr, "%s: path too long\n", path);
+			free(path);
+			status = -1;
+		} else if (S_ISDIR(file.sb.st_mode)) {
+			status = addDirectory(list, path, file.uri);
+			free(path);
+		} else if (S_ISREG(file.sb.st_mode)) {
+			if (list->nfiles == list->capacity) {
+				list->capacity = (list->capacity > 0) ? 2*list->capacity : 64;
+				PackFile *files = realloc(list->files, list->capacity * sizeof(PackFile));
+				if (files == NULL) {
+					free(path);
+					status = -1;
+					break;
+				}
+				list->files = files;
+			}
+			file.path = path;
+			list->files[list->nfiles++] = file;
+		} else {
+			free(path);
+		}
+	}
+	closedir(dir);
+	return status;
+}
+
+/**
+ * Compare files by request path.
+ *
+ * @param a the first file
+ * @param b the second file
+ * @return the order of the files
+ */
+static int compareFiles(const void *a, const void *b) {
+	return strcmp(((const PackFile *)a)->uri, ((const PackFile *)b)->uri);
+}
+
+/**
+ * Read a whole file.
+ *
+ * @param file the file
+ * @return the content, or NULL if error
+ */
+static char *readFile(const PackFile *file) {
+	char *content = malloc(file->sb.st_size + 1);
+	FILE *istream = fopen(file->path, "r");
+	if (content == NULL || istream == NULL
+			|| fread(content, 1, file->sb.st_size, istream) != (size_t)file->sb.st_size) {
+		perror(file->path);
+		free(content);
+		content = NULL;
+	}
+	if (istream != NULL) {
+		fclose(istream);
+	}
+	return content;
+}
+
+/**
+ * Compute the 64-bit FNV-1a hash of content for its ETag.
+ *
+ * @param content the content
+ * @param len the length of the content
+ * @return the hash
+ */
+static uint64_t contentHash(const char *content, size_t len) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ (unsigned char)content[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+/**
+ * Compress content with gzip.
+ *
+ * @param content the content
+ * @param len the length of the content
+ * @param gzipLen returns the length of the gzip content
+ * @return the gzip content, or NULL if not worth compressing
+ */
+static char *gzipContent(const char *content, size_t len, size_t *gzipLen) {
+#if defined(HAVE_ZLIB)
+	z_stream zs = { 0 };
+	if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15+16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return NULL;
+	}
+	size_t bound = deflateBound(&zs, len);
+	char *gzip = malloc(bound);
+	if (gzip != NULL) {
+		zs.next_in = (Bytef *)content;
+		zs.avail_in = len;
+		zs.next_out = (Bytef *)gzip;
+		zs.avail_out = bound;
+		if (deflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out < len - len/10) {
+			*gzipLen = zs.total_out;
+		} else {
+			free(gzip);
+			gzip = NULL;
+		}
+	}
+	deflateEnd(&zs);
+	return gzip;
+#else
+	(void)content;
+	(void)len;
+	(void)gzipLen;
+	return NULL;
+#endif
+}
+
+/**
+ * Write bytes to the bundle.
+ *
+ * @param ostream the bundle stream
+ * @param bytes the bytes
+ * @param len the number of bytes
+ * @param offset the bundle offset; advanced past the bytes
+ * @return the offset of the bytes
+ */
+static uint64_t writeBytes(FILE *ostream, const void *bytes, size_t len, uint64_t *offset) {
+	uint64_t start = *offset;
+	fwrite(bytes, 1, len, ostream);
+	*offset += len;
+	return start;
+}
+
+/**
+ * Write a string and its terminator to the bundle.
+ *
+ * @param ostream the bundle stream
+ * @param str the string
+ * @param offset the bundle offset; advanced past the string
+ * @return the offset of the string
+ */
+static uint64_t writeString(FILE *ostream, const char *str, uint64_t *offset) {
+	return writeBytes(ostream, str, strlen(str) + 1, offset);
+}
+
+/**
+ * Write one file and its strings to the bundle.
+ *
+ * @param ostream the bundle stream
+ * @param file the file
+ * @param compress add a gzip variant if worthwhile
+ * @param entry returns the index entry
+ * @param offset the bundle offset; advanced past the file
+ * @return 0 if successful, -1 if error
+ */
+static int packFile(FILE *ostream, const PackFile *file, bool compress, BundleEntry *entry, uint64_t *offset) {
+	char *content = readFile(file);
+	if (content == NULL) {
+		return -1;
+	}
+	size_t len = file->sb.st_size;
+	size_t gzipLen = 0;
+	char *gzip = compress ? gzipContent(content, len, &gzipLen) : NULL;
+
+	char etag[32], mimeType[MAXBUF], lastModified[128];
+	snprintf(etag, sizeof(etag), "\"%016" PRIx64 "\"", contentHash(content, len));
+	getMimeType_Advanced(&mimeMap, file->uri, mimeType);
+	milliTimeToRFC_1123_Date_Time(file->sb.st_mtim.tv_sec, lastModified);
+	const char *vary = (gzip != NULL) ? "Vary: Accept-Encoding\r\n" : "";
+
+	char headers[4*MAXBUF];
+	memset(entry, 0, sizeof(*entry));
+	entry->contentLen = len;
+	entry->content = writeBytes(ostream, content, len, offset);
+	entry->path = writeString(ostream, file->uri, offset);
+	entry->etag = writeString(ostream, etag, offset);
+	snprintf(headers, sizeof(headers),
+			 "Content-Type: %s\r\nContent-Length: %zu\r\nLast-Modified: %s\r\nETag: %s\r\n%s\r\n",
+			 mimeType, len, lastModified, etag, vary);
+	entry->headers = writeString(ostream, headers, offset);
+	if (gzip != NULL) {
+		entry->gzipLen = gzipLen;
+		entry->gzipContent = writeBytes(ostream, gzip, gzipLen, offset);
+		snprintf(headers, sizeof(headers),
+				 "Content-Type: %s\r\nContent-Encoding: gzip\r\nContent-Length: %zu\r\n"
+				 "Last-Modified: %s\r\nETag: %s\r\n%s\r\n",
+				 mimeType, gzipLen, lastModified, etag, vary);
+		entry->gzipHeaders = writeString(ostream, headers, offset);
+	}
+	free(gzip);
+	free(content);
+	return 0;
+}
+
+/**
+ * Write the bundle for the files.
+ *
+ * @param ostream the bundle stream
+ * @param list the files sorted by request path
+ * @param compress add gzip variants where worthwhile
+ * @return 0 if successful, -1 if error
+ */
+static int writeBundle(FILE *ostream, const PackList *list, bool compress) {
+	BundleEntry *index = calloc(list->nfiles + 1, sizeof(BundleEntry));
+	if (index == NULL) {
+		return -1;
+	}
+	BundleHeader header = { BUNDLE_MAGIC, BUNDLE_VERSION, (uint32_t)list->nfiles, 0, 0 };
+	uint64_t offset = 0;
+	writeBytes(ostream, &header, sizeof(header), &offset);
+	for (size_t i = 0; i < list->nfiles; i++) {
+		if (packFile(ostream, &list->files[i], compress, &index[i], &offset) != 0) {
+			free(index);
+			return -1;
+		}
+	}
+	// align the index for the server to read it in place
+	static const char padding[sizeof(uint64_t)];
+	writeBytes(ostream, padding, (sizeof(uint64_t) - offset % sizeof(uint64_t)) % sizeof(uint64_t), &offset);
+	header.index = writeBytes(ostream, index, list->nfiles * sizeof(BundleEntry), &offset);
+	header.size = offset;
+	free(index);
+
+	rewind(ostream);
+	fwrite(&header, sizeof(header), 1, ostream);
+	return ferror(ostream) ? -1 : 0;
+}
+
+/**
+ * Main program packs a content tree into a bundle.
+ * @param argv: [-z] content-dir mime-types bundle-file
+ */
+int main(int argc, char* argv[argc]) {
+	bool compress = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "z")) != -1) {
+		if (opt == 'z') {
+			compress = true;
+		} else {
+			argc = 0;
+		}
+	}
+	if (argc - optind != 3) {
+		fprintf(stderr, "Usage: %s [-z] content-dir mime-types bundle-file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *contentDir = argv[optind];
+	const char *mimeTypes = argv[optind+1];
+	const char *bundlePath = argv[optind+2];
+#if !defined(HAVE_ZLIB)
+	if (compress) {
+		fprintf(stderr, "Built without zlib; gzip variants are not added\n");
+	}
+#endif
+
+	FILE *mime = fopen(mimeTypes, "r");
+	if (mime == NULL) {
+		perror(mimeTypes);
+		return EXIT_FAILURE;
+	}
+	buildMap(mime, &mimeMap);
+	fclose(mime);
+
+	PackList list = { NULL, 0, 0 };
+	if (addDirectory(&list, contentDir, "/") != 0) {
+		return EXIT_FAILURE;
+	}
+	qsort(list.files, list.nfiles, sizeof(PackFile), compareFiles);
+
+	// write beside the bundle and rename, so a server that has the
+	// old bundle mapped keeps serving it unchanged
+	char tmpPath[PATH_MAX];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", bundlePath);
+	FILE *ostream = fopen(tmpPath, "w");
+	if (ostream == NULL) {
+		perror(tmpPath);
+		return EXIT_FAILURE;
+	}
+	int status = writeBundle(ostream, &list, compress);
+	if (fclose(ostream) != 0 || status != 0 || rename(tmpPath, bundlePath) != 0) {
+		perror(bundlePath);
+		unlink(tmpPath);
+		return EXIT_FAILURE;
+	}
+	printf("Packed %zu files into %s\n", list.nfiles, bundlePath);
+
+	for (size_t i = 0; i < list.nfiles; i++) {
+		free(list.files[i].path);
+	}
+	free(list.files);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+#!/bin/sh
+#
+# test_proxy.sh
+#
+# Scenario that checks the reverse proxy against two stand-in
+# backends written in Python. Each backend numbers its connections
+# and answers
+#   .../id       its name and the number of the connection
+#   .../chunked  a body sent in chunks, a little at a time
+#   .../drop     like id, but the next request on the connection is
+#                dropped without a response, as by an upstream that
+#                timed out an idle connection
+# The server is started with the route /api to the first backend and
+# /pair to both, and the scenario checks
+#   reuse     requests on new client connections share one pooled
+#             upstream connection
+#   chunked   a chunked response is relayed chunked and complete
+#   stale     a pooled connection dropped before it answers is
+#             retried on a new one
+#   failover  with the second backend stopped, every request goes to
+#             the first and the second is marked down
+#
+# Run from the server directory:
+#   tools/test_proxy.sh [port]
+#
+# The backends listen on the two ports above the server port, and
+# count the health checks of the server among their connections.
+# The exit status is 0 if every check passes.
+#
+#  @since 2026-10-19
+#
+
+set -e
+
+PORT=${1:-18090}
+BACKEND_A=$((PORT + 1))
+BACKEND_B=$((PORT + 2))
+SERVER_DIR=$(pwd)
+WORK=$(mktemp -d)
+trap 'kill $SERVER_PID $PID_A $PID_B 2>/dev/null || true; rm -rf "$WORK"' EXIT
+
+gcc -O2 -pthread -o "$WORK/http_server" ./*.c
+
+cat > "$WORK/backend.py" <<'EOF'
+import socket, sys, threading, time
+
+port, name = int(sys.argv[1]), sys.argv[2]
+conns = 0
+lock = threading.Lock()
+
+def respond(conn, number, path):
+	if path.endswith("/chunked"):
+		conn.sendall(b"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n")
+		for part in (b"one\n", b"two\n", b"three\n"):
+			time.sleep(0.05)
+			conn.sendall(b"%x\r\n%s\r\n" % (len(part), part))
+		conn.sendall(b"0\r\n\r\n")
+	else:
+		body = b"%s conn %d\n" % (name.encode(), number)
+		conn.sendall(b"HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s" % (len(body), body))
+
+def serve(conn, number):
+	data = b""
+	drop = False
+	while True:
+		while b"\r\n\r\n" not in data:
+			more = conn.recv(4096)
+			if not more:
+				conn.close()
+				return
+			data += more
+		head, data = data.split(b"\r\n\r\n", 1)
+		if drop:
+			conn.close()
+			return
+		path = head.split(b" ")[1].decode()
+		respond(conn, number, path)
+		drop = path.endswith("/drop")
+
+listener = socket.socket()
+listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+listener.bind(("127.0.0.1", port))
+listener.listen(64)
+while True:
+	conn, _ = listener.accept()
+	with lock:
+		conns += 1
+		number = conns
+	threading.Thread(target=serve, args=(conn, number), daemon=True).start()
+EOF
+
+python3 "$WORK/backend.py" "$BACKEND_A" a &
+PID_A=$!
+python3 "$WORK/backend.py" "$BACKEND_B" b &
+PID_B=$!
+
+cp -r "$SERVER_DIR/content" "$WORK/content"
+cat > "$WORK/http_server.properties" <<EOF
+content_base=$WORK/content
+mime_types=$SERVER_DIR/mime.types
+proxy_routes=/api=127.0.0.1:$BACKEND_A /pair=127.0.0.1:$BACKEND_A,127.0.0.1:$BACKEND_B
+proxy_health_interval_ms=200
+EOF
+(cd "$WORK" && exec ./http_server "$PORT" > /dev/null 2> "$WORK/server.log") &
+SERVER_PID=$!
+sleep 1
+
+URL=http://127.0.0.1:$PORT
+FAILED=0
+
+# report a check: name, then the command that must succeed
+check() {
+	name=$1
+	shift
+	if "$@"; then
+		echo "ok   $name"
+	else
+		echo "FAIL $name"
+		FAILED=$((FAILED + 1))
+	fi
+}
+
+# print a counter or gauge of the server status
+stat() {
+	curl -s "$URL/server-status" | awk -v name="$1" '$1 == name { print $2 }'
+}
+
+# reuse: three client connections, one upstream connection
+reused_before=$(stat proxy_reuses)
+ids=$(for i in 1 2 3; do curl -s "$URL/api/id"; done | sort -u)
+reused_after=$(stat proxy_reuses)
+check "reuse" test "$(echo "$ids" | wc -l)" -eq 1 -a $((reused_after - reused_before)) -eq 2
+
+# chunked: relayed with its framing, and whole
+curl -s -D "$WORK/headers" -o "$WORK/body" "$URL/api/chunked"
+check "chunked" grep -qi "^transfer-encoding: chunked" "$WORK/headers"
+check "chunked body" test "$(cat "$WORK/body")" = "$(printf 'one\ntwo\nthree')"
+
+# stale: the pooled connection drops the next request, which is sent again
+dropped=$(curl -s "$URL/api/drop")
+retried=$(curl -s -o "$WORK/body" -w "%{http_code}" "$URL/api/id")
+check "stale retried" test "$retried" = "200" -a "$(cat "$WORK/body")" != "$dropped"
+
+# failover: both backends serve the pair, then only the first
+both=$(for i in 1 2 3 4; do curl -s "$URL/pair/id"; done | cut -d' ' -f1 | sort -u | tr '\n' ' ')
+check "both backends" test "$both" = "a b "
+kill "$PID_B"
+wait "$PID_B" 2>/dev/null || true
+codes=$(for i in 1 2 3 4 5 6; do curl -s -o /dev/null -w "%{http_code} " "$URL/pair/id"; done)
+check "failover" test "$codes" = "200 200 200 200 200 200 "
+sleep 1
+check "marked down" test "$(stat proxy_upstreams_up)" = "1"
+
+if [ "$FAILED" -ne 0 ]; then
+	echo "$FAILED failed; server log:"
+	cat "$WORK/server.log"
+	exit 1
+fi
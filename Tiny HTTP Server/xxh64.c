@@ -0,0 +1,200 @@
+/*
+ * xxh64.c
+ *
+ * Functions that compute the XXH64 hash of data, in one call or
+ * incrementally as the data arrives. Follows the XXH64 algorithm
+ * of the xxHash specification; values are read little-endian.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <string.h>
+
+#include "xxh64.h"
+
+/** XXH64 primes */
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+/**
+ * Rotate left.
+ * @param x the value
+ * @param r the bits to rotate by
+ * @return the rotated value
+ */
+static inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * Read a little-endian 64-bit value.
+ * @param p the bytes
+ * @return the value
+ */
+static inline uint64_t read64(const unsigned char *p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+/**
+ * Read a little-endian 32-bit value.
+ * @param p the bytes
+ * @return the value
+ */
+static inline uint32_t read32(const unsigned char *p) {
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/**
+ * Mix a lane into an accumulator.
+ * @param acc the accumulator
+ * @param lane the lane
+ * @return the new accumulator
+ */
+static inline uint64_t round64(uint64_t acc, uint64_t lane) {
+	acc += lane * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+/**
+ * Merge an accumulator into the hash.
+ * @param hash the hash
+ * @param acc the accumulator
+ * @return the new hash
+ */
+static inline uint64_t mergeRound(uint64_t hash, uint64_t acc) {
+	hash ^= round64(0, acc);
+	return hash * PRIME1 + PRIME4;
+}
+
+/**
+ * Consume whole 32-byte stripes.
+ * @param acc the accumulators
+ * @param p the bytes
+ * @param nstripes the number of stripes
+ */
+static void consumeStripes(uint64_t acc[4], const unsigned char *p, size_t nstripes) {
+	for (size_t i = 0; i < nstripes; i++, p += 32) {
+		acc[0] = round64(acc[0], read64(p));
+		acc[1] = round64(acc[1], read64(p + 8));
+		acc[2] = round64(acc[2], read64(p + 16));
+		acc[3] = round64(acc[3], read64(p + 24));
+	}
+}
+
+/**
+ * Start an incremental hash.
+ *
+ * @param state the hash state
+ * @param seed the seed
+ */
+void xxh64Reset(Xxh64State *state, uint64_t seed) {
+	state->acc[0] = seed + PRIME1 + PRIME2;
+	state->acc[1] = seed + PRIME2;
+	state->acc[2] = seed;
+	state->acc[3] = seed - PRIME1;
+	state->seed = seed;
+	state->total = 0;
+	state->buflen = 0;
+}
+
+/**
+ * Add data to an incremental hash.
+ *
+ * @param state the hash state
+ * @param data the data
+ * @param len the number of bytes
+ */
+void xxh64Update(Xxh64State *state, const void *data, size_t len) {
+	const unsigned char *p = data;
+	state->total += len;
+
+	// complete a buffered stripe first
+	if (state->buflen > 0) {
+		size_t n = sizeof(state->buf) - state->buflen;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(state->buf + state->buflen, p, n);
+		state->buflen += n;
+		p += n;
+		len -= n;
+		if (state->buflen < sizeof(state->buf)) {
+			return;
+		}
+		consumeStripes(state->acc, state->buf, 1);
+		state->buflen = 0;
+	}
+	consumeStripes(state->acc, p, len / 32);
+	p += len & ~(size_t)31;
+	len &= 31;
+	memcpy(state->buf, p, len);
+	state->buflen = len;
+}
+
+/**
+ * Return the hash of the data added so far.
+ *
+ * @param state the hash state
+ * @return the hash
+ */
+uint64_t xxh64Digest(const Xxh64State *state) {
+	uint64_t hash;
+	if (state->total >= 32) {
+		const uint64_t *acc = state->acc;
+		hash = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+		for (int i = 0; i < 4; i++) {
+			hash = mergeRound(hash, acc[i]);
+		}
+	} else {
+		hash = state->seed + PRIME5;
+	}
+	hash += state->total;
+
+	// the bytes of the last incomplete stripe
+	const unsigned char *p = state->buf;
+	size_t len = state->buflen;
+	for (; len >= 8; p += 8, len -= 8) {
+		hash ^= round64(0, read64(p));
+		hash = rotl(hash, 27) * PRIME1 + PRIME4;
+	}
+	if (len >= 4) {
+		hash ^= (uint64_t)read32(p) * PRIME1;
+		hash = rotl(hash, 23) * PRIME2 + PRIME3;
+		p += 4;
+		len -= 4;
+	}
+	for (; len > 0; p++, len--) {
+		hash ^= *p * PRIME5;
+		hash = rotl(hash, 11) * PRIME1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+/**
+ * Return the hash of data.
+ *
+ * @param data the data
+ * @param len the number of bytes
+ * @param seed the seed
+ * @return the hash
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+	Xxh64State state;
+	xxh64Reset(&state, seed);
+	xxh64Update(&state, data, len);
+	return xxh64Digest(&state);
+}
@@ -0,0 +1,60 @@
+/*
+ * xxh64.h
+ *
+ * Functions that compute the XXH64 hash of data, in one call or
+ * incrementally as the data arrives.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef XXH64_H_
+#define XXH64_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Definition of the state of an incremental hash */
+typedef struct Xxh64State {
+	uint64_t acc[4];            /** stripe accumulators */
+	uint64_t seed;              /** the seed */
+	uint64_t total;             /** bytes hashed */
+	unsigned char buf[32];      /** bytes of an incomplete stripe */
+	size_t buflen;              /** number of bytes in buf */
+} Xxh64State;
+
+/**
+ * Start an incremental hash.
+ *
+ * @param state the hash state
+ * @param seed the seed
+ */
+void xxh64Reset(Xxh64State *state, uint64_t seed);
+
+/**
+ * Add data to an incremental hash.
+ *
+ * @param state the hash state
+ * @param data the data
+ * @param len the number of bytes
+ */
+void xxh64Update(Xxh64State *state, const void *data, size_t len);
+
+/**
+ * Return the hash of the data added so far.
+ *
+ * @param state the hash state
+ * @return the hash
+ */
+uint64_t xxh64Digest(const Xxh64State *state);
+
+/**
+ * Return the hash of data.
+ *
+ * @param data the data
+ * @param len the number of bytes
+ * @param seed the seed
+ * @return the hash
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+#endif /* XXH64_H_ */